@@ -109,6 +109,12 @@ static unsigned int counterRoutine[] =
 /* Cast the above instructions into a function. */
 static unsigned int (*counter)(void)= (void *)counterRoutine;
 
+void access_counter(unsigned *hi, unsigned *lo)
+{
+    *hi = 0;
+    *lo = counter();
+}
+
 
 void start_counter()
 {
@@ -144,6 +150,14 @@ double get_counter()
  * haven't provided a Sparc version here.
  ***************************************************************/
 
+void access_counter(unsigned *hi __attribute__((unused)),
+                    unsigned *lo __attribute__((unused)))
+{
+    printf("ERROR: You are trying to use an access_counter routine in clock.c\n");
+    printf("that has not been implemented yet on this platform.\n");
+    exit(1);
+}
+
 void start_counter()
 {
     printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
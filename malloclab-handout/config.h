@@ -107,7 +107,7 @@
 #define ALIGNMENT 8
 
 /*
- * Maximum heap size in bytes
+ * Default maximum heap size in bytes, per arena; mdriver -M changes it
  */
 #define MAX_HEAP (100*(1<<20))  /* 100 MB */
 
@@ -117,5 +117,7 @@
 #define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_PERF   0   /* perf_event_open task clock and hardware counters
+                          (Linux only); mdriver reports the counters */
 
 #endif /* __CONFIG_H */
@@ -0,0 +1,146 @@
+/*
+ * fbench.c - Time a function f over a fixed number of runs and
+ *     summarize the runs with statistics that hold up on noisy machines.
+ *
+ * Unlike the K-best scheme of fcyc, which keeps sampling until the K
+ * fastest runs agree and then reports their minimum, fbench always
+ * takes the same number of samples and reports their median, the
+ * median absolute deviation, and a distribution-free confidence
+ * interval of the median from the order statistics.  Two sets of
+ * samples, say from two builds of an allocator, are compared with the
+ * Mann-Whitney U test, which assumes nothing about their distribution.
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fbench.h"
+
+/* function prototypes */
+static double now(void);
+static int dbl_cmp(const void *x, const void *y);
+static double median_sorted(const double *x, int n);
+
+/*
+ * fbench - Warm up with warmup untimed runs of f(argp), then time n runs
+ */
+void fbench(fbench_test_funct f, void *argp, int warmup, int n,
+            double *samples)
+{
+    double start;
+    int i;
+
+    for (i = 0; i < warmup; i++)
+        f(argp);
+    for (i = 0; i < n; i++) {
+        start = now();
+        f(argp);
+        samples[i] = now() - start;
+    }
+}
+
+/*
+ * fbench_summarize - Median, MAD and the 95% confidence interval of the
+ *     median, which lies between the order statistics of ranks
+ *     (n - 1.96 sqrt(n)) / 2 and 1 + (n + 1.96 sqrt(n)) / 2
+ */
+void fbench_summarize(const double *x, int n, fbench_summary_t *s)
+{
+    double *v = malloc(n * sizeof(double));
+    int i, lo, hi;
+
+    memset(s, 0, sizeof(*s));
+    s->n = n;
+    if (v == NULL || n == 0) {
+        free(v);
+        return;
+    }
+
+    memcpy(v, x, n * sizeof(double));
+    qsort(v, n, sizeof(double), dbl_cmp);
+    s->median = median_sorted(v, n);
+    lo = (int)floor((n - 1.96 * sqrt(n)) / 2);
+    hi = (int)ceil(1 + (n + 1.96 * sqrt(n)) / 2);
+    s->lo = v[(lo < 1) ? 0 : lo - 1];
+    s->hi = v[(hi > n) ? n - 1 : hi - 1];
+
+    for (i = 0; i < n; i++)
+        v[i] = fabs(x[i] - s->median);
+    qsort(v, n, sizeof(double), dbl_cmp);
+    s->mad = median_sorted(v, n);
+    free(v);
+}
+
+/*
+ * fbench_pvalue - Rank the pooled samples (ties get their mean rank)
+ *     and compare the rank sum of a[] with what it would be by chance,
+ *     using the normal approximation with tie and continuity corrections
+ */
+double fbench_pvalue(const double *a, int na, const double *b, int nb)
+{
+    struct { double v; int in_a; } *all;
+    int n = na + nb;
+    int i, j, k;
+    double rank_a = 0, ties = 0, u, mu, sigma, t, z;
+
+    if (na == 0 || nb == 0)
+        return 1.0;
+    if ((all = malloc(n * sizeof(*all))) == NULL)
+        return 1.0;
+    for (i = 0; i < na; i++) {
+        all[i].v = a[i];
+        all[i].in_a = 1;
+    }
+    for (i = 0; i < nb; i++) {
+        all[na + i].v = b[i];
+        all[na + i].in_a = 0;
+    }
+    qsort(all, n, sizeof(*all), dbl_cmp);   /* sorts by the leading v */
+
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && all[j].v == all[i].v; j++)
+            ;
+        t = j - i;
+        ties += t * t * t - t;
+        for (k = i; k < j; k++)
+            if (all[k].in_a)
+                rank_a += (i + j + 1) / 2.0;  /* mean of ranks i+1 .. j */
+    }
+    free(all);
+
+    u = rank_a - na * (na + 1) / 2.0;
+    mu = na * (double)nb / 2;
+    sigma = sqrt(na * (double)nb / 12 *
+                 ((n + 1) - ties / ((double)n * (n - 1))));
+    if (sigma == 0)
+        return 1.0;
+    z = (fabs(u - mu) - 0.5) / sigma;
+    if (z < 0)
+        z = 0;
+    return erfc(z / sqrt(2));
+}
+
+/*
+ * Helper routines
+ */
+
+/* Seconds on the monotonic clock */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int dbl_cmp(const void *x, const void *y)
+{
+    double a = *(const double *)x, b = *(const double *)y;
+
+    return (a > b) - (a < b);
+}
+
+static double median_sorted(const double *x, int n)
+{
+    return (n % 2) ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2;
+}
@@ -0,0 +1,25 @@
+/*
+ * Benchmark runner: a fixed number of timed runs after a warmup, and
+ * robust statistics over them
+ */
+typedef void (*fbench_test_funct)(void *);
+
+/* Summary of a set of samples */
+typedef struct {
+    int n;
+    double median;
+    double mad;          /* median absolute deviation from the median */
+    double lo, hi;       /* 95% confidence interval of the median */
+} fbench_summary_t;
+
+/* Run f(argp) warmup times untimed, then n times, storing the running
+   time of each of the n runs in seconds in samples[] */
+void fbench(fbench_test_funct f, void *argp, int warmup, int n,
+            double *samples);
+
+/* Summarize the n samples in x[] */
+void fbench_summarize(const double *x, int n, fbench_summary_t *s);
+
+/* Two-sided p-value of the Mann-Whitney U test that samples a[] and b[]
+   come from the same distribution */
+double fbench_pvalue(const double *a, int na, const double *b, int nb);
@@ -8,6 +8,7 @@
  * the time in CPU cycles for a function f.
  */
 #include <stdlib.h>
+#include <string.h>
 #include <sys/times.h>
 #include <stdio.h>
 
@@ -113,6 +114,8 @@ static void clear()
 	    fprintf(stderr, "Fatal error.  Malloc returned null when trying to clear cache\n");
 	    exit(1);
 	}
+	/* Untouched pages would all read from the same zero page */
+	memset(cache_buf, 1, cache_bytes);
     }
     cptr = (int *) cache_buf;
     cend = cptr + cache_bytes/sizeof(int);
@@ -206,6 +209,54 @@ void set_fcyc_cache_block(int bytes) {
 }
 
 
+/*
+ * fcyc_detect_cache - Find the size and block size of the largest data
+ *     or unified cache of CPU 0 in sysfs.  Returns the size in bytes,
+ *     or 0 if sysfs does not say, and stores the block size in *block.
+ */
+int fcyc_detect_cache(int *block)
+{
+    char path[128], type[32];
+    FILE *fp;
+    int i, size, line, best = 0;
+    char unit;
+
+    for (i = 0; ; i++) {
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    break;
+	if (fscanf(fp, "%31s", type) != 1)
+	    type[0] = 0;
+	fclose(fp);
+	if (strcmp(type, "Instruction") == 0)
+	    continue;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    continue;
+	unit = 0;
+	if (fscanf(fp, "%d%c", &size, &unit) < 1)
+	    size = 0;
+	fclose(fp);
+	size *= (unit == 'K') ? 1 << 10 : (unit == 'M') ? 1 << 20 : 1;
+	if (size <= best)
+	    continue;
+	best = size;
+
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/"
+		"coherency_line_size", i);
+	line = 0;
+	if ((fp = fopen(path, "r")) != NULL) {
+	    if (fscanf(fp, "%d", &line) != 1)
+		line = 0;
+	    fclose(fp);
+	}
+	if (line > 0)
+	    *block = line;
+    }
+    return best;
+}
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -36,6 +36,12 @@ void set_fcyc_cache_size(int bytes);
  */
 void set_fcyc_cache_block(int bytes);
 
+/*
+ * fcyc_detect_cache - Return the size of the last-level cache in bytes
+ *     from sysfs, or 0 if unknown, and store its block size in *block
+ */
+int fcyc_detect_cache(int *block);
+
 /* 
  * set_fcyc_compensate- When set, will attempt to compensate for 
  *     timer interrupt overhead 
@@ -0,0 +1,148 @@
+/*
+ * fperf.c - Estimate the time (in seconds) used by a function f, and
+ *     count what the hardware did meanwhile, with perf_event_open.
+ *
+ * Every event gets a counter of its own that only counts this process
+ * in user mode, so it works with the default perf_event_paranoid
+ * setting.  Counters that the kernel multiplexes are scaled by the
+ * share of the run they were scheduled for.  Events the machine (or a
+ * virtual machine) does not support read as -1; without even the task
+ * clock the time comes from clock_gettime.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "fperf.h"
+
+#define CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* The events, followed by the task clock */
+static const struct {
+    const char *name;
+    unsigned type;
+    unsigned long long config;
+} events[FPERF_EVENTS + 1] = {
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instrs", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "L1d", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { "LLC", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+    { "dTLB", PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    { "br-miss", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+#define TASK_CLOCK FPERF_EVENTS
+
+static int fds[FPERF_EVENTS + 1];
+static pid_t owner = 0;   /* process the counters count; 0 until opened */
+static double best_counts[FPERF_EVENTS];
+
+/* function prototypes */
+static void open_counters(void);
+static double read_counter(int i);
+static double now(void);
+
+/*
+ * fperf - Run f(argp) n times with the counters on and return the
+ * running time of the fastest run, keeping that run's counts.
+ */
+double fperf(fperf_test_funct f, void *argp, int n)
+{
+    double best = -1, secs, start;
+    int i, j;
+
+    /* A forked child must not read its parent's counters */
+    if (owner != getpid())
+        open_counters();
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j <= FPERF_EVENTS; j++)
+            if (fds[j] >= 0)
+                ioctl(fds[j], PERF_EVENT_IOC_RESET, 0);
+        start = now();
+        for (j = 0; j <= FPERF_EVENTS; j++)
+            if (fds[j] >= 0)
+                ioctl(fds[j], PERF_EVENT_IOC_ENABLE, 0);
+        f(argp);
+        for (j = FPERF_EVENTS; j >= 0; j--)
+            if (fds[j] >= 0)
+                ioctl(fds[j], PERF_EVENT_IOC_DISABLE, 0);
+        secs = now() - start;
+
+        /* The task clock counts nanoseconds */
+        if (fds[TASK_CLOCK] >= 0)
+            secs = read_counter(TASK_CLOCK) / 1e9;
+        if (best < 0 || secs < best) {
+            best = secs;
+            for (j = 0; j < FPERF_EVENTS; j++)
+                best_counts[j] = read_counter(j);
+        }
+    }
+    return best;
+}
+
+/*
+ * fperf_counts - Copy out the counts of the run fperf last returned
+ */
+void fperf_counts(double counts[FPERF_EVENTS])
+{
+    memcpy(counts, best_counts, sizeof(best_counts));
+}
+
+const char *fperf_name(int event)
+{
+    return events[event].name;
+}
+
+/*
+ * Routines for the counters themselves
+ */
+
+/* Open one disabled counter per event; fds[i] is -1 if event i failed */
+static void open_counters(void)
+{
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i <= FPERF_EVENTS; i++) {
+        if (owner != 0 && fds[i] >= 0)
+            close(fds[i]);
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    if (fds[TASK_CLOCK] < 0 && owner == 0)
+        printf("perf_event_open fails; timing with clock_gettime.\n");
+    owner = getpid();
+}
+
+/* Read counter i, scaled up if it was multiplexed; -1 if unavailable */
+static double read_counter(int i)
+{
+    unsigned long long v[3];  /* value, time enabled, time running */
+
+    if (fds[i] < 0 || read(fds[i], v, sizeof(v)) != sizeof(v) || v[2] == 0)
+        return -1;
+    return (double)v[0] * ((double)v[1] / v[2]);
+}
+
+/* Seconds on the monotonic clock */
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
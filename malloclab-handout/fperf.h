@@ -0,0 +1,26 @@
+/*
+ * Function timer based on the Linux perf_event_open counters
+ */
+typedef void (*fperf_test_funct)(void *);
+
+/* The hardware events counted next to the running time */
+enum {
+    FPERF_CYCLES,
+    FPERF_INSTRUCTIONS,
+    FPERF_L1D_MISSES,       /* L1 data cache read misses */
+    FPERF_LLC_MISSES,       /* last-level cache read misses */
+    FPERF_DTLB_MISSES,      /* data TLB read misses */
+    FPERF_BRANCH_MISSES,    /* mispredicted branches */
+    FPERF_EVENTS
+};
+
+/* Estimate the running time of f(argp) from the task clock, which does
+   not depend on the clock rate.  Return the fastest of n runs. */
+double fperf(fperf_test_funct f, void *argp, int n);
+
+/* Store the event counts of the run fperf last returned in counts[];
+   events this machine cannot count are stored as -1 */
+void fperf_counts(double counts[FPERF_EVENTS]);
+
+/* Short name of an event, for report headings */
+const char *fperf_name(int event);
@@ -6,8 +6,12 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "fperf.h"
 #include "config.h"
 
+#define CLEAR_BYTES (1<<19) /* cache cleared before each fsecs run */
+#define CLEAR_BLOCK 32
+
 static double Mhz;  /* estimated CPU clock frequency */
 
 extern int verbose; /* -v option in mdriver.c */
@@ -26,6 +30,8 @@ void init_fsecs(void)
     /* set key parameters for the fcyc package */
     set_fcyc_maxsamples(20); 
     set_fcyc_clear_cache(1);
+    set_fcyc_cache_size(CLEAR_BYTES);
+    set_fcyc_cache_block(CLEAR_BLOCK);
     set_fcyc_compensate(1);
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
@@ -36,6 +42,9 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_PERF
+    if (verbose)
+	printf("Measuring performance with perf_event_open().\n");
 #endif
 }
 
@@ -51,7 +60,42 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_PERF
+    return fperf(f, argp, 5);
 #endif 
 }
 
+/*
+ * fsecs_cache - Return the running time of f with a warm or cold cache.
+ *     The cold cache is cleared with a buffer the size of the
+ *     last-level cache, or of CLEAR_BYTES if sysfs does not tell.
+ */
+double fsecs_cache(fsecs_test_funct f, void *argp, int cold)
+{
+#if USE_FCYC
+    static int llc_bytes = -1, llc_block = CLEAR_BLOCK;
+    double cycles;
+
+    if (llc_bytes < 0 && (llc_bytes = fcyc_detect_cache(&llc_block)) == 0)
+        llc_bytes = CLEAR_BYTES;
+    set_fcyc_clear_cache(cold);
+    if (cold) {
+        set_fcyc_cache_size(llc_bytes);
+        set_fcyc_cache_block(llc_block);
+    }
+    cycles = fcyc(f, argp);
+
+    /* Back to what fsecs does */
+    set_fcyc_clear_cache(1);
+    set_fcyc_cache_size(CLEAR_BYTES);
+    set_fcyc_cache_block(CLEAR_BLOCK);
+    return cycles/(Mhz*1e6);
+#else
+    (void)f;
+    (void)argp;
+    (void)cold;
+    return -1;
+#endif
+}
+
 
@@ -2,3 +2,8 @@ typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+
+/* Like fsecs, but with a warm cache, or with the whole last-level cache
+   cleared before each run (cold); returns a negative value if the
+   timing method cannot control the cache */
+double fsecs_cache(fsecs_test_funct f, void *argp, int cold);
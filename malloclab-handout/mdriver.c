@@ -7,15 +7,25 @@
  * Copyright (c) 2004, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE             /* for sched_setaffinity */
 #include <assert.h>
+#include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
+#include <malloc.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -23,7 +33,15 @@
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "clock.h"
+#include "fperf.h"
+#include "fbench.h"
+#include "trace.h"
 #include "config.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX 1
+#endif
 
 /**********************
  * Constants and macros
@@ -33,6 +51,7 @@
 #define MAXLINE     1024 /* max string size */
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
 
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
@@ -43,6 +62,46 @@
 #define WUTIL 2
 #define WPERF 3
 
+/* Multithreaded replay (-j) */
+#define MT_MAX_THREADS 64     /* most threads -j accepts */
+#define MT_MIN_SECS  0.05     /* a single-thread replay runs at least this long */
+#define MT_MAX_REPS 10000     /* most replays of a trace per thread */
+#define MT_BATCH       64     /* remote frees handed over at once */
+#define MT_INBOX_MAX 4096     /* remote frees a thread may have waiting */
+#define MT_INBOX_BYTES (1<<20) /* and bytes of them it may have unfreed */
+
+/* Copy and zero routines (-Z) */
+#define COPY_RUNS        5    /* runs with each routine; the fastest counts */
+#define COPY_BLOCKS     64    /* blocks calloc'd per pass */
+#define COPY_MAX  (8<<20)     /* largest block calloc'd and realloc'd */
+
+/* 4K pages vs hugepages (-g) */
+#define PAGE_RUNS        5    /* runs on each kind of page; the fastest counts */
+
+/* Latency histograms (-L) */
+#define LAT_MIN_OPS 100000    /* timed calls per trace we aim for */
+#define LAT_MAX_REPS   100    /* most replays of a trace */
+#define LAT_SUB_BITS     4    /* each power of two is split in 16 buckets */
+#define LAT_SUB  (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+#define LAT_NPCT         5    /* p50, p90, p99, p999, max */
+
+/* Benchmark mode (-n) */
+#define BENCH_MAX      100    /* most samples per trace */
+#define BENCH_WARMUP     3    /* untimed runs before the samples */
+#define BENCH_ALPHA   0.01    /* p-value below which a change is real */
+#define BENCH_MIN_CHANGE 0.02 /* and the smallest change that counts */
+
+/* Range records are carved from pools of this many */
+#define RANGE_POOL  4096
+
+/* Streaming (-S) */
+#define STREAM_CHUNK    65536 /* ops the reader parses at a time */
+#define STREAM_MIN_SLOTS 1024 /* slots the id table starts with */
+
+/* Other allocators (-a) */
+#define MAX_BACKENDS     8    /* most allocators -a takes */
+
 /******************************
  * The key compound data types
  *****************************/
@@ -54,34 +113,167 @@
  * Remember that index (-1) is the null pointer.
  */
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload.  The ranges form an AVL
+   tree keyed by lo; since they never overlap, that orders them by hi
+   as well. */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges below lo, or the next free record */
+    struct range_t *right; /* ranges above hi */
+    int height;            /* height of the subtree rooted here */
     int index;             /* same index as free; for debugging */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    int index;                        /* index for free() to use later */
-    size_t size;                      /* byte size of alloc/realloc request */
-} traceop_t;
-
 /* Holds the information for one trace file*/
 typedef struct {
     char filename[MAXLINE];
-    int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
+    int ignore_ranges;   /* unused; overlaps are always checked now */
     int num_ids;         /* number of alloc/realloc ids */
     int num_ops;         /* number of distinct requests */
+    int num_blocks;      /* requests counting every block of a batch */
     int weight;          /* weight for this trace (unused) */
+    int max_count;       /* blocks in the largest batch */
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
     int *block_rand_base;/* index into random_data, if debug is on */
+    void **batch;        /* room for the blocks of the largest batch */
+    void *map;           /* mapping that holds ops, for binary traces */
+    size_t map_len;
 } trace_t;
 
+/*
+ * One thread of a multithreaded replay (-j).  The thread replays its
+ * trace reps times with blocks of its own; the trace's ops are shared.
+ * With cross-thread frees, every block the trace frees is handed to
+ * the peer thread, MT_BATCH at a time through the peer's inbox, and the
+ * peer frees it; the peer allocates from another arena, so this is what
+ * exercises the allocator's remote-free queues.  Before handing more
+ * over, a thread waits, freeing its own inbox meanwhile, until its peer
+ * has fewer than MT_INBOX_MAX blocks and MT_INBOX_BYTES bytes handed
+ * over and not yet freed.  That keeps a thread from running replays
+ * ahead of its peer's frees and filling up the heap, whether or not
+ * threads outnumber cores.
+ */
+typedef struct mt_thread {
+    pthread_t tid;
+    const trace_t *trace;     /* trace to replay */
+    void **blocks;            /* this thread's blocks, by trace index */
+    size_t *sizes;            /* ... and their payload sizes */
+    int reps;                 /* number of replays */
+    double secs;              /* time the thread took */
+    struct mt_thread *peer;   /* frees go here with cross-thread frees */
+    pthread_barrier_t *start; /* all threads start together */
+    int *finished;            /* threads done replaying */
+    int nthreads;
+    int cpu;                  /* CPU the thread is pinned to, or -1 */
+
+    pthread_mutex_t lock;     /* protects the inbox */
+    void **inbox;             /* blocks handed over by other threads */
+    int inbox_len, inbox_cap;
+    void **spare;             /* the other inbox buffer */
+    int spare_cap;
+    int pending;              /* inbox is not empty */
+    size_t inbox_bytes;       /* bytes handed over and not yet freed */
+    void *outbox[MT_BATCH];   /* frees not yet handed to the peer */
+    int outbox_len;
+    size_t outbox_bytes;
+} mt_thread_t;
+
+/*
+ * A split replay (-T) runs one trace on several threads at once.  Ids
+ * are dealt out to the threads, id mod (threads) to each, or a batch's
+ * ids all to the owner of its first, and an id's allocs and reallocs
+ * run on its owner in trace order.  Its frees are handed to another
+ * thread, which frees the block at the same point of the trace: the
+ * owner pushes the block on a split_queue_t to that thread, and that
+ * thread pops it when it gets to the free, waiting if the owner is
+ * behind.  A thread's share of the trace is a list of trace ops, with
+ * SPLIT_SEND and SPLIT_RECV ops for the two ends of each hand-off.
+ */
+enum { SPLIT_SEND = FREE_BATCH + 1,  /* push block index to thread count */
+       SPLIT_RECV };                 /* free a block popped from thread count */
+
+/*
+ * A lock-free queue of blocks from one thread to another.  It has room
+ * for every hand-off between the two in a replay, and the threads meet
+ * at a barrier between replays, so the producer never waits for room
+ * and never reads the consumer's position, which the consumer keeps in
+ * split_thread_t.heads.  Each queue has a cache line of its own.
+ */
+typedef struct {
+    void **slots;             /* cap blocks, used as a ring */
+    unsigned long cap;        /* hand-offs in one replay */
+    unsigned long tail;       /* blocks pushed, stored with release */
+} __attribute__((aligned(64))) split_queue_t;
+
+typedef struct split {
+    int n;                    /* threads */
+    struct split_thread *threads;
+    split_queue_t *queues;    /* n x n, from thread p to c at p * n + c */
+} split_t;
+
+/* One thread of a split replay */
+typedef struct split_thread {
+    pthread_t tid;
+    split_t *s;
+    int k;                    /* this is s->threads[k] */
+    traceop_t *ops;           /* this thread's share of the trace */
+    int num_ops;
+    long num_calls;           /* allocator calls the ops make */
+    void **blocks;            /* this thread's blocks, by trace index */
+    int num_ids;
+    unsigned long *heads;     /* blocks popped from each thread's queue */
+    int reps;                 /* number of replays */
+    double secs;              /* time the thread took */
+    pthread_barrier_t *start; /* all threads start together */
+    pthread_barrier_t *done;  /* and end each replay together */
+    int cpu;                  /* CPU the thread is pinned to, or -1 */
+} split_thread_t;
+
+/* A live block of a streamed trace (-S), in the id table */
+typedef struct {
+    int index;           /* block id, or -1 if the slot is empty */
+    int rand_base;       /* index into random_data, if debug is on */
+    char *p;             /* as returned by malloc/realloc... */
+    size_t size;         /* ... and its payload size */
+} stream_block_t;
+
+/* A chunk of ops of a streamed trace, filled by the reader thread */
+typedef struct {
+    traceop_t *ops;      /* STREAM_CHUNK of them */
+    int n;               /* ops in the chunk */
+    int last;            /* the trace ends with this chunk */
+    int full;            /* filled, and not yet replayed */
+} stream_chunk_t;
+
+/*
+ * A trace being streamed (-S).  The reader thread and the replay hand
+ * the two chunks back and forth under lock; everything else belongs
+ * to the replay, apart from file, which belongs to the reader.
+ */
+typedef struct {
+    trace_t trace;       /* only the header fields and filename are used */
+    FILE *file;
+    int binary;          /* a binary trace? */
+    stream_chunk_t chunk[2];
+    pthread_mutex_t lock;
+    pthread_cond_t cond; /* a chunk was filled or emptied */
+    int stop;            /* the replay failed; the reader must stop */
+    stream_block_t *table; /* the live blocks, open addressing */
+    size_t slots;        /* slots in table, a power of two */
+    size_t count;        /* live blocks in table */
+    size_t peak_count;   /* most live blocks at once */
+    void **batch;        /* room for the blocks of a batch */
+    int batch_len;
+    range_t *ranges;     /* payload ranges of the live blocks */
+    long long ops;       /* ops replayed */
+    long long blocks;    /* ... counting every block of a batch */
+    long long payload;   /* payload bytes live */
+    long long peak_payload;
+} stream_t;
+
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -92,6 +284,53 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* The calls whose latency -L measures; batch calls are not timed */
+enum { LAT_MALLOC, LAT_FREE, LAT_REALLOC, LAT_TYPES };
+
+/*
+ * Log-linear histogram of call latencies in cycles: values below
+ * LAT_SUB get a bucket each, and every power of two above that is
+ * split into LAT_SUB equal buckets, so a bucket is within 1/LAT_SUB of
+ * the values it holds.
+ */
+typedef struct {
+    unsigned long count[LAT_BUCKETS];
+    unsigned long n;     /* samples in the histogram */
+    unsigned long max;   /* largest sample */
+} lat_hist_t;
+
+/*
+ * An allocator that -a compares: mm.c as linked into the driver, the C
+ * library's malloc, or the mm.h calls of a shared object.  Only the
+ * malloc, free and realloc calls must be there.  setup runs once, and
+ * reset and init before each replay; the memlib of an mm.c built as a
+ * shared object supplies the first two.
+ */
+typedef struct {
+    const char *name;
+    void (*setup)(void);
+    void (*reset)(void);
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+} backend_t;
+
+/* What the child that runs an allocator on a trace sends back (-a) */
+typedef struct {
+    int valid;
+    double secs;         /* time of a replay, as fsecs measures it */
+    double p99;          /* 99th percentile cycles of a call */
+    size_t peak_rss;     /* most the resident set grew while replaying */
+    double util;         /* peak payload over peak_rss */
+} backend_result_t;
+
+/* The argument of backend_speed */
+typedef struct {
+    const backend_t *b;
+    trace_t *trace;
+} backend_speed_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -105,6 +344,44 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t peak_heap;      /* largest heap size while running the trace */
+    size_t peak_resident;  /* most heap bytes resident while running it */
+    size_t final_resident; /* heap bytes still resident at the end */
+
+    /* defined only with -R, replaying with a region and no frees */
+    int region_valid;      /* did every region allocation succeed? */
+    double region_secs;    /* number of secs needed to run the trace */
+    size_t region_peak;    /* largest heap size while running the trace */
+
+    /* defined only with -P: utilization the size classes predict */
+    double pred_util;
+
+    /* defined only with -L, from timing each call on its own */
+    unsigned long lat_n[LAT_TYPES];       /* calls timed */
+    double lat[LAT_TYPES][LAT_NPCT];      /* p50 ... max, in cycles */
+    double lat_ovhd;       /* cycles of timer overhead subtracted */
+
+    /* defined only with -C: secs with a cold and a warm cache */
+    double cold_secs;
+    double warm_secs;
+
+    /* defined only with -n: the timed runs, whose median is secs */
+    int bench_n;
+    double bench[BENCH_MAX];
+    fbench_summary_t bench_sum;
+
+    /* defined only with USE_PERF: counts of the timed run, -1 if unknown */
+    double perf[FPERF_EVENTS];
+
+    /* defined only with -g: secs and dTLB misses (-1 if unknown) of a
+       run on 4K pages [0] and on hugepages [1] */
+    double page_secs[2];
+    double page_tlb[2];
+
+    /* defined only with -S */
+    double stream_ops;     /* ops in the trace, batches counting once */
+    double stream_peak_ids;/* most blocks live at once */
+    double stream_wait;    /* secs the replay waited for the reader */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -120,6 +397,7 @@ typedef struct {
  *******************/
 #define RANDOM_DATA_LEN (1<<16)
 typedef unsigned char randint_t;
+_Static_assert(sizeof(randint_t) == 1, "garbled_run compares bytes");
 static const char randint_t_name[] = "byte";
 static randint_t random_data[RANDOM_DATA_LEN];
 
@@ -134,8 +412,40 @@ int verbose = 1;        /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 int onetime_flag = 0;
 
+/* if set, compare regions with individual frees (-R) */
+static int region_flag = 0;
+
+/* multithreaded replay: number of threads (-j), whether threads replay
+   different traces (-m), whether frees cross threads (-x), and whether
+   threads are pinned across the NUMA nodes (-N), to mt_cpus[k] */
+static int mt_threads = 0;
+static int mt_mixed = 0;
+static int mt_cross = 0;
+static int mt_numa = 0;
+static int mt_cpus[MT_MAX_THREADS];
+
+/* split replay: number of threads each trace is split over (-T) */
+static int split_threads = 0;
+
 /* by default, no timeouts */
 static int set_timeout = 0;
+static int convert_flag = 0; /* write binary traces and exit (-b) */
+static int latency_flag = 0; /* time every call on its own (-L) */
+static int cache_flag = 0;   /* time with cold and warm caches (-C) */
+static int predict_flag = 0; /* predict utilization from size classes (-P) */
+static int huge_pages = MEM_PAGES_4K; /* pages backing the heap (-g) */
+static int prefault_flag = 0;   /* prefault the heap (-F) */
+static size_t heap_capacity = MAX_HEAP; /* most bytes an arena grows to (-M) */
+static int workers = 1;      /* traces evaluated at once (-p) */
+static int bench_samples = 0;   /* timed runs per trace (-n) */
+static int heap_interval = 0;   /* ops between heap samples (-H) */
+static int heap_fd = -1;        /* where the samples go (-o) */
+static int check_mode = -1;     /* mm_checkheap every op, this way (-k) */
+static int check_k = 0;         /* blocks per incremental check (-k) */
+static int copy_flag = 0;       /* time calloc and realloc copies (-Z) */
+static int stream_flag = 0;     /* stream each trace in one pass (-S) */
+static char *backend_names[MAX_BACKENDS]; /* allocators to compare (-a) */
+static int num_backends = 0;
 
 
 /* Directory where default tracefiles are found */
@@ -152,20 +462,29 @@ char autoresult[MAXLINE]; /* autoresult string */
  * Function prototypes
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size,
-                     const trace_t *trace, int opnum, int index);
+                     const trace_t *trace, long long opnum, int index);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static void check_ranges(const trace_t *trace, int opnum, const range_t *r);
 
 /* These functions implement the debugging code */
 static void init_random_data(void);
-static void check_index(const trace_t *trace, int opnum, int index);
+static void fill_random(char *p, size_t size, int base);
+static int count_garbled(const char *p, size_t size, int base, size_t *first);
+static void check_index(const trace_t *trace, long long opnum, int index);
 static void randomize_block(trace_t *trace, int index);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
+static void parse_trace(trace_t *trace, FILE *tracefile);
+static void parse_header(trace_t *trace, FILE *tracefile);
+static int parse_op(FILE *tracefile, const char *filename, long long opnum,
+                    traceop_t *last, traceop_t *op);
+static void map_trace(trace_t *trace, FILE *tracefile);
+static void write_trace(const trace_t *trace);
 static void reinit_trace(trace_t *trace);
 static void free_trace(trace_t *trace);
 
@@ -176,13 +495,88 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
+static void open_heap_samples(const char *path);
+static void sample_heap(const trace_t *trace, int opnum, int payload);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static void eval_mm_pages(speed_t *speed_params, stats_t *stats);
+
+/* Routines for replaying traces with a region instead of frees */
+static int region_replay(trace_t *trace);
+static int eval_region_util(trace_t *trace, stats_t *stats);
+static double eval_class_util(trace_t *trace);
+static void eval_region_speed(void *ptr);
+
+/* Routines for replaying traces on several threads at once (-j) */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, const stats_t *mm_stats);
+static void run_copy_tests(void);
+static double mt_run(trace_t **traces, int n, int reps, double *thread_secs);
+static void *mt_thread_main(void *arg);
+static void mt_free(mt_thread_t *t, void *p, size_t size);
+static void mt_send(mt_thread_t *t);
+static void mt_drain(mt_thread_t *t);
+static void mt_spread_cpus(void);
+static double mt_now(void);
+
+/* Routines for replaying one trace split over several threads (-T) */
+static void run_split_tests(int num_tracefiles, const char *tracedir,
+                            char **tracefiles, const stats_t *mm_stats);
+static split_t *split_trace(const trace_t *trace, int n);
+static void split_pass(split_t *s, const trace_t *trace, int *owner, int fill);
+static void split_add(split_t *s, int k, traceop_t op, int fill);
+static void split_hand(split_t *s, int *owner, int id, int fill);
+static void split_free(split_t *s);
+static double split_run(split_t *s, const trace_t *trace, int reps,
+                        double *thread_secs);
+static void *split_thread_main(void *arg);
+
+/* Streaming traces (-S) */
+static void run_stream_tests(int num_tracefiles, const char *tracedir,
+                             char **tracefiles, stats_t *mm_stats);
+static void stream_open(stream_t *s, const char *tracedir,
+                        const char *filename);
+static void stream_close(stream_t *s);
+static void *stream_reader(void *arg);
+static stream_block_t *stream_find(stream_t *s, int index);
+static stream_block_t *stream_add(stream_t *s, int index);
+static void stream_remove(stream_t *s, stream_block_t *b);
+static void stream_fill(stream_block_t *b);
+static void stream_check(stream_t *s, long long opnum,
+                         const stream_block_t *b);
+static int stream_replay(stream_t *s, const stream_chunk_t *c);
+static void eval_mm_stream(stream_t *s, stats_t *stats);
+
+/* Comparing other allocators (-a) */
+static void run_backend_tests(int num_tracefiles, const char *tracedir,
+                              char **tracefiles);
+static void backend_open(backend_t *b, const char *name);
+static int backend_replay(const backend_t *b, trace_t *trace,
+                          lat_hist_t *hist, unsigned long ovhd,
+                          long long *peak_payload);
+static void backend_speed(void *ptr);
+static void eval_backend(const backend_t *b, trace_t *trace,
+                         backend_result_t *res);
+static long proc_status_kb(const char *field);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printfootprint(int n, stats_t *stats);
+static void printregion(int n, stats_t *stats);
+static void printpredict(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printperf(int n, stats_t *stats);
+static void printbench(int n, stats_t *stats);
+static void printcache(int n, stats_t *stats);
+static void printpages(int n, stats_t *stats);
+static void printstream(int n, stats_t *stats);
+static void save_bench(const char *path, int n, const stats_t *stats);
+static int compare_bench(const char *path, int n, const stats_t *stats);
 static void usage(void);
-static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
+static size_t parse_bytes(const char *s);
+static void malloc_error(const trace_t *trace, long long opnum,
+                         const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
 static void unix_error(const char *fmt, ...)
     __attribute__((format(printf, 1,2), noreturn));
@@ -198,6 +592,9 @@ static void timeout_handler(int sig __attribute__((unused))) {
     longjmp(timeout_jmpbuf, 1);
 }
 
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats);
+
 /* Run the tests; return the number of tests run (may be less than
    num_tracefiles, if there's a timeout) */
 static void run_tests(int num_tracefiles, const char *tracedir,
@@ -205,6 +602,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
                       stats_t *mm_stats, range_t *ranges, speed_t *speed_params) {
     volatile int i;
     volatile int timed_out = 0;
+    unsigned long counts[MM_CTRS];
 
     for (i=0; i < num_tracefiles; i++) {
         /* initialize simulated memory system in memlib.c *
@@ -219,7 +617,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         trace_t *trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
-        mm_stats[i].ops = trace->num_ops;
+        mm_stats[i].ops = trace->num_blocks;
         if(timed_out) {
             mm_stats[i].valid = 0;
         } else {
@@ -235,12 +633,57 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
+            if (predict_flag)
+                mm_stats[i].pred_util = eval_class_util(trace);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            if (bench_samples > 0) {
+                fbench(eval_mm_speed, speed_params, BENCH_WARMUP,
+                       bench_samples, mm_stats[i].bench);
+                mm_stats[i].bench_n = bench_samples;
+                fbench_summarize(mm_stats[i].bench, bench_samples,
+                                 &mm_stats[i].bench_sum);
+                mm_stats[i].secs = mm_stats[i].bench_sum.median;
+            } else {
+                mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+#if USE_PERF
+                fperf_counts(mm_stats[i].perf);
+#endif
+            }
+            if (verbose > 1 && mm_stats_get(counts) == 0) {
+                printf("Counters of the last timed run of %s:\n",
+                       trace->filename);
+                mm_stats_dump(stdout);
+            }
+            if (cache_flag) {
+                if (verbose > 1)
+                    printf("Timing with cold and warm caches.\n");
+                mm_stats[i].cold_secs = fsecs_cache(eval_mm_speed,
+                                                    speed_params, 1);
+                mm_stats[i].warm_secs = fsecs_cache(eval_mm_speed,
+                                                    speed_params, 0);
+            }
+            if (latency_flag) {
+                if (verbose > 1)
+                    printf("Timing each call.\n");
+                eval_mm_latency(trace, &mm_stats[i]);
+            }
+            if (region_flag) {
+                if (verbose > 1)
+                    printf("Comparing with a region.\n");
+                mm_stats[i].region_valid = eval_region_util(trace, &mm_stats[i]);
+                if (mm_stats[i].region_valid)
+                    mm_stats[i].region_secs = fsecs(eval_region_speed,
+                                                    speed_params);
+            }
+            if (huge_pages != MEM_PAGES_4K) {
+                if (verbose > 1)
+                    printf("Comparing 4K pages with hugepages.\n");
+                eval_mm_pages(speed_params, &mm_stats[i]);
+            }
         }
 
         free_trace(trace);
@@ -250,6 +693,125 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     }
 }
 
+/*
+ * What a worker of run_tests_parallel sends back through its pipe
+ */
+typedef struct {
+    stats_t stats;
+    int errors;
+} worker_result_t;
+
+/*
+ * run_tests_parallel - Like run_tests, but the traces are evaluated
+ *     by up to "workers" child processes at once, one trace per child,
+ *     each with a heap of its own.  Each child is pinned to a CPU of
+ *     its own so that the timed runs do not compete, which means
+ *     there are never more workers than CPUs; it sends its stats back
+ *     through a pipe.  The timeout
+ *     applies to each trace rather than to the whole run.
+ */
+static void run_tests_parallel(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats)
+{
+    worker_result_t res;
+    speed_t speed_params;
+    cpu_set_t allowed, mine;
+    int *cpus, ncpus, cpu;
+    int *slot_trace, *slot_fd;
+    pid_t *slot_pid, pid;
+    int fds[2];
+    int i, k, next, running, status;
+    ssize_t n;
+
+    /* The CPUs we may run on; worker slot k always gets CPU k */
+    if ((cpus = calloc(CPU_SETSIZE, sizeof(*cpus))) == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+    ncpus = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0)
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed))
+                cpus[ncpus++] = cpu;
+    if (workers == 0 || (ncpus > 0 && workers > ncpus))
+        workers = (ncpus > 0) ? ncpus : 1;
+    if (workers > num_tracefiles)
+        workers = num_tracefiles;
+
+    slot_trace = calloc(workers, sizeof(*slot_trace));
+    slot_fd = calloc(workers, sizeof(*slot_fd));
+    slot_pid = calloc(workers, sizeof(*slot_pid));
+    if (slot_trace == NULL || slot_fd == NULL || slot_pid == NULL)
+        unix_error("calloc failed in run_tests_parallel");
+
+    /* Each child sets its own alarm */
+    alarm(0);
+
+    next = running = 0;
+    while (next < num_tracefiles || running > 0) {
+
+        /* Start a worker for the next trace in every free slot */
+        for (k = 0; k < workers && next < num_tracefiles; k++) {
+            if (slot_pid[k] != 0)
+                continue;
+            if (pipe(fds) < 0)
+                unix_error("pipe failed in run_tests_parallel");
+            if ((pid = fork()) < 0)
+                unix_error("fork failed in run_tests_parallel");
+            if (pid == 0) {
+                close(fds[0]);
+                if (ncpus > 0) {
+                    CPU_ZERO(&mine);
+                    CPU_SET(cpus[k], &mine);
+                    sched_setaffinity(0, sizeof(mine), &mine);
+                }
+                if (set_timeout > 0)
+                    alarm(set_timeout);
+                memset(&res, 0, sizeof(res));
+                run_tests(1, tracedir, &tracefiles[next], &res.stats,
+                          NULL, &speed_params);
+                res.errors = errors;
+                if (write(fds[1], &res, sizeof(res)) != sizeof(res))
+                    _exit(1);
+                _exit(0);
+            }
+            close(fds[1]);
+            slot_pid[k] = pid;
+            slot_fd[k] = fds[0];
+            slot_trace[k] = next++;
+            running++;
+        }
+
+        /* Collect the next worker to finish */
+        if ((pid = wait(&status)) < 0)
+            unix_error("wait failed in run_tests_parallel");
+        for (k = 0; k < workers && slot_pid[k] != pid; k++)
+            ;
+        if (k == workers)
+            continue;
+        i = slot_trace[k];
+        n = read(slot_fd[k], &res, sizeof(res));
+        if (n == sizeof(res)) {
+            mm_stats[i] = res.stats;
+            errors |= res.errors;
+        } else {
+            /* The allocator crashed the worker */
+            printf("ERROR [trace %s]: worker died (status %d)\n",
+                   tracefiles[i], status);
+            strcpy(mm_stats[i].filename, tracedir);
+            strcat(mm_stats[i].filename, tracefiles[i]);
+            mm_stats[i].valid = 0;
+            errors = 1;
+        }
+        close(slot_fd[k]);
+        slot_pid[k] = 0;
+        running--;
+    }
+
+    free(slot_trace);
+    free(slot_fd);
+    free(slot_pid);
+    free(cpus);
+}
+
 /**************
  * Main routine
  **************/
@@ -261,6 +823,10 @@ int main(int argc, char **argv)
     int num_tracefiles = 0;    /* the number of traces in that array */
 
     range_t *ranges = NULL;    /* keeps track of block extents for one trace */
+    char *heap_path = "heap.csv"; /* time series of heap samples (-H) */
+    char *bench_out = NULL;    /* where to save the -n samples (-w) */
+    char *bench_base = NULL;   /* samples to compare against (-B) */
+    int regressed = 0;         /* some trace got significantly slower */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */
@@ -280,7 +846,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlD")) != EOF) {
+    while ((c = getopt(argc, argv, "a:d:f:c:g:j:k:n:o:p:s:t:v:w:hB:H:M:T:VAbCFlDLNPRSmxZ")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -314,10 +880,134 @@ int main(int argc, char **argv)
                 strcat(tracedir, "/"); /* path always ends with "/" */
             break;
 
+        case 'b': /* Convert the traces to binary traces */
+            convert_flag = 1;
+            break;
+
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
 
+        case 'j': /* Replay on several threads */
+            mt_threads = atoi(optarg);
+            if (mt_threads < 1 || mt_threads > MT_MAX_THREADS)
+                app_error("-j takes 1 to %d threads\n", MT_MAX_THREADS);
+            break;
+
+        case 'T': /* Replay each trace split over several threads */
+            split_threads = atoi(optarg);
+            if (split_threads < 1 || split_threads > MT_MAX_THREADS)
+                app_error("-T takes 1 to %d threads\n", MT_MAX_THREADS);
+            break;
+
+        case 'g': /* Back the heap with hugepages */
+            if (strcmp(optarg, "thp") == 0)
+                huge_pages = MEM_PAGES_THP;
+            else if (strcmp(optarg, "hugetlb") == 0)
+                huge_pages = MEM_PAGES_HUGETLB;
+            else if (strcmp(optarg, "4k") == 0)
+                huge_pages = MEM_PAGES_4K;
+            else
+                app_error("-g takes thp, hugetlb or 4k\n");
+            break;
+
+        case 'k': /* Check the heap every op: full, inc[:<k>] or sample */
+            if (strcmp(optarg, "full") == 0)
+                check_mode = MM_CHECK_FULL;
+            else if (strcmp(optarg, "sample") == 0)
+                check_mode = MM_CHECK_SAMPLED;
+            else if (strncmp(optarg, "inc", 3) == 0 &&
+                     (optarg[3] == '\0' || optarg[3] == ':')) {
+                check_mode = MM_CHECK_INCREMENTAL;
+                check_k = optarg[3] == ':' ? atoi(optarg + 4) : 0;
+            } else
+                app_error("-k takes full, inc[:<k>] or sample\n");
+            break;
+
+        case 'M': /* Heap capacity, with an optional K, M or G suffix */
+            heap_capacity = parse_bytes(optarg);
+            if (heap_capacity == 0)
+                app_error("-M takes a heap size like 100M or 16G\n");
+            break;
+
+        case 'Z': /* Time calloc and realloc with each copy routine */
+            copy_flag = 1;
+            break;
+
+        case 'F': /* Fault the heap in as it grows */
+            prefault_flag = 1;
+            break;
+
+        case 'P': /* Predict utilization from the size classes */
+            predict_flag = 1;
+            break;
+
+        case 'C': /* Time each trace with cold and warm caches */
+            if (!USE_FCYC)
+                app_error("-C needs USE_FCYC in config.h\n");
+            cache_flag = 1;
+            break;
+
+        case 'n': /* Time a fixed number of runs of every trace */
+            bench_samples = atoi(optarg);
+            if (bench_samples < 1 || bench_samples > BENCH_MAX)
+                app_error("-n takes 1 to %d samples\n", BENCH_MAX);
+            break;
+
+        case 'w': /* Save the samples of -n */
+            bench_out = optarg;
+            break;
+
+        case 'B': /* Compare the samples of -n with saved ones */
+            bench_base = optarg;
+            break;
+
+        case 'H': /* Sample the heap every so many ops */
+            heap_interval = atoi(optarg);
+            if (heap_interval < 1)
+                app_error("-H takes a number of ops\n");
+            break;
+
+        case 'o': /* File for the heap samples */
+            heap_path = optarg;
+            break;
+
+        case 'p': /* Evaluate several traces at once */
+            workers = atoi(optarg);
+            if (workers < 0)
+                app_error("-p takes a number of workers, or 0 for one per CPU\n");
+            break;
+
+        case 'm': /* With -j, each thread replays a different trace */
+            mt_mixed = 1;
+            break;
+
+        case 'x': /* With -j, free blocks on another thread */
+            mt_cross = 1;
+            break;
+
+        case 'N': /* With -j or -T, pin threads to CPUs of every NUMA node */
+            mt_numa = 1;
+            break;
+
+        case 'L': /* Latency percentiles of each call */
+            latency_flag = 1;
+            break;
+
+        case 'R': /* Compare regions with individual frees */
+            region_flag = 1;
+            break;
+
+        case 'S': /* Stream each trace instead of loading it */
+            stream_flag = 1;
+            break;
+
+        case 'a': /* Compare with another allocator */
+            if (num_backends == MAX_BACKENDS)
+                app_error("-a takes at most %d allocators\n", MAX_BACKENDS);
+            backend_names[num_backends++] = optarg;
+            break;
+
         case 'V': /* Increase verbosity level */
             verbose += 1;
             break;
@@ -354,13 +1044,32 @@ int main(int argc, char **argv)
         printf("Using default tracefiles in %s\n", tracedir);
     }
 
+    if (convert_flag) {
+        stats_t stats;
+        for (i = 0; i < num_tracefiles; i++) {
+            trace_t *trace = read_trace(&stats, tracedir, tracefiles[i]);
+            write_trace(trace);
+            free_trace(trace);
+        }
+        exit(0);
+    }
+
     if(debug_mode != DBG_NONE) {
         init_random_data();
     }
 
+    if (heap_interval > 0)
+        open_heap_samples(heap_path);
+
     /* Initialize the timing package */
     init_fsecs();
 
+    /* Size and back the simulated heap as -M, -g and -F ask */
+    mem_set_heap_size(heap_capacity);
+    mem_set_pages(huge_pages, prefault_flag);
+    if (check_mode >= 0)
+        mm_check_mode(check_mode, check_k);
+
     /* Initialize the timeout */
     if (set_timeout > 0) {
         signal(SIGALRM, timeout_handler);
@@ -413,8 +1122,13 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
-    run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
-              ranges, &speed_params);
+    if (stream_flag)
+        run_stream_tests(num_tracefiles, tracedir, tracefiles, mm_stats);
+    else if (workers != 1 && !onetime_flag)
+        run_tests_parallel(num_tracefiles, tracedir, tracefiles, mm_stats);
+    else
+        run_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+                  ranges, &speed_params);
 
 
     /* Display the mm results in a compact table */
@@ -430,9 +1144,80 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_tracefiles, mm_stats);
             printf("\n");
+            if (verbose > 1) {
+                printf("Heap footprint for mm malloc:\n");
+                printfootprint(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (stream_flag) {
+                printf("Streamed replay for mm malloc:\n");
+                printstream(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (bench_samples > 0) {
+                printf("Timed runs for mm malloc:\n");
+                printbench(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (cache_flag) {
+                printf("Cold and warm caches for mm malloc:\n");
+                printcache(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (huge_pages != MEM_PAGES_4K) {
+                printf("4K pages and hugepages for mm malloc:\n");
+                printpages(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (USE_PERF) {
+                printf("Hardware events per op for mm malloc:\n");
+                printperf(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (latency_flag) {
+                printf("Latency percentiles for mm malloc:\n");
+                printlatency(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (region_flag) {
+                printf("Region allocation vs individual frees:\n");
+                printregion(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (predict_flag) {
+                printf("Predicted and achieved utilization for mm malloc:\n");
+                printpredict(num_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (mt_threads > 0) {
+                run_mt_tests(num_tracefiles, tracedir, tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (split_threads > 0) {
+                run_split_tests(num_tracefiles, tracedir, tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (copy_flag) {
+                printf("Copy and zero routines of mm malloc, in MB/s:\n");
+                run_copy_tests();
+                printf("\n");
+            }
+            if (num_backends > 0) {
+                printf("mm malloc and other allocators side by side:\n");
+                run_backend_tests(num_tracefiles, tracedir, tracefiles);
+                printf("\n");
+            }
         }
     }
 
+    /* Keep the timed runs for later, and compare with earlier ones */
+    if (bench_samples > 0 && !onetime_flag) {
+        if (bench_out != NULL)
+            save_bench(bench_out, num_tracefiles, mm_stats);
+        if (bench_base != NULL)
+            regressed = compare_bench(bench_base, num_tracefiles, mm_stats);
+    }
+
     /*
      * Accumulate the aggregate statistics for the student's mm package
      */
@@ -541,27 +1326,136 @@ int main(int argc, char **argv)
         printf("\nAUTORESULT_STRING=%s\n", autoresult);
     }
 
-    exit(0);
+    exit(regressed ? 2 : 0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.  Every
+ * operation is O(log n), so even the largest traces are checked.
  ****************************************************************/
 
+/* Unused range records; new ones come from RANGE_POOL-sized pools */
+static range_t *range_free_list = NULL;
+
+static range_t *range_alloc(void)
+{
+    range_t *p;
+    int i;
+
+    if (range_free_list == NULL) {
+        if ((p = (range_t *)malloc(RANGE_POOL * sizeof(range_t))) == NULL)
+            unix_error("malloc error in add_range");
+        for (i = 0; i < RANGE_POOL; i++) {
+            p[i].left = range_free_list;
+            range_free_list = &p[i];
+        }
+    }
+    p = range_free_list;
+    range_free_list = p->left;
+    return p;
+}
+
+static void range_release(range_t *p)
+{
+    p->left = range_free_list;
+    range_free_list = p;
+}
+
+static int range_height(const range_t *r)
+{
+    return (r == NULL) ? 0 : r->height;
+}
+
+/* range_rotate - rotate the subtree at r right or left; returns its root */
+static range_t *range_rotate(range_t *r, int right)
+{
+    range_t *c = right ? r->left : r->right;
+
+    if (right) {
+        r->left = c->right;
+        c->right = r;
+    } else {
+        r->right = c->left;
+        c->left = r;
+    }
+    r->height = 1 + MAX(range_height(r->left), range_height(r->right));
+    c->height = 1 + MAX(range_height(c->left), range_height(c->right));
+    return c;
+}
+
+/*
+ * range_fix - recompute the height of r after one of its subtrees
+ *     changed height by at most one, rotating to rebalance it.
+ *     Returns the new root of the subtree.
+ */
+static range_t *range_fix(range_t *r)
+{
+    int bal = range_height(r->left) - range_height(r->right);
+
+    if (bal > 1) {
+        if (range_height(r->left->left) < range_height(r->left->right))
+            r->left = range_rotate(r->left, 0);
+        return range_rotate(r, 1);
+    }
+    if (bal < -1) {
+        if (range_height(r->right->right) < range_height(r->right->left))
+            r->right = range_rotate(r->right, 1);
+        return range_rotate(r, 0);
+    }
+    r->height = 1 + MAX(range_height(r->left), range_height(r->right));
+    return r;
+}
+
+static range_t *range_insert(range_t *r, range_t *p)
+{
+    if (r == NULL)
+        return p;
+    if (p->lo < r->lo)
+        r->left = range_insert(r->left, p);
+    else
+        r->right = range_insert(r->right, p);
+    return range_fix(r);
+}
+
+/* range_delete - unlink the range starting at lo, if any, into *found */
+static range_t *range_delete(range_t *r, const char *lo, range_t **found)
+{
+    range_t *m;
+
+    if (r == NULL)
+        return NULL;
+    if (lo < r->lo) {
+        r->left = range_delete(r->left, lo, found);
+    } else if (lo > r->lo) {
+        r->right = range_delete(r->right, lo, found);
+    } else {
+        *found = r;
+        if (r->left == NULL || r->right == NULL)
+            return (r->left != NULL) ? r->left : r->right;
+        /* Replace r by its successor */
+        for (m = r->right; m->left != NULL; m = m->left)
+            ;
+        m->right = range_delete(r->right, m->lo, &m);
+        m->left = r->left;
+        r = m;
+    }
+    return range_fix(r);
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
 static int add_range(range_t **ranges, char *lo, int size,
-                     const trace_t *trace, int opnum, int index)
+                     const trace_t *trace, long long opnum, int index)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *pred;
 
     assert(size > 0);
 
@@ -572,42 +1466,49 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or within a
+       block that memlib mapped for the allocator */
+    if (!mem_in_heap(lo, hi)) {
         malloc_error(trace, opnum,
                      "Payload (%p:%p) lies outside heap (%p:%p)",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
         return 0;
     }
 
-    /* If we can't afford the linear-time loop, we check less thoroughly and
-       just assume the overlap will be caught by writing random bits. */
-    if(trace->ignore_ranges || debug_mode == DBG_NONE) return 1;
+    /* Without debugging, overlaps are left to the random data checks */
+    if (debug_mode == DBG_NONE)
+        return 1;
 
-
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            malloc_error(trace, opnum,
-                         "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                         lo, hi, p->lo, p->hi);
-            return 0;
+    /*
+     * The payload must not overlap any other payloads.  The ranges are
+     * disjoint, so if any of them overlaps the payload, the one that
+     * starts last at or below hi does.
+     */
+    for (pred = NULL, p = *ranges; p != NULL; )
+        if (p->lo <= hi) {
+            pred = p;
+            p = p->right;
+        } else {
+            p = p->left;
         }
+    if (pred != NULL && pred->hi >= lo) {
+        malloc_error(trace, opnum,
+                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                     lo, hi, pred->lo, pred->hi);
+        return 0;
     }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by adding a range struct for it to the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-        unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = range_alloc();
     p->lo = lo;
     p->hi = hi;
+    p->left = p->right = NULL;
+    p->height = 1;
     p->index = index;
-    *ranges = p;
+    *ranges = range_insert(*ranges, p);
 
     return 1;
 }
@@ -617,17 +1518,11 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
+    range_t *p = NULL;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    *ranges = range_delete(*ranges, lo, &p);
+    if (p != NULL)
+        range_release(p);
 }
 
 /*
@@ -635,21 +1530,120 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+        return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    range_release(p);
     *ranges = NULL;
 }
 
+/*
+ * check_ranges - check the data of every block in the range tree r
+ */
+static void check_ranges(const trace_t *trace, int opnum, const range_t *r)
+{
+    for (; r != NULL; r = r->right) {
+        check_ranges(trace, opnum, r->left);
+        check_index(trace, opnum, r->index);
+    }
+}
+
 /**********************************************
  * The following routines handle the random data used for
  * checking memory access.
  *********************************************/
 
+/*
+ * A block holds random_data from its base on, wrapping around at
+ * RANDOM_DATA_LEN, so it is filled and checked a run at a time: each
+ * run is one piece of random_data, copied with memcpy and compared
+ * with garbled_run.
+ */
+
+/* fill_random - Fill the size-byte block p with random data from base */
+static void fill_random(char *p, size_t size, int base) {
+    randint_t *block = (randint_t *)p;
+    size_t i, n, off;
+
+    size /= sizeof(*block);
+    for(i = 0; i < size; i += n) {
+        off = (base + i) % RANDOM_DATA_LEN;
+        n = (size - i < RANDOM_DATA_LEN - off) ? size - i : RANDOM_DATA_LEN - off;
+        memcpy(block + i, random_data + off, n * sizeof(*block));
+    }
+}
+
+/* garbled_memcmp - Count the bytes of the n-byte run p that differ
+   from want, the first at *first.  memcmp passes a run that is intact,
+   which is nearly always, and only then are the bytes counted */
+static size_t garbled_memcmp(const unsigned char *p, const unsigned char *want,
+                             size_t n, size_t *first) {
+    size_t i, count = 0;
+
+    if(memcmp(p, want, n) == 0) return 0;
+    for(i = 0; i < n; i++) {
+        if(p[i] != want[i]) {
+            if(count == 0) *first = i;
+            count++;
+        }
+    }
+    return count;
+}
+
+#ifdef HAVE_AVX
+/* garbled_avx2 - Like garbled_memcmp, but counting 64 bytes at a time
+   from the masks of bytes that differ, so a garbled run costs no more
+   than an intact one */
+__attribute__((target("avx2,popcnt,bmi")))
+static size_t garbled_avx2(const unsigned char *p, const unsigned char *want,
+                           size_t n, size_t *first) {
+    size_t i, count = 0, tail_first = 0, tail;
+    unsigned long long diff;
+    __m256i e0, e1;
+
+    for(i = 0; i + 64 <= n; i += 64) {
+        e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i)),
+                               _mm256_loadu_si256((const __m256i *)(want + i)));
+        e1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + i + 32)),
+                               _mm256_loadu_si256((const __m256i *)(want + i + 32)));
+        diff = ~((unsigned long long)(unsigned)_mm256_movemask_epi8(e1) << 32 |
+                 (unsigned)_mm256_movemask_epi8(e0));
+        if(diff != 0) {
+            if(count == 0) *first = i + __builtin_ctzll(diff);
+            count += __builtin_popcountll(diff);
+        }
+    }
+    tail = garbled_memcmp(p + i, want + i, n - i, &tail_first);
+    if(tail != 0 && count == 0) *first = i + tail_first;
+    return count + tail;
+}
+#endif
+
+/* The best of the above the CPU has; init_random_data picks it */
+static size_t (*garbled_run)(const unsigned char *p, const unsigned char *want,
+                             size_t n, size_t *first) = garbled_memcmp;
+
+/* count_garbled - Count the randint_t's of block p that fill_random
+   did not leave there, the first at *first */
+static int count_garbled(const char *p, size_t size, int base, size_t *first) {
+    const randint_t *block = (const randint_t *)p;
+    size_t i, n, off, at = 0, count;
+    int ngarbled = 0;
+
+    size /= sizeof(*block);
+    for(i = 0; i < size; i += n) {
+        off = (base + i) % RANDOM_DATA_LEN;
+        n = (size - i < RANDOM_DATA_LEN - off) ? size - i : RANDOM_DATA_LEN - off;
+        count = garbled_run(block + i, random_data + off, n, &at);
+        if(count != 0 && ngarbled == 0) *first = i + at;
+        ngarbled += count;
+    }
+    return ngarbled;
+}
+
 static void init_random_data(void) {
     int len;
 
@@ -658,48 +1652,28 @@ static void init_random_data(void) {
     for(len = 0; len < RANDOM_DATA_LEN; ++len) {
         random_data[len] = random();
     }
+#ifdef HAVE_AVX
+    if(__builtin_cpu_supports("avx2")) garbled_run = garbled_avx2;
+#endif
 }
 
 static void randomize_block(trace_t *traces, int index) {
-    size_t size;
-    size_t i;
-    randint_t *block;
-    int base;
-
     if(debug_mode == DBG_NONE) return;
 
     traces->block_rand_base[index] = random();
-
-    block = (randint_t*)traces->blocks[index];
-    size = traces->block_sizes[index] / sizeof(*block);
-    base = traces->block_rand_base[index];
-
-    for(i = 0; i < size; i++) {
-        block[i] = random_data[(base + i) % RANDOM_DATA_LEN];
-    }
+    fill_random(traces->blocks[index], traces->block_sizes[index],
+                traces->block_rand_base[index]);
 }
 
-static void check_index(const trace_t *trace, int opnum, int index) {
-    size_t size;
-    size_t i;
-    randint_t *block;
-    int base;
-    int ngarbled = 0;
-    int firstgarbled = -1;
+static void check_index(const trace_t *trace, long long opnum, int index) {
+    int ngarbled;
+    size_t firstgarbled = 0;
 
     if(index < 0) return; /* we're doing free(NULL) */
     if(debug_mode == DBG_NONE) return;
 
-    block = (randint_t*)trace->blocks[index];
-    size = trace->block_sizes[index] / sizeof(*block);
-    base = trace->block_rand_base[index];
-
-    for(i = 0; i < size; i++) {
-        if(block[i] != random_data[(base + i) % RANDOM_DATA_LEN]) {
-            if(firstgarbled == -1) firstgarbled = i;
-            ngarbled++;
-        }
-    }
+    ngarbled = count_garbled(trace->blocks[index], trace->block_sizes[index],
+                             trace->block_rand_base[index], &firstgarbled);
     if(ngarbled != 0) {
         malloc_error(trace, opnum, "block %d has %d garbled %s%s, "
                      "starting at byte %zu", index, ngarbled, randint_t_name,
@@ -712,17 +1686,16 @@ static void check_index(const trace_t *trace, int opnum, int index) {
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory.  Binary traces
+ *     (see bintrace_t) are mapped in place; anything else is parsed as
+ *     a text .rep trace.
  */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
 {
     FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    int index, size;
-    int max_index = 0;
-    int op_index;
+    char magic[sizeof(BIN_MAGIC)];
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -737,22 +1710,16 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((tracefile = fopen(trace->filename, "r")) == NULL) {
         unix_error("Could not open %s in read_trace", trace->filename);
     }
-    fscanf(tracefile, "%d", &trace->weight);
-    fscanf(tracefile, "%d", &trace->num_ids);
-    fscanf(tracefile, "%d", &trace->num_ops);
-    fscanf(tracefile, "%d", &trace->ignore_ranges);
-
-    if(trace->weight < 0 || trace->weight > 3) {
-        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
-    }
-    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
-        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
+    trace->map = NULL;
+    trace->map_len = 0;
+    if (fread(magic, 1, sizeof(magic), tracefile) == sizeof(magic) &&
+        memcmp(magic, BIN_MAGIC, sizeof(magic)) == 0) {
+        map_trace(trace, tracefile);
+    } else {
+        rewind(tracefile);
+        parse_trace(trace, tracefile);
     }
-
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
+    fclose(tracefile);
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks =
@@ -769,48 +1736,223 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
          calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
         unix_error("malloc 5 failed in read_trace");
 
+    /* Scratch space for passing a batch to the allocator */
+    if ((trace->batch = calloc(trace->max_count, sizeof(*trace->batch))) == NULL)
+        unix_error("malloc 6 failed in read_trace");
 
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-        switch(type[0]) {
-        case 'a':
-            fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'r':
-            fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            fscanf(tracefile, "%ud", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-            break;
-        default:
-            app_error("Bogus type character (%c) in tracefile %s\n",
-                      type[0], trace->filename);
+    /* fill in the stats */
+    strcpy(stats->filename, trace->filename);
+    stats->weight = trace->weight;
+    stats->ops = trace->num_blocks;
+
+    return trace;
+}
+
+/*
+ * parse_trace - fill in the header fields and ops of a trace from a
+ *     text .rep file
+ */
+static void parse_trace(trace_t *trace, FILE *tracefile)
+{
+    traceop_t *op, last = {0};
+    int max_index = 0;
+    int max_count = 1;
+    int op_index;
+
+    parse_header(trace, tracefile);
+    if (trace->num_ops < 0)
+        app_error("%s: a streamed trace, which only -S can run",
+                  trace->filename);
+
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops =
+         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+        unix_error("malloc 2 failed in read_trace");
+
+    /* read every request line in the trace file */
+    op_index = 0;
+    trace->num_blocks = 0;
+    while (op_index < trace->num_ops &&
+           parse_op(tracefile, trace->filename, op_index, &last,
+                    op = &trace->ops[op_index])) {
+        if (op->type == ALLOC || op->type == REALLOC)
+            max_index = (op->index > max_index) ? op->index : max_index;
+        else if (op->type == ALLOC_BATCH)
+            max_index = (op->index + (int)op->count - 1 > max_index) ?
+                op->index + (int)op->count - 1 : max_index;
+        if (op->type == ALLOC_BATCH || op->type == FREE_BATCH) {
+            max_count = ((int)op->count > max_count) ? (int)op->count : max_count;
+            trace->num_blocks += op->count;
+        } else {
+            trace->num_blocks++;
         }
         op_index++;
-        if(op_index == trace->num_ops) break;
     }
-    fclose(tracefile);
+
+    trace->max_count = max_count;
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
+}
 
-    /* fill in the stats */
-    strcpy(stats->filename, trace->filename);
-    stats->weight = trace->weight;
-    stats->ops = trace->num_ops;
+/*
+ * parse_header - read the four header lines of a text .rep file
+ */
+static void parse_header(trace_t *trace, FILE *tracefile)
+{
+    fscanf(tracefile, "%d", &trace->weight);
+    fscanf(tracefile, "%d", &trace->num_ids);
+    fscanf(tracefile, "%d", &trace->num_ops);
+    fscanf(tracefile, "%d", &trace->ignore_ranges);
 
-    return trace;
+    if(trace->weight < 0 || trace->weight > 3) {
+        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
+    }
+    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
+        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
+    }
+}
+
+/*
+ * parse_op - read request opnum of a text .rep file into op.  A number
+ *     a line leaves out keeps its value from the line before, which
+ *     the caller passes in last and which is updated.  Returns 0 at
+ *     the end of the file.
+ */
+static int parse_op(FILE *tracefile, const char *filename, long long opnum,
+                    traceop_t *last, traceop_t *op)
+{
+    char type[MAXLINE];
+    int index = last->index, size = last->size, count = last->count;
+
+    if (fscanf(tracefile, "%s", type) == EOF)
+        return 0;
+    op->count = 0;
+    switch(type[0]) {
+    case 'a':
+        fscanf(tracefile, "%u %u", &index, &size);
+        op->type = ALLOC;
+        op->index = index;
+        op->size = size;
+        break;
+    case 'r':
+        fscanf(tracefile, "%u %u", &index, &size);
+        op->type = REALLOC;
+        op->index = index;
+        op->size = size;
+        break;
+    case 'f':
+        fscanf(tracefile, "%ud", &index);
+        op->type = FREE;
+        op->index = index;
+        op->size = 0;
+        break;
+    case 'A':
+        fscanf(tracefile, "%u %u %u", &index, &count, &size);
+        if (count < 1 || count > MAX_BATCH)
+            app_error("%s: bad batch size at line %lld", filename,
+                      LINENUM(opnum));
+        op->type = ALLOC_BATCH;
+        op->index = index;
+        op->count = count;
+        op->size = size;
+        break;
+    case 'F':
+        fscanf(tracefile, "%u %u", &index, &count);
+        if (count < 1 || count > MAX_BATCH)
+            app_error("%s: bad batch size at line %lld", filename,
+                      LINENUM(opnum));
+        op->type = FREE_BATCH;
+        op->index = index;
+        op->count = count;
+        op->size = 0;
+        break;
+    default:
+        app_error("Bogus type character (%c) in tracefile %s\n",
+                  type[0], filename);
+    }
+    last->index = index;
+    last->size = size;
+    last->count = count;
+    return 1;
+}
+
+/*
+ * map_trace - map a binary trace and point the ops at the mapping.
+ *     The ops are used where they lie and never copied.
+ */
+static void map_trace(trace_t *trace, FILE *tracefile)
+{
+    struct stat st;
+    const bintrace_t *hdr;
+    size_t len;
+
+    if (fstat(fileno(tracefile), &st) < 0)
+        unix_error("Could not stat %s in read_trace", trace->filename);
+    len = st.st_size;
+    if (len < sizeof(bintrace_t))
+        app_error("%s: truncated binary trace", trace->filename);
+    trace->map = mmap(NULL, len, PROT_READ, MAP_PRIVATE,
+                      fileno(tracefile), 0);
+    if (trace->map == MAP_FAILED)
+        unix_error("Could not map %s in read_trace", trace->filename);
+    trace->map_len = len;
+
+    hdr = trace->map;
+    if (hdr->version != BIN_VERSION || hdr->op_size != sizeof(traceop_t))
+        app_error("%s: binary trace from another mdriver; rerun mdriver -b",
+                  trace->filename);
+    if (hdr->num_ops < 0)
+        app_error("%s: a streamed trace, which only -S can run",
+                  trace->filename);
+    if (hdr->num_ids < 1 || hdr->max_count < 1 ||
+        len != sizeof(*hdr) + (size_t)hdr->num_ops * sizeof(traceop_t))
+        app_error("%s: corrupt binary trace", trace->filename);
+
+    trace->weight = hdr->weight;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->ignore_ranges = hdr->ignore_ranges;
+    trace->num_blocks = hdr->num_blocks;
+    trace->max_count = hdr->max_count;
+    trace->ops = (traceop_t *)(hdr + 1);
+}
+
+/*
+ * write_trace - save a trace as a binary trace, replacing the .rep
+ *     suffix of its file name (if any) with .bin
+ */
+static void write_trace(const trace_t *trace)
+{
+    char filename[MAXLINE + 4];
+    bintrace_t hdr;
+    FILE *out;
+    size_t len;
+
+    strcpy(filename, trace->filename);
+    len = strlen(filename);
+    if (len > 4 && strcmp(filename + len - 4, ".rep") == 0)
+        filename[len - 4] = '\0';
+    strcat(filename, ".bin");
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BIN_MAGIC, sizeof(hdr.magic));
+    hdr.version = BIN_VERSION;
+    hdr.op_size = sizeof(traceop_t);
+    hdr.weight = trace->weight;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.ignore_ranges = trace->ignore_ranges;
+    hdr.num_blocks = trace->num_blocks;
+    hdr.max_count = trace->max_count;
+
+    if ((out = fopen(filename, "w")) == NULL)
+        unix_error("Could not create %s in write_trace", filename);
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1 ||
+        fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, out) !=
+        (size_t)trace->num_ops || fclose(out) != 0)
+        unix_error("Could not write %s in write_trace", filename);
+    if (verbose > 1)
+        printf("Wrote %s\n", filename);
 }
 
 /*
@@ -824,15 +1966,19 @@ static void reinit_trace(trace_t *trace)
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ * free_trace - Free the trace record and the arrays it points to,
+ *              all of which were allocated (or mapped) in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the arrays... */
+        munmap(trace->map, trace->map_len);
+    else
+        free(trace->ops);
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->batch);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -846,8 +1992,8 @@ static void free_trace(trace_t *trace)
  */
 static int eval_mm_valid(trace_t *trace, range_t **ranges)
 {
-    int i;
-    int index;
+    int i, j;
+    int index, count;
     size_t size;
     char *newp;
     char *oldp;
@@ -869,18 +2015,13 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         index = trace->ops[i].index;
         size = trace->ops[i].size;
 
-        if(debug_mode == DBG_EXPENSIVE) {
-            range_t *r;
-                        
+        if(debug_mode == DBG_EXPENSIVE || check_mode >= 0) {
             /* Let the students check their own heap */
             mm_checkheap(verbose);
-
+        }
+        if(debug_mode == DBG_EXPENSIVE) {
             /* Now check that all our allocated blocks have the right data */
-            r = *ranges;
-            while(r) {
-                check_index(trace, i, r->index);
-                r = r->next;
-            }
+            check_ranges(trace, i, *ranges);
         }
 
         switch (trace->ops[i].type) {
@@ -962,6 +2103,34 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
             mm_free(p);
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, trace->batch) != (size_t)count) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return 0;
+            }
+
+            /* Check and remember every block, as for mm_malloc */
+            for (j = 0; j < count; j++) {
+                p = trace->batch[j];
+                if (add_range(ranges, p, size, trace, i, index + j) == 0)
+                    return 0;
+                trace->blocks[index + j] = p;
+                trace->block_sizes[index + j] = size;
+                randomize_block(trace, index + j);
+            }
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            count = trace->ops[i].count;
+            for (j = 0; j < count; j++) {
+                check_index(trace, i, index + j);
+                trace->batch[j] = trace->blocks[index + j];
+                remove_range(ranges, trace->blocks[index + j]);
+            }
+            mm_free_batch(trace->batch, count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_valid");
         }
@@ -977,17 +2146,19 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   largest size the heap reached while running the student's malloc
+ *   package on the trace. mem_sbrk() lets the package shrink the heap
+ *   again, so the final size says nothing about the space it needed;
+ *   it is recorded in stats, together with the bytes of the heap that
+ *   were resident at most and are still resident at the end, to show
+ *   how much memory was given back.
  *
  *   A higher number is better: 1 is optimal.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
-    int i;
-    int index;
+    int i, j;
+    int index, count;
     int size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
@@ -1053,6 +2224,34 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             total_size -= size;
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            size = trace->ops[i].size;
+
+            if (mm_malloc_batch(size, count, trace->batch) != (size_t)count) {
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            }
+            for (j = 0; j < count; j++) {
+                trace->blocks[index + j] = trace->batch[j];
+                trace->block_sizes[index + j] = size;
+            }
+
+            total_size += count * size;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            for (j = 0; j < count; j++) {
+                trace->batch[j] = trace->blocks[index + j];
+                total_size -= trace->block_sizes[index + j];
+            }
+
+            mm_free_batch(trace->batch, count);
+            break;
+
         default:
             app_error("trace %d: Nonexistent request type in eval_mm_util",
                       tracenum);
@@ -1061,21 +2260,82 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
+
+        if (heap_interval > 0 &&
+            ((i + 1) % heap_interval == 0 || i == trace->num_ops - 1))
+            sample_heap(trace, i + 1, total_size);
     }
 
     printf(".");
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    stats->peak_heap = mem_peak_heapsize();
+    stats->peak_resident = mem_peak_resident();
+    stats->final_resident = mem_resident();
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
+/*
+ * open_heap_samples - create the CSV file for the heap samples of -H
+ *     and write its header line.  The file is opened for appending so
+ *     that the workers of -p can share it a line at a time.
+ */
+static void open_heap_samples(const char *path)
+{
+    char line[MAXLINE * 2];
+    int k, n;
+
+    if ((heap_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                        0644)) < 0)
+        unix_error("Could not create %s", path);
+    n = snprintf(line, sizeof(line), "trace,op,payload,heap,largest_free,frag,"
+                 "alloc_blocks,alloc_bytes,free_blocks,free_bytes,"
+                 "slot_blocks,slot_bytes,slot_free_blocks,slot_free_bytes,"
+                 "mapped_blocks,mapped_bytes");
+    for (k = 0; k < MM_STAT_CLASSES; k++)
+        n += snprintf(line + n, sizeof(line) - n, ",alloc_%lu",
+                      (unsigned long)16 << k);
+    for (k = 0; k < MM_STAT_CLASSES; k++)
+        n += snprintf(line + n, sizeof(line) - n, ",free_%lu",
+                      (unsigned long)16 << k);
+    n += snprintf(line + n, sizeof(line) - n, "\n");
+    if (write(heap_fd, line, n) != n)
+        unix_error("Could not write %s", path);
+}
+
+/*
+ * sample_heap - append one line of heap statistics, taken after opnum
+ *     ops of the trace with payload bytes allocated, to the -H file
+ */
+static void sample_heap(const trace_t *trace, int opnum, int payload)
+{
+    char line[MAXLINE * 3];
+    mm_heap_stats_t st;
+    int j, k, n;
+
+    mm_heap_stats(&st);
+    n = snprintf(line, sizeof(line), "%s,%d,%d,%zu,%zu,%.4f",
+                 trace->filename, opnum, payload, st.heap_bytes,
+                 st.largest_free, st.frag);
+    for (j = 0; j < MM_BLK_STATES; j++)
+        n += snprintf(line + n, sizeof(line) - n, ",%zu,%zu",
+                      st.blocks[j], st.bytes[j]);
+    for (k = 0; k < MM_STAT_CLASSES; k++)
+        n += snprintf(line + n, sizeof(line) - n, ",%zu", st.class_alloc[k]);
+    for (k = 0; k < MM_STAT_CLASSES; k++)
+        n += snprintf(line + n, sizeof(line) - n, ",%zu", st.class_free[k]);
+    n += snprintf(line + n, sizeof(line) - n, "\n");
+    if (write(heap_fd, line, n) != n)
+        unix_error("Could not write heap samples");
+}
+
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
  */
 static void eval_mm_speed(void *ptr)
 {
-    int i, index, size, newsize;
+    int i, index, size, newsize, count;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
@@ -1116,11 +2376,228 @@ static void eval_mm_speed(void *ptr)
             mm_free(block);
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            size = trace->ops[i].size;
+            if (mm_malloc_batch(size, count, trace->batch) != (size_t)count)
+                app_error("mm_malloc_batch error in eval_mm_speed");
+            memcpy(&trace->blocks[index], trace->batch,
+                   count * sizeof(*trace->batch));
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            memcpy(trace->batch, &trace->blocks[index],
+                   count * sizeof(*trace->batch));
+            mm_free_batch(trace->batch, count);
+            break;
+
         default:
             app_error("Nonexistent request type in eval_mm_speed");
         }
 }
 
+/*
+ * eval_mm_pages - time the trace with the heap on 4K pages and then on
+ *     the hugepages of -g, counting dTLB misses, and leave the heap on
+ *     hugepages.  Each heap is mapped afresh.
+ */
+static void eval_mm_pages(speed_t *speed_params, stats_t *stats)
+{
+    int kind[2] = { MEM_PAGES_4K, mem_pages() };  /* after any fallback */
+    double counts[FPERF_EVENTS];
+    int k;
+
+    for (k = 0; k < 2; k++) {
+        mem_deinit();
+        mem_set_pages(kind[k], prefault_flag);
+        mem_init();
+        stats->page_secs[k] = fperf(eval_mm_speed, speed_params, PAGE_RUNS);
+        fperf_counts(counts);
+        stats->page_tlb[k] = counts[FPERF_DTLB_MISSES];
+    }
+}
+
+/*
+ * lat_now - read the cycle counter
+ */
+static inline unsigned long lat_now(void)
+{
+    unsigned hi, lo;
+
+    access_counter(&hi, &lo);
+    return ((unsigned long)hi << 32) | lo;
+}
+
+/*
+ * lat_bucket - the histogram bucket that holds v cycles, and
+ * lat_value - the smallest value that bucket b holds
+ */
+static inline int lat_bucket(unsigned long v)
+{
+    int e;
+
+    if (v < LAT_SUB)
+        return v;
+    e = 63 - __builtin_clzl(v);
+    return (e - LAT_SUB_BITS + 1) * LAT_SUB +
+        ((v >> (e - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+static double lat_value(int b)
+{
+    int e;
+
+    if (b < LAT_SUB)
+        return b;
+    e = b / LAT_SUB + LAT_SUB_BITS - 1;
+    return (double)((unsigned long)(LAT_SUB + b % LAT_SUB) << (e - LAT_SUB_BITS));
+}
+
+/*
+ * lat_add - record one call that took t1 - t0 cycles, ovhd of which
+ *     were spent reading the counter
+ */
+static inline void lat_add(lat_hist_t *h, unsigned long t0, unsigned long t1,
+                           unsigned long ovhd)
+{
+    unsigned long v = t1 - t0;
+
+    v = (v > ovhd) ? v - ovhd : 0;
+    h->count[lat_bucket(v)]++;
+    h->n++;
+    h->max = (v > h->max) ? v : h->max;
+}
+
+/*
+ * lat_percentile - the value of the smallest bucket of h that reaches
+ *     rank pct of its samples
+ */
+static double lat_percentile(const lat_hist_t *h, double pct)
+{
+    unsigned long want = (unsigned long)(pct * h->n), seen = 0;
+    int b = 0;
+
+    want = (want < 1) ? 1 : want;
+    while (b < LAT_BUCKETS - 1 && seen + h->count[b] < want)
+        seen += h->count[b++];
+    return lat_value(b);
+}
+
+/*
+ * lat_ovhd - the cost of two back to back counter reads, i.e. what an
+ *     empty call would seem to take.  We take the minimum so that
+ *     subtracting it never makes a real call look cheaper than it is.
+ */
+static unsigned long lat_ovhd(void)
+{
+    unsigned long t0, t1, best = ~0UL;
+    int i;
+
+    for (i = 0; i < 10000; i++) {
+        t0 = lat_now();
+        t1 = lat_now();
+        best = (t1 - t0 < best) ? t1 - t0 : best;
+    }
+    return best;
+}
+
+/*
+ * eval_mm_latency - replay the trace, timing every malloc, free and
+ *     realloc on its own, and store the latency percentiles in stats
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
+{
+    static const double pct[LAT_NPCT - 1] = { 0.5, 0.9, 0.99, 0.999 };
+    lat_hist_t *hist;
+    unsigned long t0, t1, ovhd;
+    int i, j, rep, reps, index, size, newsize, count;
+    char *p, *newp, *oldp, *block;
+
+    if ((hist = calloc(LAT_TYPES, sizeof(*hist))) == NULL)
+        unix_error("calloc failed in eval_mm_latency");
+    ovhd = lat_ovhd();
+    reps = (trace->num_blocks > 0) ? LAT_MIN_OPS / trace->num_blocks : 1;
+    reps = (reps < 1) ? 1 : (reps > LAT_MAX_REPS) ? LAT_MAX_REPS : reps;
+
+    for (rep = 0; rep < reps; rep++) {
+        reinit_trace(trace);
+        mem_reset_brk();
+        if (mm_init() < 0)
+            app_error("mm_init failed in eval_mm_latency");
+
+        for (i = 0;  i < trace->num_ops;  i++)
+            switch (trace->ops[i].type) {
+
+            case ALLOC: /* mm_malloc */
+                index = trace->ops[i].index;
+                size = trace->ops[i].size;
+                t0 = lat_now();
+                p = mm_malloc(size);
+                t1 = lat_now();
+                if (p == NULL)
+                    app_error("mm_malloc error in eval_mm_latency");
+                lat_add(&hist[LAT_MALLOC], t0, t1, ovhd);
+                trace->blocks[index] = p;
+                break;
+
+            case REALLOC: /* mm_realloc */
+                index = trace->ops[i].index;
+                newsize = trace->ops[i].size;
+                oldp = trace->blocks[index];
+                t0 = lat_now();
+                newp = mm_realloc(oldp, newsize);
+                t1 = lat_now();
+                if (newp == NULL && newsize != 0)
+                    app_error("mm_realloc error in eval_mm_latency");
+                lat_add(&hist[LAT_REALLOC], t0, t1, ovhd);
+                trace->blocks[index] = newp;
+                break;
+
+            case FREE: /* mm_free */
+                index = trace->ops[i].index;
+                block = (index < 0) ? NULL : trace->blocks[index];
+                t0 = lat_now();
+                mm_free(block);
+                t1 = lat_now();
+                lat_add(&hist[LAT_FREE], t0, t1, ovhd);
+                break;
+
+            case ALLOC_BATCH: /* mm_malloc_batch */
+                index = trace->ops[i].index;
+                count = trace->ops[i].count;
+                size = trace->ops[i].size;
+                if (mm_malloc_batch(size, count, trace->batch) != (size_t)count)
+                    app_error("mm_malloc_batch error in eval_mm_latency");
+                memcpy(&trace->blocks[index], trace->batch,
+                       count * sizeof(*trace->batch));
+                break;
+
+            case FREE_BATCH: /* mm_free_batch */
+                index = trace->ops[i].index;
+                count = trace->ops[i].count;
+                memcpy(trace->batch, &trace->blocks[index],
+                       count * sizeof(*trace->batch));
+                mm_free_batch(trace->batch, count);
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_mm_latency");
+            }
+    }
+
+    for (j = 0; j < LAT_TYPES; j++) {
+        stats->lat_n[j] = hist[j].n;
+        for (i = 0; i < LAT_NPCT - 1; i++)
+            stats->lat[j][i] = lat_percentile(&hist[j], pct[i]);
+        stats->lat[j][LAT_NPCT - 1] = hist[j].max;
+    }
+    stats->lat_ovhd = ovhd;
+    free(hist);
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -1129,7 +2606,7 @@ static void eval_mm_speed(void *ptr)
  */
 static int eval_libc_valid(trace_t *trace)
 {
-    int i, newsize;
+    int i, j, newsize;
     char *p, *newp, *oldp;
 
     reinit_trace(trace);
@@ -1163,6 +2640,21 @@ static int eval_libc_valid(trace_t *trace)
             }
             break;
 
+        case ALLOC_BATCH: /* one malloc per block */
+            for (j = 0; j < trace->ops[i].count; j++) {
+                if ((p = malloc(trace->ops[i].size)) == NULL) {
+                    malloc_error(trace, i, "libc malloc failed");
+                    unix_error("System message");
+                }
+                trace->blocks[trace->ops[i].index + j] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* one free per block */
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[trace->ops[i].index + j]);
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1178,7 +2670,7 @@ static int eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, j;
     int index, size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
@@ -1214,68 +2706,1864 @@ static void eval_libc_speed(void *ptr)
                 free(0);
             }
             break;
+
+        case ALLOC_BATCH: /* one malloc per block */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            for (j = 0; j < trace->ops[i].count; j++) {
+                if ((p = malloc(size)) == NULL)
+                    unix_error("malloc failed in eval_libc_speed");
+                trace->blocks[index + j] = p;
+            }
+            break;
+
+        case FREE_BATCH: /* one free per block */
+            index = trace->ops[i].index;
+            for (j = 0; j < trace->ops[i].count; j++)
+                free(trace->blocks[index + j]);
+            break;
         }
     }
 }
 
-/*************************************
- * Some miscellaneous helper routines
- ************************************/
-
-
 /*
- * printresults - prints a performance summary for some malloc package
+ * region_replay - Run a trace with every block allocated from one
+ *    region: frees do nothing, a realloc moves the block to a new
+ *    object, and the whole region goes away at the end.  Returns 0 if
+ *    the region ran out of memory.
  */
-static void printresults(int n, stats_t *stats)
+static int region_replay(trace_t *trace)
 {
-    int i;
-    /* weighted sums all */
-    double sumsecs = 0;
-    double sumops  = 0;
-    double sumutil = 0;
-    int sum_perf_weight = 0;
-    int sum_util_weight = 0;
+    int i, j, index, count;
+    size_t size, oldsize;
+    mm_region_t *r;
+    char *p;
 
-    char wstr;
+    reinit_trace(trace);
 
-    /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
-    for (i=0; i < n; i++) {
-        if (stats[i].valid) {
-            switch(stats[i].weight)
-                {
-                case WNONE:
-                    wstr = ' ';
-                    break;
-                case WALL:
-                    wstr = '*';
-                    break;
-                case WUTIL:
-                    wstr = 'u';
-                    break;
-                case WPERF:
-                    wstr = 'p';
-                    break;
-                default:
-                    app_error("wrong value for weight found!");
-                }
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in region_replay");
+    if ((r = mm_region_create()) == NULL)
+        return 0;
 
-            /* prints done in a somewhat silly way to avoid hassle
-             * if future columns need to be added/modified like this time */
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
 
-            printf("%2c", wstr);
-            printf("%4s", "yes");
+        switch (trace->ops[i].type) {
 
-            /* print '--' if util isn't weighted */
-            if(stats[i].weight == WNONE || stats[i].weight == WALL
-               || stats[i].weight == WUTIL)
-                printf(" %5.0f%%", stats[i].util * 100.0);
-            else
-                printf(" %6s", "--");
+        case ALLOC: /* mm_region_alloc */
+            if ((p = mm_region_alloc(r, size)) == NULL)
+                goto failed;
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
 
-            /* print '--' if perf isn't weighted */
-            if(stats[i].weight == WNONE || stats[i].weight == WALL
+        case REALLOC: /* mm_region_alloc and copy */
+            oldsize = trace->block_sizes[index];
+            p = NULL;
+            if (size > 0 && (p = mm_region_alloc(r, size)) == NULL)
+                goto failed;
+            if (p != NULL && oldsize > 0)
+                memcpy(p, trace->blocks[index], size < oldsize ? size : oldsize);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case ALLOC_BATCH: /* mm_region_alloc per block */
+            count = trace->ops[i].count;
+            for (j = 0; j < count; j++) {
+                if ((p = mm_region_alloc(r, size)) == NULL)
+                    goto failed;
+                trace->blocks[index + j] = p;
+                trace->block_sizes[index + j] = size;
+            }
+            break;
+
+        case FREE:
+        case FREE_BATCH:
+            /* Released with the region */
+            break;
+
+        default:
+            app_error("Nonexistent request type in region_replay");
+        }
+    }
+
+    mm_region_destroy(r);
+    return 1;
+
+ failed:
+    mm_region_destroy(r);
+    return 0;
+}
+
+/*
+ * eval_region_util - Check that the trace runs with a region and
+ *    record the peak heap size it needs.
+ */
+static int eval_region_util(trace_t *trace, stats_t *stats)
+{
+    int ok = region_replay(trace);
+
+    stats->region_peak = mem_peak_heapsize();
+    return ok;
+}
+
+/*
+ * eval_class_util - The utilization the trace would get if every block
+ *    took up exactly mm_class_size bytes and freed space were always
+ *    reused: the peak payload over the peak of the live class bytes.
+ *    The gap to the achieved utilization is fragmentation and heap
+ *    overhead rather than size rounding.
+ */
+static double eval_class_util(trace_t *trace)
+{
+    size_t *sizes;
+    double payload = 0, bytes = 0, max_payload = 0, max_bytes = 0;
+    int i, j, index, count;
+
+    if ((sizes = calloc(trace->num_ids, sizeof(*sizes))) == NULL)
+        unix_error("calloc failed in eval_class_util");
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        count = trace->ops[i].count;
+        switch (trace->ops[i].type) {
+        case REALLOC:
+            payload -= sizes[index];
+            bytes -= mm_class_size(sizes[index]);
+            /* fall through */
+        case ALLOC:
+            sizes[index] = trace->ops[i].size;
+            payload += sizes[index];
+            bytes += mm_class_size(sizes[index]);
+            break;
+        case FREE:
+            if (index < 0)
+                break;
+            payload -= sizes[index];
+            bytes -= mm_class_size(sizes[index]);
+            sizes[index] = 0;
+            break;
+        case ALLOC_BATCH:
+            for (j = 0; j < count; j++)
+                sizes[index + j] = trace->ops[i].size;
+            payload += (double)count * trace->ops[i].size;
+            bytes += (double)count * mm_class_size(trace->ops[i].size);
+            break;
+        case FREE_BATCH:
+            for (j = 0; j < count; j++) {
+                payload -= sizes[index + j];
+                bytes -= mm_class_size(sizes[index + j]);
+                sizes[index + j] = 0;
+            }
+            break;
+        }
+        max_payload = MAX(max_payload, payload);
+        max_bytes = MAX(max_bytes, bytes);
+    }
+    free(sizes);
+    return max_bytes > 0 ? max_payload / max_bytes : 0;
+}
+
+/*
+ * eval_region_speed - This is the function that is used by fcyc() to
+ *    measure the running time of a trace replayed with a region.
+ */
+static void eval_region_speed(void *ptr)
+{
+    if (!region_replay(((speed_t *)ptr)->trace))
+        app_error("region allocation failed in eval_region_speed");
+}
+
+/*
+ * run_copy_tests - Time mm_calloc and mm_realloc with each copy
+ *    routine the CPU has, taking the best of COPY_RUNS.  A run callocs
+ *    COPY_BLOCKS blocks of up to COPY_MAX bytes into a new heap,
+ *    frees them and callocs them again into the memory they left, and
+ *    then reallocs blocks of every power of two up to COPY_MAX to twice
+ *    their size, each with a guard block behind so that it must move.
+ *    Rates are in MB per second.  The blocks are checked afterwards.
+ */
+static void run_copy_tests(void)
+{
+    static const char *names[] = { "libc", "avx2", "avx512" };
+    static char *blocks[COPY_BLOCKS];
+    double best[3], secs[3], t0, bytes[3];
+    size_t size, i, j;
+    int kind, run, pass;
+    char *p;
+
+    mem_init();
+    printf("%8s%15s%15s%15s\n", "routine", "fresh calloc",
+           "reused calloc", "realloc");
+    for (kind = MM_COPY_LIBC; kind <= MM_COPY_AVX512; kind++) {
+        if (mm_copy_mode(kind) < 0) {
+            printf("%8s%15s%15s%15s\n", names[kind], "--", "--", "--");
+            continue;
+        }
+        best[0] = best[1] = best[2] = 1e30;
+        for (run = 0; run < COPY_RUNS; run++) {
+            mem_deinit();               /* a heap never used before */
+            mem_init();
+            if (mm_init() < 0)
+                app_error("mm_init failed in run_copy_tests");
+
+            for (pass = 0; pass < 2; pass++) {
+                if (pass > 0)
+                    for (i = 0; i < COPY_BLOCKS; i++)
+                        mm_free(blocks[i]);
+                bytes[pass] = 0;
+                t0 = mt_now();
+                for (i = 0; i < COPY_BLOCKS; i++) {
+                    size = COPY_MAX >> (i % 12);
+                    if ((blocks[i] = mm_calloc(1, size)) == NULL)
+                        app_error("mm_calloc failed in run_copy_tests");
+                    blocks[i][size - 1] = 1;    /* dirty for the next pass */
+                    bytes[pass] += size;
+                }
+                secs[pass] = mt_now() - t0;
+            }
+            for (i = 0; i < COPY_BLOCKS; i++) {
+                size = COPY_MAX >> (i % 12);
+                for (j = 0; j < size - 1 && blocks[i][j] == 0; j++)
+                    ;
+                if (j < size - 1) {
+                    printf("ERROR: mm_calloc(1, %zu) left byte %zu nonzero\n",
+                           size, j);
+                    errors++;
+                }
+            }
+
+            bytes[2] = secs[2] = 0;
+            for (size = COPY_MAX >> 11; size < COPY_MAX; size *= 2) {
+                mem_reset_brk();
+                if (mm_init() < 0 || (p = mm_malloc(size)) == NULL ||
+                    mm_malloc(16 * sizeof(double)) == NULL)
+                    app_error("mm_malloc failed in run_copy_tests");
+                memset(p, 1, size);
+                t0 = mt_now();
+                if ((p = mm_realloc(p, 2 * size)) == NULL)
+                    app_error("mm_realloc failed in run_copy_tests");
+                secs[2] += mt_now() - t0;
+                bytes[2] += size;
+                for (j = 0; j < size && p[j] == 1; j++)
+                    ;
+                if (j < size) {
+                    printf("ERROR: mm_realloc to %zu bytes lost byte %zu\n",
+                           2 * size, j);
+                    errors++;
+                }
+            }
+
+            for (i = 0; i < 3; i++)
+                if (secs[i] < best[i])
+                    best[i] = secs[i];
+        }
+        printf("%8s%15.0f%15.0f%15.0f\n", names[kind], bytes[0] / 1e6 / best[0],
+               bytes[1] / 1e6 / best[1], bytes[2] / 1e6 / best[2]);
+    }
+    mem_deinit();
+
+    /* Back to the best routines for whatever runs next */
+    if (mm_copy_mode(MM_COPY_AVX512) < 0 && mm_copy_mode(MM_COPY_AVX2) < 0)
+        mm_copy_mode(MM_COPY_LIBC);
+}
+
+/*
+ * run_mt_tests - Measure how throughput scales with threads.  Each
+ *    valid trace is replayed by mt_threads threads at once against the
+ *    shared allocator, and compared with one thread doing the same work
+ *    serially.  With -m, thread k replays the k-th valid trace instead
+ *    (wrapping around) and there is a single row for the mix.
+ */
+static void run_mt_tests(int num_tracefiles, const char *tracedir,
+                         char **tracefiles, const stats_t *mm_stats)
+{
+    trace_t *loaded[MT_MAX_THREADS];  /* distinct traces of a row */
+    trace_t *traces[MT_MAX_THREADS];  /* trace of each thread */
+    double base[MT_MAX_THREADS];      /* one thread's time per trace */
+    double thread_secs[MT_MAX_THREADS];
+    int valid[MT_MAX_THREADS];
+    stats_t dummy;
+    unsigned long counts[MM_CTRS];
+    double serial, wall, ops, kops, lo, hi, mean;
+    int nvalid = 0;
+    int nload, row, reps, i, k;
+
+    for (i = 0; i < num_tracefiles && nvalid < MT_MAX_THREADS; i++)
+        if (mm_stats[i].valid)
+            valid[nvalid++] = i;
+    if (nvalid == 0)
+        return;
+
+    if (mt_numa)
+        mt_spread_cpus();
+    printf("Throughput with %d threads%s", mt_threads,
+           mt_cross ? ", freeing on the next thread" : "");
+    if (mt_numa)
+        printf(", pinned across %d NUMA node%s", mem_num_nodes(),
+               mem_num_nodes() > 1 ? "s" : "");
+    printf(":\n");
+    printf("%10s%11s%9s%10s%10s%10s  %s\n", "1-thr Kops", "total Kops",
+           "scaling", "min Kops", "avg Kops", "max Kops", "trace");
+
+    for (row = 0; row < (mt_mixed ? 1 : nvalid); row++) {
+        mem_init();
+        nload = mt_mixed ? (nvalid < mt_threads ? nvalid : mt_threads) : 1;
+        for (i = 0; i < nload; i++)
+            loaded[i] = read_trace(&dummy, tracedir,
+                                   tracefiles[valid[mt_mixed ? i : row]]);
+        for (k = 0; k < mt_threads; k++)
+            traces[k] = loaded[k % nload];
+
+        /* Pick the number of replays from one pass over the traces */
+        serial = 0;
+        for (i = 0; i < nload; i++)
+            serial += mt_run(&loaded[i], 1, 1, NULL);
+        reps = serial >= MT_MIN_SECS ? 1 : (int)(MT_MIN_SECS / serial) + 1;
+        if (reps > MT_MAX_REPS)
+            reps = MT_MAX_REPS;
+
+        /* The same work on one thread in turn, then on all at once */
+        for (i = 0; i < nload; i++)
+            base[i] = mt_run(&loaded[i], 1, reps, NULL);
+        serial = 0;
+        for (k = 0; k < mt_threads; k++)
+            serial += base[k % nload];
+        wall = mt_run(traces, mt_threads, reps, thread_secs);
+
+        ops = mean = 0;
+        lo = hi = -1;
+        for (k = 0; k < mt_threads; k++) {
+            kops = (double)traces[k]->num_blocks * reps / 1e3 / thread_secs[k];
+            lo = (lo < 0 || kops < lo) ? kops : lo;
+            hi = (kops > hi) ? kops : hi;
+            mean += kops / mt_threads;
+            ops += (double)traces[k]->num_blocks * reps;
+        }
+        printf("%10.0f%11.0f%8.2fx%10.0f%10.0f%10.0f  %s\n",
+               ops / 1e3 / serial, ops / 1e3 / wall, serial / wall,
+               lo, mean, hi,
+               mt_mixed ? "(mixed)" : loaded[0]->filename);
+        if (verbose > 1)
+            for (k = 0; k < mt_threads; k++)
+                printf("    thread %2d: %10.0f Kops  %s\n", k,
+                       traces[k]->num_blocks * reps / 1e3 / thread_secs[k],
+                       traces[k]->filename);
+        if (mt_numa && mm_stats_get(counts) == 0 &&
+            counts[MM_CTR_NODE_LOCAL] + counts[MM_CTR_NODE_REMOTE] > 0)
+            printf("    %.1f%% of arena mallocs node-local\n",
+                   100.0 * counts[MM_CTR_NODE_LOCAL] /
+                   (counts[MM_CTR_NODE_LOCAL] + counts[MM_CTR_NODE_REMOTE]));
+
+        for (i = 0; i < nload; i++)
+            free_trace(loaded[i]);
+        mem_deinit();
+    }
+}
+
+/*
+ * mt_run - Replay traces[k] reps times on thread k, for n threads, all
+ *    starting at once on a fresh heap.  Returns the wall-clock time of
+ *    the whole replay, and each thread's own time in thread_secs[k]
+ *    unless that is NULL.
+ */
+static double mt_run(trace_t **traces, int n, int reps, double *thread_secs)
+{
+    mt_thread_t *threads;
+    pthread_barrier_t start;
+    int finished = 0;
+    double t0;
+    int k;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in mt_run");
+
+    if ((threads = calloc(n, sizeof(*threads))) == NULL)
+        unix_error("calloc failed in mt_run");
+    pthread_barrier_init(&start, NULL, n + 1);
+    for (k = 0; k < n; k++) {
+        mt_thread_t *t = &threads[k];
+
+        t->trace = traces[k];
+        t->reps = reps;
+        t->peer = &threads[(k + 1) % n];
+        t->start = &start;
+        t->finished = &finished;
+        t->nthreads = n;
+        t->cpu = mt_numa ? mt_cpus[k] : -1;
+        pthread_mutex_init(&t->lock, NULL);
+        if ((t->blocks = calloc(traces[k]->num_ids, sizeof(*t->blocks))) == NULL ||
+            (t->sizes = calloc(traces[k]->num_ids, sizeof(*t->sizes))) == NULL)
+            unix_error("calloc failed in mt_run");
+        if (pthread_create(&t->tid, NULL, mt_thread_main, t) != 0)
+            unix_error("pthread_create failed in mt_run");
+    }
+
+    pthread_barrier_wait(&start);
+    t0 = mt_now();
+    for (k = 0; k < n; k++)
+        pthread_join(threads[k].tid, NULL);
+    t0 = mt_now() - t0;
+
+    /* Threads share the heap, so check it once they are all done */
+    mm_checkheap(verbose);
+
+    for (k = 0; k < n; k++) {
+        if (thread_secs != NULL)
+            thread_secs[k] = threads[k].secs;
+        pthread_mutex_destroy(&threads[k].lock);
+        free(threads[k].blocks);
+        free(threads[k].sizes);
+        free(threads[k].inbox);
+        free(threads[k].spare);
+    }
+    pthread_barrier_destroy(&start);
+    free(threads);
+    return t0;
+}
+
+/*
+ * mt_thread_main - Body of one replay thread.  At the end of every
+ *    replay the blocks the trace left allocated are freed, so that the
+ *    heap does not fill up over many replays.
+ */
+static void *mt_thread_main(void *arg)
+{
+    mt_thread_t *t = arg;
+    const trace_t *trace = t->trace;
+    void **blocks = t->blocks;
+    size_t *sizes = t->sizes;
+    int rep, i, j, index, count;
+    cpu_set_t mine;
+    double t0;
+
+    /* Before the first malloc, which picks the thread's arena */
+    if (t->cpu >= 0) {
+        CPU_ZERO(&mine);
+        CPU_SET(t->cpu, &mine);
+        sched_setaffinity(0, sizeof(mine), &mine);
+    }
+    pthread_barrier_wait(t->start);
+    t0 = mt_now();
+
+    for (rep = 0; rep < t->reps; rep++) {
+        for (i = 0;  i < trace->num_ops;  i++) {
+            index = trace->ops[i].index;
+
+            switch (trace->ops[i].type) {
+            case ALLOC: /* mm_malloc */
+                if ((blocks[index] = mm_malloc(trace->ops[i].size)) == NULL)
+                    app_error("mm_malloc error in mt_thread_main");
+                sizes[index] = trace->ops[i].size;
+                break;
+
+            case REALLOC: /* mm_realloc */
+                blocks[index] = mm_realloc(blocks[index], trace->ops[i].size);
+                if (blocks[index] == NULL && trace->ops[i].size != 0)
+                    app_error("mm_realloc error in mt_thread_main");
+                sizes[index] = trace->ops[i].size;
+                break;
+
+            case FREE: /* mm_free, possibly on the peer */
+                if (index >= 0) {
+                    mt_free(t, blocks[index], sizes[index]);
+                    blocks[index] = NULL;
+                }
+                break;
+
+            case ALLOC_BATCH: /* mm_malloc_batch */
+                count = trace->ops[i].count;
+                if (mm_malloc_batch(trace->ops[i].size, count, &blocks[index])
+                    != (size_t)count)
+                    app_error("mm_malloc_batch error in mt_thread_main");
+                for (j = 0; j < count; j++)
+                    sizes[index + j] = trace->ops[i].size;
+                break;
+
+            case FREE_BATCH: /* mm_free_batch, or one by one on the peer */
+                count = trace->ops[i].count;
+                if (mt_cross)
+                    for (j = 0; j < count; j++)
+                        mt_free(t, blocks[index + j], sizes[index + j]);
+                else
+                    mm_free_batch(&blocks[index], count);
+                memset(&blocks[index], 0, count * sizeof(*blocks));
+                break;
+            }
+            mt_drain(t);
+        }
+
+        for (i = 0; i < trace->num_ids; i++)
+            if (blocks[i] != NULL) {
+                mm_free(blocks[i]);
+                blocks[i] = NULL;
+            }
+    }
+
+    mt_send(t);
+    t->secs = mt_now() - t0;
+
+    /* Keep freeing for the others; nothing is sent once all are done */
+    __atomic_add_fetch(t->finished, 1, __ATOMIC_ACQ_REL);
+    while (__atomic_load_n(t->finished, __ATOMIC_ACQUIRE) < t->nthreads) {
+        mt_drain(t);
+        sched_yield();
+    }
+    mt_drain(t);
+    return NULL;
+}
+
+/*
+ * mt_free - Free block p of size bytes, or queue it for the peer thread
+ *    with -x.
+ */
+static void mt_free(mt_thread_t *t, void *p, size_t size)
+{
+    if (!mt_cross) {
+        mm_free(p);
+        return;
+    }
+    t->outbox[t->outbox_len++] = p;
+    t->outbox_bytes += size;
+    if (t->outbox_len == MT_BATCH)
+        mt_send(t);
+}
+
+/*
+ * mt_send - Move the blocks queued in t's outbox to its peer's inbox.
+ *    The inbox is grown with libc realloc, never with the allocator
+ *    under test.
+ */
+static void mt_send(mt_thread_t *t)
+{
+    mt_thread_t *peer = t->peer;
+
+    if (t->outbox_len == 0)
+        return;
+
+    while (__atomic_load_n(&peer->inbox_len, __ATOMIC_RELAXED) >= MT_INBOX_MAX ||
+           __atomic_load_n(&peer->inbox_bytes, __ATOMIC_RELAXED) >= MT_INBOX_BYTES) {
+        mt_drain(t);
+        sched_yield();
+    }
+
+    pthread_mutex_lock(&peer->lock);
+    if (peer->inbox_len + t->outbox_len > peer->inbox_cap) {
+        peer->inbox_cap = 2 * (peer->inbox_cap + MT_BATCH);
+        peer->inbox = realloc(peer->inbox, peer->inbox_cap * sizeof(void *));
+        if (peer->inbox == NULL)
+            unix_error("realloc failed in mt_send");
+    }
+    memcpy(peer->inbox + peer->inbox_len, t->outbox,
+           t->outbox_len * sizeof(void *));
+    peer->inbox_len += t->outbox_len;
+    __atomic_add_fetch(&peer->inbox_bytes, t->outbox_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&peer->pending, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&peer->lock);
+    t->outbox_len = 0;
+    t->outbox_bytes = 0;
+}
+
+/*
+ * mt_drain - Free the blocks other threads handed to t.  The inbox is
+ *    swapped for the spare buffer so that the frees run unlocked; their
+ *    bytes count against t's inbox until they are freed.
+ */
+static void mt_drain(mt_thread_t *t)
+{
+    void **buf;
+    size_t bytes;
+    int i, n, cap;
+
+    if (!__atomic_load_n(&t->pending, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&t->lock);
+    buf = t->inbox;
+    n = t->inbox_len;
+    cap = t->inbox_cap;
+    t->inbox = t->spare;
+    t->inbox_cap = t->spare_cap;
+    t->inbox_len = 0;
+    t->pending = 0;
+    bytes = __atomic_load_n(&t->inbox_bytes, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&t->lock);
+
+    for (i = 0; i < n; i++)
+        mm_free(buf[i]);
+    __atomic_sub_fetch(&t->inbox_bytes, bytes, __ATOMIC_RELAXED);
+    t->spare = buf;
+    t->spare_cap = cap;
+}
+
+/*
+ * mt_spread_cpus - Choose the CPU of each thread for -N: thread k runs
+ *    on NUMA node k mod (nodes), on the next of that node's CPUs we are
+ *    allowed to use, so that any two consecutive threads, a thread and
+ *    its peer with -x, sit on different nodes.  A node with none of our
+ *    CPUs is made up for by any CPU.
+ */
+static void mt_spread_cpus(void)
+{
+    cpu_set_t allowed;
+    int nodes = mem_num_nodes();
+    int k, cpu, node, seen, want, any;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+        unix_error("sched_getaffinity failed in mt_spread_cpus");
+    for (k = 0; k < MT_MAX_THREADS; k++) {
+        node = k % nodes;
+
+        /* How many of the node's CPUs there are, then the one we want */
+        for (seen = 0, cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed) && mem_cpu_node(cpu) == node)
+                seen++;
+        any = (seen == 0);
+        want = any ? k % CPU_COUNT(&allowed) : (k / nodes) % seen;
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &allowed) &&
+                (any || mem_cpu_node(cpu) == node) && want-- == 0)
+                break;
+        mt_cpus[k] = cpu;
+    }
+}
+
+/*
+ * mt_now - Wall-clock time in seconds.
+ */
+static double mt_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*****************************************************************
+ * The following routines replay one trace split over several
+ * threads (-T), which hand blocks to each other to free
+ ****************************************************************/
+
+/*
+ * run_split_tests - Measure throughput with each valid trace split over
+ *    split_threads threads, compared with the whole trace on one.
+ *    Unlike -j, the threads do the work of a single replay between
+ *    them, and every free but those of a lone thread is a hand-off.
+ */
+static void run_split_tests(int num_tracefiles, const char *tracedir,
+                            char **tracefiles, const stats_t *mm_stats)
+{
+    trace_t *trace;
+    split_t *one, *many;
+    stats_t dummy;
+    unsigned long counts[MM_CTRS];
+    double thread_secs[MT_MAX_THREADS];
+    double serial, wall, ops, kops, lo, hi, mean;
+    int i, k, reps;
+
+    if (mt_numa)
+        mt_spread_cpus();
+    printf("Throughput with each trace split over %d thread%s%s",
+           split_threads, split_threads > 1 ? "s" : "",
+           split_threads > 1 ? ", freeing on another thread" : "");
+    if (mt_numa)
+        printf(", pinned across %d NUMA node%s", mem_num_nodes(),
+               mem_num_nodes() > 1 ? "s" : "");
+    printf(":\n");
+    printf("%10s%11s%9s%10s%10s%10s  %s\n", "1-thr Kops", "total Kops",
+           "scaling", "min Kops", "avg Kops", "max Kops", "trace");
+
+    for (i = 0; i < num_tracefiles; i++) {
+        if (!mm_stats[i].valid)
+            continue;
+        mem_init();
+        trace = read_trace(&dummy, tracedir, tracefiles[i]);
+        one = split_trace(trace, 1);
+        many = split_trace(trace, split_threads);
+
+        /* Pick the number of replays from one pass over the trace */
+        serial = split_run(one, trace, 1, NULL);
+        reps = serial >= MT_MIN_SECS ? 1 : (int)(MT_MIN_SECS / serial) + 1;
+        if (reps > MT_MAX_REPS)
+            reps = MT_MAX_REPS;
+
+        serial = split_run(one, trace, reps, NULL);
+        wall = split_run(many, trace, reps, thread_secs);
+
+        ops = mean = 0;
+        lo = hi = -1;
+        for (k = 0; k < split_threads; k++) {
+            kops = (double)many->threads[k].num_calls * reps / 1e3 /
+                   thread_secs[k];
+            lo = (lo < 0 || kops < lo) ? kops : lo;
+            hi = (kops > hi) ? kops : hi;
+            mean += kops / split_threads;
+            ops += (double)many->threads[k].num_calls * reps;
+        }
+        printf("%10.0f%11.0f%8.2fx%10.0f%10.0f%10.0f  %s\n",
+               ops / 1e3 / serial, ops / 1e3 / wall, serial / wall,
+               lo, mean, hi, trace->filename);
+        if (verbose > 1)
+            for (k = 0; k < split_threads; k++)
+                printf("    thread %2d: %10.0f Kops  %ld calls\n", k,
+                       many->threads[k].num_calls * reps / 1e3 /
+                       thread_secs[k], many->threads[k].num_calls);
+        if (mt_numa && mm_stats_get(counts) == 0 &&
+            counts[MM_CTR_NODE_LOCAL] + counts[MM_CTR_NODE_REMOTE] > 0)
+            printf("    %.1f%% of arena mallocs node-local\n",
+                   100.0 * counts[MM_CTR_NODE_LOCAL] /
+                   (counts[MM_CTR_NODE_LOCAL] + counts[MM_CTR_NODE_REMOTE]));
+
+        split_free(one);
+        split_free(many);
+        free_trace(trace);
+        mem_deinit();
+    }
+}
+
+/*
+ * split_trace - Split trace over n threads: one pass to size each
+ *    thread's ops and each queue, another to fill them in.
+ */
+static split_t *split_trace(const trace_t *trace, int n)
+{
+    split_t *s;
+    int *owner;
+    int k;
+
+    if ((s = calloc(1, sizeof(*s))) == NULL ||
+        (s->threads = calloc(n, sizeof(*s->threads))) == NULL ||
+        (owner = malloc(trace->num_ids * sizeof(*owner) + 1)) == NULL)
+        unix_error("calloc failed in split_trace");
+    if (posix_memalign((void **)&s->queues, sizeof(split_queue_t),
+                       (size_t)n * n * sizeof(*s->queues)) != 0)
+        unix_error("posix_memalign failed in split_trace");
+    memset(s->queues, 0, (size_t)n * n * sizeof(*s->queues));
+    s->n = n;
+
+    split_pass(s, trace, owner, 0);
+    for (k = 0; k < n; k++) {
+        split_thread_t *t = &s->threads[k];
+
+        if ((t->ops = malloc(t->num_ops * sizeof(*t->ops) + 1)) == NULL)
+            unix_error("malloc failed in split_trace");
+        t->num_ops = 0;
+        t->num_calls = 0;
+    }
+    for (k = 0; k < n * n; k++)
+        if (s->queues[k].cap > 0 &&
+            (s->queues[k].slots = malloc(s->queues[k].cap * sizeof(void *)))
+            == NULL)
+            unix_error("malloc failed in split_trace");
+    split_pass(s, trace, owner, 1);
+
+    free(owner);
+    return s;
+}
+
+/*
+ * split_pass - Deal the trace's ops out to s's threads, counting them
+ *    unless fill is set, when they are stored.  A FREE_BATCH becomes
+ *    one free per block, since its blocks may have different owners.
+ */
+static void split_pass(split_t *s, const trace_t *trace, int *owner, int fill)
+{
+    traceop_t op;
+    int i, j;
+
+    for (i = 0; i < trace->num_ids; i++)
+        owner[i] = i % s->n;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        op = trace->ops[i];
+        switch (op.type) {
+        case ALLOC:
+        case REALLOC:
+            split_add(s, owner[op.index], op, fill);
+            break;
+
+        case ALLOC_BATCH:
+            for (j = 0; j < (int)op.count; j++)
+                owner[op.index + j] = op.index % s->n;
+            split_add(s, op.index % s->n, op, fill);
+            break;
+
+        case FREE:
+            if (op.index >= 0)
+                split_hand(s, owner, op.index, fill);
+            break;
+
+        case FREE_BATCH:
+            for (j = 0; j < (int)op.count; j++)
+                split_hand(s, owner, op.index + j, fill);
+            break;
+        }
+    }
+}
+
+/*
+ * split_add - Append op to thread k's share of the trace.
+ */
+static void split_add(split_t *s, int k, traceop_t op, int fill)
+{
+    split_thread_t *t = &s->threads[k];
+
+    if (fill)
+        t->ops[t->num_ops] = op;
+    t->num_ops++;
+    if (op.type == ALLOC_BATCH)
+        t->num_calls += op.count;
+    else if (op.type != SPLIT_SEND)
+        t->num_calls++;
+}
+
+/*
+ * split_hand - Add the free of block id.  The thread that frees it is
+ *    one of the others, picked by id so that every owner hands blocks
+ *    to all of them; with one thread it is freed in place.
+ */
+static void split_hand(split_t *s, int *owner, int id, int fill)
+{
+    traceop_t op = { 0 };
+    int n = s->n;
+    int o = owner[id];
+    int c = (n == 1) ? o : (o + 1 + (id / n) % (n - 1)) % n;
+
+    if (c == o) {
+        op.type = FREE;
+        op.index = id;
+        split_add(s, o, op, fill);
+        return;
+    }
+
+    op.type = SPLIT_SEND;
+    op.index = id;
+    op.count = c;
+    split_add(s, o, op, fill);
+    op.type = SPLIT_RECV;
+    op.index = -1;
+    op.count = o;
+    split_add(s, c, op, fill);
+    if (!fill)
+        s->queues[o * n + c].cap++;
+}
+
+/*
+ * split_free - Free what split_trace allocated.
+ */
+static void split_free(split_t *s)
+{
+    int k;
+
+    for (k = 0; k < s->n; k++)
+        free(s->threads[k].ops);
+    for (k = 0; k < s->n * s->n; k++)
+        free(s->queues[k].slots);
+    free(s->queues);
+    free(s->threads);
+    free(s);
+}
+
+/*
+ * split_run - Replay trace split as in s reps times, all threads
+ *    starting at once on a fresh heap.  Returns the wall-clock time of
+ *    the whole replay, and each thread's own time in thread_secs[k]
+ *    unless that is NULL.
+ */
+static double split_run(split_t *s, const trace_t *trace, int reps,
+                        double *thread_secs)
+{
+    pthread_barrier_t start, done;
+    double t0;
+    int k;
+
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in split_run");
+
+    pthread_barrier_init(&start, NULL, s->n + 1);
+    pthread_barrier_init(&done, NULL, s->n);
+    for (k = 0; k < s->n * s->n; k++)
+        s->queues[k].tail = 0;
+    for (k = 0; k < s->n; k++) {
+        split_thread_t *t = &s->threads[k];
+
+        t->s = s;
+        t->k = k;
+        t->num_ids = trace->num_ids;
+        t->reps = reps;
+        t->start = &start;
+        t->done = &done;
+        t->cpu = mt_numa ? mt_cpus[k] : -1;
+        if ((t->blocks = calloc(trace->num_ids + 1, sizeof(*t->blocks))) == NULL ||
+            (t->heads = calloc(s->n, sizeof(*t->heads))) == NULL)
+            unix_error("calloc failed in split_run");
+        if (pthread_create(&t->tid, NULL, split_thread_main, t) != 0)
+            unix_error("pthread_create failed in split_run");
+    }
+
+    pthread_barrier_wait(&start);
+    t0 = mt_now();
+    for (k = 0; k < s->n; k++)
+        pthread_join(s->threads[k].tid, NULL);
+    t0 = mt_now() - t0;
+
+    /* Threads share the heap, so check it once they are all done */
+    mm_checkheap(verbose);
+
+    for (k = 0; k < s->n; k++) {
+        if (thread_secs != NULL)
+            thread_secs[k] = s->threads[k].secs;
+        free(s->threads[k].blocks);
+        free(s->threads[k].heads);
+    }
+    pthread_barrier_destroy(&start);
+    pthread_barrier_destroy(&done);
+    return t0;
+}
+
+/*
+ * split_thread_main - Body of one thread of a split replay.  At the end
+ *    of every replay the thread frees the blocks it owns that the trace
+ *    left allocated; every hand-off has been popped by then, so the
+ *    queues are empty when the threads go on together to the next.
+ */
+static void *split_thread_main(void *arg)
+{
+    split_thread_t *t = arg;
+    split_t *s = t->s;
+    void **blocks = t->blocks;
+    const traceop_t *op, *end = t->ops + t->num_ops;
+    split_queue_t *q;
+    unsigned long pos;
+    int rep, i, index;
+    cpu_set_t mine;
+    double t0;
+
+    /* Before the first malloc, which picks the thread's arena */
+    if (t->cpu >= 0) {
+        CPU_ZERO(&mine);
+        CPU_SET(t->cpu, &mine);
+        sched_setaffinity(0, sizeof(mine), &mine);
+    }
+    pthread_barrier_wait(t->start);
+    t0 = mt_now();
+
+    for (rep = 0; rep < t->reps; rep++) {
+        for (op = t->ops; op < end; op++) {
+            index = op->index;
+
+            switch (op->type) {
+            case ALLOC: /* mm_malloc */
+                if ((blocks[index] = mm_malloc(op->size)) == NULL)
+                    app_error("mm_malloc error in split_thread_main");
+                break;
+
+            case REALLOC: /* mm_realloc */
+                blocks[index] = mm_realloc(blocks[index], op->size);
+                if (blocks[index] == NULL && op->size != 0)
+                    app_error("mm_realloc error in split_thread_main");
+                break;
+
+            case ALLOC_BATCH: /* mm_malloc_batch */
+                if (mm_malloc_batch(op->size, op->count, &blocks[index])
+                    != op->count)
+                    app_error("mm_malloc_batch error in split_thread_main");
+                break;
+
+            case FREE: /* mm_free of a block we own */
+                mm_free(blocks[index]);
+                blocks[index] = NULL;
+                break;
+
+            case SPLIT_SEND: /* hand the block to the thread that frees it */
+                q = &s->queues[t->k * s->n + op->count];
+                pos = q->tail;
+                q->slots[pos % q->cap] = blocks[index];
+                __atomic_store_n(&q->tail, pos + 1, __ATOMIC_RELEASE);
+                blocks[index] = NULL;
+                break;
+
+            case SPLIT_RECV: /* mm_free of the next block handed to us */
+                q = &s->queues[op->count * s->n + t->k];
+                pos = t->heads[op->count];
+                while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == pos)
+                    sched_yield();
+                mm_free(q->slots[pos % q->cap]);
+                t->heads[op->count] = pos + 1;
+                break;
+            }
+        }
+
+        for (i = 0; i < t->num_ids; i++)
+            if (blocks[i] != NULL) {
+                mm_free(blocks[i]);
+                blocks[i] = NULL;
+            }
+        pthread_barrier_wait(t->done);
+    }
+
+    t->secs = mt_now() - t0;
+    return NULL;
+}
+
+/*****************************************************************
+ * The following routines replay a trace as it is read (-S).  A
+ * reader thread parses the trace into two chunks of STREAM_CHUNK ops
+ * by turns while the replay works through the other, so the replay
+ * only waits for I/O when the reader falls behind, and that wait is
+ * kept out of its time.  The live blocks are kept in a hash table
+ * keyed by id rather than in arrays indexed by id, so the memory used
+ * depends on the blocks live at once, not on the length of the trace
+ * or on how large its ids get.
+ ****************************************************************/
+
+/*
+ * stream_open - Open a trace for streaming and read its header.  A
+ *     binary trace starts with BIN_MAGIC, a text trace with a digit;
+ *     only that first byte is looked at before the header is read, so
+ *     the trace may be a pipe.  A trace that gives num_ops as -1 is
+ *     read to its end, any other only up to num_ops ops.
+ */
+static void stream_open(stream_t *s, const char *tracedir,
+                        const char *filename)
+{
+    bintrace_t hdr;
+    int c;
+
+    memset(s, 0, sizeof(*s));
+    if (filename[0] != '/')     /* e.g. -f /dev/stdin */
+        strcpy(s->trace.filename, tracedir);
+    strcat(s->trace.filename, filename);
+    if ((s->file = fopen(s->trace.filename, "r")) == NULL)
+        unix_error("Could not open %s in stream_open", s->trace.filename);
+    setvbuf(s->file, NULL, _IOFBF, 1 << 20);
+
+    if ((c = getc(s->file)) == BIN_MAGIC[0]) {
+        hdr.magic[0] = c;
+        if (fread(hdr.magic + 1, sizeof(hdr) - 1, 1, s->file) != 1 ||
+            memcmp(hdr.magic, BIN_MAGIC, sizeof(hdr.magic)) != 0)
+            app_error("%s: truncated binary trace", s->trace.filename);
+        if (hdr.version != BIN_VERSION || hdr.op_size != sizeof(traceop_t))
+            app_error("%s: binary trace from another mdriver; rerun mdriver -b",
+                      s->trace.filename);
+        s->binary = 1;
+        s->trace.weight = hdr.weight;
+        s->trace.num_ids = hdr.num_ids;
+        s->trace.num_ops = hdr.num_ops;
+    } else {
+        ungetc(c, s->file);
+        parse_header(&s->trace, s->file);
+    }
+
+    for (c = 0; c < 2; c++)
+        if ((s->chunk[c].ops = malloc(STREAM_CHUNK * sizeof(traceop_t))) == NULL)
+            unix_error("malloc failed in stream_open");
+    s->slots = STREAM_MIN_SLOTS;
+    if ((s->table = malloc(s->slots * sizeof(*s->table))) == NULL)
+        unix_error("malloc failed in stream_open");
+    for (c = 0; c < (int)s->slots; c++)
+        s->table[c].index = -1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+}
+
+/*
+ * stream_close - Free what stream_open and the replay allocated
+ */
+static void stream_close(stream_t *s)
+{
+    fclose(s->file);
+    free(s->chunk[0].ops);
+    free(s->chunk[1].ops);
+    free(s->table);
+    free(s->batch);
+    clear_ranges(&s->ranges);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+}
+
+/*
+ * stream_reader - The reader thread: fill the chunks by turns, each
+ *     once the replay is done with it, until the end of the trace or
+ *     until the replay stops
+ */
+static void *stream_reader(void *arg)
+{
+    stream_t *s = arg;
+    stream_chunk_t *c;
+    traceop_t last = {0};
+    long long opnum = 0;
+    int k, n, want;
+
+    for (k = 0; ; k ^= 1) {
+        c = &s->chunk[k];
+        pthread_mutex_lock(&s->lock);
+        while (c->full && !s->stop)
+            pthread_cond_wait(&s->cond, &s->lock);
+        pthread_mutex_unlock(&s->lock);
+        if (s->stop)
+            break;
+
+        want = STREAM_CHUNK;
+        if (s->trace.num_ops >= 0 && s->trace.num_ops - opnum < want)
+            want = s->trace.num_ops - opnum;
+        if (s->binary) {
+            n = fread(c->ops, sizeof(traceop_t), want, s->file);
+            if (ferror(s->file))
+                unix_error("Could not read %s", s->trace.filename);
+        } else {
+            for (n = 0; n < want &&
+                     parse_op(s->file, s->trace.filename, opnum + n,
+                              &last, &c->ops[n]); n++)
+                ;
+        }
+        opnum += n;
+
+        pthread_mutex_lock(&s->lock);
+        c->n = n;
+        c->last = n < STREAM_CHUNK;
+        c->full = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+        if (c->last)
+            break;
+    }
+    return NULL;
+}
+
+/*
+ * stream_hash - The slot at which block id index is looked for first
+ */
+static inline size_t stream_hash(const stream_t *s, int index)
+{
+    return ((unsigned)index * 0x9e3779b9u) & (s->slots - 1);
+}
+
+/*
+ * stream_find - The entry of live block id index, or NULL
+ */
+static stream_block_t *stream_find(stream_t *s, int index)
+{
+    size_t i;
+
+    for (i = stream_hash(s, index); s->table[i].index != -1;
+         i = (i + 1) & (s->slots - 1))
+        if (s->table[i].index == index)
+            return &s->table[i];
+    return NULL;
+}
+
+/*
+ * stream_add - The entry of block id index, made if it is not there.
+ *     The table doubles when it gets three quarters full.
+ */
+static stream_block_t *stream_add(stream_t *s, int index)
+{
+    stream_block_t *old = s->table, *b;
+    size_t i, n = s->slots;
+
+    if ((b = stream_find(s, index)) != NULL)
+        return b;
+
+    if (4 * (s->count + 1) > 3 * s->slots) {
+        s->slots *= 2;
+        if ((s->table = malloc(s->slots * sizeof(*s->table))) == NULL)
+            unix_error("malloc failed in stream_add");
+        for (i = 0; i < s->slots; i++)
+            s->table[i].index = -1;
+        for (i = 0; i < n; i++) {
+            if (old[i].index == -1)
+                continue;
+            for (b = &s->table[stream_hash(s, old[i].index)]; b->index != -1; )
+                b = &s->table[(b - s->table + 1) & (s->slots - 1)];
+            *b = old[i];
+        }
+        free(old);
+    }
+
+    for (i = stream_hash(s, index); s->table[i].index != -1;
+         i = (i + 1) & (s->slots - 1))
+        ;
+    b = &s->table[i];
+    b->index = index;
+    b->p = NULL;
+    b->size = 0;
+    if (++s->count > s->peak_count)
+        s->peak_count = s->count;
+    return b;
+}
+
+/*
+ * stream_remove - Drop entry b, moving back the entries after it that
+ *     would no longer be found
+ */
+static void stream_remove(stream_t *s, stream_block_t *b)
+{
+    size_t hole = b - s->table, i, home;
+
+    for (i = (hole + 1) & (s->slots - 1); s->table[i].index != -1;
+         i = (i + 1) & (s->slots - 1)) {
+        home = stream_hash(s, s->table[i].index);
+        /* Move it if its home is not in the cyclic range (hole, i] */
+        if (((i - home) & (s->slots - 1)) >= ((i - hole) & (s->slots - 1))) {
+            s->table[hole] = s->table[i];
+            hole = i;
+        }
+    }
+    s->table[hole].index = -1;
+    s->count--;
+}
+
+/*
+ * stream_fill - Fill a new block with random data, for debugging
+ */
+static void stream_fill(stream_block_t *b)
+{
+    if (debug_mode == DBG_NONE)
+        return;
+    b->rand_base = random();
+    fill_random(b->p, b->size, b->rand_base);
+}
+
+/*
+ * stream_check - Check that block b still holds its random data
+ */
+static void stream_check(stream_t *s, long long opnum,
+                         const stream_block_t *b)
+{
+    int ngarbled;
+    size_t first = 0;
+
+    if (debug_mode == DBG_NONE)
+        return;
+    ngarbled = count_garbled(b->p, b->size, b->rand_base, &first);
+    if (ngarbled != 0)
+        malloc_error(&s->trace, opnum, "block %d has %d garbled %s%s, "
+                     "starting at byte %zu", b->index, ngarbled,
+                     randint_t_name, ngarbled > 1 ? "s" : "",
+                     sizeof(randint_t) * first);
+}
+
+/*
+ * stream_replay - Replay the ops of chunk c, checking them as
+ *     eval_mm_valid does, except that the data of every block is not
+ *     checked every op with DBG_EXPENSIVE.  Returns 0 on an error.
+ */
+static int stream_replay(stream_t *s, const stream_chunk_t *c)
+{
+    const traceop_t *op;
+    stream_block_t *b;
+    long long opnum;
+    int i, j, index, count;
+    size_t size;
+    char *p;
+
+    for (i = 0; i < c->n; i++) {
+        op = &c->ops[i];
+        opnum = s->ops + i;
+        index = op->index;
+        size = op->size;
+
+        if (debug_mode == DBG_EXPENSIVE || check_mode >= 0)
+            mm_checkheap(verbose);
+
+        switch (op->type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(size)) == NULL) {
+                malloc_error(&s->trace, opnum, "mm_malloc failed.");
+                return 0;
+            }
+            if (add_range(&s->ranges, p, size, &s->trace, opnum, index) == 0)
+                return 0;
+            b = stream_add(s, index);
+            s->payload += (long long)size - (long long)b->size;
+            b->p = p;
+            b->size = size;
+            stream_fill(b);
+            s->blocks++;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            b = stream_add(s, index);
+            stream_check(s, opnum, b);
+            if ((p = mm_realloc(b->p, size)) == NULL && size != 0) {
+                malloc_error(&s->trace, opnum, "mm_realloc failed.");
+                return 0;
+            }
+            if (p != NULL && size == 0) {
+                malloc_error(&s->trace, opnum, "mm_realloc with size 0 "
+                             "returned non-NULL.");
+                return 0;
+            }
+            if (b->p != NULL)
+                remove_range(&s->ranges, b->p);
+            if (size > 0 &&
+                add_range(&s->ranges, p, size, &s->trace, opnum, index) == 0)
+                return 0;
+
+            /* Check up to min(size, oldsize) for correct copying */
+            s->payload += (long long)size - (long long)b->size;
+            b->p = p;
+            if (size < b->size)
+                b->size = size;
+            stream_check(s, opnum, b);
+            b->size = size;
+            if (size == 0)
+                stream_remove(s, b);
+            else
+                stream_fill(b);
+            s->blocks++;
+            break;
+
+        case FREE: /* mm_free */
+            p = NULL;
+            if (index >= 0) {
+                if ((b = stream_find(s, index)) == NULL)
+                    app_error("%s: line %lld frees block %d, which is not "
+                              "allocated", s->trace.filename,
+                              LINENUM(opnum), index);
+                stream_check(s, opnum, b);
+                p = b->p;
+                remove_range(&s->ranges, p);
+                s->payload -= b->size;
+                stream_remove(s, b);
+            }
+            mm_free(p);
+            s->blocks++;
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+        case FREE_BATCH:  /* mm_free_batch */
+            count = op->count;
+            if (count > s->batch_len) {
+                if ((s->batch = realloc(s->batch,
+                                        count * sizeof(*s->batch))) == NULL)
+                    unix_error("realloc failed in stream_replay");
+                s->batch_len = count;
+            }
+            if (op->type == ALLOC_BATCH) {
+                if (mm_malloc_batch(size, count, s->batch) != (size_t)count) {
+                    malloc_error(&s->trace, opnum, "mm_malloc_batch failed.");
+                    return 0;
+                }
+                for (j = 0; j < count; j++) {
+                    p = s->batch[j];
+                    if (add_range(&s->ranges, p, size, &s->trace, opnum,
+                                  index + j) == 0)
+                        return 0;
+                    b = stream_add(s, index + j);
+                    s->payload += (long long)size - (long long)b->size;
+                    b->p = p;
+                    b->size = size;
+                    stream_fill(b);
+                }
+            } else {
+                for (j = 0; j < count; j++) {
+                    if ((b = stream_find(s, index + j)) == NULL)
+                        app_error("%s: line %lld frees block %d, which is "
+                                  "not allocated", s->trace.filename,
+                                  LINENUM(opnum), index + j);
+                    stream_check(s, opnum, b);
+                    s->batch[j] = b->p;
+                    remove_range(&s->ranges, b->p);
+                    s->payload -= b->size;
+                    stream_remove(s, b);
+                }
+                mm_free_batch(s->batch, count);
+            }
+            s->blocks += count;
+            break;
+
+        default:
+            app_error("%s: Nonexistent request type at line %lld",
+                      s->trace.filename, LINENUM(opnum));
+        }
+
+        if (s->payload > s->peak_payload)
+            s->peak_payload = s->payload;
+    }
+    s->ops += c->n;
+    return 1;
+}
+
+/*
+ * eval_mm_stream - Replay a trace as it is read, one chunk at a time
+ *     while the reader thread fills the other.  Fills in the stats
+ *     that run_tests would; utilization is the peak payload over the
+ *     peak heap, as in eval_mm_util, and secs is the time spent in
+ *     the replay, without the waits for the reader but with the random
+ *     data checks that debug_mode asks for.
+ */
+static void eval_mm_stream(stream_t *s, stats_t *stats)
+{
+    pthread_t reader;
+    stream_chunk_t *c;
+    double start;
+    int k, ok = 1, last = 0;
+
+    strcpy(stats->filename, s->trace.filename);
+    stats->weight = s->trace.weight;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        malloc_error(&s->trace, 0, "mm_init failed.");
+        return;
+    }
+    if (pthread_create(&reader, NULL, stream_reader, s) != 0)
+        unix_error("pthread_create failed in eval_mm_stream");
+
+    for (k = 0; ok && !last; k ^= 1) {
+        c = &s->chunk[k];
+        start = mt_now();
+        pthread_mutex_lock(&s->lock);
+        while (!c->full)
+            pthread_cond_wait(&s->cond, &s->lock);
+        pthread_mutex_unlock(&s->lock);
+        stats->stream_wait += mt_now() - start;
+
+        start = mt_now();
+        ok = stream_replay(s, c);
+        stats->secs += mt_now() - start;
+
+        pthread_mutex_lock(&s->lock);
+        last = c->last;
+        c->full = 0;
+        s->stop = !ok;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+    pthread_join(reader, NULL);
+
+    stats->valid = ok;
+    stats->ops = s->blocks;
+    stats->stream_ops = s->ops;
+    stats->stream_peak_ids = s->peak_count;
+    stats->peak_heap = mem_peak_heapsize();
+    stats->peak_resident = mem_peak_resident();
+    stats->final_resident = mem_resident();
+    stats->util = stats->peak_heap > 0 ?
+        (double)s->peak_payload / stats->peak_heap : 0;
+    printf(".");
+}
+
+/*
+ * run_stream_tests - Stream every trace (-S), with a clean heap each
+ */
+static void run_stream_tests(int num_tracefiles, const char *tracedir,
+                             char **tracefiles, stats_t *mm_stats)
+{
+    stream_t *s;
+    int i;
+
+    if ((s = malloc(sizeof(*s))) == NULL)
+        unix_error("malloc failed in run_stream_tests");
+    for (i = 0; i < num_tracefiles; i++) {
+        mem_init();
+        stream_open(s, tracedir, tracefiles[i]);
+        if (verbose > 1)
+            printf("Streaming %s\n", s->trace.filename);
+        eval_mm_stream(s, &mm_stats[i]);
+        stream_close(s);
+        mem_deinit();
+    }
+    free(s);
+}
+
+/*****************************************************************
+ * The following routines put mm malloc side by side with other
+ * allocators (-a).  Each allocator runs each trace in a child process
+ * of its own: it starts from a fresh heap, which is the only way to
+ * reset the C library's, and if it crashes only the child goes.  The
+ * child times each call to find the 99th percentile, measures how far
+ * its resident set grows, and then times whole replays with fsecs.
+ * Every allocator, mm malloc included, is called through the same
+ * function pointers.  Utilization is the peak payload over the growth
+ * of the resident set, so unlike in the other tables it counts the
+ * allocator's own data and the pages it touches around the payload.
+ ****************************************************************/
+
+/*
+ * run_backend_tests - Run mm malloc and each allocator -a named on
+ *     every trace, and print a row for each, then one for each over
+ *     all the traces: their ops per second, mean utilization, and the
+ *     worst p99 latency and peak resident memory
+ */
+static void run_backend_tests(int num_tracefiles, const char *tracedir,
+                              char **tracefiles)
+{
+    backend_result_t res, *sum;
+    backend_t b;
+    stats_t dummy;
+    trace_t *trace;
+    const char *name, *slash;
+    double ns = 1e3 / mhz(0), *ops, *secs;
+    int nb = num_backends + 1, *nvalid;
+    int i, k, fds[2], status;
+    pid_t pid;
+    ssize_t n;
+
+    sum = calloc(nb, sizeof(*sum));
+    ops = calloc(nb, sizeof(*ops));
+    secs = calloc(nb, sizeof(*secs));
+    nvalid = calloc(nb, sizeof(*nvalid));
+    if (sum == NULL || ops == NULL || secs == NULL || nvalid == NULL)
+        unix_error("calloc failed in run_backend_tests");
+
+    printf("%-14s%5s%9s%6s%9s%11s  %s\n", "allocator", "valid", "Kops",
+           "util", "p99 ns", "peak KB", "trace");
+    for (i = 0; i < num_tracefiles; i++) {
+        trace = read_trace(&dummy, tracedir, tracefiles[i]);
+        reinit_trace(trace);    /* so the children share its pages */
+
+        for (k = 0; k < nb; k++) {
+            name = (k == 0) ? "mm" : backend_names[k - 1];
+            if (pipe(fds) < 0)
+                unix_error("pipe failed in run_backend_tests");
+            if ((pid = fork()) < 0)
+                unix_error("fork failed in run_backend_tests");
+            if (pid == 0) {
+                close(fds[0]);
+                backend_open(&b, name);
+                eval_backend(&b, trace, &res);
+                if (write(fds[1], &res, sizeof(res)) != sizeof(res))
+                    _exit(1);
+                _exit(0);
+            }
+            close(fds[1]);
+            while ((n = read(fds[0], &res, sizeof(res))) < 0 && errno == EINTR)
+                ;
+            close(fds[0]);
+            waitpid(pid, &status, 0);
+            if (n != sizeof(res)) {
+                memset(&res, 0, sizeof(res));
+                if (WIFSIGNALED(status))
+                    printf("%s died of signal %d on %s\n", name,
+                           WTERMSIG(status), trace->filename);
+            }
+
+            slash = strrchr(name, '/');
+            printf("%-14s", slash ? slash + 1 : name);
+            if (!res.valid) {
+                printf("%5s%9s%6s%9s%11s  %s\n", "no", "-", "-", "-", "-",
+                       trace->filename);
+                continue;
+            }
+            printf("%5s%9.0f%5.0f%%%9.0f", "yes",
+                   trace->num_blocks / res.secs / 1e3, res.util * 100,
+                   res.p99 * ns);
+            if (res.peak_rss > 0)
+                printf("%11.1f", res.peak_rss / 1024.0);
+            else
+                printf("%11s", "--");
+            printf("  %s\n", trace->filename);
+
+            nvalid[k]++;
+            ops[k] += trace->num_blocks;
+            secs[k] += res.secs;
+            sum[k].util += res.util;
+            sum[k].p99 = (res.p99 > sum[k].p99) ? res.p99 : sum[k].p99;
+            sum[k].peak_rss = (res.peak_rss > sum[k].peak_rss) ?
+                res.peak_rss : sum[k].peak_rss;
+        }
+        free_trace(trace);
+    }
+
+    for (k = 0; k < nb && num_tracefiles > 1; k++) {
+        name = (k == 0) ? "mm" : backend_names[k - 1];
+        slash = strrchr(name, '/');
+        printf("%-14s%2d/%-2d", slash ? slash + 1 : name, nvalid[k],
+               num_tracefiles);
+        if (nvalid[k] == 0) {
+            printf("%9s%6s%9s%11s  %s\n", "-", "-", "-", "-", "all traces");
+            continue;
+        }
+        printf("%9.0f%5.0f%%%9.0f", ops[k] / secs[k] / 1e3,
+               sum[k].util / nvalid[k] * 100, sum[k].p99 * ns);
+        if (sum[k].peak_rss > 0)
+            printf("%11.1f", sum[k].peak_rss / 1024.0);
+        else
+            printf("%11s", "--");
+        printf("  %s\n", "all traces");
+    }
+    printf("(util: peak payload over the peak growth of the resident set)\n");
+    free(sum);
+    free(ops);
+    free(secs);
+    free(nvalid);
+}
+
+/*
+ * backend_open - Find the calls of allocator name: "mm" for mm.c as
+ *     linked into the driver, "libc" for the C library, and otherwise
+ *     a shared object with the mm.h calls.  The object is opened with
+ *     RTLD_DEEPBIND so that it binds to its own symbols and those of
+ *     the libraries it was linked with (its memlib, jemalloc's malloc)
+ *     before the driver's and the C library's.
+ */
+static void backend_open(backend_t *b, const char *name)
+{
+    void *h;
+
+    memset(b, 0, sizeof(*b));
+    b->name = name;
+    if (strcmp(name, "mm") == 0) {
+        b->setup = mem_init;
+        b->reset = mem_reset_brk;
+        b->init = mm_init;
+        b->malloc = mm_malloc;
+        b->free = mm_free;
+        b->realloc = mm_realloc;
+    } else if (strcmp(name, "libc") == 0) {
+        b->malloc = malloc;
+        b->free = free;
+        b->realloc = realloc;
+    } else {
+        if ((h = dlopen(name, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND)) == NULL)
+            app_error("-a: %s\n", dlerror());
+        b->setup = (void (*)(void))dlsym(h, "mem_init");
+        b->reset = (void (*)(void))dlsym(h, "mem_reset_brk");
+        b->init = (int (*)(void))dlsym(h, "mm_init");
+        b->malloc = (void *(*)(size_t))dlsym(h, "mm_malloc");
+        b->free = (void (*)(void *))dlsym(h, "mm_free");
+        b->realloc = (void *(*)(void *, size_t))dlsym(h, "mm_realloc");
+        if (b->malloc == NULL || b->free == NULL || b->realloc == NULL)
+            app_error("-a: %s lacks mm_malloc, mm_free or mm_realloc\n", name);
+    }
+}
+
+/*
+ * backend_replay - Replay the trace once with allocator b, batches
+ *     one block at a time, and free what it leaves allocated.  With
+ *     hist, time each call into it, less ovhd cycles; with
+ *     peak_payload, raise it to the most payload live at once, and
+ *     write to every page of each new block so that it is resident, as
+ *     it would be in a program that used it.  Returns 0 if a call
+ *     fails.
+ */
+static int backend_replay(const backend_t *b, trace_t *trace,
+                          lat_hist_t *hist, unsigned long ovhd,
+                          long long *peak_payload)
+{
+    const traceop_t *op;
+    unsigned long t0 = 0;
+    long long payload = 0;
+    int i, j, n, index;
+    size_t size, k;
+    char *p;
+
+    reinit_trace(trace);
+    if (b->reset != NULL)
+        b->reset();
+    if (b->init != NULL && b->init() < 0) {
+        malloc_error(trace, 0, "%s: mm_init failed.", b->name);
+        return 0;
+    }
+
+    for (i = 0; i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        size = op->size;
+        n = (op->type == ALLOC_BATCH || op->type == FREE_BATCH) ?
+            (int)op->count : 1;
+        for (j = 0, index = op->index; j < n; j++, index++) {
+            if (hist != NULL)
+                t0 = lat_now();
+            switch (op->type) {
+            case ALLOC:
+            case ALLOC_BATCH:
+                p = b->malloc(size);
+                break;
+            case REALLOC:
+                p = b->realloc(trace->blocks[index], size);
+                break;
+            default:
+                p = (index < 0) ? NULL : trace->blocks[index];
+                b->free(p);
+                break;
+            }
+            if (hist != NULL)
+                lat_add(hist, t0, lat_now(), ovhd);
+
+            if (op->type == FREE || op->type == FREE_BATCH) {
+                if (index < 0)
+                    continue;
+                p = NULL;
+                size = 0;
+            } else if (p == NULL && size != 0) {
+                malloc_error(trace, i, "%s: %s failed.", b->name,
+                             op->type == REALLOC ? "realloc" : "malloc");
+                return 0;
+            }
+            if (peak_payload != NULL && size > 0) {
+                for (k = 0; k < size; k += 4096)
+                    p[k] = 0;
+                p[size - 1] = 0;
+            }
+            payload += (long long)size - (long long)trace->block_sizes[index];
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+        }
+        if (peak_payload != NULL && payload > *peak_payload)
+            *peak_payload = payload;
+    }
+
+    for (index = 0; index < trace->num_ids; index++)
+        if (trace->blocks[index] != NULL)
+            b->free(trace->blocks[index]);
+    return 1;
+}
+
+/*
+ * backend_speed - This is the function that is used by fcyc() to
+ *    measure the running time of another allocator on a trace
+ */
+static void backend_speed(void *ptr)
+{
+    backend_speed_t *args = ptr;
+
+    if (!backend_replay(args->b, args->trace, NULL, 0, NULL))
+        app_error("%s failed in backend_speed\n", args->b->name);
+}
+
+/*
+ * eval_backend - In the child for allocator b, fill in res for the
+ *     trace.  The latency replays come first, as many as
+ *     eval_mm_latency does, and the resident set they grow to is the
+ *     peak.  Its high-water mark is reset through clear_refs first;
+ *     where that cannot be done, peak_rss and util stay 0.
+ */
+static void eval_backend(const backend_t *b, trace_t *trace,
+                         backend_result_t *res)
+{
+    backend_speed_t args;
+    lat_hist_t *hist;
+    long long peak_payload = 0;
+    unsigned long ovhd;
+    long base = -1, peak;
+    int fd, rep, reps;
+
+    memset(res, 0, sizeof(*res));
+    if ((hist = malloc(sizeof(*hist))) == NULL)
+        unix_error("malloc failed in eval_backend");
+    memset(hist, 0, sizeof(*hist));
+    ovhd = lat_ovhd();
+    reps = (trace->num_blocks > 0) ? LAT_MIN_OPS / trace->num_blocks : 1;
+    reps = (reps < 1) ? 1 : (reps > LAT_MAX_REPS) ? LAT_MAX_REPS : reps;
+    if (b->setup != NULL)
+        b->setup();
+
+    /* Give back the memory the driver freed before the fork, or the C
+       library's malloc would reuse it without growing the resident set */
+    malloc_trim(0);
+    if ((fd = open("/proc/self/clear_refs", O_WRONLY)) >= 0) {
+        if (write(fd, "5", 1) == 1)
+            base = proc_status_kb("VmRSS:");
+        close(fd);
+    }
+    for (rep = 0; rep < reps; rep++)
+        if (!backend_replay(b, trace, hist, ovhd, &peak_payload)) {
+            free(hist);
+            return;
+        }
+    if (base >= 0 && (peak = proc_status_kb("VmHWM:")) > base) {
+        res->peak_rss = (size_t)(peak - base) * 1024;
+        res->util = (double)peak_payload / res->peak_rss;
+    }
+    res->p99 = lat_percentile(hist, 0.99);
+    free(hist);
+
+    args.b = b;
+    args.trace = trace;
+    res->secs = fsecs(backend_speed, &args);
+    res->valid = 1;
+}
+
+/*
+ * proc_status_kb - A size in kB from /proc/self/status, such as that
+ *     of "VmRSS:", or -1 if it is not there
+ */
+static long proc_status_kb(const char *field)
+{
+    char line[MAXLINE];
+    size_t len = strlen(field);
+    long kb = -1;
+    FILE *fp;
+
+    if ((fp = fopen("/proc/self/status", "r")) == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (strncmp(line, field, len) == 0) {
+            kb = strtol(line + len, NULL, 10);
+            break;
+        }
+    fclose(fp);
+    return kb;
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+
+/*
+ * printresults - prints a performance summary for some malloc package
+ */
+static void printresults(int n, stats_t *stats)
+{
+    int i;
+    /* weighted sums all */
+    double sumsecs = 0;
+    double sumops  = 0;
+    double sumutil = 0;
+    int sum_perf_weight = 0;
+    int sum_util_weight = 0;
+
+    char wstr;
+
+    /* Print the individual results for each trace */
+    printf("  %2s%6s %5s%8s%9s  %s\n",
+           "valid", "util", "ops", "secs", "Kops", "trace");
+    for (i=0; i < n; i++) {
+        if (stats[i].valid) {
+            switch(stats[i].weight)
+                {
+                case WNONE:
+                    wstr = ' ';
+                    break;
+                case WALL:
+                    wstr = '*';
+                    break;
+                case WUTIL:
+                    wstr = 'u';
+                    break;
+                case WPERF:
+                    wstr = 'p';
+                    break;
+                default:
+                    app_error("wrong value for weight found!");
+                }
+
+            /* prints done in a somewhat silly way to avoid hassle
+             * if future columns need to be added/modified like this time */
+
+            printf("%2c", wstr);
+            printf("%4s", "yes");
+
+            /* print '--' if util isn't weighted */
+            if(stats[i].weight == WNONE || stats[i].weight == WALL
+               || stats[i].weight == WUTIL)
+                printf(" %5.0f%%", stats[i].util * 100.0);
+            else
+                printf(" %6s", "--");
+
+            /* print '--' if perf isn't weighted */
+            if(stats[i].weight == WNONE || stats[i].weight == WALL
                || stats[i].weight == WPERF)
                 printf("%8.0f%10.6f%6.0f", stats[i].ops, stats[i].secs,
                        (stats[i].ops/1e3)/stats[i].secs);
@@ -1330,6 +4618,314 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * printfootprint - prints the most of the heap that was resident while
+ *     each valid trace ran next to what was still resident when it
+ *     finished; both are whole pages, as mincore reports them
+ */
+static void printfootprint(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%10s%10s%7s  %s\n", "peak KB", "final KB", "final", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%10.1f%10.1f %5.0f%%  %s\n",
+               stats[i].peak_resident / 1024.0,
+               stats[i].final_resident / 1024.0,
+               stats[i].peak_resident == 0 ? 0.0 :
+               100.0 * stats[i].final_resident / stats[i].peak_resident,
+               stats[i].filename);
+    }
+}
+
+/*
+ * printregion - For each trace, compare throughput and peak heap size
+ *    with individual frees and with a single region (-R)
+ */
+static void printregion(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%10s%10s%8s%10s%10s  %s\n",
+           "free Kops", "rgn Kops", "speedup", "peak KB", "rgn KB", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        if (!stats[i].region_valid) {
+            printf("%10.0f%10s%8s%10.1f%10s  %s\n",
+                   (stats[i].ops / 1e3) / stats[i].secs, "--", "--",
+                   stats[i].peak_heap / 1024.0, "--", stats[i].filename);
+            continue;
+        }
+        printf("%10.0f%10.0f%7.2fx%10.1f%10.1f  %s\n",
+               (stats[i].ops / 1e3) / stats[i].secs,
+               (stats[i].ops / 1e3) / stats[i].region_secs,
+               stats[i].secs / stats[i].region_secs,
+               stats[i].peak_heap / 1024.0,
+               stats[i].region_peak / 1024.0,
+               stats[i].filename);
+    }
+}
+
+/*
+ * printpredict - For each trace, compare the utilization the size
+ *    classes predict (-P) with the utilization achieved
+ */
+static void printpredict(int n, stats_t *stats)
+{
+    double pred = 0, util = 0;
+    int i, valid = 0;
+
+    printf("%10s%10s%10s  %s\n", "predicted", "achieved", "achv/pred",
+           "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%9.0f%%%9.0f%%%10.2f  %s\n", 100 * stats[i].pred_util,
+               100 * stats[i].util,
+               stats[i].pred_util > 0 ? stats[i].util / stats[i].pred_util : 0,
+               stats[i].filename);
+        pred += stats[i].pred_util;
+        util += stats[i].util;
+        valid++;
+    }
+    if (valid > 0)
+        printf("%9.0f%%%9.0f%%%10.2f\n", 100 * pred / valid,
+               100 * util / valid, pred > 0 ? util / pred : 0);
+}
+
+/*
+ * printlatency - For each trace and kind of call, print the latency
+ *     percentiles in nanoseconds (-L)
+ */
+static void printlatency(int n, stats_t *stats)
+{
+    static const char *names[LAT_TYPES] = { "malloc", "free", "realloc" };
+    double ns = 1e3 / mhz(0);
+    int i, j, k;
+
+    printf("%8s%9s%8s%8s%8s%8s%10s  %s\n", "call", "count",
+           "p50 ns", "p90", "p99", "p999", "max", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        for (j = 0; j < LAT_TYPES; j++) {
+            if (stats[i].lat_n[j] == 0)
+                continue;
+            printf("%8s%9lu", names[j], stats[i].lat_n[j]);
+            for (k = 0; k < LAT_NPCT - 1; k++)
+                printf("%8.0f", stats[i].lat[j][k] * ns);
+            printf("%10.0f  %s\n", stats[i].lat[j][LAT_NPCT - 1] * ns,
+                   stats[i].filename);
+        }
+    }
+    for (i = 0; i < n; i++)
+        if (stats[i].valid) {
+            printf("(%.0f cycles of timer overhead subtracted from each call)\n",
+                   stats[i].lat_ovhd);
+            break;
+        }
+}
+
+/*
+ * printperf - For each trace, print the instructions per cycle and the
+ *     hardware events per op of the timed run (USE_PERF)
+ */
+static void printperf(int n, stats_t *stats)
+{
+    const double *c;
+    int i, j;
+
+    printf("%6s", "IPC");
+    for (j = 0; j < FPERF_EVENTS; j++)
+        printf("%9s", fperf_name(j));
+    printf("  %s\n", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        c = stats[i].perf;
+        if (c[FPERF_CYCLES] > 0 && c[FPERF_INSTRUCTIONS] >= 0)
+            printf("%6.2f", c[FPERF_INSTRUCTIONS] / c[FPERF_CYCLES]);
+        else
+            printf("%6s", "--");
+        for (j = 0; j < FPERF_EVENTS; j++) {
+            if (c[j] >= 0 && stats[i].ops > 0)
+                printf("%9.2f", c[j] / stats[i].ops);
+            else
+                printf("%9s", "--");
+        }
+        printf("  %s\n", stats[i].filename);
+    }
+}
+
+/*
+ * printbench - For each trace, summarize the timed runs of -n in Kops
+ */
+static void printbench(int n, stats_t *stats)
+{
+    const fbench_summary_t *b;
+    int i;
+
+    printf("%10s%8s%20s%5s  %s\n", "med Kops", "MAD", "95% CI Kops", "n",
+           "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].bench_n == 0)
+            continue;
+        b = &stats[i].bench_sum;
+        printf("%10.0f%7.1f%%%10.0f%10.0f%5d  %s\n",
+               stats[i].ops / 1e3 / b->median, 100 * b->mad / b->median,
+               stats[i].ops / 1e3 / b->hi, stats[i].ops / 1e3 / b->lo,
+               b->n, stats[i].filename);
+    }
+}
+
+/*
+ * printcache - For each trace, compare the Kops of -C with the whole
+ *     last-level cache cleared before each run and with a warm cache
+ */
+static void printcache(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%10s%10s%10s  %s\n", "cold Kops", "warm Kops", "warm/cold",
+           "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].cold_secs <= 0 ||
+            stats[i].warm_secs <= 0)
+            continue;
+        printf("%10.0f%10.0f%9.2fx  %s\n",
+               stats[i].ops / 1e3 / stats[i].cold_secs,
+               stats[i].ops / 1e3 / stats[i].warm_secs,
+               stats[i].cold_secs / stats[i].warm_secs, stats[i].filename);
+    }
+}
+
+/*
+ * printpages - For each trace, compare the Kops and the dTLB misses per
+ *     op of -g on 4K pages and on hugepages
+ */
+static void printpages(int n, stats_t *stats)
+{
+    int i, k;
+
+    printf("%10s%10s%9s%10s%10s  %s\n", "4K Kops", "huge Kops", "speedup",
+           "4K dTLB", "huge dTLB", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].page_secs[0] <= 0 ||
+            stats[i].page_secs[1] <= 0)
+            continue;
+        printf("%10.0f%10.0f%8.2fx",
+               stats[i].ops / 1e3 / stats[i].page_secs[0],
+               stats[i].ops / 1e3 / stats[i].page_secs[1],
+               stats[i].page_secs[0] / stats[i].page_secs[1]);
+        for (k = 0; k < 2; k++) {
+            if (stats[i].page_tlb[k] >= 0)
+                printf("%10.3f", stats[i].page_tlb[k] / stats[i].ops);
+            else
+                printf("%10s", "--");
+        }
+        printf("  %s\n", stats[i].filename);
+    }
+    printf("(dTLB: data TLB read misses per op)\n");
+}
+
+/*
+ * printstream - Print what -S saw of each trace
+ */
+static void printstream(int n, stats_t *stats)
+{
+    int i;
+
+    printf("%14s%14s%12s%10s  %s\n", "ops", "blocks", "peak live",
+           "wait secs", "trace");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%14.0f%14.0f%12.0f%10.3f  %s\n", stats[i].stream_ops,
+               stats[i].ops, stats[i].stream_peak_ids, stats[i].stream_wait,
+               stats[i].filename);
+    }
+    printf("(wait secs: time the replay waited for the reader, not in secs)\n");
+}
+
+/*
+ * save_bench - Write the timed runs of every valid trace to path, one
+ *     line per trace: the trace name, the number of runs, and the
+ *     running time of each run in seconds
+ */
+static void save_bench(const char *path, int n, const stats_t *stats)
+{
+    FILE *fp;
+    int i, j;
+
+    if ((fp = fopen(path, "w")) == NULL)
+        unix_error("Could not create %s", path);
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].bench_n == 0)
+            continue;
+        fprintf(fp, "%s %d", stats[i].filename, stats[i].bench_n);
+        for (j = 0; j < stats[i].bench_n; j++)
+            fprintf(fp, " %.9g", stats[i].bench[j]);
+        fprintf(fp, "\n");
+    }
+    if (fclose(fp) != 0)
+        unix_error("Could not write %s", path);
+}
+
+/*
+ * compare_bench - Compare the timed runs of each trace with the runs
+ *     saved in path by an earlier -w, e.g. with another build of the
+ *     allocator.  A trace counts as slower or faster if the change is
+ *     significant at BENCH_ALPHA and at least BENCH_MIN_CHANGE.
+ *     Returns whether any trace got slower.
+ */
+static int compare_bench(const char *path, int n, const stats_t *stats)
+{
+    char name[MAXLINE];
+    double base[BENCH_MAX], p, change;
+    fbench_summary_t bs;
+    const char *verdict;
+    int i, j, nb, regressed = 0;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        unix_error("Could not open %s", path);
+    printf("Timed runs compared with %s:\n", path);
+    printf("%10s%10s%8s%9s%9s  %s\n", "base Kops", "new Kops", "change",
+           "p", "", "trace");
+    while (fscanf(fp, "%1023s %d", name, &nb) == 2) {
+        if (nb < 1 || nb > BENCH_MAX)
+            app_error("%s: bad number of runs for %s\n", path, name);
+        for (j = 0; j < nb; j++)
+            if (fscanf(fp, "%lf", &base[j]) != 1)
+                app_error("%s: too few runs for %s\n", path, name);
+        for (i = 0; i < n; i++)
+            if (stats[i].valid && stats[i].bench_n > 0 &&
+                strcmp(stats[i].filename, name) == 0)
+                break;
+        if (i == n)
+            continue;
+
+        fbench_summarize(base, nb, &bs);
+        p = fbench_pvalue(base, nb, stats[i].bench, stats[i].bench_n);
+        change = bs.median / stats[i].secs - 1;   /* in throughput */
+        verdict = "";
+        if (p < BENCH_ALPHA && fabs(change) >= BENCH_MIN_CHANGE) {
+            verdict = (change < 0) ? "slower" : "faster";
+            regressed |= (change < 0);
+        }
+        printf("%10.0f%10.0f%+7.1f%%%9.4f%9s  %s\n",
+               stats[i].ops / 1e3 / bs.median,
+               stats[i].ops / 1e3 / stats[i].secs,
+               100 * change, p, verdict, name);
+    }
+    fclose(fp);
+    printf("\n");
+    return regressed;
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1356,14 +4952,14 @@ void unix_error(const char *fmt, ...) {
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
+void malloc_error(const trace_t *trace, long long opnum, const char *fmt, ...)
 {
     va_list ap;
     va_start(ap, fmt);
 
     errors++;
 
-    printf("ERROR [trace %s, line %d]: ", trace->filename, LINENUM(opnum));
+    printf("ERROR [trace %s, line %lld]: ", trace->filename, LINENUM(opnum));
     vprintf(fmt, ap);
     putchar('\n');
 
@@ -1373,16 +4969,66 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
 /*
  * usage - Explain the command line arguments
  */
+/*
+ * parse_bytes - Parse a size with an optional K, M or G suffix; 0 if
+ *     it is not one
+ */
+static size_t parse_bytes(const char *s)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    switch (*end) {
+    case 'k': case 'K': v *= 1 << 10; end++; break;
+    case 'm': case 'M': v *= 1 << 20; end++; break;
+    case 'g': case 'G': v *= 1 << 30; end++; break;
+    }
+    if (end == s || *end != '\0' || v < 0)
+        return 0;
+    return (size_t)v;
+}
+
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+    fprintf(stderr, "Usage: mdriver [-hbCFlVDLNPRSmxZ] [-d <i>] [-v <i>] [-s <s>] [-t <dir>]\n");
+    fprintf(stderr, "               [-g <kind>] [-k <mode>] [-M <size>] [-j <n>] [-T <n>] [-p <n>]\n");
+    fprintf(stderr, "               [-n <n> [-w <file>] [-B <file>]] [-H <k> [-o <file>]]\n");
+    fprintf(stderr, "               [-a <alloc>]... [-c <file> | -f <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
+    fprintf(stderr, "\t-k <mode>  Run mm_checkheap every op: full, inc[:<k>] blocks or sample.\n");
     fprintf(stderr, "\t-c <file>  Run trace file <file> once, check for correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-b         Write each trace as a binary .bin trace and exit.\n");
+    fprintf(stderr, "\t-C         Also time each trace with a cold and a warm cache.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-a <alloc> Compare with another allocator: libc, or a shared object\n"
+                    "\t           with the mm.h calls, such as ./mm-libc.so; up to %d.\n", MAX_BACKENDS);
+    fprintf(stderr, "\t-L         Report latency percentiles of each call.\n");
+    fprintf(stderr, "\t-R         Compare with a region and no frees.\n");
+    fprintf(stderr, "\t-S         Stream each trace through once, in bounded memory;\n"
+                    "\t           time it with -d 0.\n");
+    fprintf(stderr, "\t-g <kind>  Back the heap with thp or hugetlb pages; compare with 4K.\n");
+    fprintf(stderr, "\t-Z         Time calloc and realloc with each copy routine.\n");
+    fprintf(stderr, "\t-F         Prefault the heap, keeping page faults out of timed runs.\n");
+    fprintf(stderr, "\t-M <size>  Let the heap grow to <size> bytes (K, M or G suffix).\n");
+    fprintf(stderr, "\t-P         Compare utilization with what the size classes predict.\n");
+    fprintf(stderr, "\t-n <n>     Time <n> runs of each trace; report median, MAD and CI.\n");
+    fprintf(stderr, "\t-w <file>  Save the runs of -n to <file>.\n");
+    fprintf(stderr, "\t-B <file>  Compare the runs of -n with those saved in <file>;\n");
+    fprintf(stderr, "\t           exit with status 2 if any trace got significantly slower.\n");
+    fprintf(stderr, "\t-H <k>     Sample mm_heap_stats every <k> ops into a CSV file.\n");
+    fprintf(stderr, "\t-o <file>  The CSV file for -H (default heap.csv).\n");
+    fprintf(stderr, "\t-p <n>     Evaluate up to <n> traces at once, one per CPU (0: all CPUs).\n");
+    fprintf(stderr, "\t-j <n>     Also replay each trace on <n> threads at once.\n");
+    fprintf(stderr, "\t-m         With -j, give each thread a different trace.\n");
+    fprintf(stderr, "\t-x         With -j, free every block on another thread.\n");
+    fprintf(stderr, "\t-N         With -j or -T, pin the threads to CPUs of each NUMA node\n"
+                    "\t           in turn.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace split over <n> threads, which free\n"
+                    "\t           each other's blocks.\n");
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
@@ -1,8 +1,40 @@
 /*
- * memlib.c - a module that simulates the memory system.	Needed because it 
- *						allows us to interleave calls from the student's malloc package 
+ * memlib.c - a module that simulates the memory system.	Needed because it
+ *						allows us to interleave calls from the student's malloc package
  *						with the system's malloc package in libc.
+ *
+ *						The memory system is a set of arenas, each an independently
+ *						growing region with its own brk pointer.  An arena reserves
+ *						mem_set_heap_size bytes of address space (MAX_HEAP unless
+ *						set) with no access, and pages are made read-write in
+ *						COMMIT_CHUNK steps as the break first passes them, so a
+ *						heap costs only what it touches however large it may grow.
+ *						Arena 0 is the default heap behind mem_sbrk, mem_heap_lo and
+ *						mem_heap_hi; further arenas are created on demand with
+ *						mem_arena_create so that an allocator can give each thread
+ *						or core a region of its own.
+ *
+ *						Blocks too big for an arena can be mapped on their own
+ *						with mem_map.  Such mappings count as part of the heap:
+ *						mem_in_heap accepts them and their size is included in
+ *						mem_peak_heapsize.
+ *
+ *						mem_set_pages chooses how arenas are backed: by 4K pages,
+ *						by transparent hugepages (madvise MADV_HUGEPAGE) or by
+ *						explicit hugetlb pages (MAP_HUGETLB, falling back to
+ *						transparent ones if none are reserved).  Arenas can also be
+ *						prefaulted as they are committed, so that page faults stay
+ *						out of later timed runs; pages of a prefaulted arena are
+ *						then never given back to the system.
+ *
+ *						On a machine with several NUMA nodes, mem_arena_bind asks
+ *						the kernel to place an arena's pages on a given node
+ *						(mbind with MPOL_PREFERRED, so that a full node still
+ *						spills over), and mem_current_node tells a thread which
+ *						node the CPU it runs on belongs to.  The topology is read
+ *						from /sys once, on first use.
  */
+#define _GNU_SOURCE	/* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -12,61 +44,307 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* suggested start of arena 0; arena i is suggested heap_size bytes above i-1 */
+#define HEAP_BASE ((char *)0x800000000)
+
+#define HUGE_PAGE (1<<21)	/* size of a hugepage, and alignment of HEAP_BASE */
+#define COMMIT_CHUNK HUGE_PAGE	/* granule arenas are made read-write in */
+
+#define MAX_NODES 64		/* NUMA nodes we know of; the rest count as node 0 */
+#define MAX_CPUS 1024		/* likewise for CPUs */
+
+#define RESIDENT_STEP 32	/* resample resident pages as the peak grows by 1/32 */
+#define RESIDENT_CHUNK 4096	/* pages mincore looks at in one call */
+
+/* One simulated heap */
+typedef struct {
+	char *heap;			/* first byte of the region */
+	char *brk;			/* current break */
+	char *peak;			/* highest break since the last reset */
+	char *fresh;		/* highest break since the arena was mapped */
+	char *commit;		/* end of the read-write part */
+	char *max_addr;		/* one past the last usable byte */
+	int node;			/* NUMA node the region is bound to, or -1 */
+} mem_arena_t;
+
+/* One separately mapped block */
+typedef struct {
+	char *addr;
+	size_t len;
+} mem_map_t;
+
 /* private variables */
-static char *heap;
-static char *mem_brk;
-static char *mem_max_addr;
+static mem_arena_t arenas[MEM_MAX_ARENAS];
+static int num_arenas;	/* arenas [0, num_arenas) exist */
+static pthread_mutex_t create_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static mem_map_t *maps;		/* live separate mappings */
+static int num_maps, max_maps;
+static size_t mapped_bytes;	/* total length of maps */
+static size_t peak_footprint;	/* largest heap + mapped_bytes since reset */
+static size_t peak_resident;	/* most of it seen resident since reset */
+static size_t resident_mark;	/* peak_footprint when last sampled */
+static pthread_mutex_t map_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int page_kind = MEM_PAGES_4K;	/* backing of arenas mapped from now on */
+static int prefault;		/* populate arenas when they are mapped */
+static size_t release_page;	/* granule mem_release_range works in */
+static size_t heap_size = MAX_HEAP;	/* address space of arenas mapped from now on */
+
+static int num_nodes = 1;	/* NUMA nodes, from /sys */
+static signed char cpu_node[MAX_CPUS];	/* node of each CPU */
+static pthread_once_t topo_once = PTHREAD_ONCE_INIT;
+
+static void prefault_range(char *lo, char *hi);
+static size_t arena_resident(int id);
+
+/*
+ * note_footprint - raise peak_footprint to the current footprint, and
+ *		sample the resident pages when it has grown by 1/RESIDENT_STEP
+ *		(and at least a page) since they were last sampled, so that
+ *		sampling costs a constant factor over the heap's growth.
+ *		Caller holds map_lock.
+ */
+static void note_footprint(void){
+	size_t cur = mem_heapsize() + mapped_bytes;
+	size_t step = resident_mark / RESIDENT_STEP, r;
+
+	if (cur > peak_footprint)
+		peak_footprint = cur;
+	if (step < mem_pagesize())
+		step = mem_pagesize();
+	if (cur >= resident_mark + step) {
+		resident_mark = cur;
+		r = arena_resident(0) + mapped_bytes;
+		if (r > peak_resident)
+			peak_resident = r;
+	}
+}
+
+/*
+ * find_map - return the index of the mapping starting at p, or -1.
+ *		Caller holds map_lock.
+ */
+static int find_map(const void *p){
+	int i;
+
+	for (i = 0; i < num_maps; i++)
+		if (maps[i].addr == p)
+			return i;
+	return -1;
+}
+
+/*
+ * unmap_all - drop every separate mapping.  Caller holds map_lock.
+ */
+static void unmap_all(void){
+	int i;
+
+	for (i = 0; i < num_maps; i++)
+		munmap(maps[i].addr, maps[i].len);
+	num_maps = 0;
+	mapped_bytes = 0;
+}
+
+/*
+ * map_region - reserve heap_size bytes of address space, preferably at
+ *		start, for the pages mem_set_pages asked for.  Nothing is
+ *		accessible until commit_to makes it so.
+ */
+static char *map_region(char *start){
+	char *p;
+
+	if (page_kind == MEM_PAGES_HUGETLB) {
+		/* reserves the hugepages now, so that touching them cannot fail */
+		p = mmap(start, heap_size, PROT_NONE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			release_page = HUGE_PAGE;
+			return p;
+		}
+		fprintf(stderr, "mem_init: no hugetlb pages (see /proc/sys/vm/nr_hugepages); "
+				"using transparent hugepages\n");
+		page_kind = MEM_PAGES_THP;
+	}
+
+	p = mmap(start, heap_size, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	/* the advice carries over to the pages committed later */
+	if (page_kind == MEM_PAGES_THP && madvise(p, heap_size, MADV_HUGEPAGE) < 0)
+		fprintf(stderr, "mem_init: madvise(MADV_HUGEPAGE) failed; "
+				"using 4K pages\n");
+	release_page = mem_pagesize();
+	return p;
+}
+
+/*
+ * arena_map - reserve the region of arena a at start; returns -1 if it
+ *		cannot be mapped
+ */
+static int arena_map(mem_arena_t *a, char *start){
+	if ((a->heap = map_region(start)) == NULL)
+		return -1;
+	a->max_addr = a->heap + heap_size;
+	a->brk = a->heap;
+	a->peak = a->heap;
+	a->fresh = a->heap;
+	a->commit = a->heap;
+	a->node = -1;
+	return 0;
+}
+
+/*
+ * commit_to - make arena a read-write up to at least hi, in whole
+ *		COMMIT_CHUNKs.  Returns -1 if the system refuses.
+ */
+static int commit_to(mem_arena_t *a, char *hi){
+	char *end;
+
+	if (hi <= a->commit)
+		return 0;
+	end = a->heap + (hi - a->heap + COMMIT_CHUNK - 1) / COMMIT_CHUNK * COMMIT_CHUNK;
+	if (end > a->max_addr)
+		end = a->max_addr;
+	if (mprotect(a->commit, end - a->commit, PROT_READ | PROT_WRITE) < 0)
+		return -1;
+	if (prefault)
+		prefault_range(a->commit, end);
+	a->commit = end;
+	return 0;
+}
+
+/*
+ * prefault_range - fault in every page of [lo, hi), with the pages the
+ *		region was advised to use
+ */
+static void prefault_range(char *lo, char *hi){
+	size_t page = mem_pagesize();
+
+	for (; lo < hi; lo += page)
+		*(volatile char *)lo = 0;
+}
+
+/*
+ * mem_set_heap_size - give arenas mapped by later calls to mem_init and
+ *		mem_arena_create room for bytes bytes, rounded up to hugepages
+ */
+void mem_set_heap_size(size_t bytes){
+	heap_size = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+	if (heap_size == 0)
+		heap_size = HUGE_PAGE;
+}
+
+/*
+ * mem_max_heapsize - returns the most bytes an arena mapped from now on
+ *		can grow to
+ */
+size_t mem_max_heapsize(void){
+	return heap_size;
+}
+
+/*
+ * mem_set_pages - back the arenas mapped by later calls to mem_init and
+ *		mem_arena_create with pages of the given kind, and prefault them
+ *		if pre is set
+ */
+void mem_set_pages(int kind, int pre){
+	page_kind = kind;
+	prefault = pre;
+}
 
-/* 
+/*
+ * mem_pages - return the kind of pages arenas are backed with; may have
+ *		fallen back from what mem_set_pages asked for
+ */
+int mem_pages(void){
+	return page_kind;
+}
+
+/*
  * mem_init - initialize the memory system model
  */
 void mem_init(void){
-	int dev_zero = open("/dev/zero", O_RDWR);
-	heap = mmap((void *)0x800000000, /* suggested start*/
-			MAX_HEAP,				/* length */
-			PROT_WRITE,				/* permissions */
-			MAP_PRIVATE,			/* private or shared? */
-			dev_zero,				/* fd */
-			0);						/* offset (dunno) */
-	mem_max_addr = heap + MAX_HEAP;
-	mem_brk = heap;					/* heap is empty initially */
-}
-
-/* 
+	/* heap is empty initially */
+	if (arena_map(&arenas[0], HEAP_BASE) < 0) {
+		fprintf(stderr, "mem_init: cannot reserve %zu bytes of heap\n", heap_size);
+		exit(1);
+	}
+	num_arenas = 1;
+}
+
+/*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
-	munmap(heap, MAX_HEAP);
+	int i;
+
+	for (i = 0; i < num_arenas; i++)
+		munmap(arenas[i].heap, arenas[i].max_addr - arenas[i].heap);
+	num_arenas = 0;
+
+	pthread_mutex_lock(&map_lock);
+	unmap_all();
+	if (maps != NULL)
+		munmap(maps, max_maps * sizeof(*maps));
+	maps = NULL;
+	max_maps = 0;
+	peak_footprint = peak_resident = resident_mark = 0;
+	pthread_mutex_unlock(&map_lock);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap;
+ *		separate mappings are part of the heap and are dropped as well
  */
 void mem_reset_brk(){
-	mem_brk = heap;
+	mem_arena_reset_brk(0);
+	pthread_mutex_lock(&map_lock);
+	unmap_all();
+	peak_footprint = peak_resident = resident_mark = 0;
+	pthread_mutex_unlock(&map_lock);
 }
 
-/* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+/*
+ * mem_sbrk - simple model of the sbrk function. Extends the heap
+ *		by incr bytes and returns the start address of the new area.
+ *		A negative incr shrinks the heap and hands the pages given up
+ *		back to the system.  Not thread safe: callers must serialize
+ *		calls (mm.c does so under the arena lock).
  */
 void *mem_sbrk(int incr) {
-	char *old_brk = mem_brk;
+	mem_arena_t *a = &arenas[0];
+	char *old_brk = a->brk;
+
+	if (incr < 0)
+		return mem_arena_sbrk(0, incr);
 
-    // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+	if ((size_t)incr > (size_t)(a->max_addr - a->brk) ||
+		commit_to(a, a->brk + incr) < 0) {
 		errno = ENOMEM;
 		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
 
-	mem_brk += incr;
+	a->brk += incr;
+	if (a->brk > a->fresh)
+		a->fresh = a->brk;
+	if (a->brk > a->peak) {
+		a->peak = a->brk;
+		pthread_mutex_lock(&map_lock);
+		note_footprint();
+		pthread_mutex_unlock(&map_lock);
+	}
 	return (void *)old_brk;
 }
 
@@ -74,21 +352,195 @@ void *mem_sbrk(int incr) {
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo(){
-	return (void *)heap;
+	return mem_arena_lo(0);
 }
 
-/* 
+/*
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi(){
-	return (void *)(mem_brk - 1);
+	return mem_arena_hi(0);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
 size_t mem_heapsize() {
-	return (size_t)((void *)mem_brk - (void *)heap);
+	return mem_arena_heapsize(0);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest heap size in bytes, counting
+ *		separate mappings, since the last mem_reset_brk
+ */
+size_t mem_peak_heapsize() {
+	size_t peak;
+
+	pthread_mutex_lock(&map_lock);
+	peak = peak_footprint;
+	pthread_mutex_unlock(&map_lock);
+	return peak;
+}
+
+/*
+ * mem_resident() - returns how many bytes of the heap, up to its peak,
+ *		are currently backed by physical pages.  Separate mappings are
+ *		counted in full.
+ */
+size_t mem_resident() {
+	size_t mapped;
+
+	pthread_mutex_lock(&map_lock);
+	mapped = mapped_bytes;
+	pthread_mutex_unlock(&map_lock);
+	return mem_arena_resident(0) + mapped;
+}
+
+/*
+ * mem_peak_resident() - returns the most bytes of the heap seen backed
+ *		by physical pages since the last mem_reset_brk, counted as
+ *		mem_resident counts them.  They are sampled as the heap grows
+ *		(see note_footprint), and now.
+ */
+size_t mem_peak_resident() {
+	size_t r;
+
+	pthread_mutex_lock(&map_lock);
+	r = arena_resident(0) + mapped_bytes;
+	if (r > peak_resident)
+		peak_resident = r;
+	r = peak_resident;
+	pthread_mutex_unlock(&map_lock);
+	return r;
+}
+
+/*
+ * mem_map - map a separate block of at least len zeroed bytes, rounded
+ *		up to whole pages.  Returns NULL on failure.
+ */
+void *mem_map(size_t len) {
+	size_t page = mem_pagesize();
+	mem_map_t *grown;
+	char *p;
+
+	len = (len + page - 1) & ~(page - 1);
+	p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+
+	/* the table is mapped too: malloc may be the mm.c above us, which
+	   can be in mem_sbrk, and so want map_lock, at any time */
+	pthread_mutex_lock(&map_lock);
+	if (num_maps == max_maps) {
+		if (maps == NULL)
+			grown = mmap(NULL, page, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		else
+			grown = mremap(maps, max_maps * sizeof(*maps),
+					2 * max_maps * sizeof(*maps), MREMAP_MAYMOVE);
+		if (grown == MAP_FAILED) {
+			pthread_mutex_unlock(&map_lock);
+			munmap(p, len);
+			return NULL;
+		}
+		max_maps = maps == NULL ? (int)(page / sizeof(*maps)) : 2 * max_maps;
+		maps = grown;
+	}
+	maps[num_maps].addr = p;
+	maps[num_maps].len = len;
+	num_maps++;
+	mapped_bytes += len;
+	note_footprint();
+	pthread_mutex_unlock(&map_lock);
+	return p;
+}
+
+/*
+ * mem_remap - resize the mapping starting at p to at least len bytes,
+ *		moving it if necessary.  Returns its new address, or NULL (the
+ *		old mapping left alone) on failure.
+ */
+void *mem_remap(void *p, size_t len) {
+	size_t page = mem_pagesize();
+	char *q = NULL;
+	int i;
+
+	len = (len + page - 1) & ~(page - 1);
+	pthread_mutex_lock(&map_lock);
+	if ((i = find_map(p)) >= 0) {
+		q = mremap(p, maps[i].len, len, MREMAP_MAYMOVE);
+		if (q == MAP_FAILED) {
+			q = NULL;
+		} else {
+			mapped_bytes += len - maps[i].len;
+			maps[i].addr = q;
+			maps[i].len = len;
+			note_footprint();
+		}
+	}
+	pthread_mutex_unlock(&map_lock);
+	return q;
+}
+
+/*
+ * mem_unmap - drop the mapping starting at p
+ */
+void mem_unmap(void *p) {
+	int i;
+
+	pthread_mutex_lock(&map_lock);
+	if ((i = find_map(p)) >= 0) {
+		munmap(maps[i].addr, maps[i].len);
+		mapped_bytes -= maps[i].len;
+		maps[i] = maps[--num_maps];
+	}
+	pthread_mutex_unlock(&map_lock);
+}
+
+/*
+ * mem_map_size - returns the length of the mapping starting at p, or 0
+ */
+size_t mem_map_size(const void *p) {
+	size_t len = 0;
+	int i;
+
+	pthread_mutex_lock(&map_lock);
+	if ((i = find_map(p)) >= 0)
+		len = maps[i].len;
+	pthread_mutex_unlock(&map_lock);
+	return len;
+}
+
+/*
+ * mem_in_heap - return whether all of [lo, hi] lies inside the used part
+ *		of one arena or inside one separate mapping
+ */
+int mem_in_heap(const void *lo, const void *hi) {
+	const char *clo = lo, *chi = hi;
+	int i, in = 0;
+
+	if ((i = mem_arena_of(lo)) >= 0)
+		return chi >= arenas[i].heap && chi < arenas[i].brk && clo < arenas[i].brk;
+
+	pthread_mutex_lock(&map_lock);
+	for (i = 0; i < num_maps && !in; i++)
+		in = clo >= maps[i].addr && chi < maps[i].addr + maps[i].len;
+	pthread_mutex_unlock(&map_lock);
+	return in;
+}
+
+/*
+ * mem_release_range - give the pages lying entirely inside [lo, hi)
+ *		back to the system.  Their contents read as zero afterwards,
+ *		but they stay part of the heap and can be written again.
+ */
+void mem_release_range(void *lo, void *hi) {
+	size_t page = release_page;
+	char *start = (char *)(((size_t)lo + page - 1) & ~(page - 1));
+	char *end = (char *)((size_t)hi & ~(page - 1));
+
+	if (!prefault && start < end)
+		madvise(start, end - start, MADV_DONTNEED);
 }
 
 /*
@@ -97,3 +549,242 @@ size_t mem_heapsize() {
 size_t mem_pagesize(){
 	return (size_t)getpagesize();
 }
+
+/*
+ * mem_arena_create - create a new, empty arena and return its id, or -1
+ *		if MEM_MAX_ARENAS arenas exist or the region cannot be mapped.
+ *		Safe to call from several threads at once.
+ */
+int mem_arena_create(void) {
+	mem_arena_t *a;
+	int id = -1;
+
+	pthread_mutex_lock(&create_lock);
+	if (num_arenas > 0 && num_arenas < MEM_MAX_ARENAS) {
+		a = &arenas[num_arenas];
+		if (arena_map(a, HEAP_BASE + (size_t)num_arenas * heap_size) == 0) {
+			id = num_arenas;
+			/* publish only once the arena is filled in */
+			__atomic_store_n(&num_arenas, id + 1, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&create_lock);
+	return id;
+}
+
+/*
+ * mem_num_arenas - return the number of arenas, including the default
+ */
+int mem_num_arenas(void) {
+	return __atomic_load_n(&num_arenas, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * mem_arena_sbrk - mem_sbrk for arena id.  Callers must serialize calls
+ *		on the same arena; different arenas may grow concurrently.
+ */
+void *mem_arena_sbrk(int id, int incr) {
+	mem_arena_t *a = &arenas[id];
+	char *old_brk = a->brk;
+
+	if (id == 0 && incr >= 0)
+		return mem_sbrk(incr);
+
+	if (incr < 0) {
+		/* the process break is left alone: libc may own what lies above it */
+		if (a->brk + incr < a->heap) {
+			fprintf(stderr, "ERROR: mem_arena_sbrk failed. Arena %d shrunk below its start...\n", id);
+			return (void *)-1;
+		}
+		a->brk += incr;
+		mem_release_range(a->brk, old_brk);
+		return (void *)old_brk;
+	}
+
+	if ((size_t)incr > (size_t)(a->max_addr - a->brk) ||
+		commit_to(a, a->brk + incr) < 0) {
+		errno = ENOMEM;
+		fprintf(stderr, "ERROR: mem_arena_sbrk failed. Arena %d ran out of memory...\n", id);
+		return (void *)-1;
+	}
+
+	a->brk += incr;
+	if (a->brk > a->fresh)
+		a->fresh = a->brk;
+	if (a->brk > a->peak)
+		a->peak = a->brk;
+	return (void *)old_brk;
+}
+
+/*
+ * mem_arena_reset_brk - make arena id empty again
+ */
+void mem_arena_reset_brk(int id) {
+	arenas[id].brk = arenas[id].heap;
+	arenas[id].peak = arenas[id].heap;
+}
+
+/*
+ * mem_arena_lo - return address of the first byte of arena id
+ */
+void *mem_arena_lo(int id) {
+	return (void *)arenas[id].heap;
+}
+
+/*
+ * mem_arena_hi - return address of the last byte of arena id
+ */
+void *mem_arena_hi(int id) {
+	return (void *)(arenas[id].brk - 1);
+}
+
+/*
+ * mem_arena_heapsize - returns the size of arena id in bytes
+ */
+size_t mem_arena_heapsize(int id) {
+	return (size_t)(arenas[id].brk - arenas[id].heap);
+}
+
+/*
+ * mem_arena_peak_heapsize - returns the largest size of arena id in bytes
+ *		since it was last reset
+ */
+size_t mem_arena_peak_heapsize(int id) {
+	return (size_t)(arenas[id].peak - arenas[id].heap);
+}
+
+/*
+ * mem_arena_fresh - returns the address past which arena id has never
+ *		been handed out by sbrk since it was mapped, resets included;
+ *		memory from there on reads as zero when the break reaches it
+ */
+void *mem_arena_fresh(int id) {
+	return arenas[id].fresh;
+}
+
+/*
+ * mem_arena_resident - returns how many bytes of arena id, up to its
+ *		peak, are currently backed by physical pages
+ */
+size_t mem_arena_resident(int id) {
+	return arena_resident(id);
+}
+
+/*
+ * arena_resident - mem_arena_resident, RESIDENT_CHUNK pages at a time
+ *		into a vector on the stack: it runs under map_lock, where
+ *		malloc, which may be the allocator above us, must not be called
+ */
+static size_t arena_resident(int id) {
+	unsigned char vec[RESIDENT_CHUNK];
+	size_t page = mem_pagesize();
+	size_t len = mem_arena_peak_heapsize(id);
+	size_t npages = (len + page - 1) / page;
+	size_t i, n, done, resident = 0;
+
+	for (done = 0; done < npages; done += n) {
+		n = npages - done < RESIDENT_CHUNK ? npages - done : RESIDENT_CHUNK;
+		if (mincore(arenas[id].heap + done * page, n * page, vec) < 0)
+			break;
+		for (i = 0; i < n; i++)
+			resident += vec[i] & 1;
+	}
+	return resident * page;
+}
+
+/*
+ * mem_arena_of - return the id of the arena whose region contains p,
+ *		or -1 if p lies in none of them
+ */
+int mem_arena_of(const void *p) {
+	const char *cp = p;
+	int i, n = mem_num_arenas();
+
+	for (i = 0; i < n; i++)
+		if (cp >= arenas[i].heap && cp < arenas[i].max_addr)
+			return i;
+	return -1;
+}
+
+/*
+ * read_topology - fill in num_nodes and cpu_node from the cpulist of
+ *		every node in /sys; a machine without them is one node
+ */
+static void read_topology(void) {
+	char path[64], list[4096], *p, *end;
+	int node, fd, lo, hi;
+	ssize_t n;
+
+	for (node = 0; node < MAX_NODES; node++) {
+		snprintf(path, sizeof(path),
+				"/sys/devices/system/node/node%d/cpulist", node);
+		if ((fd = open(path, O_RDONLY)) < 0)
+			continue;	/* node ids may have holes */
+		n = read(fd, list, sizeof(list) - 1);
+		close(fd);
+		if (n <= 0)
+			continue;
+		list[n] = '\0';
+		if (node + 1 > num_nodes)
+			num_nodes = node + 1;
+
+		/* a list of ranges such as "0-7,16-23" */
+		for (p = list; *p >= '0' && *p <= '9'; p = end + (*end == ',')) {
+			lo = hi = strtol(p, &end, 10);
+			if (*end == '-')
+				hi = strtol(end + 1, &end, 10);
+			for (; lo <= hi && lo < MAX_CPUS; lo++)
+				cpu_node[lo] = node;
+		}
+	}
+}
+
+/*
+ * mem_num_nodes - return the number of NUMA nodes (1 on a machine
+ *		without NUMA)
+ */
+int mem_num_nodes(void) {
+	pthread_once(&topo_once, read_topology);
+	return num_nodes;
+}
+
+/*
+ * mem_cpu_node - return the NUMA node of CPU cpu
+ */
+int mem_cpu_node(int cpu) {
+	pthread_once(&topo_once, read_topology);
+	return (cpu >= 0 && cpu < MAX_CPUS) ? cpu_node[cpu] : 0;
+}
+
+/*
+ * mem_current_node - return the NUMA node of the CPU the calling thread
+ *		is running on; only a hint unless the thread is pinned
+ */
+int mem_current_node(void) {
+	if (mem_num_nodes() == 1)
+		return 0;
+	return mem_cpu_node(sched_getcpu());
+}
+
+/*
+ * mem_arena_bind - prefer node for the pages of arena id, moving those
+ *		it already has.  Returns -1 if the kernel refuses (as it does
+ *		without NUMA support), 0 otherwise; binding to the node the arena
+ *		is already bound to does nothing.  Callers must serialize calls
+ *		on the same arena.
+ */
+int mem_arena_bind(int id, int node) {
+	mem_arena_t *a = &arenas[id];
+	unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))] = { 0 };
+
+	if (node < 0 || node >= mem_num_nodes())
+		return -1;
+	if (a->node == node)
+		return 0;
+	mask[node / (8 * sizeof(*mask))] = 1UL << (node % (8 * sizeof(*mask)));
+	if (syscall(SYS_mbind, a->heap, (unsigned long)(a->max_addr - a->heap),
+				MPOL_PREFERRED, mask, MAX_NODES + 1, MPOL_MF_MOVE) < 0)
+		return -1;
+	a->node = node;
+	return 0;
+}
@@ -1,11 +1,50 @@
 #include <unistd.h>
 
-void mem_init(void);               
+/* Most arenas (including the default heap) that can exist at once */
+#define MEM_MAX_ARENAS 16
+
+/* Kinds of pages that can back the arenas */
+enum { MEM_PAGES_4K, MEM_PAGES_THP, MEM_PAGES_HUGETLB };
+
+void mem_set_heap_size(size_t bytes);
+size_t mem_max_heapsize(void);
+void mem_set_pages(int kind, int prefault);
+int mem_pages(void);
+void mem_init(void);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
-void mem_reset_brk(void); 
+void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_resident(void);
+size_t mem_peak_resident(void);
 size_t mem_pagesize(void);
+void mem_release_range(void *lo, void *hi);
+int mem_in_heap(const void *lo, const void *hi);
+
+/* Blocks mapped separately from the arenas; they count as heap */
+void *mem_map(size_t len);
+void *mem_remap(void *p, size_t len);
+void mem_unmap(void *p);
+size_t mem_map_size(const void *p);
+
+/* Independently growing arenas; arena 0 is the default heap above */
+int mem_arena_create(void);
+int mem_num_arenas(void);
+void *mem_arena_sbrk(int id, int incr);
+void mem_arena_reset_brk(int id);
+void *mem_arena_lo(int id);
+void *mem_arena_hi(int id);
+size_t mem_arena_heapsize(int id);
+size_t mem_arena_peak_heapsize(int id);
+void *mem_arena_fresh(int id);
+size_t mem_arena_resident(int id);
+int mem_arena_of(const void *p);
 
+/* NUMA placement of the arenas */
+int mem_num_nodes(void);
+int mem_cpu_node(int cpu);
+int mem_current_node(void);
+int mem_arena_bind(int id, int node);
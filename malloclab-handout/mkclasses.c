@@ -0,0 +1,120 @@
+/*
+ * mkclasses.c - Generate mm_classes.h, the size-class tables of mm.c
+ *
+ * Usage: mkclasses [slot sizes...] > mm_classes.h
+ *
+ * The slot sizes are those of the slab classes, in increasing order and
+ * multiples of the alignment; the default is every multiple of 8 up to
+ * 64.  The tables let mm.c map a request to its classes with a lookup
+ * instead of arithmetic and range tests:
+ *
+ *   mm_small_class  for a request of 1 .. MM_SMALL_MAX bytes, indexed by
+ *                   (size + 3) >> 2, its tcache bin (block size / 8) and
+ *                   its slab class, or MM_SLAB_NONE.  Block sizes change
+ *                   at 8k+4 bytes because of the 4-byte header, so the
+ *                   index steps by 4 bytes rather than 8.
+ *   mm_slot_size    the slot size of each slab class
+ *   mm_bin_by_clz   the segregated list of a free block smaller than
+ *                   TREE_MIN, indexed by __builtin_clz of its size
+ *
+ * The layout constants below must match mm.c, which checks them against
+ * the MM_CLASSES_* values written into the header.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define ALIGNMENT    8
+#define WSIZE        4
+#define MINBLOCK     16
+#define TC_MAX_SIZE  256
+#define NUM_BINS     6
+#define MAX_CLASSES  64
+
+#define ALIGN(p)      (((p) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
+#define ADJUST(size)  (ALIGN((size) + WSIZE) > MINBLOCK ? \
+                       ALIGN((size) + WSIZE) : MINBLOCK)
+
+/* Separator before entry i of a table printed n entries to a line */
+#define SEP(i, n)     ((i) == 0 ? "\n    " : (i) % (n) ? ", " : ",\n    ")
+
+int main(int argc, char **argv)
+{
+    int slot[MAX_CLASSES];
+    int nslots = 0, small_max = TC_MAX_SIZE - WSIZE;
+    int i, cls, size, bin, n;
+
+    for (i = 1; i < argc; i++) {
+        if (nslots == MAX_CLASSES) {
+            fprintf(stderr, "mkclasses: at most %d slot sizes\n", MAX_CLASSES);
+            return 1;
+        }
+        slot[nslots] = atoi(argv[i]);
+        if (slot[nslots] < ALIGNMENT || slot[nslots] % ALIGNMENT != 0 ||
+            slot[nslots] > small_max ||
+            (nslots > 0 && slot[nslots] <= slot[nslots-1])) {
+            fprintf(stderr, "mkclasses: bad slot size %s: slot sizes must "
+                    "increase and be multiples of %d up to %d\n",
+                    argv[i], ALIGNMENT, small_max);
+            return 1;
+        }
+        nslots++;
+    }
+    if (nslots == 0)
+        for (size = ALIGNMENT; size <= 64; size += ALIGNMENT)
+            slot[nslots++] = size;
+
+    printf("/*\n"
+           " * mm_classes.h - Size-class tables of mm.c, generated by "
+           "mkclasses.\n"
+           " * Do not edit; change the slot sizes given to mkclasses in "
+           "the Makefile.\n"
+           " */\n\n");
+    printf("/* Layout mkclasses assumed */\n");
+    printf("#define MM_CLASSES_ALIGNMENT %d\n", ALIGNMENT);
+    printf("#define MM_CLASSES_WSIZE     %d\n", WSIZE);
+    printf("#define MM_CLASSES_MINBLOCK  %d\n", MINBLOCK);
+    printf("#define MM_CLASSES_TC_MAX    %d\n", TC_MAX_SIZE);
+    printf("#define MM_CLASSES_NUM_BINS  %d\n\n", NUM_BINS);
+
+    printf("#define MM_SMALL_MAX    %d  /* largest request in mm_small_class */\n",
+           small_max);
+    printf("#define MM_SLAB_CLASSES %d\n", nslots);
+    printf("#define MM_SLAB_MAX     %d  /* largest request served from a slab */\n",
+           slot[nslots-1]);
+    printf("#define MM_SLAB_NONE    %d  /* slab class of larger requests */\n\n",
+           nslots);
+
+    printf("typedef struct {\n"
+           "    uint8_t bin;                /* tcache bin: block size / 8 */\n"
+           "    uint8_t slab;               /* slab class, or MM_SLAB_NONE */\n"
+           "} mm_class_t;\n\n");
+
+    printf("/* Slot size of each slab class */\n");
+    printf("static const uint16_t mm_slot_size[MM_SLAB_CLASSES] = {");
+    for (cls = 0; cls < nslots; cls++)
+        printf("%s%d", SEP(cls, 12), slot[cls]);
+    printf("\n};\n\n");
+
+    printf("/* Classes of a request of size bytes, indexed by (size + 3) >> 2 */\n");
+    printf("static const mm_class_t mm_small_class[MM_SMALL_MAX / 4 + 1] = {");
+    for (n = 0; n <= small_max / 4; n++) {
+        size = n ? 4 * n : 1;   /* every request with this index */
+        for (cls = 0; cls < nslots && slot[cls] < size; cls++)
+            ;
+        printf("%s{%d, %d}", SEP(n, 8),
+               ADJUST(size) / ALIGNMENT, cls);
+    }
+    printf("\n};\n\n");
+
+    printf("/* Segregated list of a free block, indexed by __builtin_clz of its size:\n"
+           "   list k holds blocks of [2^(k+4), 2^(k+5)) bytes; the last list holds\n"
+           "   everything larger */\n");
+    printf("static const uint8_t mm_bin_by_clz[32] = {");
+    for (n = 0; n < 32; n++) {
+        bin = 31 - n - 4;
+        bin = bin < 0 ? 0 : bin > NUM_BINS - 1 ? NUM_BINS - 1 : bin;
+        printf("%s%d", SEP(n, 16), bin);
+    }
+    printf("\n};\n");
+    return 0;
+}
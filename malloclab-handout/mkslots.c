@@ -0,0 +1,279 @@
+/*
+ * mkslots.c - Pick the slab slot sizes of mm.c from a set of traces
+ *
+ * Usage: mkslots [-n <classes>] [-m <bytes>] [-o <file>] <trace>...
+ *
+ * Builds a histogram of the request sizes of the traces (text or
+ * binary), each trace weighted equally, and picks the slot sizes of at
+ * most n slab classes that minimize the bytes wasted per request:
+ *
+ *   a request of size s in a slab class of slot size c wastes c - s;
+ *   a request larger than every slot is an ordinary block, and wastes
+ *   its header and alignment, ADJUST(s) - s.
+ *
+ * Slot sizes are multiples of 8 up to -m bytes.  The choice is exact
+ * (dynamic programming over the candidate sizes).  The result is
+ * written as a SLOT_SIZES line for the Makefile, which includes it and
+ * hands it to mkclasses:
+ *
+ *     unix> ./mkslots -n 5 traces/perl.rep traces/cccp.rep
+ *     unix> make
+ *     unix> ./mdriver -P
+ *
+ * mdriver -P then compares the utilization these classes predict with
+ * the utilization the allocator achieves.
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define ALIGNMENT     8
+#define WSIZE         4
+#define MINBLOCK      16
+#define SMALL_MAX     252       /* largest request mkclasses maps */
+#define MAX_CLASSES   64        /* most classes mkclasses takes */
+#define CANDIDATES    (SMALL_MAX / ALIGNMENT)
+
+#define ALIGN(p)      (((p) + (ALIGNMENT-1)) & ~(ALIGNMENT-1))
+#define ADJUST(size)  (ALIGN((size) + WSIZE) > MINBLOCK ? \
+                       ALIGN((size) + WSIZE) : MINBLOCK)
+
+static double hist[SMALL_MAX + 1];      /* weight of each request size */
+
+static void slots_error(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2), noreturn));
+static void slots_error(const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "mkslots: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/* count - Add a request of size bytes, n times */
+static void count(double *h, unsigned size, double n)
+{
+    if (size >= 1 && size <= SMALL_MAX)
+        h[size] += n;
+}
+
+/*
+ * read_hist - Add the request sizes of one trace to hist[], scaled so
+ *     that every trace weighs the same
+ */
+static void read_hist(const char *path)
+{
+    double h[SMALL_MAX + 1] = { 0 }, total = 0;
+    char magic[sizeof(BIN_MAGIC)], type[2];
+    unsigned index, size, n, last = 0;
+    int hdr[4], i;
+    bintrace_t bin;
+    traceop_t op;
+    FILE *fp;
+
+    if ((fp = fopen(path, "r")) == NULL)
+        slots_error("%s: %s", path, strerror(errno));
+    if (fread(magic, 1, sizeof(magic), fp) == sizeof(magic) &&
+        memcmp(magic, BIN_MAGIC, sizeof(magic)) == 0) {
+        rewind(fp);
+        if (fread(&bin, sizeof(bin), 1, fp) != 1 ||
+            bin.op_size != sizeof(traceop_t))
+            slots_error("%s: bad binary trace", path);
+        while (fread(&op, sizeof(op), 1, fp) == 1) {
+            if (op.type == ALLOC || op.type == REALLOC)
+                count(h, op.size, 1);
+            else if (op.type == ALLOC_BATCH)
+                count(h, op.size, op.count);
+        }
+    } else {
+        rewind(fp);
+        for (i = 0; i < 4; i++)
+            if (fscanf(fp, "%d", &hdr[i]) != 1)
+                slots_error("%s: bad trace header", path);
+        /* Like mdriver, read only the ops the header counts */
+        for (i = 0; i < hdr[2] && fscanf(fp, "%1s", type) == 1; i++) {
+            switch (type[0]) {
+            case 'a': case 'r':
+                /* A missing size is the last one, as in mdriver */
+                if (fscanf(fp, "%u", &index) != 1)
+                    goto bad;
+                if (fscanf(fp, "%u", &size) != 1)
+                    size = last;
+                count(h, last = size, 1);
+                break;
+            case 'A':
+                if (fscanf(fp, "%u %u %u", &index, &n, &size) != 3)
+                    goto bad;
+                count(h, size, n);
+                break;
+            case 'f':
+                if (fscanf(fp, "%u", &index) != 1)
+                    goto bad;
+                break;
+            case 'F':
+                if (fscanf(fp, "%u %u", &index, &n) != 2)
+                    goto bad;
+                break;
+            default:
+                goto bad;
+            }
+        }
+    }
+    if (0) {
+    bad:
+        fprintf(stderr, "mkslots: %s: bad request %d, ignoring the rest\n",
+                path, i + 1);
+    }
+    fclose(fp);
+
+    for (i = 1; i <= SMALL_MAX; i++)
+        total += h[i];
+    for (i = 1; total > 0 && i <= SMALL_MAX; i++)
+        hist[i] += h[i] / total;
+}
+
+/*
+ * waste - Bytes wasted by the requests in (lo, hi] when they are served
+ *     from slots of hi bytes, or as ordinary blocks when slot is 0
+ */
+static double waste(int lo, int hi, int slot)
+{
+    double w = 0;
+    int s;
+
+    for (s = lo + 1; s <= hi && s <= SMALL_MAX; s++)
+        w += hist[s] * ((slot ? slot : ADJUST(s)) - s);
+    return w;
+}
+
+/* Waste of a set of slot sizes over the requests of up to max bytes */
+static double total_waste(const int *slot, int n, int max)
+{
+    double w = 0;
+    int i, lo = 0;
+
+    for (i = 0; i < n; i++) {
+        w += waste(lo, slot[i], slot[i]);
+        lo = slot[i];
+    }
+    return w + waste(lo, max, 0);
+}
+
+int main(int argc, char **argv)
+{
+    static double best[MAX_CLASSES + 1][CANDIDATES + 1];
+    static int from[MAX_CLASSES + 1][CANDIDATES + 1];
+    int slot[MAX_CLASSES], dflt[MAX_CLASSES];
+    const char *outfile = "slots.mk";
+    int nclasses = 8, max = 64, ndflt = 0;
+    int c, i, j, k, jmax, kbest, jbest;
+    double w, wbest, total = 0;
+    FILE *out;
+
+    while ((c = getopt(argc, argv, "n:m:o:h")) != EOF) {
+        switch (c) {
+        case 'n':
+            nclasses = atoi(optarg);
+            break;
+        case 'm':
+            max = atoi(optarg);
+            break;
+        case 'o':
+            outfile = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: mkslots [-n <classes>] [-m <bytes>] "
+                    "[-o <file>] <trace>...\n");
+            fprintf(stderr, "\t-n <n>     At most <n> slab classes (default 8).\n");
+            fprintf(stderr, "\t-m <bytes> Largest slot size (default 64).\n");
+            fprintf(stderr, "\t-o <file>  Where the SLOT_SIZES line goes "
+                    "(default slots.mk; - for stdout).\n");
+            exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (nclasses < 1 || nclasses > MAX_CLASSES)
+        slots_error("-n takes 1 to %d classes", MAX_CLASSES);
+    if (max < ALIGNMENT || max > SMALL_MAX)
+        slots_error("-m takes %d to %d bytes", ALIGNMENT, SMALL_MAX);
+    if (optind == argc)
+        slots_error("no traces");
+    for (i = optind; i < argc; i++)
+        read_hist(argv[i]);
+    for (i = 1; i <= max; i++)
+        total += hist[i];
+    if (total == 0)
+        slots_error("no requests of at most %d bytes in the traces", max);
+
+    /* best[k][j]: least waste of the requests of up to 8j bytes with k
+       classes, the last of them 8j bytes */
+    jmax = max / ALIGNMENT;
+    for (k = 0; k <= nclasses; k++)
+        for (j = 0; j <= jmax; j++)
+            best[k][j] = -1;
+    best[0][0] = 0;
+    for (k = 1; k <= nclasses; k++) {
+        for (j = k; j <= jmax; j++) {
+            for (i = k - 1; i < j; i++) {
+                if (best[k-1][i] < 0)
+                    continue;
+                w = best[k-1][i] + waste(ALIGNMENT * i, ALIGNMENT * j,
+                                         ALIGNMENT * j);
+                if (best[k][j] < 0 || w < best[k][j]) {
+                    best[k][j] = w;
+                    from[k][j] = i;
+                }
+            }
+        }
+    }
+
+    /* The requests above the last class are ordinary blocks */
+    kbest = jbest = 0;
+    wbest = -1;
+    for (k = 1; k <= nclasses; k++) {
+        for (j = k; j <= jmax; j++) {
+            if (best[k][j] < 0)
+                continue;
+            w = best[k][j] + waste(ALIGNMENT * j, max, 0);
+            if (wbest < 0 || w < wbest - 1e-12) {
+                wbest = w;
+                kbest = k;
+                jbest = j;
+            }
+        }
+    }
+    for (k = kbest, j = jbest; k > 0; j = from[k][j], k--)
+        slot[k-1] = ALIGNMENT * j;
+
+    for (i = ALIGNMENT; i <= 64; i += ALIGNMENT)
+        dflt[ndflt++] = i;
+    fprintf(stderr, "mkslots: %d classes:", kbest);
+    for (k = 0; k < kbest; k++)
+        fprintf(stderr, " %d", slot[k]);
+    fprintf(stderr, "\nmkslots: bytes wasted per request of at most %d bytes: "
+            "%.2f, against %.2f with the default 8, 16, .. 64\n", max, wbest / total,
+            total_waste(dflt, ndflt, max) / total);
+
+    if (strcmp(outfile, "-") == 0)
+        out = stdout;
+    else if ((out = fopen(outfile, "w")) == NULL)
+        slots_error("%s: %s", outfile, strerror(errno));
+    fprintf(out, "# Slot sizes chosen by mkslots -n %d -m %d from", nclasses, max);
+    for (i = optind; i < argc; i++)
+        fprintf(out, " %s", argv[i]);
+    fprintf(out, "\nSLOT_SIZES =");
+    for (k = 0; k < kbest; k++)
+        fprintf(out, " %d", slot[k]);
+    fprintf(out, "\n");
+    if (out != stdout && fclose(out) != 0)
+        slots_error("%s: %s", outfile, strerror(errno));
+    return 0;
+}
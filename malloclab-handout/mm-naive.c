@@ -138,6 +138,129 @@ void *calloc (size_t nmemb, size_t size)
   return newptr;
 }
 
+/*
+ * mm_malloc_batch - One malloc per block.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+  size_t i, got = 0;
+
+  while (got < n && (out[got] = malloc(size)) != NULL)
+    got++;
+  for (i = got; i < n; i++)
+    out[i] = NULL;
+
+  return got;
+}
+
+/*
+ * mm_free_batch - One free per block.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    free(ptrs[i]);
+}
+
+/*
+ * Regions - Every object is a block of its own, linked to the previous
+ *      one through its first word; reset frees them one at a time.
+ */
+struct mm_region {
+  void *last;
+};
+
+mm_region_t *mm_region_create(void)
+{
+  mm_region_t *r = malloc(sizeof(*r));
+
+  if (r != NULL)
+    r->last = NULL;
+  return r;
+}
+
+void *mm_region_alloc(mm_region_t *r, size_t size)
+{
+  void **p;
+
+  if (size == 0 || (p = malloc(ALIGN(size) + SIZE_T_SIZE)) == NULL)
+    return NULL;
+  *p = r->last;
+  r->last = p;
+  return (char *)p + SIZE_T_SIZE;
+}
+
+void mm_region_reset(mm_region_t *r)
+{
+  void *p, *prev;
+
+  for (p = r->last; p != NULL; p = prev) {
+    prev = *(void **)p;
+    free(p);
+  }
+  r->last = NULL;
+}
+
+void mm_region_destroy(mm_region_t *r)
+{
+  if (r != NULL) {
+    mm_region_reset(r);
+    free(r);
+  }
+}
+
+/*
+ * mm_heap_stats - Nothing is ever freed, so every block in the heap
+ *      counts as allocated.
+ */
+void mm_heap_stats(mm_heap_stats_t *st)
+{
+  char *p = mem_heap_lo();
+  char *hi = (char *)mem_heap_hi() + 1;
+  size_t size;
+  int k;
+
+  memset(st, 0, sizeof(*st));
+  st->heap_bytes = mem_heapsize();
+  while (p < hi) {
+    size = ALIGN(*(size_t *)p + SIZE_T_SIZE);
+    for (k = 0; k < MM_STAT_CLASSES - 1 && size >= (size_t)32 << k; k++)
+      ;
+    st->blocks[MM_BLK_ALLOC]++;
+    st->bytes[MM_BLK_ALLOC] += size;
+    st->class_alloc[k] += size;
+    p += size;
+  }
+}
+
+/*
+ * mm_class_size - Every block is the request plus its size word.
+ */
+size_t mm_class_size(size_t size)
+{
+  return ALIGN(size + SIZE_T_SIZE);
+}
+
+/*
+ * mm_stats_get - No counters are kept.
+ */
+int mm_stats_get(unsigned long count[MM_CTRS])
+{
+  memset(count, 0, MM_CTRS * sizeof(*count));
+  return -1;
+}
+
+/*
+ * mm_stats_dump - No counters are kept.
+ */
+int mm_stats_dump(FILE *fp)
+{
+  (void)fp;
+  return -1;
+}
+
 /*
  * mm_checkheap - There are no bugs in my code, so I don't need to check,
  *      so nah!
@@ -146,3 +269,20 @@ void mm_checkheap(int verbose){
 	/*Get gcc to be quiet. */
 	verbose = verbose;
 }
+
+/*
+ * mm_check_mode - There is nothing to check either way.
+ */
+void mm_check_mode(int mode, int k)
+{
+  (void)mode;
+  (void)k;
+}
+
+/*
+ * mm_copy_mode - Only memcpy and memset are used.
+ */
+int mm_copy_mode(int kind)
+{
+  return kind == MM_COPY_LIBC ? 0 : -1;
+}
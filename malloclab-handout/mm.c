@@ -1,27 +1,215 @@
 /*
- * mm.c
+ * mm.c - Segregated explicit free-list allocator.
  *
- * NOTE TO STUDENTS: Replace this header comment with your own header
- * comment that gives a high level description of your solution.
+ * Blocks use a compact format.  Every block starts with a 4-byte header
+ * holding the block size, the allocated bit and a prev-alloc bit that
+ * tells whether the block before it is allocated.  Only free blocks
+ * carry a footer, since a footer is only needed to find the start of a
+ * free neighbour when coalescing; the prev-alloc bit says when to look.
+ *
+ *     allocated:  [ hdr | payload ............................ ]
+ *     free:       [ hdr | next | prev | (unused) ....... | ftr ]
+ *
+ * Payloads are 8-byte aligned, so headers sit 4 bytes below a multiple
+ * of 8 and the smallest block is 16 bytes.  Free-list links are 32-bit
+ * offsets from the start of the block's arena, in units of ALIGNMENT,
+ * rather than pointers, which is enough for arenas of up to MAX_ARENA
+ * (32 GB); 0 is the null link.
+ *
+ * Free blocks smaller than TREE_MIN are kept on doubly linked explicit
+ * lists, one per size class: bin k holds free blocks whose size lies in
+ * [2^(k+4), 2^(k+5)).  Allocation searches the bin matching the request,
+ * looking at up to FIT_CANDIDATES fitting blocks and taking the tightest
+ * one, and then falls through to the head of the next non-empty bin.
+ * Larger free blocks, whose sizes vary too much for a few lists, are
+ * indexed by a red-black tree ordered by size and then address, so the
+ * best fit is found in O(log n) however many of them there are:
+ *
+ *     tree node:  [ hdr | left | right | parent | red | ... | ftr ]
+ *
+ * Oversized blocks are split and the remainder goes back on the
+ * appropriate list or into the tree.  Freed blocks are immediately
+ * coalesced with free neighbours.
+ *
+ * The heap starts with an allocated prologue block and ends with an
+ * allocated zero-size epilogue header, which removes the edge cases
+ * from coalescing.  When no free block fits, the heap is grown by just
+ * enough to satisfy the request, reusing a free block that sits right
+ * before the epilogue if there is one.
+ *
+ * Slabs: requests of up to SLAB_MAX bytes are served from slabs once a
+ * slab class has seen SLAB_MIN_USES allocations in an arena (until then
+ * they are ordinary blocks, so that tiny heaps do not pay for a whole
+ * slab per class).  Free fragments too small to hold a slab are still
+ * used for ordinary blocks before a new slab is made.  A slab is one
+ * page-aligned SLAB_SIZE page carved from the arena as an ordinary
+ * allocated block.  It starts with a slab_t header and is divided into
+ * equal slots of one class, with a bitmap of free slots; slots have no
+ * header at all.  Allocating a slot is a find-first-set over the bitmap
+ * and freeing one sets its bit.  Each arena keeps a bitmap of the pages
+ * that hold slabs, which is how free tells a slot from an ordinary
+ * block, and a list of the slabs of each class that have free slots.  A
+ * slab whose slots are all free is given back to the arena unless it is
+ * the last one of its class.
+ *
+ * Memory goes back to the system in two ways.  A free block of at least
+ * TRIM_THRESHOLD bytes at the end of the heap is cut down to TRIM_KEEP
+ * bytes by shrinking the break, and the pages lying wholly inside any
+ * other free block of at least RELEASE_THRESHOLD bytes are released
+ * with mem_release_range.  Released pages stay part of the block and
+ * read as zero when the block is reused.
+ *
+ * realloc works in place whenever it can: a block shrinks by splitting
+ * off its tail, and grows by absorbing a free block that follows it
+ * and/or by moving the break when it is the last block of its arena.
+ * Only when neither is possible is the payload copied.
+ *
+ * Huge blocks: requests of at least mmap_threshold bytes (MMAP_THRESHOLD,
+ * or MM_MMAP_THRESHOLD from the environment) bypass the arenas and get
+ * a mapping of their own from mem_map, so they neither fragment nor use
+ * up an arena.  The mapping starts with two pointers linking it into
+ * the list of mapped blocks and the length of the mapping, followed by
+ * a header with the MAPPED bit set.  Freeing such a block unmaps it, and
+ * realloc resizes it with mem_remap instead of copying.
+ *
+ * Arenas: the heap described above exists once per arena.  Each arena
+ * lives in its own memlib region (arena 0 is the default mem_sbrk heap),
+ * has its own free lists and is protected by its own lock.  Threads are
+ * spread over up to 2 * (online CPUs) arenas round-robin when they first
+ * allocate, so threads on different cores rarely contend for a lock or
+ * for a break pointer.  A block always goes back to the arena it was
+ * carved from, which is found from its address.
+ *
+ * NUMA: on a machine with several NUMA nodes, mm_init deals the arenas
+ * out to the nodes in turn, starting with arena 0 on the node mm_init
+ * runs on, and each arena's pages are bound to its node (mem_arena_bind)
+ * before it is first used.  A thread's first malloc then picks, round-
+ * robin, among the arenas of the node it is running on, so its free-list
+ * walks stay on local memory.  The choice is not revisited if the thread
+ * later migrates, since its cached blocks belong to the old arena; pin
+ * threads for the placement to hold.
+ *
+ * Thread caches: in front of the arenas every thread keeps a small cache
+ * of recently freed blocks (a tcache), one LIFO stack per exact block
+ * size up to TC_MAX_SIZE.  Cached blocks stay marked allocated, so the
+ * arenas never see them; small mallocs and frees are served from the
+ * cache without taking any lock; slots have stacks of their own, one per
+ * slab class.  An empty stack is refilled with up to
+ * TC_FILL blocks carved from one free block under a single lock
+ * acquisition, and a full stack returns half of its blocks in one go.
+ * A thread's cache is flushed back to the arenas when it exits.
+ *
+ * Remote frees: a block freed by a thread that allocates from another
+ * arena is not cached or freed under that arena's lock.  It is pushed on
+ * the arena's remote queue, a lock-free stack linked through TC_NEXT,
+ * with a single compare-and-swap.  A thread of the owning arena takes
+ * the whole queue with one atomic exchange the next time its malloc
+ * holds the lock anyway, and frees the blocks there, so the producer
+ * and consumer threads of a queue never share a lock.
+ *
+ * Size classes: the slot sizes of the slab classes, and the mapping of
+ * small requests to their tcache stack and slab class, are tables in
+ * mm_classes.h that mkclasses generates at build time.  A small malloc
+ * is a lookup in mm_small_class and a pop from one of two stacks, with
+ * no tests of the size; requests no slab class holds map to a slot
+ * stack that is always empty.  The segregated list of a free block is
+ * looked up by the leading zero count of its size.
+ *
+ * Batches: mm_malloc_batch carves all n blocks back to back from one
+ * free block where it can, and mm_free_batch sorts its pointers so that
+ * runs of neighbouring blocks are merged into one and coalesced once.
+ * Both take each arena lock once rather than once per block.
+ *
+ * Regions: a region hands out memory by bumping a pointer through a
+ * chain of chunks, which are ordinary blocks from malloc.  Objects are
+ * never freed one by one.  mm_region_reset rewinds the region to its
+ * first chunk in O(1), keeping the chunks for reuse, and
+ * mm_region_destroy gives every chunk back to the free lists.
+ *
+ * mm_heap_stats walks the same structures as mm_checkheap and sums up
+ * the blocks by state and size class; a slab counts as its slots.
+ *
+ * Copies and zeroing: realloc and calloc copy and zero large blocks
+ * (NT_THRESHOLD bytes or more) with AVX2 or AVX-512 streaming stores,
+ * chosen from the CPU by the first mm_init, so that moving a big block
+ * does not flush the cache; smaller ones use memcpy and memset.  Each
+ * arena remembers the address past which it has never handed out a
+ * block since memlib mapped it (a->fresh, which place() moves up).  A
+ * block placed wholly above that address sits on pages that read as
+ * zero except for the links and footer the free block kept there, so
+ * calloc clears only those; mapped blocks are zero already.
+ * mm_copy_mode picks the routines by hand; MM_COPY_LIBC also turns the
+ * zeroing shortcut off.
+ *
+ * Guarded blocks: with MM_GUARD_RATE=N in the environment, about one
+ * malloc in N (at random, per thread) of at most a page is served from
+ * a pool of guard slots instead, GWP-ASan style: MM_GUARD_SLOTS pages
+ * (GUARD_SLOTS unless set), each between two inaccessible guard pages,
+ * with the block ending at the end of its page.  Reading or writing
+ * past the end of the block hits the next guard page, and freeing the
+ * block makes its page inaccessible too, so that a later use faults.
+ * A SIGSEGV handler then reports which block was overrun or used after
+ * free before the process dies as it would have; a double or invalid
+ * free is reported and aborts.  Freed slots are reused oldest first, to
+ * keep them protected for as long as possible, and a malloc that finds
+ * no free slot is served normally.  Every other malloc pays only for a
+ * per-thread countdown; each sampled one pays for two mprotect calls,
+ * which is why N should be in the tens of thousands (mdriver with
+ * MM_GUARD_RATE set shows the cost).  The pool is one mem_map mapping,
+ * so it counts as heap.  Built without DRIVER (make mm-preload.so),
+ * this file is the malloc of whatever program it is preloaded into, and
+ * the first malloc sets up the heap.
+ *
+ * Counters: built with MM_STATS defined, the hot paths count events
+ * (free-list search steps, splits, coalesces, sbrk calls, slab and
+ * tcache hits and misses, reallocs in place and copied, remote frees,
+ * guarded mallocs, and arena mallocs whose arena is on the caller's NUMA
+ * node or not) in plain per-thread counters.  Threads link their
+ * counters into a list when they first allocate, and mm_stats_get sums
+ * the list only when asked; mm_init starts every count over.  Without
+ * MM_STATS the COUNT macros expand to nothing.
  */
 #include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_AVX 1
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 
 /* If you want debugging output, use the following macro.  When you hand
  * in, remove the #define DEBUG line. */
-#define DEBUG
+/* #define DEBUG */
 #ifdef DEBUG
 # define dbg_printf(...) printf(__VA_ARGS__)
 #else
 # define dbg_printf(...)
 #endif
 
+#include "contracts.h"
+
+/* If you want the hot-path counters of mm_stats_dump, define MM_STATS
+   here or build with make MMFLAGS=-DMM_STATS. */
+/* #define MM_STATS */
+#ifdef MM_STATS
+# define COUNT(c)       (ctrs.count[c]++)
+# define COUNT_N(c, n)  (ctrs.count[c] += (n))
+# define COUNT_NODE(a)  COUNT(arena_node[(a) - arenas] == mem_current_node() ? \
+                              MM_CTR_NODE_LOCAL : MM_CTR_NODE_REMOTE)
+#else
+# define COUNT(c)
+# define COUNT_N(c, n)
+# define COUNT_NODE(a)
+#endif
 
 /* do not change the following! */
 #ifdef DRIVER
@@ -38,62 +226,2864 @@
 /* rounds up to the nearest multiple of ALIGNMENT */
 #define ALIGN(p) (((size_t)(p) + (ALIGNMENT-1)) & ~0x7)
 
+/* Basic constants */
+#define WSIZE       4       /* header/footer and link size (bytes) */
+#define DSIZE       8       /* double word size (bytes) */
+#define MINBLOCK    16      /* hdr + next + prev + ftr */
+#define CHUNKSIZE   (1<<9)  /* minimum heap extension (bytes) */
+#define MAX_BLOCK   ((size_t)1<<30) /* largest block a header can describe */
+#define MAX_ARENA   ((size_t)ALIGNMENT<<32) /* largest arena links can span */
+
+#ifndef MMAP_THRESHOLD
+#define MMAP_THRESHOLD  (1<<18) /* default size of separately mapped blocks */
+#endif
+#define MAP_OVERHEAD    32  /* next + prev + length + pad + hdr of a mapping */
+#ifndef NT_THRESHOLD
+#define NT_THRESHOLD    (1<<20) /* smallest copy or fill with streaming stores */
+#endif
+#define FREE_LINKS      (4*WSIZE) /* links and color at the start of a free block */
+
+#define TRIM_THRESHOLD  (1<<18) /* trailing free space that gets trimmed */
+#define TRIM_KEEP       (1<<16) /* trailing free space left after a trim */
+#define RELEASE_THRESHOLD (1<<20) /* free blocks whose pages get released */
+
+#define TREE_MIN      1024  /* smallest free block kept in the tree */
+#define NUM_BINS         6  /* segregated free lists below TREE_MIN */
+#define FIT_CANDIDATES   8  /* fitting blocks examined per bin */
+
+/* Slab parameters */
+#define SLAB_SIZE     4096  /* bytes per slab, also its alignment */
+#define SLAB_MAX      MM_SLAB_MAX      /* largest request served from a slab */
+#define SLAB_CLASSES  MM_SLAB_CLASSES  /* slot sizes, from mm_classes.h */
+#define SLAB_WORDS    (SLAB_SIZE / ALIGNMENT / 64)  /* bitmap words */
+#define SLAB_MIN_USES   64  /* allocations of a class before slabs are used */
+#define SLAB_PAGES  (1<<15) /* arena pages covered by the slab page map */
+
+#define BATCH_MAX   (1<<20) /* most bytes a batch carves from one block */
+
+#define CHECK_K         64  /* default blocks per incremental check */
+#define CHECK_STEPS     16  /* most links a sampled check follows */
+
+/* Keep the incremental check's cursor on a block boundary when the
+   block bp has just swallowed the block it pointed to */
+#define CHECK_CLAMP(a, bp) \
+    do { if ((a)->check_at > (char *)(bp) && \
+             (a)->check_at < (char *)NEXT_BLKP(bp)) \
+             (a)->check_at = (char *)(bp); } while (0)
+
+/* Guard slots */
+#define GUARD_SLOTS      64  /* default number of slots in the pool */
+#define GUARD_MAX_SLOTS 1024 /* most slots MM_GUARD_SLOTS may ask for */
+
+#define REGION_CHUNK     (1<<12)  /* size of the first chunk of a region */
+#define REGION_MAX_CHUNK (1<<16)  /* chunks double in size up to this */
+
+/* Thread cache parameters */
+#define TC_MAX_SIZE    256  /* largest block size kept in a tcache */
+#define TC_BINS        (TC_MAX_SIZE / ALIGNMENT + 1)
+#define TC_LIMIT         8  /* max blocks cached per size */
+#define TC_FILL          4  /* blocks fetched per refill */
+
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+#include "mm_classes.h"
+_Static_assert(MM_CLASSES_ALIGNMENT == ALIGNMENT && MM_CLASSES_WSIZE == WSIZE &&
+               MM_CLASSES_MINBLOCK == MINBLOCK &&
+               MM_CLASSES_TC_MAX == TC_MAX_SIZE &&
+               MM_CLASSES_NUM_BINS == NUM_BINS,
+               "mm_classes.h is out of date; rerun mkclasses");
+
+/* Header bits */
+#define ALLOC        0x1    /* this block is allocated */
+#define PREV_ALLOC   0x2    /* the block before this one is allocated */
+#define MAPPED       0x4    /* this block has a mapping of its own */
+
+/* Pack a size and allocated bits into a word */
+#define PACK(size, alloc)  ((uint32_t)(size) | (alloc))
+
+/* Read and write a word at address p */
+#define GET(p)       (*(uint32_t *)(p))
+#define PUT(p, val)  (*(uint32_t *)(p) = (val))
+
+/* Read the size and allocated fields from address p */
+#define GET_SIZE(p)  ((size_t)(GET(p) & ~0x7))
+#define GET_ALLOC(p) (GET(p) & ALLOC)
+#define GET_PREV_ALLOC(p) (GET(p) & PREV_ALLOC)
+#define GET_MAPPED(p) (GET(p) & MAPPED)
+
+/* Given block ptr bp, compute address of its header and (free) footer */
+#define HDRP(bp)       ((char *)(bp) - WSIZE)
+#define FTRP(bp)       ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
+
+/* Given block ptr bp, compute address of next and (free) previous blocks */
+#define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(HDRP(bp)))
+#define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE((char *)(bp) - DSIZE))
+
+/* Record in the block after bp whether bp is allocated */
+#define SET_PREV_ALLOC(bp)  (GET(HDRP(NEXT_BLKP(bp))) |= PREV_ALLOC)
+#define CLR_PREV_ALLOC(bp)  (GET(HDRP(NEXT_BLKP(bp))) &= ~PREV_ALLOC)
+
+/* Convert between block pointers and 32-bit links within arena a */
+#define TO_LINK(a, bp) \
+    ((bp) ? (uint32_t)(((char *)(bp) - (a)->base) / ALIGNMENT) : 0)
+#define FROM_LINK(a, l)   ((l) ? (a)->base + (size_t)(l) * ALIGNMENT : NULL)
+
+/* Given free block ptr bp in arena a, read and write its free-list links */
+#define NEXT_FREE(a, bp)  FROM_LINK(a, GET(bp))
+#define PREV_FREE(a, bp)  FROM_LINK(a, GET((char *)(bp) + WSIZE))
+#define SET_NEXT_FREE(a, bp, p)  PUT(bp, TO_LINK(a, p))
+#define SET_PREV_FREE(a, bp, p)  PUT((char *)(bp) + WSIZE, TO_LINK(a, p))
+
+/* Given free block ptr bp of at least TREE_MIN bytes in arena a, read and
+   write its tree links and colour */
+#define TREE_LEFT(a, bp)    FROM_LINK(a, GET(bp))
+#define TREE_RIGHT(a, bp)   FROM_LINK(a, GET((char *)(bp) + WSIZE))
+#define TREE_PARENT(a, bp)  FROM_LINK(a, GET((char *)(bp) + DSIZE))
+#define TREE_RED(bp)        GET((char *)(bp) + 3*WSIZE)
+#define SET_TREE_LEFT(a, bp, p)    PUT(bp, TO_LINK(a, p))
+#define SET_TREE_RIGHT(a, bp, p)   PUT((char *)(bp) + WSIZE, TO_LINK(a, p))
+#define SET_TREE_PARENT(a, bp, p)  PUT((char *)(bp) + DSIZE, TO_LINK(a, p))
+#define SET_TREE_RED(bp, red)      PUT((char *)(bp) + 3*WSIZE, red)
+
+/* Whether free block x orders before free block y in the tree */
+#define TREE_LESS(x, y) \
+    (GET_SIZE(HDRP(x)) < GET_SIZE(HDRP(y)) || \
+     (GET_SIZE(HDRP(x)) == GET_SIZE(HDRP(y)) && (char *)(x) < (char *)(y)))
+
+/* Given cached block ptr bp, access its tcache stack link */
+#define TC_NEXT(bp)    (*(char **)(bp))
+
+/* Given mapped block ptr bp, access its list links and mapping length */
+#define MAP_NEXT(bp)   (*(char **)((char *)(bp) - MAP_OVERHEAD))
+#define MAP_PREV(bp)   (*(char **)((char *)(bp) - MAP_OVERHEAD + 8))
+#define MAP_LEN(bp)    (*(size_t *)((char *)(bp) - MAP_OVERHEAD + 16))
+
+/* Classes of a request of 1 .. MM_SMALL_MAX bytes; slab class of a
+   request of at most SLAB_MAX bytes; slot size of a class */
+#define SMALL_CLASS(size) (&mm_small_class[((size) + 3) >> 2])
+#define SLAB_CLASS(size)  ((int)SMALL_CLASS(size)->slab)
+#define SLOT_SIZE(cls)    ((size_t)mm_slot_size[cls])
+
+/* The slab a slot lives in; slabs are SLAB_SIZE aligned */
+#define SLAB_OF(p)     ((slab_t *)((uintptr_t)(p) & ~(uintptr_t)(SLAB_SIZE - 1)))
+
+/* First slab-aligned payload address at or above bp that leaves room
+   for a free block in front */
+#define SLAB_ALIGN(bp) \
+    ((char *)(((uintptr_t)(bp) + MINBLOCK + SLAB_SIZE - 1) & \
+              ~(uintptr_t)(SLAB_SIZE - 1)) - \
+     ((uintptr_t)(bp) % SLAB_SIZE == 0 ? SLAB_SIZE : 0))
+
+/* Slots in a slab of class cls; the last word of the slab holds the
+   header of the next block */
+#define SLAB_SLOTS(cls) \
+    ((SLAB_SIZE - WSIZE - ALIGN(sizeof(slab_t))) / SLOT_SIZE(cls))
+
+/* Header at the start of every slab */
+typedef struct slab {
+    struct slab *next;          /* partial-slab list of the class */
+    struct slab *prev;
+    uint16_t cls;               /* slab class of the slots */
+    uint16_t nslots;            /* slots in this slab */
+    uint16_t nfree;             /* bits set in free_map */
+    uint16_t first;             /* offset of slot 0 */
+    uint64_t free_map[SLAB_WORDS];  /* bit i set: slot i is free */
+} slab_t;
+
+/* A chunk of a region; its memory follows the header */
+typedef struct region_chunk {
+    struct region_chunk *next;  /* next chunk of the region */
+    size_t size;                /* bytes after the header */
+} region_chunk_t;
+
+#define CHUNK_HDR       ALIGN(sizeof(region_chunk_t))
+#define CHUNK_START(c)  ((char *)(c) + CHUNK_HDR)
+
+struct mm_region {
+    region_chunk_t *head;       /* first chunk, NULL until one is needed */
+    region_chunk_t *cur;        /* chunk being carved */
+    char *top;                  /* next free byte in cur */
+    char *end;                  /* end of cur */
+    size_t next_size;           /* size of the next chunk to get */
+};
+
+/* One independently locked heap, backed by memlib arena of the same id */
+typedef struct {
+    pthread_mutex_t lock;       /* protects everything below */
+    char *base;                 /* start of the arena; links are relative */
+    char *heap_listp;           /* prologue block, NULL until initialized */
+    char *seg_heads[NUM_BINS];  /* heads of the segregated lists */
+    char *tree_root;            /* free blocks of at least TREE_MIN bytes */
+    slab_t *slabs[SLAB_CLASSES];        /* slabs with free slots */
+    unsigned slab_uses[SLAB_CLASSES];   /* counts up to SLAB_MIN_USES */
+    uint64_t slab_map[SLAB_PAGES / 64]; /* arena pages that hold slabs */
+    char *remote;               /* blocks freed by other arenas' threads;
+                                   lock-free, not under lock */
+    char *check_at;             /* next block of the incremental check */
+    char *fresh;                /* no block was ever handed out past here */
+} arena_t;
+
+/* Per-thread cache of free blocks, indexed by block size / ALIGNMENT,
+   and of free slots, indexed by slab class; the slot stack of
+   MM_SLAB_NONE stays empty */
+typedef struct {
+    char *head[TC_BINS];        /* stacks linked through TC_NEXT */
+    unsigned count[TC_BINS];    /* blocks on each stack */
+    char *slot_head[SLAB_CLASSES + 1];
+    unsigned slot_count[SLAB_CLASSES + 1];
+    unsigned gen;               /* heap_gen the cache belongs to */
+    arena_t *arena;             /* where this thread allocates */
+    unsigned guard_left;        /* mallocs until the next guarded one */
+    unsigned guard_rng;         /* xorshift state choosing guard_left */
+} tcache_t;
+
+/* One slot of the guard pool and the block it holds or last held */
+typedef struct {
+    char *bp;                   /* the block, at the end of the slot */
+    size_t size;                /* bytes asked for */
+    int live;                   /* allocated, its page accessible */
+} guard_slot_t;
+
+#ifdef MM_STATS
+/* One thread's counters, on the list of all threads' counters */
+typedef struct ctr_block {
+    unsigned long count[MM_CTRS];
+    unsigned gen;               /* heap_gen the counts belong to */
+    int linked;                 /* on ctr_head */
+    struct ctr_block *next;
+    struct ctr_block *prev;
+} ctr_block_t;
+
+static __thread ctr_block_t ctrs;
+static ctr_block_t *ctr_head;       /* counters of live threads */
+static unsigned long ctr_exited[MM_CTRS];  /* of threads gone since mm_init */
+static pthread_mutex_t ctr_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/* Names of the counters, for mm_stats_dump */
+static const char *const ctr_names[MM_CTRS] = {
+    "mallocs", "frees", "fit searches", "search steps", "splits",
+    "coalesces", "sbrk calls", "tcache hits", "tcache misses",
+    "slab hits", "slab misses", "realloc in place", "realloc copies",
+    "remote frees", "guarded mallocs", "NUMA local", "NUMA remote",
+};
+
+/* Global variables */
+static arena_t arenas[MEM_MAX_ARENAS];
+static pthread_mutex_t arena_create_lock = PTHREAD_MUTEX_INITIALIZER;
+static int arena_limit;             /* arenas threads are spread over */
+static unsigned next_arena;         /* round-robin arena assignment */
+static int num_nodes;               /* NUMA nodes the arenas are dealt to */
+static int arena_node[MEM_MAX_ARENAS];  /* NUMA node of each arena */
+static unsigned next_node_arena[MEM_MAX_ARENAS];  /* round robin per node */
+
+static size_t mmap_threshold;       /* smallest separately mapped request */
+static char *mapped_head;           /* list of mapped blocks */
+static pthread_mutex_t mapped_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned heap_gen = 1;       /* bumped by every mm_init; a new
+                                       thread's cache has gen 0 */
+
+/* The guard pool: a guard page, then a slot and a guard page for each
+   slot; guard_free_slots is a FIFO ring of the free ones */
+static size_t guard_rate;           /* MM_GUARD_RATE, 0 if off */
+static int guard_nslots;            /* slots in the pool */
+static char *guard_pool;            /* NULL until the first guarded malloc */
+static size_t guard_bytes;          /* length of guard_pool */
+static guard_slot_t guard_slots[GUARD_MAX_SLOTS];
+static int guard_free_slots[GUARD_MAX_SLOTS];
+static int guard_first, guard_nfree;
+static pthread_mutex_t guard_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction guard_old_segv;  /* handler before ours */
+static int guard_handling;          /* ours is installed */
+
+/* Routines for large copies and fills, chosen by mm_init */
+static int copy_kind = -1;          /* MM_COPY_*, -1 until chosen */
+static void *(*copy_big)(void *dst, const void *src, size_t n);
+static void *(*zero_big)(void *dst, size_t n);
+static __thread char *fresh_bp;     /* last block placed on fresh memory */
+
+static int check_mode = MM_CHECK_FULL;  /* what mm_checkheap does */
+static int check_k = CHECK_K;       /* blocks per incremental check */
+static int check_arena;             /* arena the incremental check is in */
+static pthread_mutex_t check_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t tc_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tc_key;        /* runs tcache_exit on thread exit */
+#ifndef DRIVER
+static pthread_once_t preload_once = PTHREAD_ONCE_INIT;
+#endif
+static __thread tcache_t tcache;
+
+/* Function prototypes for internal helper routines */
+static int arena_init(arena_t *a);
+static arena_t *arena_pick(void);
+static void *extend_heap(arena_t *a, size_t size);
+static void *coalesce(arena_t *a, void *bp);
+static void *find_fit(arena_t *a, size_t asize);
+static void place(arena_t *a, void *bp, size_t asize);
+static int size_to_bin(size_t size);
+static void insert_free(arena_t *a, void *bp);
+static void remove_free(arena_t *a, void *bp);
+static void tree_insert(arena_t *a, char *z);
+static void tree_remove(arena_t *a, char *z);
+static void tree_rotate(arena_t *a, char *x, int left);
+static void tree_replace(arena_t *a, char *u, char *v);
+static char *tree_fit(arena_t *a, size_t asize);
+static void *block_malloc(arena_t *a, size_t asize);
+static void block_free(arena_t *a, void *bp);
+static void *trim_free(arena_t *a, void *bp, char *lo, char *hi);
+static void *block_resize(void *bp, size_t size);
+static void *map_malloc(size_t size);
+static void *zero_libc(void *dst, size_t n);
+#ifdef HAVE_AVX
+static void *copy_avx2(void *dst, const void *src, size_t n);
+static void *zero_avx2(void *dst, size_t n);
+static void *copy_avx512(void *dst, const void *src, size_t n);
+static void *zero_avx512(void *dst, size_t n);
+#endif
+static void map_free(void *bp);
+static void *map_realloc(void *bp, size_t size);
+static void map_link(void *bp);
+static void map_unlink(void *bp);
+static unsigned guard_countdown(tcache_t *tc);
+static void *guard_malloc(tcache_t *tc, size_t size);
+static void guard_free(void *bp);
+static int guard_owns(const void *p);
+static void guard_report(const char *what, const void *p,
+                         const guard_slot_t *g);
+static void guard_segv(int sig, siginfo_t *info, void *ctx);
+static size_t payload_size(void *bp);
+static int is_slot(const void *p);
+static slab_t *slab_new(arena_t *a, int cls);
+static void *slab_alloc(arena_t *a, int cls);
+static void slab_free(arena_t *a, void *p);
+static void *slab_refill(tcache_t *tc, size_t size);
+static void slot_flush(tcache_t *tc, int cls, unsigned keep);
+static tcache_t *tcache_get(void);
+static void *tcache_refill(tcache_t *tc, size_t asize);
+static void tcache_flush(tcache_t *tc, int idx, unsigned keep);
+static void tcache_exit(void *arg);
+static void tcache_key_init(void);
+#ifndef DRIVER
+static void preload_init(void);
+#endif
+static void remote_push(arena_t *a, char *bp);
+static void remote_drain(arena_t *a);
+#ifdef MM_STATS
+static void ctr_link(void);
+static void ctr_unlink(void);
+#endif
+static int ptr_cmp(const void *x, const void *y);
+static void *region_grow(mm_region_t *r, size_t size);
+static int stat_class(size_t size);
+static void heapstats(arena_t *a, mm_heap_stats_t *st);
+static int in_heap(const void *p);
+static int aligned(const void *p);
+static void checkheap(arena_t *a, int verbose);
+static void checkincr(int verbose);
+static int checkrange(arena_t *a, int n, int verbose);
+static void checksample(int verbose);
+static void checkends(arena_t *a);
+static int checkblock(arena_t *a, char *bp, int verbose);
+static void checklinks(arena_t *a, char *bp);
+static void checkmapped(int verbose);
+static void checkslab(arena_t *a, slab_t *s);
+static int checktree(arena_t *a, char *bp, char *parent, int *count);
+
+/* The arena a heap block was carved from */
+#define ARENA_OF(bp)   (&arenas[mem_arena_of(bp)])
+
+/* Whether page index pg of arena a holds a slab */
+#define SLAB_PAGE(a, pg)  ((a)->slab_map[(pg) / 64] >> ((pg) % 64) & 1)
+
+/* Free the blocks on arena a's remote queue, if any.  Caller holds
+   a->lock. */
+#define REMOTE_DRAIN(a) \
+    do { if (__atomic_load_n(&(a)->remote, __ATOMIC_RELAXED) != NULL) \
+             remote_drain(a); } while (0)
+
+/* Block size for a request of size bytes */
+#define ADJUST(size)   MAX(ALIGN((size) + WSIZE), MINBLOCK)
+
 /*
  * Initialize: return -1 on error, 0 on success.
  */
 int mm_init(void) {
-    return 0;
+    int i, home;
+    long ncpus;
+    char *env;
+
+    if (mem_max_heapsize() > MAX_ARENA)
+        return -1;
+
+    if (copy_kind < 0 && mm_copy_mode(MM_COPY_AVX512) < 0 &&
+        mm_copy_mode(MM_COPY_AVX2) < 0)
+        mm_copy_mode(MM_COPY_LIBC);
+
+    if (arena_limit == 0) {
+        mmap_threshold = MMAP_THRESHOLD;
+        if ((env = getenv("MM_MMAP_THRESHOLD")) != NULL)
+            mmap_threshold = MAX(strtoul(env, NULL, 0), TC_MAX_SIZE);
+        if ((env = getenv("MM_GUARD_RATE")) != NULL)
+            guard_rate = strtoul(env, NULL, 0);
+        guard_nslots = GUARD_SLOTS;
+        if ((env = getenv("MM_GUARD_SLOTS")) != NULL)
+            guard_nslots = MIN(MAX(atoi(env), 1), GUARD_MAX_SLOTS);
+
+        ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+        arena_limit = ncpus < 1 ? 1 : 2 * ncpus;
+        if (arena_limit > MEM_MAX_ARENAS)
+            arena_limit = MEM_MAX_ARENAS;
+        for (i = 0; i < MEM_MAX_ARENAS; i++)
+            pthread_mutex_init(&arenas[i].lock, NULL);
+        num_nodes = mem_num_nodes();
+    }
+
+    /* Blocks cached by any thread belong to the old heap */
+    heap_gen++;
+#ifdef MM_STATS
+    pthread_mutex_lock(&ctr_lock);
+    memset(ctr_exited, 0, sizeof(ctr_exited));
+    pthread_mutex_unlock(&ctr_lock);
+#endif
+    next_arena = 0;
+    memset(next_node_arena, 0, sizeof(next_node_arena));
+    mapped_head = NULL;             /* mem_reset_brk dropped the mappings */
+    __atomic_store_n(&guard_pool, NULL, __ATOMIC_RELEASE);  /* likewise */
+
+    /* Deal the arenas out to the NUMA nodes, arena 0 to this one */
+    home = mem_current_node();
+    for (i = 0; i < MEM_MAX_ARENAS; i++)
+        arena_node[i] = (home + i) % num_nodes;
+    if (num_nodes > 1)
+        mem_arena_bind(0, arena_node[0]);
+
+    /* Arenas other than the default one are rebuilt on first use */
+    for (i = 0; i < MEM_MAX_ARENAS; i++) {
+        arenas[i].heap_listp = NULL;
+        arenas[i].remote = NULL;
+        if (i > 0 && i < mem_num_arenas())
+            mem_arena_reset_brk(i);
+    }
+    return arena_init(&arenas[0]);
 }
 
 /*
- * malloc
+ * malloc - Allocate a block with at least size bytes of payload.
  */
 void *malloc (size_t size) {
-    return NULL;
+    const mm_class_t *c;
+    size_t asize;
+    tcache_t *tc;
+    arena_t *a;
+    char *bp;
+
+    /* Now and then, a block in the guard pool instead */
+    tc = tcache_get();
+    COUNT(MM_CTR_MALLOCS);
+    if (--tc->guard_left == 0 && (bp = guard_malloc(tc, size)) != NULL)
+        return bp;
+
+    /* Small blocks come from this thread's cache, tiny requests
+       preferably as slots in a slab; size 0 wraps around and fails the
+       test (mmap_threshold is at least TC_MAX_SIZE) */
+    if (size - 1 < MM_SMALL_MAX) {
+        c = SMALL_CLASS(size);
+        COUNT_NODE(tc->arena);
+        if ((bp = tc->slot_head[c->slab]) != NULL) {
+            tc->slot_head[c->slab] = TC_NEXT(bp);
+            tc->slot_count[c->slab]--;
+            COUNT(MM_CTR_SLAB_HITS);
+            return bp;
+        }
+        if ((bp = tc->head[c->bin]) != NULL) {
+            tc->head[c->bin] = TC_NEXT(bp);
+            tc->count[c->bin]--;
+            COUNT(MM_CTR_TC_HITS);
+            return bp;
+        }
+        COUNT(c->slab != MM_SLAB_NONE ? MM_CTR_SLAB_MISSES : MM_CTR_TC_MISSES);
+        pthread_mutex_lock(&tc->arena->lock);
+        REMOTE_DRAIN(tc->arena);
+        if (c->slab != MM_SLAB_NONE)
+            bp = slab_refill(tc, size);
+        else
+            bp = tcache_refill(tc, (size_t)c->bin * ALIGNMENT);
+        pthread_mutex_unlock(&tc->arena->lock);
+        return bp;
+    }
+
+    /* Ignore spurious requests */
+    if (size == 0)
+        return NULL;
+
+    if (size >= mmap_threshold || size >= MAX_BLOCK)
+        return map_malloc(size);
+
+    /* Adjust block size to include overhead and alignment reqs */
+    asize = ADJUST(size);
+
+    a = tc->arena;
+    COUNT_NODE(a);
+    pthread_mutex_lock(&a->lock);
+    REMOTE_DRAIN(a);
+    bp = block_malloc(a, asize);
+    pthread_mutex_unlock(&a->lock);
+    return bp;
 }
 
 /*
- * free
+ * free - Free a block and coalesce it with its free neighbours.
  */
 void free (void *ptr) {
+    size_t size;
+    tcache_t *tc;
+    arena_t *a;
+    int idx, id;
+
     if(!ptr) return;
+    REQUIRES(in_heap(ptr));
+    COUNT(MM_CTR_FREES);
+    if (guard_owns(ptr)) {
+        guard_free(ptr);
+        return;
+    }
+
+    /* Blocks of another thread's arena go on that arena's remote queue */
+    tc = tcache_get();
+    a = (id = mem_arena_of(ptr)) >= 0 ? &arenas[id] : NULL;
+    if (a != NULL && a != tc->arena) {
+        remote_push(a, ptr);
+        return;
+    }
+
+    /* Slots go back to this thread's cache */
+    if (is_slot(ptr)) {
+        idx = SLAB_OF(ptr)->cls;
+        if (tc->slot_count[idx] == TC_LIMIT)
+            slot_flush(tc, idx, TC_LIMIT / 2);
+        TC_NEXT(ptr) = tc->slot_head[idx];
+        tc->slot_head[idx] = ptr;
+        tc->slot_count[idx]++;
+        return;
+    }
+
+    REQUIRES(GET_ALLOC(HDRP(ptr)));
+    if (GET_MAPPED(HDRP(ptr))) {
+        map_free(ptr);
+        return;
+    }
+
+    /* Small blocks go back to this thread's cache */
+    size = GET_SIZE(HDRP(ptr));
+    if (size <= TC_MAX_SIZE) {
+        idx = size / ALIGNMENT;
+        if (tc->count[idx] == TC_LIMIT)
+            tcache_flush(tc, idx, TC_LIMIT / 2);
+        TC_NEXT(ptr) = tc->head[idx];
+        tc->head[idx] = ptr;
+        tc->count[idx]++;
+        return;
+    }
+
+    pthread_mutex_lock(&a->lock);
+    block_free(a, ptr);
+    pthread_mutex_unlock(&a->lock);
 }
 
 /*
- * realloc - you may want to look at mm-naive.c
+ * realloc - Resize the block in place if possible; otherwise allocate
+ *      a new block, copy the old payload and free the old block.
+ *      Mapped blocks that stay huge are remapped instead.
  */
 void *realloc(void *oldptr, size_t size) {
-    return NULL;
+    size_t oldsize;
+    void *newptr;
+
+    /* If size == 0 then this is just free, and we return NULL. */
+    if (size == 0) {
+        free(oldptr);
+        return NULL;
+    }
+
+    /* If oldptr is NULL, then this is just malloc. */
+    if (oldptr == NULL)
+        return malloc(size);
+
+    if (guard_owns(oldptr)) {
+        /* always moves, so that the old pointer faults from now on */
+    } else if (is_slot(oldptr)) {
+        if (size <= SLOT_SIZE(SLAB_OF(oldptr)->cls)) {
+            COUNT(MM_CTR_REALLOC_INPLACE);
+            return oldptr;
+        }
+    } else if (GET_MAPPED(HDRP(oldptr))) {
+        if (size >= mmap_threshold)
+            return map_realloc(oldptr, size);
+    } else if (size < mmap_threshold && size < MAX_BLOCK &&
+               (newptr = block_resize(oldptr, size)) != NULL) {
+        COUNT(MM_CTR_REALLOC_INPLACE);
+        return newptr;
+    }
+
+    COUNT(MM_CTR_REALLOC_COPY);
+    newptr = malloc(size);
+
+    /* If realloc() fails the original block is left untouched  */
+    if (!newptr)
+        return NULL;
+
+    /* Copy the old data. */
+    oldsize = payload_size(oldptr);
+    if (size < oldsize) oldsize = size;
+    if (oldsize >= NT_THRESHOLD)
+        copy_big(newptr, oldptr, oldsize);
+    else
+        memcpy(newptr, oldptr, oldsize);
+
+    /* Free the old block. */
+    free(oldptr);
+
+    return newptr;
 }
 
 /*
- * calloc - you may want to look at mm-naive.c
- * This function is not tested by mdriver, but it is
- * needed to run the traces.
+ * calloc - Allocate the block and set it to zero.  Mapped blocks, and
+ *      blocks placed on memory the arena never handed out before, are
+ *      zero already but for the links and footer of the free block they
+ *      came from.  mdriver -Z times it.
  */
 void *calloc (size_t nmemb, size_t size) {
-    return NULL;
+    size_t bytes = nmemb * size;
+    char *newptr;
+
+    if (nmemb != 0 && bytes / nmemb != size)
+        return NULL;
+
+    fresh_bp = NULL;
+    if ((newptr = malloc(bytes)) == NULL)
+        return NULL;
+
+    if (copy_kind == MM_COPY_LIBC || guard_owns(newptr) || is_slot(newptr)) {
+        memset(newptr, 0, bytes);
+    } else if (GET_MAPPED(HDRP(newptr))) {
+        /* a fresh mapping */
+    } else if (newptr == fresh_bp) {
+        memset(newptr, 0, MIN(bytes, FREE_LINKS));
+        PUT(FTRP(newptr), 0);       /* where the free block's footer was */
+    } else if (bytes >= NT_THRESHOLD) {
+        zero_big(newptr, bytes);
+    } else {
+        memset(newptr, 0, bytes);
+    }
+    return newptr;
 }
 
+/*
+ * mm_copy_mode - Copy and zero large blocks with the given routines,
+ *      or return -1 if the CPU lacks them.  MM_COPY_LIBC uses memcpy
+ *      and memset, and zeroes fresh memory too.
+ */
+int mm_copy_mode(int kind) {
+    switch (kind) {
+    case MM_COPY_LIBC:
+        copy_big = memcpy;
+        zero_big = zero_libc;
+        break;
+#ifdef HAVE_AVX
+    case MM_COPY_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2"))
+            return -1;
+        copy_big = copy_avx2;
+        zero_big = zero_avx2;
+        break;
+    case MM_COPY_AVX512:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx512f"))
+            return -1;
+        copy_big = copy_avx512;
+        zero_big = zero_avx512;
+        break;
+#endif
+    default:
+        return -1;
+    }
+    copy_kind = kind;
+    return 0;
+}
 
 /*
- * Return whether the pointer is in the heap.
- * May be useful for debugging.
+ * zero_libc - memset to zero, in the shape of the other fill routines.
  */
-static int in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+static void *zero_libc(void *dst, size_t n) {
+    return memset(dst, 0, n);
 }
 
+#ifdef HAVE_AVX
 /*
- * Return whether the pointer is aligned.
- * May be useful for debugging.
+ * copy_avx2 - Copy n bytes with 32-byte streaming stores, which bypass
+ *      the cache.  n is at least NT_THRESHOLD.
  */
-static int aligned(const void *p) {
-    return (size_t)ALIGN(p) == (size_t)p;
+__attribute__((target("avx2")))
+static void *copy_avx2(void *dst, const void *src, size_t n) {
+    char *d = dst;
+    const char *s = src;
+    size_t head = -(uintptr_t)d & 31;
+    __m256i x0, x1, x2, x3;
+
+    memcpy(d, s, head);
+    d += head, s += head, n -= head;
+    for (; n >= 128; d += 128, s += 128, n -= 128) {
+        x0 = _mm256_loadu_si256((const __m256i *)s);
+        x1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+        x2 = _mm256_loadu_si256((const __m256i *)(s + 64));
+        x3 = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_stream_si256((__m256i *)d, x0);
+        _mm256_stream_si256((__m256i *)(d + 32), x1);
+        _mm256_stream_si256((__m256i *)(d + 64), x2);
+        _mm256_stream_si256((__m256i *)(d + 96), x3);
+    }
+    _mm_sfence();
+    memcpy(d, s, n);
+    return dst;
 }
 
 /*
- * mm_checkheap
+ * zero_avx2 - Zero n bytes with 32-byte streaming stores.
  */
-void mm_checkheap(int verbose) {
+__attribute__((target("avx2")))
+static void *zero_avx2(void *dst, size_t n) {
+    char *d = dst;
+    size_t head = -(uintptr_t)d & 31;
+    __m256i z = _mm256_setzero_si256();
+
+    memset(d, 0, head);
+    d += head, n -= head;
+    for (; n >= 128; d += 128, n -= 128) {
+        _mm256_stream_si256((__m256i *)d, z);
+        _mm256_stream_si256((__m256i *)(d + 32), z);
+        _mm256_stream_si256((__m256i *)(d + 64), z);
+        _mm256_stream_si256((__m256i *)(d + 96), z);
+    }
+    _mm_sfence();
+    memset(d, 0, n);
+    return dst;
+}
+
+/*
+ * copy_avx512 - Copy n bytes with 64-byte streaming stores.
+ */
+__attribute__((target("avx512f")))
+static void *copy_avx512(void *dst, const void *src, size_t n) {
+    char *d = dst;
+    const char *s = src;
+    size_t head = -(uintptr_t)d & 63;
+    __m512i x0, x1, x2, x3;
+
+    memcpy(d, s, head);
+    d += head, s += head, n -= head;
+    for (; n >= 256; d += 256, s += 256, n -= 256) {
+        x0 = _mm512_loadu_si512(s);
+        x1 = _mm512_loadu_si512(s + 64);
+        x2 = _mm512_loadu_si512(s + 128);
+        x3 = _mm512_loadu_si512(s + 192);
+        _mm512_stream_si512((__m512i *)d, x0);
+        _mm512_stream_si512((__m512i *)(d + 64), x1);
+        _mm512_stream_si512((__m512i *)(d + 128), x2);
+        _mm512_stream_si512((__m512i *)(d + 192), x3);
+    }
+    _mm_sfence();
+    memcpy(d, s, n);
+    return dst;
+}
+
+/*
+ * zero_avx512 - Zero n bytes with 64-byte streaming stores.
+ */
+__attribute__((target("avx512f")))
+static void *zero_avx512(void *dst, size_t n) {
+    char *d = dst;
+    size_t head = -(uintptr_t)d & 63;
+    __m512i z = _mm512_setzero_si512();
+
+    memset(d, 0, head);
+    d += head, n -= head;
+    for (; n >= 256; d += 256, n -= 256) {
+        _mm512_stream_si512((__m512i *)d, z);
+        _mm512_stream_si512((__m512i *)(d + 64), z);
+        _mm512_stream_si512((__m512i *)(d + 128), z);
+        _mm512_stream_si512((__m512i *)(d + 192), z);
+    }
+    _mm_sfence();
+    memset(d, 0, n);
+    return dst;
+}
+#endif
+
+/*
+ * mm_malloc_batch - Allocate n blocks of size bytes each into out[].
+ *      Ordinary blocks are carved back to back from as few free blocks
+ *      as possible, under a single lock acquisition.  Returns the
+ *      number of blocks allocated; if that is less than n, the rest of
+ *      out[] is NULL.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out) {
+    size_t asize, csize, want;
+    size_t got = 0;
+    arena_t *a;
+    char *bp;
+    int cls;
+
+    if (size == 0 || size >= mmap_threshold || size >= MAX_BLOCK) {
+        while (got < n && (out[got] = malloc(size)) != NULL)
+            got++;
+    } else {
+        asize = ADJUST(size);
+        a = tcache_get()->arena;
+        pthread_mutex_lock(&a->lock);
+        REMOTE_DRAIN(a);
+
+        /* Tiny blocks are slots once their class uses slabs */
+        if (size <= SLAB_MAX &&
+            a->slab_uses[cls = SLAB_CLASS(size)] >= SLAB_MIN_USES)
+            while (got < n && (out[got] = slab_alloc(a, cls)) != NULL)
+                got++;
+
+        while (got < n) {
+            /* A free block for all of the rest, or failing that for
+               some of it, before growing the heap */
+            want = n - got > BATCH_MAX / asize ? BATCH_MAX : (n - got) * asize;
+            if ((bp = find_fit(a, want)) != NULL ||
+                (bp = find_fit(a, asize)) != NULL)
+                remove_free(a, bp);
+            else if ((bp = extend_heap(a, want)) == NULL)
+                break;
+
+            /* Carve as in tcache_refill; bp follows an allocated block */
+            csize = GET_SIZE(HDRP(bp));
+            while (got < n - 1 && csize >= 2*asize) {
+                PUT(HDRP(bp), PACK(asize, PREV_ALLOC | ALLOC));
+                out[got++] = bp;
+                COUNT(MM_CTR_SPLITS);
+
+                csize -= asize;
+                bp = NEXT_BLKP(bp);
+                PUT(HDRP(bp), PACK(csize, PREV_ALLOC));
+                PUT(FTRP(bp), GET(HDRP(bp)));
+            }
+            place(a, bp, asize);
+            out[got++] = bp;
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+
+    memset(out + got, 0, (n - got) * sizeof(*out));
+    return got;
+}
+
+/*
+ * mm_free_batch - Free the n blocks in ptrs[]; NULL entries are skipped.
+ *      ptrs is sorted by address in place, so that a run of adjacent
+ *      blocks is merged and coalesced as one block, and each arena's
+ *      lock is taken once per run of its blocks.  The thread cache is
+ *      bypassed.
+ */
+void mm_free_batch(void **ptrs, size_t n) {
+    arena_t *held = NULL;
+    arena_t *a;
+    char *bp, *next;
+    size_t i;
+    int id;
+
+    qsort(ptrs, n, sizeof(*ptrs), ptr_cmp);
+
+    for (i = 0; i < n; i++) {
+        if ((bp = ptrs[i]) == NULL)
+            continue;
+        REQUIRES(in_heap(bp));
+
+        if ((id = mem_arena_of(bp)) < 0) {
+            if (guard_owns(bp))
+                guard_free(bp);
+            else
+                map_free(bp);
+            continue;
+        }
+        if ((a = &arenas[id]) != held) {
+            if (held != NULL)
+                pthread_mutex_unlock(&held->lock);
+            pthread_mutex_lock(&a->lock);
+            held = a;
+        }
+        if (is_slot(bp)) {
+            slab_free(a, bp);
+            continue;
+        }
+
+        REQUIRES(GET_ALLOC(HDRP(bp)));
+        while (i + 1 < n && (next = ptrs[i + 1]) == NEXT_BLKP(bp)) {
+            PUT(HDRP(bp), PACK(GET_SIZE(HDRP(bp)) + GET_SIZE(HDRP(next)),
+                               GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+            i++;
+        }
+        block_free(a, bp);
+    }
+    if (held != NULL)
+        pthread_mutex_unlock(&held->lock);
+}
+
+/*
+ * mm_region_create - Return a new, empty region, or NULL if out of
+ *      memory.
+ */
+mm_region_t *mm_region_create(void) {
+    mm_region_t *r;
+
+    if ((r = malloc(sizeof(*r))) == NULL)
+        return NULL;
+    r->head = r->cur = NULL;
+    r->top = r->end = NULL;
+    r->next_size = REGION_CHUNK;
+    return r;
+}
+
+/*
+ * mm_region_alloc - Allocate size bytes from region r; NULL if size is
+ *      zero or memory ran out.
+ */
+void *mm_region_alloc(mm_region_t *r, size_t size) {
+    char *p;
+
+    if (size == 0)
+        return NULL;
+    size = ALIGN(size);
+    if (size > (size_t)(r->end - r->top))
+        return region_grow(r, size);
+
+    p = r->top;
+    r->top += size;
+    return p;
+}
+
+/*
+ * region_grow - Allocate size bytes from a later chunk of region r: one
+ *      kept by an earlier reset if it is large enough, otherwise a new
+ *      one linked in after the current chunk.
+ */
+static void *region_grow(mm_region_t *r, size_t size) {
+    region_chunk_t *c;
+    size_t csize;
+
+    if (r->cur != NULL && (c = r->cur->next) != NULL && c->size >= size) {
+        r->cur = c;
+    } else {
+        csize = MAX(r->next_size, size);
+        if ((c = malloc(CHUNK_HDR + csize)) == NULL)
+            return NULL;
+        c->size = csize;
+        if (r->cur == NULL) {
+            c->next = NULL;
+            r->head = c;
+        } else {
+            c->next = r->cur->next;
+            r->cur->next = c;
+        }
+        r->cur = c;
+        if (r->next_size < REGION_MAX_CHUNK)
+            r->next_size *= 2;
+    }
+
+    r->top = CHUNK_START(c) + size;
+    r->end = CHUNK_START(c) + c->size;
+    return CHUNK_START(c);
+}
+
+/*
+ * mm_region_reset - Release everything allocated from region r at once.
+ *      The chunks stay with the region and are carved again from the
+ *      start.
+ */
+void mm_region_reset(mm_region_t *r) {
+    r->cur = r->head;
+    if (r->head != NULL) {
+        r->top = CHUNK_START(r->head);
+        r->end = r->top + r->head->size;
+    }
+}
+
+/*
+ * mm_region_destroy - Release region r and return its chunks to the
+ *      free lists.
+ */
+void mm_region_destroy(mm_region_t *r) {
+    region_chunk_t *c, *next;
+
+    if (r == NULL)
+        return;
+    for (c = r->head; c != NULL; c = next) {
+        next = c->next;
+        free(c);
+    }
+    free(r);
+}
+
+/*
+ * ptr_cmp - qsort comparison of two pointers by address.
+ */
+static int ptr_cmp(const void *x, const void *y) {
+    uintptr_t p = (uintptr_t)*(void * const *)x;
+    uintptr_t q = (uintptr_t)*(void * const *)y;
+
+    return (p > q) - (p < q);
+}
+
+/*
+ * arena_init - Create the initial empty heap of arena a: padding, a
+ *      prologue block and the epilogue only.  Returns -1 if the arena
+ *      cannot grow.
+ */
+static int arena_init(arena_t *a) {
+    int id = a - arenas;
+    char *bp;
+    int i;
+
+    for (i = 0; i < NUM_BINS; i++)
+        a->seg_heads[i] = NULL;
+    a->tree_root = NULL;
+    a->check_at = NULL;
+    for (i = 0; i < SLAB_CLASSES; i++) {
+        a->slabs[i] = NULL;
+        a->slab_uses[i] = 0;
+    }
+    memset(a->slab_map, 0, sizeof(a->slab_map));
+
+    if ((bp = mem_arena_sbrk(id, 2*DSIZE)) == (void *)-1)
+        return -1;
+    a->base = mem_arena_lo(id);
+    PUT(bp, 0);                                         /* padding */
+    PUT(bp + WSIZE, PACK(DSIZE, PREV_ALLOC | ALLOC));   /* prologue header */
+    PUT(bp + 2*WSIZE, 0);                               /* prologue payload */
+    PUT(bp + 3*WSIZE, PACK(0, PREV_ALLOC | ALLOC));     /* epilogue header */
+    a->heap_listp = bp + DSIZE;
+    a->fresh = mem_arena_fresh(id);
+    return 0;
+}
+
+/*
+ * arena_pick - Choose the arena for a thread that has none yet: one of
+ *      its NUMA node's arenas if there are several nodes, any otherwise.
+ *      The arena is created, bound to its node and initialized on first
+ *      use.  Falls back to the default arena if no more arenas can be
+ *      made.
+ */
+static arena_t *arena_pick(void) {
+    int first, n, id;
+    arena_t *a;
+
+    /* Arenas of node n are first, first + num_nodes, ... */
+    first = (mem_current_node() - arena_node[0] + num_nodes) % num_nodes;
+    if (num_nodes > 1 && first < arena_limit) {
+        n = (arena_limit - first + num_nodes - 1) / num_nodes;
+        id = first + num_nodes * (int)(__atomic_fetch_add(
+                &next_node_arena[first], 1, __ATOMIC_RELAXED) % n);
+    } else {
+        id = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % arena_limit;
+    }
+    a = &arenas[id];
+
+    if (a->heap_listp != NULL)
+        return a;
+
+    pthread_mutex_lock(&arena_create_lock);
+    while (mem_num_arenas() <= id)
+        if (mem_arena_create() < 0)
+            break;
+    if (id >= mem_num_arenas()) {
+        a = &arenas[0];
+    } else {
+        pthread_mutex_lock(&a->lock);
+        if (a->heap_listp == NULL && num_nodes > 1)
+            mem_arena_bind(id, arena_node[id]);
+        if (a->heap_listp == NULL && arena_init(a) < 0)
+            a = &arenas[0];
+        pthread_mutex_unlock(&arenas[id].lock);
+    }
+    pthread_mutex_unlock(&arena_create_lock);
+    return a;
+}
+
+/*
+ * block_malloc - Allocate a block of asize bytes from arena a,
+ *      growing it if nothing fits.  Caller holds a->lock.
+ */
+static void *block_malloc(arena_t *a, size_t asize) {
+    char *bp;
+
+    /* Search the free lists for a fit */
+    if ((bp = find_fit(a, asize)) != NULL) {
+        remove_free(a, bp);
+    } else {
+        /* No fit found. Get more memory and place the block */
+        if ((bp = extend_heap(a, asize)) == NULL)
+            return NULL;
+    }
+    place(a, bp, asize);
+    return bp;
+}
+
+/*
+ * block_free - Return an allocated block to the free lists of its
+ *      arena a.  Caller holds a->lock.
+ */
+static void block_free(arena_t *a, void *bp) {
+    size_t size = GET_SIZE(HDRP(bp));
+    char *lo = bp;
+    char *hi = NEXT_BLKP(bp);
+
+    /* Free neighbours below RELEASE_THRESHOLD may still hold pages */
+    if (!GET_PREV_ALLOC(HDRP(bp)) && GET_SIZE(lo - DSIZE) < RELEASE_THRESHOLD)
+        lo -= GET_SIZE(lo - DSIZE);
+    if (!GET_ALLOC(HDRP(hi)) && GET_SIZE(HDRP(hi)) < RELEASE_THRESHOLD)
+        hi += GET_SIZE(HDRP(hi));
+
+    PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), GET(HDRP(bp)));
+    insert_free(a, trim_free(a, coalesce(a, bp), lo, hi));
+}
+
+/*
+ * trim_free - Give the memory of a large, unlisted free block back to
+ *      the system: shrink the heap when the block is the last one,
+ *      otherwise release its pages within [lo, hi), the part that was
+ *      not released before.  Returns the block, which may have become
+ *      smaller.  Caller holds a->lock.
+ */
+static void *trim_free(arena_t *a, void *bp, char *lo, char *hi) {
+    size_t size = GET_SIZE(HDRP(bp));
+    size_t cut;
+
+    if (GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0 && size >= TRIM_THRESHOLD) {
+        cut = size - TRIM_KEEP;
+        /* Leave zeroes behind the break for calloc; see place() */
+        PUT(FTRP(bp), 0);
+        PUT(HDRP(NEXT_BLKP(bp)), 0);
+        COUNT(MM_CTR_SBRKS);
+        if (mem_arena_sbrk(a - arenas, -(int)cut) != (void *)-1) {
+            PUT(HDRP(bp), PACK(TRIM_KEEP, PREV_ALLOC));
+            if (a->check_at > (char *)bp)
+                a->check_at = NULL;
+        }
+        PUT(FTRP(bp), GET(HDRP(bp)));
+        PUT(HDRP(NEXT_BLKP(bp)), PACK(0, ALLOC));       /* epilogue */
+    } else if (size >= RELEASE_THRESHOLD) {
+        /* keep the links and the footer */
+        lo = MAX(lo, (char *)bp + DSIZE);
+        hi = hi < FTRP(bp) ? hi : FTRP(bp);
+        mem_release_range(lo, hi);
+    }
+    return bp;
+}
+
+/*
+ * block_resize - Make arena block bp hold size bytes without moving
+ *      it.  Returns bp, or NULL if the block would have to move.
+ */
+static void *block_resize(void *bp, size_t size) {
+    size_t asize = ADJUST(size);
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t avail = csize;
+    arena_t *a;
+    char *next;
+
+    /* Too little to gain to be worth the lock */
+    if (asize <= csize && csize - asize < MINBLOCK)
+        return bp;
+
+    a = ARENA_OF(bp);
+    pthread_mutex_lock(&a->lock);
+    next = NEXT_BLKP(bp);
+
+    if (asize < csize) {
+        /* Shrink: hand the tail back as a block of its own */
+        PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+        next = NEXT_BLKP(bp);
+        PUT(HDRP(next), PACK(csize - asize, PREV_ALLOC | ALLOC));
+        block_free(a, next);
+        pthread_mutex_unlock(&a->lock);
+        return bp;
+    }
+
+    /* Grow into the free block that follows, if any */
+    if (!GET_ALLOC(HDRP(next))) {
+        avail += GET_SIZE(HDRP(next));
+        next = NEXT_BLKP(next);
+    }
+
+    /* Short of space at the end of the arena: move the break */
+    if (avail < asize) {
+        COUNT(MM_CTR_SBRKS);
+        if (GET_SIZE(HDRP(next)) != 0 ||
+            mem_arena_sbrk(a - arenas, asize - avail) == (void *)-1) {
+            pthread_mutex_unlock(&a->lock);
+            return NULL;
+        }
+        avail = asize;
+        PUT(HDRP(bp) + avail, PACK(0, ALLOC));  /* new epilogue header */
+    }
+
+    if (avail > csize && !GET_ALLOC(HDRP(NEXT_BLKP(bp))))
+        remove_free(a, NEXT_BLKP(bp));
+    PUT(HDRP(bp), PACK(avail, GET_PREV_ALLOC(HDRP(bp))));
+    CHECK_CLAMP(a, bp);
+    place(a, bp, asize);
+    pthread_mutex_unlock(&a->lock);
+    return bp;
+}
+
+/*
+ * map_malloc - Give a huge request a mapping of its own.
+ */
+static void *map_malloc(size_t size) {
+    size_t page = mem_pagesize();
+    size_t len = (size + MAP_OVERHEAD + page - 1) & ~(page - 1);
+    char *bp;
+
+    if (len < size || (bp = mem_map(len)) == NULL)
+        return NULL;
+    bp += MAP_OVERHEAD;
+    MAP_LEN(bp) = len;
+    PUT(HDRP(bp), PACK(0, MAPPED | ALLOC));
+
+    pthread_mutex_lock(&mapped_lock);
+    map_link(bp);
+    pthread_mutex_unlock(&mapped_lock);
+    return bp;
+}
+
+/*
+ * map_free - Unmap a mapped block.
+ */
+static void map_free(void *bp) {
+    pthread_mutex_lock(&mapped_lock);
+    map_unlink(bp);
+    pthread_mutex_unlock(&mapped_lock);
+    mem_unmap((char *)bp - MAP_OVERHEAD);
+}
+
+/*
+ * map_realloc - Resize a mapped block to hold size bytes, moving it
+ *      if necessary.  Returns NULL, leaving the block alone, on failure.
+ */
+static void *map_realloc(void *bp, size_t size) {
+    size_t page = mem_pagesize();
+    size_t len = (size + MAP_OVERHEAD + page - 1) & ~(page - 1);
+    char *newbp;
+
+    if (len < size)
+        return NULL;
+    if (len == MAP_LEN(bp))
+        return bp;
+
+    /* The block may move, so it cannot stay linked meanwhile */
+    pthread_mutex_lock(&mapped_lock);
+    map_unlink(bp);
+    if ((newbp = mem_remap((char *)bp - MAP_OVERHEAD, len)) == NULL) {
+        map_link(bp);
+        pthread_mutex_unlock(&mapped_lock);
+        return NULL;
+    }
+    newbp += MAP_OVERHEAD;
+    MAP_LEN(newbp) = len;
+    map_link(newbp);
+    pthread_mutex_unlock(&mapped_lock);
+    return newbp;
+}
+
+/*
+ * map_link - Push mapped block bp on the list of mapped blocks.
+ *      Caller holds mapped_lock.
+ */
+static void map_link(void *bp) {
+    MAP_NEXT(bp) = mapped_head;
+    MAP_PREV(bp) = NULL;
+    if (mapped_head != NULL)
+        MAP_PREV(mapped_head) = bp;
+    mapped_head = bp;
+}
+
+/*
+ * map_unlink - Take mapped block bp off the list of mapped blocks.
+ *      Caller holds mapped_lock.
+ */
+static void map_unlink(void *bp) {
+    if (MAP_PREV(bp) != NULL)
+        MAP_NEXT(MAP_PREV(bp)) = MAP_NEXT(bp);
+    else
+        mapped_head = MAP_NEXT(bp);
+    if (MAP_NEXT(bp) != NULL)
+        MAP_PREV(MAP_NEXT(bp)) = MAP_PREV(bp);
+}
+
+/*
+ * guard_countdown - Return the number of mallocs until the calling
+ *      thread's next guarded one: random, and guard_rate on average.
+ *      Without MM_GUARD_RATE, as many as the countdown can hold.
+ */
+static unsigned guard_countdown(tcache_t *tc) {
+    unsigned x = tc->guard_rng;
+
+    if (guard_rate == 0)
+        return UINT32_MAX;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    tc->guard_rng = x;
+    return 1 + x % (2 * MIN(guard_rate, UINT32_MAX / 2));
+}
+
+/*
+ * guard_malloc - Allocate size bytes at the end of a free slot of the
+ *      guard pool, mapping the pool on first use, and start the
+ *      thread's countdown over.  Returns NULL if the block does not fit
+ *      in a page or there is no free slot.
+ */
+static void *guard_malloc(tcache_t *tc, size_t size) {
+    size_t page = mem_pagesize();
+    struct sigaction sa;
+    guard_slot_t *g;
+    char *pool;
+    int i;
+
+    tc->guard_left = guard_countdown(tc);
+    if (guard_rate == 0 || size == 0 || size > page)
+        return NULL;
+
+    pthread_mutex_lock(&guard_lock);
+    if (guard_pool == NULL) {
+        guard_bytes = (2 * (size_t)guard_nslots + 1) * page;
+        if ((pool = mem_map(guard_bytes)) == NULL ||
+            mprotect(pool, guard_bytes, PROT_NONE) < 0) {
+            pthread_mutex_unlock(&guard_lock);
+            return NULL;
+        }
+        memset(guard_slots, 0, sizeof(guard_slots));
+        for (i = 0; i < guard_nslots; i++)
+            guard_free_slots[i] = i;
+        guard_first = 0;
+        guard_nfree = guard_nslots;
+        __atomic_store_n(&guard_pool, pool, __ATOMIC_RELEASE);
+
+        if (!guard_handling) {
+            memset(&sa, 0, sizeof(sa));
+            sa.sa_sigaction = guard_segv;
+            sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+            sigemptyset(&sa.sa_mask);
+            guard_handling = sigaction(SIGSEGV, &sa, &guard_old_segv) == 0;
+        }
+    }
+    if (guard_nfree == 0) {
+        pthread_mutex_unlock(&guard_lock);
+        return NULL;
+    }
+    i = guard_free_slots[guard_first];
+    guard_first = (guard_first + 1) % guard_nslots;
+    guard_nfree--;
+    pthread_mutex_unlock(&guard_lock);
+
+    g = &guard_slots[i];
+    g->bp = guard_pool + (2 * (size_t)i + 2) * page - ALIGN(size);
+    g->size = size;
+    if (mprotect(guard_pool + (2 * (size_t)i + 1) * page, page,
+                 PROT_READ | PROT_WRITE) < 0) {
+        pthread_mutex_lock(&guard_lock);
+        guard_free_slots[(guard_first + guard_nfree++) % guard_nslots] = i;
+        pthread_mutex_unlock(&guard_lock);
+        return NULL;
+    }
+    g->live = 1;
+    COUNT(MM_CTR_GUARDED);
+    return g->bp;
+}
+
+/*
+ * guard_free - Make the page of guarded block bp inaccessible and put
+ *      its slot at the back of the free ones.  A pointer into the pool
+ *      that is not a live guarded block is reported and aborts.
+ */
+static void guard_free(void *bp) {
+    size_t page = mem_pagesize();
+    int i = MIN((size_t)((char *)bp - guard_pool) / (2 * page),
+                (size_t)guard_nslots - 1);
+    guard_slot_t *g = &guard_slots[i];
+
+    if (bp != g->bp || !g->live) {
+        guard_report(bp == g->bp ? "double free" : "invalid free", bp, g);
+        abort();
+    }
+    g->live = 0;
+    mprotect(guard_pool + (2 * (size_t)i + 1) * page, page, PROT_NONE);
+
+    pthread_mutex_lock(&guard_lock);
+    guard_free_slots[(guard_first + guard_nfree++) % guard_nslots] = i;
+    pthread_mutex_unlock(&guard_lock);
+}
+
+/*
+ * guard_owns - Return whether p points into the guard pool.
+ */
+static int guard_owns(const void *p) {
+    char *pool = __atomic_load_n(&guard_pool, __ATOMIC_ACQUIRE);
+
+    return pool != NULL && (size_t)((const char *)p - pool) < guard_bytes;
+}
+
+/*
+ * guard_report - Print to stderr what went wrong at address p, with the
+ *      block of guard slot g.  Async-signal-safe as far as snprintf is.
+ */
+static void guard_report(const char *what, const void *p,
+                         const guard_slot_t *g) {
+    char msg[160];
+    int n;
+
+    n = snprintf(msg, sizeof(msg), "mm: %s at %p (the %zu-byte block at %p)\n",
+                 what, p, g->size, (void *)g->bp);
+    if (n > 0)
+        write(STDERR_FILENO, msg, MIN((size_t)n, sizeof(msg) - 1));
+}
+
+/*
+ * guard_segv - SIGSEGV handler: if the fault is in the guard pool, say
+ *      which block was used after free, overrun or underrun.  Then hand
+ *      the signal to the handler there was before, or return to fault
+ *      again with the default action.
+ */
+static void guard_segv(int sig, siginfo_t *info, void *ctx) {
+    size_t page = mem_pagesize();
+    char *addr = info->si_addr;
+    size_t pg;
+    int left, right;
+
+    if (guard_owns(addr)) {
+        pg = (addr - guard_pool) / page;
+        left = (int)(pg / 2) - 1;   /* slot before a guard page */
+        right = pg / 2;             /* slot after it */
+        if (pg % 2 == 1)
+            guard_report("use after free", addr, &guard_slots[pg / 2]);
+        else if (left >= 0 && guard_slots[left].live)
+            guard_report("overflow", addr, &guard_slots[left]);
+        else if (right < guard_nslots && guard_slots[right].live)
+            guard_report("underflow", addr, &guard_slots[right]);
+        else
+            write(STDERR_FILENO, "mm: wild access to a guard page\n", 32);
+    }
+
+    if (guard_old_segv.sa_flags & SA_SIGINFO)
+        guard_old_segv.sa_sigaction(sig, info, ctx);
+    else if (guard_old_segv.sa_handler != SIG_DFL &&
+             guard_old_segv.sa_handler != SIG_IGN)
+        guard_old_segv.sa_handler(sig);
+    else
+        signal(SIGSEGV, SIG_DFL);
+}
+
+/*
+ * payload_size - Return the usable bytes of allocated block bp.
+ */
+static size_t payload_size(void *bp) {
+    if (guard_owns(bp))
+        return ALIGN(guard_slots[((char *)bp - guard_pool) /
+                                 (2 * mem_pagesize())].size);
+    if (is_slot(bp))
+        return SLOT_SIZE(SLAB_OF(bp)->cls);
+    if (GET_MAPPED(HDRP(bp)))
+        return MAP_LEN(bp) - MAP_OVERHEAD;
+    return GET_SIZE(HDRP(bp)) - WSIZE;
+}
+
+/*
+ * is_slot - Return whether p points into a slab rather than at an
+ *      ordinary or mapped block.
+ */
+static int is_slot(const void *p) {
+    int id = mem_arena_of(p);
+    size_t pg;
+
+    if (id < 0)
+        return 0;
+    pg = ((const char *)p - arenas[id].base) / SLAB_SIZE;
+    return pg < SLAB_PAGES && SLAB_PAGE(&arenas[id], pg);
+}
+
+/*
+ * slab_new - Carve a fresh, page-aligned slab of class cls out of arena
+ *      a and put it on the class's list.  Returns NULL if the arena
+ *      cannot provide one.  Caller holds a->lock.
+ */
+static slab_t *slab_new(arena_t *a, int cls) {
+    size_t csize, front, pg;
+    char *bp, *sp, *last;
+    slab_t *s;
+    int i;
+
+    /* A free block with room for the slab at an aligned address... */
+    if ((bp = find_fit(a, 2*SLAB_SIZE + MINBLOCK)) != NULL) {
+        remove_free(a, bp);
+    } else {
+        /* ...or just enough new memory to end one at the top of the heap,
+           so that slabs made in a row sit back to back */
+        last = (char *)mem_arena_hi(a - arenas) + 1;
+        if (GET_PREV_ALLOC(last - WSIZE)) {
+            bp = last;
+        } else {
+            bp = last - GET_SIZE(last - DSIZE);
+            remove_free(a, bp);
+        }
+        sp = SLAB_ALIGN(bp);
+        if (bp == last || bp + GET_SIZE(HDRP(bp)) < sp + SLAB_SIZE) {
+            if (bp != last)
+                insert_free(a, bp);
+            if ((bp = extend_heap(a, sp - bp + SLAB_SIZE)) == NULL)
+                return NULL;
+        }
+    }
+    csize = GET_SIZE(HDRP(bp));
+    place(a, bp, csize);
+    sp = SLAB_ALIGN(bp);
+
+    /* Hand back the space in front of and behind the slab */
+    if ((front = sp - bp) != 0) {
+        PUT(HDRP(bp), PACK(front, GET_PREV_ALLOC(HDRP(bp)) | ALLOC));
+        PUT(HDRP(sp), PACK(csize - front, PREV_ALLOC | ALLOC));
+        block_free(a, bp);
+        csize -= front;
+    }
+    if (csize - SLAB_SIZE >= MINBLOCK) {
+        PUT(HDRP(sp), PACK(SLAB_SIZE, GET_PREV_ALLOC(HDRP(sp)) | ALLOC));
+        bp = NEXT_BLKP(sp);
+        PUT(HDRP(bp), PACK(csize - SLAB_SIZE, PREV_ALLOC | ALLOC));
+        block_free(a, bp);
+    }
+
+    pg = (sp - a->base) / SLAB_SIZE;
+    if (pg >= SLAB_PAGES) {
+        block_free(a, sp);
+        return NULL;
+    }
+    a->slab_map[pg / 64] |= (uint64_t)1 << (pg % 64);
+
+    s = (slab_t *)sp;
+    s->cls = cls;
+    s->first = ALIGN(sizeof(slab_t));
+    s->nslots = SLAB_SLOTS(cls);
+    s->nfree = s->nslots;
+    for (i = 0; i < SLAB_WORDS; i++) {
+        int bits = s->nslots - 64 * i;
+        s->free_map[i] = bits >= 64 ? ~(uint64_t)0 :
+            bits > 0 ? ((uint64_t)1 << bits) - 1 : 0;
+    }
+    s->prev = NULL;
+    s->next = a->slabs[cls];
+    if (s->next != NULL)
+        s->next->prev = s;
+    a->slabs[cls] = s;
+    return s;
+}
+
+/*
+ * slab_alloc - Take a free slot of class cls from arena a, making a new
+ *      slab if none is left.  Returns NULL if no slab can be made.
+ *      Caller holds a->lock.
+ */
+static void *slab_alloc(arena_t *a, int cls) {
+    slab_t *s = a->slabs[cls];
+    int w, bit;
+
+    if (s == NULL && (s = slab_new(a, cls)) == NULL)
+        return NULL;
+
+    for (w = 0; s->free_map[w] == 0; w++)
+        ;
+    bit = __builtin_ctzll(s->free_map[w]);
+    s->free_map[w] &= s->free_map[w] - 1;
+
+    /* A full slab leaves the list until a slot is freed */
+    if (--s->nfree == 0) {
+        a->slabs[cls] = s->next;
+        if (s->next != NULL)
+            s->next->prev = NULL;
+    }
+    return (char *)s + s->first + (size_t)(64 * w + bit) * SLOT_SIZE(cls);
+}
+
+/*
+ * slab_free - Return slot p to its slab in arena a.  A slab that becomes
+ *      empty goes back to the arena, unless it is the only one left on
+ *      its class's list.  Caller holds a->lock.
+ */
+static void slab_free(arena_t *a, void *p) {
+    slab_t *s = SLAB_OF(p);
+    int cls = s->cls;
+    size_t i = ((char *)p - ((char *)s + s->first)) / SLOT_SIZE(cls);
+    size_t pg;
+
+    s->free_map[i / 64] |= (uint64_t)1 << (i % 64);
+    if (s->nfree++ == 0) {
+        s->prev = NULL;
+        s->next = a->slabs[cls];
+        if (s->next != NULL)
+            s->next->prev = s;
+        a->slabs[cls] = s;
+    }
+
+    if (s->nfree == s->nslots && (s->prev != NULL || s->next != NULL)) {
+        if (s->prev != NULL)
+            s->prev->next = s->next;
+        else
+            a->slabs[cls] = s->next;
+        if (s->next != NULL)
+            s->next->prev = s->prev;
+        pg = ((char *)s - a->base) / SLAB_SIZE;
+        a->slab_map[pg / 64] &= ~((uint64_t)1 << (pg % 64));
+        block_free(a, s);
+    }
+}
+
+/*
+ * slab_refill - Allocate a tiny request of size bytes for the caller
+ *      and stock the (empty) slot stack of its class with up to
+ *      TC_FILL - 1 more slots.  Until the class has been used
+ *      SLAB_MIN_USES times in the arena, or while a free fragment too
+ *      small for a slab fits, an ordinary block is returned instead.
+ *      Caller holds tc->arena->lock.
+ */
+static void *slab_refill(tcache_t *tc, size_t size) {
+    arena_t *a = tc->arena;
+    int cls = SLAB_CLASS(size);
+    char *bp;
+    int n;
+
+    if (a->slab_uses[cls] < SLAB_MIN_USES) {
+        a->slab_uses[cls]++;
+        return tcache_refill(tc, ADJUST(size));
+    }
+
+    /* Free fragments too small to hold a slab are used up first */
+    if (a->slabs[cls] == NULL && (bp = find_fit(a, ADJUST(size))) != NULL &&
+        GET_SIZE(HDRP(bp)) < 2*SLAB_SIZE + MINBLOCK)
+        return tcache_refill(tc, ADJUST(size));
+
+    if ((bp = slab_alloc(a, cls)) == NULL)
+        return tcache_refill(tc, ADJUST(size));
+
+    for (n = 1; n < TC_FILL && a->slabs[cls] != NULL; n++) {
+        char *sp = slab_alloc(a, cls);
+        TC_NEXT(sp) = tc->slot_head[cls];
+        tc->slot_head[cls] = sp;
+        tc->slot_count[cls]++;
+    }
+    return bp;
+}
+
+/*
+ * slot_flush - Return cached slots of class cls to their slabs until
+ *      only keep of them are left.
+ */
+static void slot_flush(tcache_t *tc, int cls, unsigned keep) {
+    arena_t *held = NULL;
+    arena_t *a;
+    char *p;
+
+    while (tc->slot_count[cls] > keep) {
+        p = tc->slot_head[cls];
+        tc->slot_head[cls] = TC_NEXT(p);
+        tc->slot_count[cls]--;
+
+        if ((a = ARENA_OF(p)) != held) {
+            if (held != NULL)
+                pthread_mutex_unlock(&held->lock);
+            pthread_mutex_lock(&a->lock);
+            held = a;
+        }
+        slab_free(a, p);
+    }
+    if (held != NULL)
+        pthread_mutex_unlock(&held->lock);
+}
+
+/*
+ * tcache_get - Return the calling thread's cache, discarding its
+ *      contents if they belong to a heap that mm_init has since reset.
+ */
+static tcache_t *tcache_get(void) {
+    tcache_t *tc = &tcache;
+
+    if (tc->gen != heap_gen) {
+#ifndef DRIVER
+        /* Interposed on a program, which never calls mm_init itself */
+        pthread_once(&preload_once, preload_init);
+#endif
+        pthread_once(&tc_once, tcache_key_init);
+        pthread_setspecific(tc_key, tc);
+        memset(tc, 0, sizeof(*tc));
+        tc->gen = heap_gen;
+        tc->arena = arena_pick();
+        tc->guard_rng = (unsigned)(uintptr_t)tc | 1;
+        tc->guard_left = guard_countdown(tc);
+#ifdef MM_STATS
+        ctr_link();
+#endif
+    }
+    return tc;
+}
+
+/*
+ * tcache_refill - Allocate a block of asize bytes for the caller and
+ *      stock the (empty) cache stack for asize with up to TC_FILL - 1
+ *      more, all carved from the same free block of the thread's arena.
+ *      The heap is only grown for the caller's block.  Caller holds
+ *      tc->arena->lock.
+ */
+static void *tcache_refill(tcache_t *tc, size_t asize) {
+    arena_t *a = tc->arena;
+    int idx = asize / ALIGNMENT;
+    size_t csize;
+    char *bp;
+    int n;
+
+    if ((bp = find_fit(a, asize)) == NULL)
+        return block_malloc(a, asize);
+    remove_free(a, bp);
+
+    /* Carve whole blocks off the front while two or more still fit;
+       a free block always follows an allocated one */
+    csize = GET_SIZE(HDRP(bp));
+    for (n = 1; n < TC_FILL && csize >= 2*asize; n++) {
+        COUNT(MM_CTR_SPLITS);
+        PUT(HDRP(bp), PACK(asize, PREV_ALLOC | ALLOC));
+        TC_NEXT(bp) = tc->head[idx];
+        tc->head[idx] = bp;
+        tc->count[idx]++;
+
+        csize -= asize;
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(csize, PREV_ALLOC));
+        PUT(FTRP(bp), GET(HDRP(bp)));
+    }
+    place(a, bp, asize);
+    return bp;
+}
+
+/*
+ * tcache_flush - Return cached blocks of stack idx to their arenas
+ *      until only keep of them are left.  Takes each arena's lock once
+ *      per run of blocks that belong to it.
+ */
+static void tcache_flush(tcache_t *tc, int idx, unsigned keep) {
+    arena_t *held = NULL;
+    arena_t *a;
+    char *bp;
+
+    while (tc->count[idx] > keep) {
+        bp = tc->head[idx];
+        tc->head[idx] = TC_NEXT(bp);
+        tc->count[idx]--;
+
+        if ((a = ARENA_OF(bp)) != held) {
+            if (held != NULL)
+                pthread_mutex_unlock(&held->lock);
+            pthread_mutex_lock(&a->lock);
+            held = a;
+        }
+        block_free(a, bp);
+    }
+    if (held != NULL)
+        pthread_mutex_unlock(&held->lock);
+}
+
+/*
+ * tcache_exit - Thread destructor: hand the exiting thread's cached
+ *      blocks back to their arenas.
+ */
+static void tcache_exit(void *arg) {
+    tcache_t *tc = arg;
+    int idx;
+
+#ifdef MM_STATS
+    ctr_unlink();
+#endif
+    if (tc->gen != heap_gen)
+        return;
+    for (idx = 0; idx < TC_BINS; idx++)
+        tcache_flush(tc, idx, 0);
+    for (idx = 0; idx < SLAB_CLASSES; idx++)
+        slot_flush(tc, idx, 0);
+}
+
+/*
+ * tcache_key_init - Create the key whose destructor flushes caches.
+ */
+static void tcache_key_init(void) {
+    pthread_key_create(&tc_key, tcache_exit);
+}
+
+#ifndef DRIVER
+/*
+ * preload_init - Set up the heap on the first malloc of a program that
+ *      this file is interposed on (make mm-preload.so).
+ */
+static void preload_init(void) {
+    mem_init();
+    if (mm_init() < 0) {
+        write(STDERR_FILENO, "mm: mm_init failed\n", 19);
+        abort();
+    }
+}
+#endif
+
+/*
+ * mm_stats_get - Sum the counters of every thread since the last
+ *      mm_init into count[].  Returns -1, with count[] all zero, if
+ *      mm.c was built without MM_STATS.
+ */
+int mm_stats_get(unsigned long count[MM_CTRS]) {
+    memset(count, 0, MM_CTRS * sizeof(*count));
+#ifdef MM_STATS
+    ctr_block_t *b;
+    int i;
+
+    pthread_mutex_lock(&ctr_lock);
+    memcpy(count, ctr_exited, sizeof(ctr_exited));
+    for (b = ctr_head; b != NULL; b = b->next)
+        if (b->gen == heap_gen)
+            for (i = 0; i < MM_CTRS; i++)
+                count[i] += __atomic_load_n(&b->count[i], __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ctr_lock);
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/*
+ * mm_stats_dump - Print the counters of mm_stats_get to fp, one per
+ *      line, with the mean search steps per fit search.  Prints nothing
+ *      and returns -1 without MM_STATS.
+ */
+int mm_stats_dump(FILE *fp) {
+    unsigned long count[MM_CTRS];
+    int i;
+
+    if (mm_stats_get(count) < 0)
+        return -1;
+    for (i = 0; i < MM_CTRS; i++)
+        fprintf(fp, "  %-18s%12lu\n", ctr_names[i], count[i]);
+    if (count[MM_CTR_FITS] > 0)
+        fprintf(fp, "  %-18s%12.2f\n", "steps per search",
+                (double)count[MM_CTR_STEPS] / count[MM_CTR_FITS]);
+    return 0;
+}
+
+#ifdef MM_STATS
+/*
+ * ctr_link - Start the calling thread's counts over for the current
+ *      heap, putting its counters on the list if they are not yet.
+ */
+static void ctr_link(void) {
+    pthread_mutex_lock(&ctr_lock);
+    memset(ctrs.count, 0, sizeof(ctrs.count));
+    ctrs.gen = heap_gen;
+    if (!ctrs.linked) {
+        ctrs.prev = NULL;
+        ctrs.next = ctr_head;
+        if (ctr_head != NULL)
+            ctr_head->prev = &ctrs;
+        ctr_head = &ctrs;
+        ctrs.linked = 1;
+    }
+    pthread_mutex_unlock(&ctr_lock);
+}
+
+/*
+ * ctr_unlink - Fold an exiting thread's counts into ctr_exited and take
+ *      its counters off the list.
+ */
+static void ctr_unlink(void) {
+    int i;
+
+    pthread_mutex_lock(&ctr_lock);
+    if (ctrs.linked) {
+        if (ctrs.gen == heap_gen)
+            for (i = 0; i < MM_CTRS; i++)
+                ctr_exited[i] += ctrs.count[i];
+        if (ctrs.prev != NULL)
+            ctrs.prev->next = ctrs.next;
+        else
+            ctr_head = ctrs.next;
+        if (ctrs.next != NULL)
+            ctrs.next->prev = ctrs.prev;
+        ctrs.linked = 0;
+    }
+    pthread_mutex_unlock(&ctr_lock);
+}
+#endif
+
+/*
+ * remote_push - Put block bp, which belongs to arena a but not to the
+ *      calling thread's arena, on a's remote queue.  Takes no lock.
+ */
+static void remote_push(arena_t *a, char *bp) {
+    char *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+
+    COUNT(MM_CTR_REMOTE);
+    do {
+        TC_NEXT(bp) = head;
+    } while (!__atomic_compare_exchange_n(&a->remote, &head, bp, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * remote_drain - Take arena a's whole remote queue at once and free
+ *      its blocks.  Since the queue is emptied by an exchange, never
+ *      popped block by block, pushes cannot suffer from ABA.  Caller
+ *      holds a->lock.
+ */
+static void remote_drain(arena_t *a) {
+    char *bp = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+    char *next;
+
+    for (; bp != NULL; bp = next) {
+        next = TC_NEXT(bp);
+        if (is_slot(bp))
+            slab_free(a, bp);
+        else
+            block_free(a, bp);
+    }
+}
+
+/*
+ * extend_heap - Extend the heap so that a free block of at least size
+ *      bytes sits before the epilogue.  If the last block is already
+ *      free, only the missing part is requested.  Returns the (coalesced,
+ *      unlisted) free block, or NULL if the heap cannot grow.
+ */
+static void *extend_heap(arena_t *a, size_t size) {
+    int id = a - arenas;
+    char *bp;
+    char *last;
+    size_t incr = MAX(size, CHUNKSIZE);
+
+    /* Reuse a free block that sits right before the epilogue */
+    last = (char *)mem_arena_hi(id) + 1;   /* just past the epilogue */
+    if (!GET_PREV_ALLOC(last - WSIZE)) {
+        size_t lastsize = GET_SIZE(last - DSIZE);
+        incr = MAX(size - lastsize, DSIZE);
+    }
+
+    COUNT(MM_CTR_SBRKS);
+    if ((long)(bp = mem_arena_sbrk(id, incr)) == -1)
+        return NULL;
+
+    /* Initialize free block header/footer and the epilogue header; the
+       header takes over the old epilogue's prev-alloc bit */
+    PUT(HDRP(bp), PACK(incr, GET_PREV_ALLOC(HDRP(bp))));
+    PUT(FTRP(bp), GET(HDRP(bp)));
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, ALLOC));   /* new epilogue header */
+
+    /* Coalesce if the previous block was free; the old footer and
+       epilogue then lie inside the block, where calloc expects zeroes */
+    if ((last = coalesce(a, bp)) != bp) {
+        PUT(HDRP(bp) - WSIZE, 0);
+        PUT(HDRP(bp), 0);
+    }
+    return last;
+}
+
+/*
+ * coalesce - Boundary tag coalescing.  Removes free neighbours from
+ *      their lists and returns a pointer to the merged (unlisted) block.
+ *      The block after it is marked as following a free block.
+ */
+static void *coalesce(arena_t *a, void *bp) {
+    size_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+    size_t next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+    size_t size = GET_SIZE(HDRP(bp));
+
+    COUNT_N(MM_CTR_COALESCES, !prev_alloc || !next_alloc);
+    if (prev_alloc && next_alloc) {            /* Case 1 */
+        /* nothing to merge */
+    }
+
+    else if (prev_alloc && !next_alloc) {      /* Case 2 */
+        remove_free(a, NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(size, PREV_ALLOC));
+    }
+
+    else if (!prev_alloc && next_alloc) {      /* Case 3 */
+        remove_free(a, PREV_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+        PUT(FTRP(bp), PACK(size, PREV_ALLOC));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
+        bp = PREV_BLKP(bp);
+    }
+
+    else {                                     /* Case 4 */
+        remove_free(a, PREV_BLKP(bp));
+        remove_free(a, NEXT_BLKP(bp));
+        size += GET_SIZE(HDRP(PREV_BLKP(bp))) +
+            GET_SIZE(HDRP(NEXT_BLKP(bp)));
+        PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
+        PUT(FTRP(NEXT_BLKP(bp)), PACK(size, PREV_ALLOC));
+        bp = PREV_BLKP(bp);
+    }
+    CLR_PREV_ALLOC(bp);
+    CHECK_CLAMP(a, bp);
+    return bp;
+}
+
+/*
+ * find_fit - Find a free block of at least asize bytes.  Within the
+ *      first bin that can hold asize, the tightest of the first
+ *      FIT_CANDIDATES fitting blocks wins; every block of a higher bin
+ *      fits, so the head of the next non-empty bin is taken.
+ */
+static void *find_fit(arena_t *a, size_t asize) {
+    int bin;
+    char *bp;
+    char *best = NULL;
+    size_t bestsize = 0;
+    int found = 0;
+
+    COUNT(MM_CTR_FITS);
+    if (asize >= TREE_MIN)
+        return tree_fit(a, asize);
+
+    bin = size_to_bin(asize);
+    for (bp = a->seg_heads[bin]; bp != NULL; bp = NEXT_FREE(a, bp)) {
+        size_t bsize = GET_SIZE(HDRP(bp));
+        COUNT(MM_CTR_STEPS);
+        if (bsize < asize)
+            continue;
+        if (best == NULL || bsize < bestsize) {
+            best = bp;
+            bestsize = bsize;
+        }
+        if (bsize == asize || ++found == FIT_CANDIDATES)
+            break;
+    }
+    if (best != NULL)
+        return best;
+
+    for (bin++; bin < NUM_BINS; bin++) {
+        COUNT(MM_CTR_STEPS);
+        if (a->seg_heads[bin] != NULL)
+            return a->seg_heads[bin];
+    }
+
+    return tree_fit(a, asize);
+}
+
+/*
+ * place - Place a block of asize bytes at the start of block bp, whose
+ *      header gives its full size, and split if the remainder would be
+ *      at least the minimum block size.  bp must not be on a free list.
+ */
+static void place(arena_t *a, void *bp, size_t asize) {
+    size_t csize = GET_SIZE(HDRP(bp));
+    uint32_t prev = GET_PREV_ALLOC(HDRP(bp));
+    char *end = (char *)bp + ((csize - asize) >= MINBLOCK ? asize : csize);
+
+    /* Move the fresh mark past the block, noting whether it lies wholly
+       on fresh memory */
+    if (end > a->fresh) {
+        if ((char *)bp >= a->fresh)
+            fresh_bp = bp;
+        a->fresh = end;
+    }
+
+    if ((csize - asize) >= MINBLOCK) {
+        COUNT(MM_CTR_SPLITS);
+        PUT(HDRP(bp), PACK(asize, prev | ALLOC));
+        bp = NEXT_BLKP(bp);
+        PUT(HDRP(bp), PACK(csize-asize, PREV_ALLOC));
+        PUT(FTRP(bp), PACK(csize-asize, PREV_ALLOC));
+        CLR_PREV_ALLOC(bp);
+        insert_free(a, bp);
+    }
+    else {
+        PUT(HDRP(bp), PACK(csize, prev | ALLOC));
+        SET_PREV_ALLOC(bp);
+    }
+}
+
+/*
+ * size_to_bin - Map a block size to its segregated list index.
+ */
+static int size_to_bin(size_t size) {
+    return mm_bin_by_clz[__builtin_clz((uint32_t)size)];
+}
+
+/*
+ * insert_free - Push free block bp on the front of its list (LIFO).
+ */
+static void insert_free(arena_t *a, void *bp) {
+    int bin;
+
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+        tree_insert(a, bp);
+        return;
+    }
+
+    bin = size_to_bin(GET_SIZE(HDRP(bp)));
+    SET_NEXT_FREE(a, bp, a->seg_heads[bin]);
+    SET_PREV_FREE(a, bp, NULL);
+    if (a->seg_heads[bin] != NULL)
+        SET_PREV_FREE(a, a->seg_heads[bin], bp);
+    a->seg_heads[bin] = bp;
+}
+
+/*
+ * remove_free - Unlink free block bp from its list.
+ */
+static void remove_free(arena_t *a, void *bp) {
+    char *next, *prev;
+
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+        tree_remove(a, bp);
+        return;
+    }
+
+    next = NEXT_FREE(a, bp);
+    prev = PREV_FREE(a, bp);
+    if (prev != NULL)
+        SET_NEXT_FREE(a, prev, next);
+    else
+        a->seg_heads[size_to_bin(GET_SIZE(HDRP(bp)))] = next;
+    if (next != NULL)
+        SET_PREV_FREE(a, next, prev);
+}
+
+/*
+ * tree_fit - Return the smallest free block of at least asize bytes in
+ *      the tree of arena a, the lowest one among equals, or NULL.
+ */
+static char *tree_fit(arena_t *a, size_t asize) {
+    char *bp = a->tree_root;
+    char *best = NULL;
+
+    while (bp != NULL) {
+        COUNT(MM_CTR_STEPS);
+        if (GET_SIZE(HDRP(bp)) >= asize) {
+            best = bp;
+            bp = TREE_LEFT(a, bp);
+        } else {
+            bp = TREE_RIGHT(a, bp);
+        }
+    }
+    return best;
+}
+
+/*
+ * tree_replace - Put the subtree v where the subtree u hangs.
+ */
+static void tree_replace(arena_t *a, char *u, char *v) {
+    char *p = TREE_PARENT(a, u);
+
+    if (p == NULL)
+        a->tree_root = v;
+    else if (TREE_LEFT(a, p) == u)
+        SET_TREE_LEFT(a, p, v);
+    else
+        SET_TREE_RIGHT(a, p, v);
+    if (v != NULL)
+        SET_TREE_PARENT(a, v, p);
+}
+
+/*
+ * tree_rotate - Rotate the tree of arena a left (left != 0) or right
+ *      around node x.
+ */
+static void tree_rotate(arena_t *a, char *x, int left) {
+    char *y, *c;
+
+    if (left) {
+        y = TREE_RIGHT(a, x);
+        c = TREE_LEFT(a, y);
+        SET_TREE_RIGHT(a, x, c);
+    } else {
+        y = TREE_LEFT(a, x);
+        c = TREE_RIGHT(a, y);
+        SET_TREE_LEFT(a, x, c);
+    }
+    if (c != NULL)
+        SET_TREE_PARENT(a, c, x);
+    tree_replace(a, x, y);
+    if (left)
+        SET_TREE_LEFT(a, y, x);
+    else
+        SET_TREE_RIGHT(a, y, x);
+    SET_TREE_PARENT(a, x, y);
+}
+
+/*
+ * tree_insert - Add free block z to the tree of arena a and rebalance.
+ */
+static void tree_insert(arena_t *a, char *z) {
+    char *p = NULL;
+    char *x = a->tree_root;
+    char *g, *u;
+    int left;
+
+    while (x != NULL) {
+        p = x;
+        x = TREE_LESS(z, x) ? TREE_LEFT(a, x) : TREE_RIGHT(a, x);
+    }
+    SET_TREE_LEFT(a, z, NULL);
+    SET_TREE_RIGHT(a, z, NULL);
+    SET_TREE_PARENT(a, z, p);
+    SET_TREE_RED(z, 1);
+    if (p == NULL)
+        a->tree_root = z;
+    else if (TREE_LESS(z, p))
+        SET_TREE_LEFT(a, p, z);
+    else
+        SET_TREE_RIGHT(a, p, z);
+
+    /* Fix a red node under a red parent */
+    while ((p = TREE_PARENT(a, z)) != NULL && TREE_RED(p)) {
+        g = TREE_PARENT(a, p);
+        left = p == TREE_LEFT(a, g);
+        u = left ? TREE_RIGHT(a, g) : TREE_LEFT(a, g);
+        if (u != NULL && TREE_RED(u)) {
+            SET_TREE_RED(p, 0);
+            SET_TREE_RED(u, 0);
+            SET_TREE_RED(g, 1);
+            z = g;
+            continue;
+        }
+        if (z == (left ? TREE_RIGHT(a, p) : TREE_LEFT(a, p))) {
+            z = p;
+            tree_rotate(a, z, left);
+            p = TREE_PARENT(a, z);
+        }
+        SET_TREE_RED(p, 0);
+        SET_TREE_RED(g, 1);
+        tree_rotate(a, g, !left);
+    }
+    SET_TREE_RED(a->tree_root, 0);
+}
+
+/*
+ * tree_remove - Take free block z out of the tree of arena a and
+ *      rebalance.
+ */
+static void tree_remove(arena_t *a, char *z) {
+    char *x, *xp, *y, *w;
+    int red = TREE_RED(z);
+    int left;
+
+    if (TREE_LEFT(a, z) == NULL || TREE_RIGHT(a, z) == NULL) {
+        x = TREE_LEFT(a, z) != NULL ? TREE_LEFT(a, z) : TREE_RIGHT(a, z);
+        xp = TREE_PARENT(a, z);
+        tree_replace(a, z, x);
+    } else {
+        /* Replace z by its successor y */
+        for (y = TREE_RIGHT(a, z); TREE_LEFT(a, y) != NULL; y = TREE_LEFT(a, y))
+            ;
+        red = TREE_RED(y);
+        x = TREE_RIGHT(a, y);
+        if (TREE_PARENT(a, y) == z) {
+            xp = y;
+        } else {
+            xp = TREE_PARENT(a, y);
+            tree_replace(a, y, x);
+            SET_TREE_RIGHT(a, y, TREE_RIGHT(a, z));
+            SET_TREE_PARENT(a, TREE_RIGHT(a, y), y);
+        }
+        tree_replace(a, z, y);
+        SET_TREE_LEFT(a, y, TREE_LEFT(a, z));
+        SET_TREE_PARENT(a, TREE_LEFT(a, y), y);
+        SET_TREE_RED(y, TREE_RED(z));
+    }
+    if (red)
+        return;
+
+    /* x carries an extra black; push it up or resolve it */
+    while (x != a->tree_root && (x == NULL || !TREE_RED(x))) {
+        left = x == TREE_LEFT(a, xp);
+        w = left ? TREE_RIGHT(a, xp) : TREE_LEFT(a, xp);
+        if (TREE_RED(w)) {
+            SET_TREE_RED(w, 0);
+            SET_TREE_RED(xp, 1);
+            tree_rotate(a, xp, left);
+            w = left ? TREE_RIGHT(a, xp) : TREE_LEFT(a, xp);
+        }
+        y = left ? TREE_RIGHT(a, w) : TREE_LEFT(a, w);     /* far nephew */
+        if ((y == NULL || !TREE_RED(y))) {
+            char *n = left ? TREE_LEFT(a, w) : TREE_RIGHT(a, w);
+            if (n == NULL || !TREE_RED(n)) {
+                SET_TREE_RED(w, 1);
+                x = xp;
+                xp = TREE_PARENT(a, x);
+                continue;
+            }
+            SET_TREE_RED(n, 0);
+            SET_TREE_RED(w, 1);
+            tree_rotate(a, w, !left);
+            w = left ? TREE_RIGHT(a, xp) : TREE_LEFT(a, xp);
+            y = left ? TREE_RIGHT(a, w) : TREE_LEFT(a, w);
+        }
+        SET_TREE_RED(w, TREE_RED(xp));
+        SET_TREE_RED(xp, 0);
+        SET_TREE_RED(y, 0);
+        tree_rotate(a, xp, left);
+        x = a->tree_root;
+    }
+    if (x != NULL)
+        SET_TREE_RED(x, 0);
+}
+
+/*
+ * mm_heap_stats - Sum up the blocks of every arena and the mapped
+ *      blocks by state and size class.
+ */
+void mm_heap_stats(mm_heap_stats_t *st) {
+    char *bp;
+    size_t free_bytes;
+    int i;
+
+    memset(st, 0, sizeof(*st));
+    for (i = 0; i < MEM_MAX_ARENAS; i++) {
+        pthread_mutex_lock(&arenas[i].lock);
+        if (arenas[i].heap_listp != NULL)
+            heapstats(&arenas[i], st);
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+
+    pthread_mutex_lock(&mapped_lock);
+    for (bp = mapped_head; bp != NULL; bp = MAP_NEXT(bp)) {
+        st->blocks[MM_BLK_MAPPED]++;
+        st->bytes[MM_BLK_MAPPED] += MAP_LEN(bp);
+        st->class_alloc[stat_class(MAP_LEN(bp))] += MAP_LEN(bp);
+        st->heap_bytes += MAP_LEN(bp);
+    }
+    pthread_mutex_unlock(&mapped_lock);
+
+    free_bytes = st->bytes[MM_BLK_FREE];
+    st->frag = free_bytes ? 1.0 - (double)st->largest_free / free_bytes : 0.0;
+}
+
+/*
+ * mm_class_size - The bytes a request of size bytes occupies: a slot
+ *      if a slab class holds it, a mapping if it is huge, otherwise an
+ *      ordinary block.
+ */
+size_t mm_class_size(size_t size) {
+    size_t threshold = mmap_threshold ? mmap_threshold : MMAP_THRESHOLD;
+    size_t page = mem_pagesize();
+
+    if (size == 0)
+        return 0;
+    if (size >= threshold || size >= MAX_BLOCK)
+        return (size + MAP_OVERHEAD + page - 1) & ~(page - 1);
+    if (size <= SLAB_MAX)
+        return SLOT_SIZE(SLAB_CLASS(size));
+    return ADJUST(size);
+}
+
+/*
+ * stat_class - The mm_heap_stats size class of a block of size bytes
+ */
+static int stat_class(size_t size) {
+    int k = 63 - __builtin_clzl(size | 1) - 4;
+
+    return (k < 0) ? 0 : (k >= MM_STAT_CLASSES) ? MM_STAT_CLASSES - 1 : k;
+}
+
+/*
+ * heapstats - Add the blocks of arena a to *st.  Caller holds a->lock.
+ */
+static void heapstats(arena_t *a, mm_heap_stats_t *st) {
+    char *bp;
+    size_t size, slot, used;
+    slab_t *s;
+
+    st->heap_bytes += mem_arena_heapsize(a - arenas);
+    for (bp = NEXT_BLKP(a->heap_listp); (size = GET_SIZE(HDRP(bp))) > 0;
+         bp = NEXT_BLKP(bp)) {
+        if (!GET_ALLOC(HDRP(bp))) {
+            st->blocks[MM_BLK_FREE]++;
+            st->bytes[MM_BLK_FREE] += size;
+            st->class_free[stat_class(size)] += size;
+            st->largest_free = MAX(st->largest_free, size);
+        } else if (is_slot(bp)) {
+            s = (slab_t *)bp;
+            slot = SLOT_SIZE(s->cls);
+            used = s->nslots - s->nfree;
+            st->blocks[MM_BLK_SLOT] += used;
+            st->bytes[MM_BLK_SLOT] += used * slot;
+            st->blocks[MM_BLK_SLOT_FREE] += s->nfree;
+            st->bytes[MM_BLK_SLOT_FREE] += s->nfree * slot;
+            st->class_alloc[stat_class(slot)] += used * slot;
+            st->class_free[stat_class(slot)] += s->nfree * slot;
+        } else {
+            st->blocks[MM_BLK_ALLOC]++;
+            st->bytes[MM_BLK_ALLOC] += size;
+            st->class_alloc[stat_class(size)] += size;
+        }
+    }
+}
+
+/*
+ * Return whether the pointer is in the heap of some arena or in a
+ * mapped block.  May be useful for debugging.
+ */
+static int in_heap(const void *p) {
+    return mem_in_heap(p, p);
+}
+
+/*
+ * Return whether the pointer is aligned.
+ * May be useful for debugging.
+ */
+static int aligned(const void *p) {
+    return (size_t)ALIGN(p) == (size_t)p;
+}
+
+/*
+ * mm_check_mode - Choose what mm_checkheap does: walk everything
+ *      (MM_CHECK_FULL), check the next k blocks of the arenas in turn
+ *      (MM_CHECK_INCREMENTAL), or check one random free block and what
+ *      lies around it (MM_CHECK_SAMPLED).
+ */
+void mm_check_mode(int mode, int k) {
+    pthread_mutex_lock(&check_lock);
+    check_mode = mode;
+    check_k = k > 0 ? k : CHECK_K;
+    pthread_mutex_unlock(&check_lock);
+}
+
+/*
+ * mm_checkheap - Check the heap and report any broken invariant: bad
+ *      alignment, header/footer mismatch, stale prev-alloc bits, blocks
+ *      outside the heap, uncoalesced neighbours, free blocks that are
+ *      missing from (or misfiled in) the lists, and broken list links.
+ *      How much is checked per call depends on mm_check_mode; only the
+ *      full walk checks that every free block is listed, and mapped
+ *      blocks.  With verbose > 2 every block checked is printed as well.
+ */
+void mm_checkheap(int verbose) {
+    int i;
+
+    switch (check_mode) {
+    case MM_CHECK_INCREMENTAL:
+        checkincr(verbose);
+        return;
+    case MM_CHECK_SAMPLED:
+        checksample(verbose);
+        return;
+    }
+
+    for (i = 0; i < MEM_MAX_ARENAS; i++) {
+        pthread_mutex_lock(&arenas[i].lock);
+        if (arenas[i].heap_listp != NULL)
+            checkheap(&arenas[i], verbose);
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+
+    pthread_mutex_lock(&mapped_lock);
+    checkmapped(verbose);
+    pthread_mutex_unlock(&mapped_lock);
+}
+
+/*
+ * checkincr - Check the next check_k blocks, starting where the last
+ *      call stopped and moving on to the next arena at the end of one.
+ */
+static void checkincr(int verbose) {
+    int left, tries, id;
+    arena_t *a;
+
+    pthread_mutex_lock(&check_lock);
+    left = check_k;
+    for (tries = 0; left > 0 && tries <= MEM_MAX_ARENAS; tries++) {
+        a = &arenas[check_arena];
+        pthread_mutex_lock(&a->lock);
+        if (a->heap_listp != NULL)
+            left -= checkrange(a, left, verbose);
+        id = a->heap_listp == NULL || a->check_at == NULL;
+        pthread_mutex_unlock(&a->lock);
+        if (!id)
+            break;
+        check_arena = (check_arena + 1) % MEM_MAX_ARENAS;
+    }
+    pthread_mutex_unlock(&check_lock);
+}
+
+/*
+ * checkrange - Check up to n blocks of arena a from a->check_at on,
+ *      and leave a->check_at at the next one, or NULL once the epilogue
+ *      is reached.  Returns the number of blocks checked.  Caller holds
+ *      a->lock.
+ */
+static int checkrange(arena_t *a, int n, int verbose) {
+    char *bp = a->check_at;
+    int done = 0;
+
+    /* Start over if the heap has shrunk past the cursor */
+    if (bp == NULL || bp <= a->heap_listp || !aligned(bp) ||
+        HDRP(bp) >= (char *)mem_arena_hi(a - arenas) + 1)
+        bp = NEXT_BLKP(a->heap_listp);
+
+    for (; done < n && GET_SIZE(HDRP(bp)) > 0; done++, bp = NEXT_BLKP(bp))
+        if (checkblock(a, bp, verbose) < 0)
+            break;
+
+    if (done < n || GET_SIZE(HDRP(bp)) == 0) {
+        checkends(a);
+        bp = NULL;
+    }
+    a->check_at = bp;
+    return done;
+}
+
+/*
+ * checksample - Check a random free block of a random arena, the block
+ *      after it and its free-list neighbours.  The block is found by
+ *      walking at most CHECK_STEPS links of a random list, or down a
+ *      random path of the tree, so the cost is bounded.
+ */
+static void checksample(int verbose) {
+    static __thread uint64_t rng = 0x9e3779b97f4a7c15ULL;
+    arena_t *a;
+    char *bp, *next;
+    int i, r, bin, id;
+
+    /* xorshift64 */
+#define CHECK_RAND() (rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17)
+
+    id = CHECK_RAND() % MEM_MAX_ARENAS;
+    for (i = 0; i < MEM_MAX_ARENAS && arenas[id].heap_listp == NULL; i++)
+        id = (id + 1) % MEM_MAX_ARENAS;
+    a = &arenas[id];
+
+    pthread_mutex_lock(&a->lock);
+    if (a->heap_listp == NULL) {
+        pthread_mutex_unlock(&a->lock);
+        return;
+    }
+
+    /* A random list, or the tree, that has a block */
+    bp = NULL;
+    r = CHECK_RAND() % (NUM_BINS + 1);
+    for (i = 0; i <= NUM_BINS && bp == NULL; i++) {
+        bin = (r + i) % (NUM_BINS + 1);
+        bp = bin < NUM_BINS ? a->seg_heads[bin] : a->tree_root;
+    }
+    if (bp != NULL) {
+        for (r = CHECK_RAND() % CHECK_STEPS; r > 0; r--) {
+            if (bin < NUM_BINS)
+                next = NEXT_FREE(a, bp);
+            else
+                next = CHECK_RAND() & 1 ? TREE_LEFT(a, bp) : TREE_RIGHT(a, bp);
+            if (next == NULL || mem_arena_of(next) != id)
+                break;
+            bp = next;
+        }
+    } else {
+        bp = NEXT_BLKP(a->heap_listp);      /* no free block at all */
+    }
+#undef CHECK_RAND
+
+    if (GET_SIZE(HDRP(bp)) > 0 && checkblock(a, bp, verbose) == 0 &&
+        GET_SIZE(HDRP(NEXT_BLKP(bp))) > 0)
+        checkblock(a, NEXT_BLKP(bp), verbose);
+    pthread_mutex_unlock(&a->lock);
+}
+
+/*
+ * checkmapped - Check the list of mapped blocks.  Caller holds
+ *      mapped_lock.
+ */
+static void checkmapped(int verbose) {
+    char *bp;
+    size_t len;
+
+    for (bp = mapped_head; bp != NULL; bp = MAP_NEXT(bp)) {
+        len = MAP_LEN(bp);
+        if (verbose > 2)
+            printf("%p: length %zu mapped\n", bp, len);
+        if (!in_heap(bp) || !in_heap(bp + len - MAP_OVERHEAD - 1)) {
+            printf("mm_checkheap: mapped block %p lies outside the heap\n", bp);
+            break;
+        }
+        if (GET(HDRP(bp)) != PACK(0, MAPPED | ALLOC))
+            printf("mm_checkheap: mapped block %p has bad header\n", bp);
+        if (mem_map_size(bp - MAP_OVERHEAD) != len)
+            printf("mm_checkheap: mapped block %p has bad length %zu\n", bp, len);
+        if (MAP_NEXT(bp) != NULL && MAP_PREV(MAP_NEXT(bp)) != bp)
+            printf("mm_checkheap: %p next/prev links disagree\n", bp);
+    }
+}
+
+/*
+ * checkheap - Check the heap of one arena.  Caller holds a->lock.
+ *      Blocks held in thread caches or remote queues look allocated.
+ */
+static void checkheap(arena_t *a, int verbose) {
+    int id = a - arenas;
+    char *bp;
+    int bin;
+    int heap_free = 0;
+    int list_free = 0;
+    int slabs = 0;
+    int mapped_pages = 0;
+    slab_t *s;
+    size_t pg;
+
+    /* Every block in address order */
+    for (bp = NEXT_BLKP(a->heap_listp); GET_SIZE(HDRP(bp)) > 0;
+         bp = NEXT_BLKP(bp)) {
+        if (checkblock(a, bp, verbose) < 0)
+            return;
+        if (!GET_ALLOC(HDRP(bp)))
+            heap_free++;
+        else if (is_slot(bp))
+            slabs++;
+    }
+    checkends(a);
+
+    /* Every free list */
+    for (bin = 0; bin < NUM_BINS; bin++) {
+        for (bp = a->seg_heads[bin]; bp != NULL; bp = NEXT_FREE(a, bp)) {
+            if (mem_arena_of(bp) != id || !in_heap(bp)) {
+                printf("mm_checkheap: arena %d list %d points outside it\n",
+                       id, bin);
+                break;
+            }
+            if (GET_ALLOC(HDRP(bp)))
+                printf("mm_checkheap: %p on list %d is allocated\n", bp, bin);
+            if (size_to_bin(GET_SIZE(HDRP(bp))) != bin)
+                printf("mm_checkheap: %p filed in wrong list %d\n", bp, bin);
+            list_free++;
+        }
+    }
+
+    /* The tree */
+    if (a->tree_root != NULL && TREE_RED(a->tree_root))
+        printf("mm_checkheap: arena %d tree root is red\n", id);
+    checktree(a, a->tree_root, NULL, &list_free);
+
+    if (heap_free != list_free)
+        printf("mm_checkheap: %d free blocks in heap but %d on lists\n",
+               heap_free, list_free);
+
+    /* Every slab list, and the slab page map */
+    for (bin = 0; bin < SLAB_CLASSES; bin++) {
+        for (s = a->slabs[bin]; s != NULL; s = s->next) {
+            if (!is_slot(s) || SLAB_OF(s) != s) {
+                printf("mm_checkheap: arena %d slab list %d points outside it\n",
+                       id, bin);
+                break;
+            }
+            if (s->cls != bin || s->nfree == 0)
+                printf("mm_checkheap: slab %p misfiled in list %d\n", s, bin);
+            if (s->next != NULL && s->next->prev != s)
+                printf("mm_checkheap: slab %p next/prev links disagree\n", s);
+        }
+    }
+    for (pg = 0; pg < SLAB_PAGES; pg++)
+        mapped_pages += SLAB_PAGE(a, pg);
+    if (mapped_pages != slabs)
+        printf("mm_checkheap: %d slab pages mapped but %d slabs in heap\n",
+               mapped_pages, slabs);
+}
+
+/*
+ * checkends - Check the prologue and the epilogue of arena a.  Caller
+ *      holds a->lock.
+ */
+static void checkends(arena_t *a) {
+    char *last = (char *)mem_arena_hi(a - arenas) + 1;
+
+    if (GET_SIZE(HDRP(a->heap_listp)) != DSIZE || !GET_ALLOC(HDRP(a->heap_listp)))
+        printf("mm_checkheap: bad prologue block\n");
+    if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(a->heap_listp))))
+        printf("mm_checkheap: first block has a stale prev-alloc bit\n");
+    if (GET(last - WSIZE) != PACK(0, ALLOC) &&
+        GET(last - WSIZE) != PACK(0, PREV_ALLOC | ALLOC))
+        printf("mm_checkheap: bad epilogue block\n");
+}
+
+/*
+ * checkblock - Check block bp of arena a on its own: alignment, size,
+ *      that it lies in the heap, that the next block's prev-alloc bit
+ *      and header agree with it, and, if it is free, its footer, that
+ *      it was coalesced and its list or tree links.  Returns -1 if bp
+ *      is too broken to find the next block from.  Caller holds a->lock.
+ */
+static int checkblock(arena_t *a, char *bp, int verbose) {
+    size_t size = GET_SIZE(HDRP(bp));
+    int alloc = GET_ALLOC(HDRP(bp));
+    char *next;
+
+    if (verbose > 2)
+        printf("%p: size %zu %s\n", bp, size, alloc ? "alloc" : "free");
+    if (!aligned(bp))
+        printf("mm_checkheap: %p is not aligned\n", bp);
+    if (size < MINBLOCK || size % ALIGNMENT != 0) {
+        printf("mm_checkheap: %p has bad size %zu\n", bp, size);
+        return -1;
+    }
+    if (!in_heap(bp) || !in_heap(NEXT_BLKP(bp) - 1)) {
+        printf("mm_checkheap: %p lies outside the heap\n", bp);
+        return -1;
+    }
+    if (GET_MAPPED(HDRP(bp)))
+        printf("mm_checkheap: %p in an arena is marked mapped\n", bp);
+
+    next = NEXT_BLKP(bp);
+    if (!GET_PREV_ALLOC(HDRP(next)) != !alloc)
+        printf("mm_checkheap: %p has a stale prev-alloc bit\n", next);
+
+    if (alloc) {
+        if (is_slot(bp)) {
+            if (SLAB_OF(bp) != (slab_t *)bp || size < SLAB_SIZE)
+                printf("mm_checkheap: %p overlaps a slab\n", bp);
+            else
+                checkslab(a, (slab_t *)bp);
+        }
+        return 0;
+    }
+
+    if (GET(HDRP(bp)) != GET(FTRP(bp)))
+        printf("mm_checkheap: %p header does not match footer\n", bp);
+    if (!GET_PREV_ALLOC(HDRP(bp)) || !GET_ALLOC(HDRP(next)))
+        printf("mm_checkheap: %p was not coalesced\n", bp);
+    checklinks(a, bp);
+    return 0;
+}
+
+/*
+ * checklinks - Check that the links of free block bp and of its list or
+ *      tree neighbours agree, and that those neighbours are free blocks
+ *      of arena a.  Caller holds a->lock.
+ */
+static void checklinks(arena_t *a, char *bp) {
+    int id = a - arenas;
+    char *p, *l, *r, *n;
+
+    if (GET_SIZE(HDRP(bp)) >= TREE_MIN) {
+        p = TREE_PARENT(a, bp);
+        l = TREE_LEFT(a, bp);
+        r = TREE_RIGHT(a, bp);
+        if ((p != NULL && mem_arena_of(p) != id) ||
+            (l != NULL && mem_arena_of(l) != id) ||
+            (r != NULL && mem_arena_of(r) != id)) {
+            printf("mm_checkheap: %p has tree links outside arena %d\n", bp, id);
+            return;
+        }
+        if (p == NULL ? a->tree_root != bp :
+            TREE_LEFT(a, p) != bp && TREE_RIGHT(a, p) != bp)
+            printf("mm_checkheap: %p is not a child of its tree parent\n", bp);
+        if ((l != NULL && TREE_PARENT(a, l) != bp) ||
+            (r != NULL && TREE_PARENT(a, r) != bp))
+            printf("mm_checkheap: %p is not the parent of its children\n", bp);
+        if ((p != NULL && GET_ALLOC(HDRP(p))) ||
+            (l != NULL && GET_ALLOC(HDRP(l))) ||
+            (r != NULL && GET_ALLOC(HDRP(r))))
+            printf("mm_checkheap: %p has an allocated tree neighbour\n", bp);
+        return;
+    }
+
+    p = PREV_FREE(a, bp);
+    n = NEXT_FREE(a, bp);
+    if ((p != NULL && mem_arena_of(p) != id) ||
+        (n != NULL && mem_arena_of(n) != id)) {
+        printf("mm_checkheap: %p has list links outside arena %d\n", bp, id);
+        return;
+    }
+    if (p == NULL ? a->seg_heads[size_to_bin(GET_SIZE(HDRP(bp)))] != bp :
+        NEXT_FREE(a, p) != bp)
+        printf("mm_checkheap: %p is not linked from its list\n", bp);
+    if (n != NULL && PREV_FREE(a, n) != bp)
+        printf("mm_checkheap: %p next/prev links disagree\n", bp);
+    if ((p != NULL && GET_ALLOC(HDRP(p))) || (n != NULL && GET_ALLOC(HDRP(n))))
+        printf("mm_checkheap: %p has an allocated list neighbour\n", bp);
+}
+
+/*
+ * checktree - Check the subtree at bp, whose parent should be parent:
+ *      links, order, sizes, and that no red node has a red child.
+ *      Adds its nodes to *count and returns its black height, or -1 if
+ *      the black heights of its paths differ.
+ */
+static int checktree(arena_t *a, char *bp, char *parent, int *count) {
+    char *l, *r;
+    int lh, rh;
+
+    if (bp == NULL)
+        return 0;
+    if (mem_arena_of(bp) != a - arenas || !in_heap(bp)) {
+        printf("mm_checkheap: arena %d tree points outside it\n",
+               (int)(a - arenas));
+        return -1;
+    }
+    if (GET_ALLOC(HDRP(bp)))
+        printf("mm_checkheap: %p in the tree is allocated\n", bp);
+    if (GET_SIZE(HDRP(bp)) < TREE_MIN)
+        printf("mm_checkheap: %p in the tree is too small\n", bp);
+    if (TREE_PARENT(a, bp) != parent)
+        printf("mm_checkheap: %p has a bad tree parent\n", bp);
+    (*count)++;
+
+    l = TREE_LEFT(a, bp);
+    r = TREE_RIGHT(a, bp);
+    if ((l != NULL && !TREE_LESS(l, bp)) || (r != NULL && !TREE_LESS(bp, r)))
+        printf("mm_checkheap: tree out of order at %p\n", bp);
+    if (TREE_RED(bp) && ((l != NULL && TREE_RED(l)) || (r != NULL && TREE_RED(r))))
+        printf("mm_checkheap: red tree node %p has a red child\n", bp);
+
+    lh = checktree(a, l, bp, count);
+    rh = checktree(a, r, bp, count);
+    if (lh < 0 || rh < 0)
+        return -1;
+    if (lh != rh) {
+        printf("mm_checkheap: tree black heights differ at %p\n", bp);
+        return -1;
+    }
+    return lh + !TREE_RED(bp);
+}
+
+/*
+ * checkslab - Check the header and free bitmap of slab s in arena a.
+ *      Slots held in thread caches look allocated.
+ */
+static void checkslab(arena_t *a, slab_t *s) {
+    int i, nfree = 0;
+    int tail;
+
+    (void)a;
+    if (s->cls >= SLAB_CLASSES || s->first != ALIGN(sizeof(slab_t)) ||
+        s->nslots != SLAB_SLOTS(s->cls)) {
+        printf("mm_checkheap: slab %p has a bad header\n", s);
+        return;
+    }
+    for (i = 0; i < SLAB_WORDS; i++)
+        nfree += __builtin_popcountll(s->free_map[i]);
+    if (nfree != s->nfree)
+        printf("mm_checkheap: slab %p counts %d free slots but has %d\n",
+               s, s->nfree, nfree);
+
+    /* No bits past the last slot */
+    tail = s->nslots % 64;
+    for (i = (s->nslots + 63) / 64; i < SLAB_WORDS; i++)
+        if (s->free_map[i] != 0)
+            printf("mm_checkheap: slab %p frees slots it does not have\n", s);
+    if (tail != 0 && s->free_map[s->nslots / 64] >> tail != 0)
+        printf("mm_checkheap: slab %p frees slots it does not have\n", s);
 }
@@ -18,8 +18,111 @@ extern void *calloc (size_t nmemb, size_t size);
 
 #endif
 
+/* Allocate n blocks of size bytes each into out[] and return how many
+   were allocated; the remaining entries of out[] are set to NULL. */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+
+/* Free the n blocks in ptrs[], skipping NULL entries.  ptrs[] is
+   reordered. */
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* Regions: memory that is released all at once rather than block by
+   block.  A region must not be used by two threads at a time. */
+typedef struct mm_region mm_region_t;
+
+extern mm_region_t *mm_region_create(void);
+extern void *mm_region_alloc(mm_region_t *r, size_t size);
+extern void mm_region_reset(mm_region_t *r);
+extern void mm_region_destroy(mm_region_t *r);
+
+/* Heap statistics.  Size class k covers blocks of [2^(k+4), 2^(k+5))
+   bytes, headers included; class 0 also takes smaller blocks and the
+   last class larger ones. */
+#define MM_STAT_CLASSES 24
+
+/* States a block can be in */
+enum {
+  MM_BLK_ALLOC,         /* allocated ordinary block */
+  MM_BLK_FREE,          /* free ordinary block */
+  MM_BLK_SLOT,          /* allocated slab slot */
+  MM_BLK_SLOT_FREE,     /* free slab slot */
+  MM_BLK_MAPPED,        /* block with a mapping of its own */
+  MM_BLK_STATES
+};
+
+typedef struct {
+  size_t heap_bytes;                    /* arenas plus mappings */
+  size_t largest_free;                  /* largest free ordinary block */
+  double frag;                          /* 1 - largest_free / free bytes */
+  size_t blocks[MM_BLK_STATES];         /* blocks in each state */
+  size_t bytes[MM_BLK_STATES];          /* and the bytes they cover */
+  size_t class_alloc[MM_STAT_CLASSES];  /* allocated bytes by size class */
+  size_t class_free[MM_STAT_CLASSES];   /* free bytes by size class */
+} mm_heap_stats_t;
+
+/* Fill in *st for the whole heap.  Blocks held in thread caches or
+   waiting on remote-free queues count as allocated. */
+extern void mm_heap_stats(mm_heap_stats_t *st);
+
+/* Bytes a block serving a request of size bytes takes up, with its
+   header and the rounding up to its size class but no fragmentation;
+   the sum over the live blocks predicts the heap size. */
+extern size_t mm_class_size(size_t size);
+
+/* Hot-path event counters, kept only when mm.c is built with MM_STATS */
+enum {
+  MM_CTR_MALLOCS,
+  MM_CTR_FREES,
+  MM_CTR_FITS,          /* free-list searches */
+  MM_CTR_STEPS,         /* blocks, lists and tree nodes they looked at */
+  MM_CTR_SPLITS,        /* free blocks split */
+  MM_CTR_COALESCES,     /* frees merged with a free neighbour */
+  MM_CTR_SBRKS,         /* calls to grow or shrink an arena */
+  MM_CTR_TC_HITS,       /* small mallocs served by the thread cache */
+  MM_CTR_TC_MISSES,
+  MM_CTR_SLAB_HITS,     /* tiny mallocs served by cached slots */
+  MM_CTR_SLAB_MISSES,
+  MM_CTR_REALLOC_INPLACE,
+  MM_CTR_REALLOC_COPY,
+  MM_CTR_REMOTE,        /* frees pushed on another arena's queue */
+  MM_CTR_GUARDED,       /* mallocs served from the guard pool */
+  MM_CTR_NODE_LOCAL,    /* mallocs from an arena on the caller's NUMA node */
+  MM_CTR_NODE_REMOTE,   /* mallocs from an arena on another node */
+  MM_CTRS
+};
+
+/* Sum the counters of all threads since mm_init into count[], or
+   return -1 if they are not kept */
+extern int mm_stats_get(unsigned long count[MM_CTRS]);
+
+/* Print the counters to fp, or return -1 if they are not kept */
+extern int mm_stats_dump(FILE *fp);
+
+/* All of the above may be called concurrently from several threads.
+   mm_init resets the heap and must not race with any of them. */
 extern int mm_init(void);
 
 /* This is largely for debugging.  You can do what you want with the
    verbose flag; we don't care. */
 extern void mm_checkheap(int verbose);
+
+/* What mm_checkheap checks per call: the whole heap, the next k blocks
+   after those the last call checked, or one random free block and its
+   neighbours.  The default is MM_CHECK_FULL. */
+enum {
+  MM_CHECK_FULL,
+  MM_CHECK_INCREMENTAL,
+  MM_CHECK_SAMPLED
+};
+extern void mm_check_mode(int mode, int k);
+
+/* Routines realloc and calloc copy and zero large blocks with.  mm_init
+   picks the best the CPU has; mm_copy_mode returns -1 if it lacks them.
+   MM_COPY_LIBC (memcpy and memset) also zeroes memory that is known to
+   be zero already. */
+enum {
+  MM_COPY_LIBC,
+  MM_COPY_AVX2,
+  MM_COPY_AVX512
+};
+extern int mm_copy_mode(int kind);
@@ -0,0 +1,37 @@
+/*
+ * mmshim.c - The mm.h calls on top of some other malloc
+ *
+ * Built as a shared object for mdriver -a to compare with mm malloc:
+ *
+ *     unix> make mm-libc.so mm-jemalloc.so
+ *     unix> ./mdriver -a ./mm-libc.so -a ./mm-jemalloc.so
+ *
+ * Linked with -ljemalloc or -ltcmalloc_minimal, the malloc it calls is
+ * that library's, since mdriver opens it with RTLD_DEEPBIND; linked
+ * with nothing, it is the C library's.  There is no mm_init, since
+ * such an allocator cannot be reset; mdriver gives each trace a new
+ * process instead.
+ */
+#include <stdlib.h>
+
+#include "mm.h"
+
+void *mm_malloc(size_t size)
+{
+    return malloc(size);
+}
+
+void mm_free(void *ptr)
+{
+    free(ptr);
+}
+
+void *mm_realloc(void *ptr, size_t size)
+{
+    return realloc(ptr, size);
+}
+
+void *mm_calloc(size_t nmemb, size_t size)
+{
+    return calloc(nmemb, size);
+}
@@ -0,0 +1,647 @@
+/*
+ * mmtrace.c - Record the allocations of any program as a malloc lab trace
+ *
+ * Built as mmtrace.so and preloaded, it interposes malloc, free,
+ * realloc, calloc and the aligned allocators, passes each call on to
+ * the next allocator (libc's, or one preloaded after it), and logs it:
+ *
+ *     unix> MMTRACE_FILE=ls.rep LD_PRELOAD=./mmtrace.so ls
+ *     unix> ./mdriver -f ls.rep
+ *
+ * Each thread logs its calls, with its thread id and a CLOCK_MONOTONIC
+ * timestamp, to a ring of its own that only it writes and only the
+ * flusher thread reads, so the calls never take a lock or make a
+ * system call beyond reading the clock.  The flusher appends the
+ * records to MMTRACE_FILE.raw as they come.  At exit the records are
+ * sorted by time, pointers are numbered as trace ids (reusing the ids
+ * of freed blocks), and the trace is written as a .rep trace, or a
+ * binary one if MMTRACE_FILE ends in .bin.  The raw log is removed
+ * unless MMTRACE_KEEP is set.  Requests for 0 bytes are recorded as 1
+ * byte, since mm_malloc(0) may fail.
+ *
+ * Only the first process records, unless MMTRACE_FILE contains %p:
+ * then each process it starts records too, to a file with its own pid
+ * in place of the %p.
+ *
+ * A malloc is stamped after it returns and a free before it starts,
+ * so if one thread frees a block another allocated, or gets back an
+ * address another just freed, the timestamps order the two calls as
+ * they happened.  A thread whose ring is full waits for the flusher
+ * rather than drop records.  A forked child stops recording.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define RING_SIZE (1 << 16)     /* records per thread ring; a power of 2 */
+#define FLUSH_NSECS 1000000     /* flusher naps this long when idle */
+#define FLUSH_RECS 8192         /* records per write() of the flusher */
+#define BOOT_BYTES (1 << 16)    /* allocations made before dlsym is done */
+#define DEFAULT_FILE "mmtrace.rep"
+#define MIN(x, y) ((x) < (y) ? (x) : (y))
+
+/* What a call did */
+enum { REC_MALLOC, REC_FREE, REC_REALLOC };
+
+/* One logged call, as it is stored in the raw log */
+typedef struct {
+    uint64_t ts;                /* nanoseconds, CLOCK_MONOTONIC */
+    uint64_t ptr;               /* block returned, or freed */
+    uint64_t old;               /* with REC_REALLOC, the block passed in */
+    uint64_t size;
+    uint32_t tid;
+    uint32_t seq;               /* calls the thread made before it */
+    uint32_t type;
+    uint32_t pad;
+} rec_t;
+
+/* A thread's ring.  head is written only by the thread and tail only
+   by the flusher.  Rings of exited threads are handed to new ones. */
+typedef struct ring {
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+    _Atomic int in_use;
+    uint32_t tid;
+    uint32_t seq;
+    struct ring *next;          /* all rings, newest first */
+    rec_t recs[RING_SIZE];
+} ring_t;
+
+/* The allocator behind us */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+/* Bump allocator for dlsym, which may calloc before real_calloc is known */
+static char boot_buf[BOOT_BYTES] __attribute__((aligned(16)));
+static size_t boot_used;
+
+static _Atomic(ring_t *) rings;
+static int started;             /* did the flusher start? */
+static _Atomic int recording;   /* log calls? */
+static _Atomic int stopping;    /* tells the flusher to finish */
+static pthread_t flusher;
+static pthread_key_t ring_key;
+static char trace_file[4096 + 16];
+static char raw_file[sizeof(trace_file) + 8];
+static int raw_fd = -1;
+static pid_t owner;
+
+/* The calling thread's ring, and whether it is inside the shim (so the
+   shim's own allocations are not logged) */
+static __thread ring_t *my_ring __attribute__((tls_model("initial-exec")));
+static __thread int in_shim __attribute__((tls_model("initial-exec")));
+
+static void resolve(void)
+{
+    in_shim++;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign = dlsym(RTLD_NEXT, "memalign");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    in_shim--;
+}
+
+static int is_boot(const void *p)
+{
+    return (const char *)p >= boot_buf && (const char *)p < boot_buf + BOOT_BYTES;
+}
+
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_BYTES)
+        return NULL;
+    p = boot_buf + boot_used;
+    boot_used += size;
+    return p;
+}
+
+/*
+ * get_ring - The calling thread's ring: a free one left by an exited
+ *     thread, or a new one
+ */
+static ring_t *get_ring(void)
+{
+    ring_t *r;
+    int expect;
+
+    for (r = atomic_load(&rings); r != NULL; r = r->next) {
+        expect = 0;
+        if (atomic_load(&r->in_use) == 0 &&
+            atomic_compare_exchange_strong(&r->in_use, &expect, 1))
+            break;
+    }
+    if (r == NULL) {
+        r = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (r == MAP_FAILED)
+            return NULL;
+        atomic_store(&r->in_use, 1);
+        r->next = atomic_load(&rings);
+        while (!atomic_compare_exchange_weak(&rings, &r->next, r))
+            ;
+    }
+    r->tid = syscall(SYS_gettid);
+    r->seq = 0;
+    in_shim++;
+    pthread_setspecific(ring_key, r);
+    in_shim--;
+    return r;
+}
+
+/* put_ring - At thread exit, let another thread have the ring */
+static void put_ring(void *arg)
+{
+    ring_t *r = arg;
+
+    my_ring = NULL;
+    atomic_store(&r->in_use, 0);
+}
+
+/*
+ * log_call - Append a call to the calling thread's ring
+ */
+static void log_call(int type, void *ptr, void *old, size_t size, uint64_t ts)
+{
+    ring_t *r = my_ring;
+    rec_t *rec;
+    uint64_t h;
+
+    if (r == NULL && (r = my_ring = get_ring()) == NULL)
+        return;
+    h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (h - atomic_load_explicit(&r->tail, memory_order_acquire) ==
+           RING_SIZE) {
+        if (atomic_load(&stopping))
+            return;
+        sched_yield();
+    }
+    rec = &r->recs[h & (RING_SIZE - 1)];
+    rec->ts = ts;
+    rec->ptr = (uintptr_t)ptr;
+    rec->old = (uintptr_t)old;
+    rec->size = size;
+    rec->tid = r->tid;
+    rec->seq = r->seq++;
+    rec->type = type;
+    rec->pad = 0;
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+}
+
+static uint64_t now(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+/* Should this call be logged? */
+static int logging(void)
+{
+    return atomic_load_explicit(&recording, memory_order_relaxed) && !in_shim;
+}
+
+/*
+ * The interposed functions
+ */
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL && !in_shim)
+        resolve();
+    if (real_malloc == NULL)
+        return boot_alloc(size);
+    p = real_malloc(size);
+    if (p != NULL && logging())
+        log_call(REC_MALLOC, p, NULL, size, now());
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL || is_boot(ptr))
+        return;
+    if (real_free == NULL)
+        resolve();
+    if (logging())
+        log_call(REC_FREE, ptr, NULL, 0, now());
+    real_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL) {
+        p = boot_alloc(nmemb * size);
+        if (p != NULL)
+            memset(p, 0, nmemb * size);
+        return p;
+    }
+    p = real_calloc(nmemb, size);
+    if (p != NULL && logging())
+        log_call(REC_MALLOC, p, NULL, nmemb * size, now());
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (real_realloc == NULL)
+        resolve();
+    if (is_boot(ptr)) {
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, ptr, MIN(size, (size_t)(boot_buf + BOOT_BYTES - (char *)ptr)));
+        return p;
+    }
+    if (ptr != NULL && size == 0 && logging())
+        log_call(REC_FREE, ptr, NULL, 0, now());
+    p = real_realloc(ptr, size);
+    if (p != NULL && logging())
+        log_call(ptr ? REC_REALLOC : REC_MALLOC, p, ptr, size, now());
+    return p;
+}
+
+int posix_memalign(void **out, size_t align, size_t size)
+{
+    int rc;
+
+    if (real_posix_memalign == NULL)
+        resolve();
+    rc = real_posix_memalign(out, align, size);
+    if (rc == 0 && logging())
+        log_call(REC_MALLOC, *out, NULL, size, now());
+    return rc;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *p;
+
+    if (real_aligned_alloc == NULL)
+        resolve();
+    p = real_aligned_alloc(align, size);
+    if (p != NULL && logging())
+        log_call(REC_MALLOC, p, NULL, size, now());
+    return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    void *p;
+
+    if (real_memalign == NULL)
+        resolve();
+    p = real_memalign(align, size);
+    if (p != NULL && logging())
+        log_call(REC_MALLOC, p, NULL, size, now());
+    return p;
+}
+
+/*
+ * drain - Append everything in the rings to the raw log; returns the
+ *     number of records written
+ */
+static size_t drain(void)
+{
+    static rec_t buf[FLUSH_RECS];
+    size_t n = 0, total = 0;
+    uint64_t h, t;
+    ring_t *r;
+
+    for (r = atomic_load(&rings); r != NULL; r = r->next) {
+        h = atomic_load_explicit(&r->head, memory_order_acquire);
+        t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        for (; t != h; t++) {
+            buf[n++] = r->recs[t & (RING_SIZE - 1)];
+            if (n == FLUSH_RECS) {
+                if (write(raw_fd, buf, sizeof(buf)) != sizeof(buf))
+                    atomic_store(&recording, 0);
+                total += n;
+                n = 0;
+            }
+            if ((t & 1023) == 1023)
+                atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+        }
+        atomic_store_explicit(&r->tail, t, memory_order_release);
+    }
+    if (n > 0 && write(raw_fd, buf, n * sizeof(rec_t)) != (ssize_t)(n * sizeof(rec_t)))
+        atomic_store(&recording, 0);
+    return total + n;
+}
+
+static void *flush_thread(void *arg)
+{
+    struct timespec nap = { 0, FLUSH_NSECS };
+
+    (void)arg;
+    in_shim = 1;
+    while (!atomic_load(&stopping))
+        if (drain() == 0)
+            nanosleep(&nap, NULL);
+    return NULL;
+}
+
+/*
+ * The trace writer
+ */
+
+/* Maps a block address to its trace id; open addressing */
+typedef struct {
+    uint64_t *keys;             /* 0 for an empty slot, 1 for a deleted one */
+    int *ids;
+    size_t mask;
+    size_t used;
+} idmap_t;
+
+static size_t hash(uint64_t p)
+{
+    p ^= p >> 33;
+    p *= 0xff51afd7ed558ccdULL;
+    return p ^ (p >> 33);
+}
+
+static void idmap_put(idmap_t *m, uint64_t p, int id);
+
+static void idmap_grow(idmap_t *m)
+{
+    idmap_t old = *m;
+    size_t i;
+
+    m->mask = old.mask ? 2 * old.mask + 1 : 1023;
+    m->keys = calloc(m->mask + 1, sizeof(*m->keys));
+    m->ids = malloc((m->mask + 1) * sizeof(*m->ids));
+    m->used = 0;
+    if (m->keys == NULL || m->ids == NULL) {
+        fprintf(stderr, "mmtrace: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; old.keys && i <= old.mask; i++)
+        if (old.keys[i] > 1)
+            idmap_put(m, old.keys[i], old.ids[i]);
+    free(old.keys);
+    free(old.ids);
+}
+
+static void idmap_put(idmap_t *m, uint64_t p, int id)
+{
+    size_t i;
+
+    if (4 * (m->used + 1) > 3 * (m->mask + 1))
+        idmap_grow(m);
+    for (i = hash(p) & m->mask; m->keys[i] > 1; i = (i + 1) & m->mask)
+        ;
+    if (m->keys[i] == 0)
+        m->used++;
+    m->keys[i] = p;
+    m->ids[i] = id;
+}
+
+/* idmap_take - Remove p from the map and return its id, or -1 */
+static int idmap_take(idmap_t *m, uint64_t p)
+{
+    size_t i;
+
+    if (m->keys == NULL)
+        return -1;
+    for (i = hash(p) & m->mask; m->keys[i] != 0; i = (i + 1) & m->mask) {
+        if (m->keys[i] == p) {
+            m->keys[i] = 1;
+            return m->ids[i];
+        }
+    }
+    return -1;
+}
+
+static int rec_cmp(const void *a, const void *b)
+{
+    const rec_t *x = a, *y = b;
+
+    if (x->ts != y->ts)
+        return x->ts < y->ts ? -1 : 1;
+    if (x->tid != y->tid)
+        return x->tid < y->tid ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* Numbers the blocks of a trace, reusing the ids of freed blocks */
+typedef struct {
+    idmap_t map;
+    int *free_ids;
+    int num_free, max_ids, next_id;
+} ids_t;
+
+static int ids_new(ids_t *ids, uint64_t p)
+{
+    int id;
+
+    if (ids->num_free > 0) {
+        id = ids->free_ids[--ids->num_free];
+    } else {
+        if (ids->next_id == ids->max_ids) {
+            ids->max_ids = ids->max_ids ? 2 * ids->max_ids : 1024;
+            ids->free_ids = realloc(ids->free_ids,
+                                    ids->max_ids * sizeof(int));
+            if (ids->free_ids == NULL) {
+                fprintf(stderr, "mmtrace: out of memory\n");
+                exit(1);
+            }
+        }
+        id = ids->next_id++;
+    }
+    idmap_put(&ids->map, p, id);
+    return id;
+}
+
+static int ids_free(ids_t *ids, uint64_t p)
+{
+    int id = idmap_take(&ids->map, p);
+
+    if (id >= 0)
+        ids->free_ids[ids->num_free++] = id;
+    return id;
+}
+
+static void put_op(FILE *out, int binary, int type, int id, size_t size)
+{
+    traceop_t op;
+
+    size = size > 0xffffffffu ? 0xffffffffu : size ? size : 1;
+    if (binary) {
+        memset(&op, 0, sizeof(op));
+        op.type = type;
+        op.index = id;
+        op.size = size;
+        fwrite(&op, sizeof(op), 1, out);
+    } else if (type == FREE) {
+        fprintf(out, "f %d\n", id);
+    } else {
+        fprintf(out, "%c %d %zu\n", type == ALLOC ? 'a' : 'r', id, size);
+    }
+}
+
+static void put_header(FILE *out, int binary, int num_ids, int num_ops)
+{
+    bintrace_t hdr;
+
+    fseek(out, 0, SEEK_SET);
+    if (binary) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, BIN_MAGIC, sizeof(hdr.magic));
+        hdr.version = BIN_VERSION;
+        hdr.op_size = sizeof(traceop_t);
+        hdr.weight = 1;
+        hdr.num_ids = num_ids;
+        hdr.num_ops = num_ops;
+        hdr.num_blocks = num_ops;
+        hdr.max_count = 1;
+        fwrite(&hdr, sizeof(hdr), 1, out);
+    } else {
+        fprintf(out, "1\n%10d\n%10d\n0\n", num_ids, num_ops);
+    }
+}
+
+/*
+ * write_trace - Turn the raw log into a trace.  Frees and reallocs of
+ *     blocks allocated before recording began are left out, or taken
+ *     as new blocks.
+ */
+static void write_trace(void)
+{
+    size_t len = strlen(trace_file), n, i;
+    int binary = len > 4 && strcmp(trace_file + len - 4, ".bin") == 0;
+    ids_t ids;
+    struct stat st;
+    rec_t *recs;
+    FILE *out;
+    int id, num_ops = 0;
+
+    memset(&ids, 0, sizeof(ids));
+    if (fstat(raw_fd, &st) < 0 || (n = st.st_size / sizeof(rec_t)) == 0)
+        return;
+    recs = mmap(NULL, n * sizeof(rec_t), PROT_READ | PROT_WRITE,
+                MAP_PRIVATE, raw_fd, 0);
+    if (recs == MAP_FAILED || (out = fopen(trace_file, "w")) == NULL) {
+        fprintf(stderr, "mmtrace: cannot write %s: %s\n", trace_file,
+                strerror(errno));
+        return;
+    }
+    qsort(recs, n, sizeof(rec_t), rec_cmp);
+
+    put_header(out, binary, 0, 0);
+    for (i = 0; i < n; i++) {
+        switch (recs[i].type) {
+        case REC_MALLOC:
+            put_op(out, binary, ALLOC, ids_new(&ids, recs[i].ptr),
+                   recs[i].size);
+            break;
+        case REC_FREE:
+            if ((id = ids_free(&ids, recs[i].ptr)) < 0)
+                continue;
+            put_op(out, binary, FREE, id, 0);
+            break;
+        case REC_REALLOC:
+            if ((id = idmap_take(&ids.map, recs[i].old)) < 0) {
+                put_op(out, binary, ALLOC, ids_new(&ids, recs[i].ptr),
+                       recs[i].size);
+                break;
+            }
+            idmap_put(&ids.map, recs[i].ptr, id);
+            put_op(out, binary, REALLOC, id, recs[i].size);
+            break;
+        }
+        num_ops++;
+    }
+    put_header(out, binary, ids.next_id ? ids.next_id : 1, num_ops);
+    if (fclose(out) != 0)
+        fprintf(stderr, "mmtrace: cannot write %s\n", trace_file);
+    munmap(recs, n * sizeof(rec_t));
+    free(ids.map.keys);
+    free(ids.map.ids);
+    free(ids.free_ids);
+}
+
+static void stop_child(void)
+{
+    atomic_store(&recording, 0);
+}
+
+__attribute__((constructor))
+static void mmtrace_start(void)
+{
+    const char *f = getenv("MMTRACE_FILE"), *pid;
+    char buf[32];
+
+    if (real_malloc == NULL)
+        resolve();
+    if (f == NULL)
+        f = DEFAULT_FILE;
+    if ((pid = strstr(f, "%p")) == NULL && getenv("MMTRACE_OWNER") != NULL)
+        return;
+    in_shim++;
+    snprintf(buf, sizeof(buf), "%d", (int)getpid());
+    setenv("MMTRACE_OWNER", buf, 1);
+    if (pid != NULL)
+        snprintf(trace_file, sizeof(trace_file), "%.*s%s%s", (int)(pid - f),
+                 f, buf, pid + 2);
+    else
+        snprintf(trace_file, sizeof(trace_file), "%s", f);
+    snprintf(raw_file, sizeof(raw_file), "%s.raw", trace_file);
+    raw_fd = open(raw_file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (raw_fd < 0) {
+        fprintf(stderr, "mmtrace: cannot create %s: %s\n", raw_file,
+                strerror(errno));
+    } else if (pthread_key_create(&ring_key, put_ring) == 0 &&
+               pthread_create(&flusher, NULL, flush_thread, NULL) == 0) {
+        pthread_atfork(NULL, NULL, stop_child);
+        owner = getpid();
+        started = 1;
+        atomic_store(&recording, 1);
+    }
+    in_shim--;
+}
+
+__attribute__((destructor))
+static void mmtrace_stop(void)
+{
+    if (!started || getpid() != owner)
+        return;
+    in_shim++;
+    atomic_store(&recording, 0);
+    atomic_store(&stopping, 1);
+    pthread_join(flusher, NULL);
+    drain();
+    write_trace();
+    close(raw_fd);
+    if (getenv("MMTRACE_KEEP") == NULL)
+        unlink(raw_file);
+    in_shim--;
+}
@@ -0,0 +1,409 @@
+/*
+ * mtracegen.c - Generate synthetic malloc lab traces
+ *
+ * Writes a trace of the given number of requests drawn from a size
+ * mix, a lifetime pattern, a realloc ratio and a cap on the live
+ * bytes, followed by frees of whatever is still live.  The trace is a
+ * text .rep trace, or a binary trace (see trace.h) if the output file
+ * name ends in .bin; mdriver reads either.  With -o -, a binary trace
+ * goes to stdout as it is made, with -1 for its counts since the
+ * header cannot be rewritten; only mdriver -S takes such a trace, but
+ * it may be as long as you like.
+ *
+ * Lifetimes are counted in requests.  The patterns are
+ *   random  exponential lifetimes around the mean
+ *   fifo    every block lives exactly the mean: a producer/consumer
+ *           queue, freed in the order it was allocated
+ *   gen     generational: most blocks die young (a tenth of the mean),
+ *           and a fraction -g lives GEN_OLD times the mean
+ *
+ * Ids of freed blocks are reused, so the trace needs only as many ids
+ * as blocks are live at once, and mdriver's per-id arrays stay small
+ * however long the trace is.
+ */
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define MAX_CLASSES 32          /* most entries in a size mix */
+#define MAX_SIZE (1u << 30)     /* largest request generated */
+#define GEN_OLD 100             /* lifetime of old blocks, times the mean */
+#define DEFAULT_MIX "16:30,64:30,256:20,1024:12,8192:6,131072:2"
+
+/* A live block, kept in a heap ordered by the request that frees it */
+typedef struct {
+    long long death;
+    int id;
+    unsigned size;
+} live_t;
+
+/* Where the requests go */
+typedef struct {
+    FILE *fp;
+    int binary;
+    int stream;         /* stdout: the header is never rewritten */
+    long long num_ops;
+} out_t;
+
+static enum { PAT_RANDOM, PAT_FIFO, PAT_GEN } pattern = PAT_RANDOM;
+
+/* The size mix: a request falls in (bound[i-1], bound[i]] with
+   probability weight[i] / total_weight */
+static unsigned bound[MAX_CLASSES];
+static double weight[MAX_CLASSES];
+static double total_weight;
+static int num_classes;
+
+static unsigned long long rng_state = 0x9e3779b97f4a7c15ULL;
+
+static live_t *live;            /* heap of live blocks */
+static long long num_live, max_live;
+static int *free_ids;           /* ids of freed blocks, for reuse */
+static int num_free_ids;
+static int next_id;             /* ids ever used */
+static int max_ids;             /* room in free_ids */
+static double old_frac = 0.1;   /* with PAT_GEN, fraction of old blocks */
+
+static void usage(void);
+
+static void gen_error(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2), noreturn));
+static void gen_error(const char *fmt, ...)
+{
+    va_list ap;
+
+    fprintf(stderr, "mtracegen: ");
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+/* rnd - xorshift64*; a uniform double in [0, 1) */
+static double rnd(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (rng_state * 2685821657736338717ULL >> 11) * (1.0 / (1ULL << 53));
+}
+
+/* parse_bytes - Parse a count with an optional K, M or G suffix */
+static long long parse_bytes(const char *s)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    switch (*end) {
+    case 'k': case 'K': v *= 1 << 10; end++; break;
+    case 'm': case 'M': v *= 1 << 20; end++; break;
+    case 'g': case 'G': v *= 1 << 30; end++; break;
+    }
+    if (end == s || *end != '\0' || v < 0)
+        gen_error("bad number %s", s);
+    return (long long)v;
+}
+
+/* parse_mix - Parse a size mix like "16:30,64:70" */
+static void parse_mix(const char *s)
+{
+    char *end;
+
+    num_classes = 0;
+    total_weight = 0;
+    while (*s) {
+        if (num_classes == MAX_CLASSES)
+            gen_error("at most %d size classes", MAX_CLASSES);
+        bound[num_classes] = strtoul(s, &end, 10);
+        if (*end != ':' || bound[num_classes] < 1 ||
+            bound[num_classes] > MAX_SIZE ||
+            (num_classes > 0 && bound[num_classes] <= bound[num_classes-1]))
+            gen_error("bad size mix at %s", s);
+        weight[num_classes] = strtod(end + 1, &end);
+        if (weight[num_classes] < 0 || (*end != ',' && *end != '\0'))
+            gen_error("bad size mix at %s", s);
+        total_weight += weight[num_classes];
+        num_classes++;
+        s = *end ? end + 1 : end;
+    }
+    if (num_classes == 0 || total_weight <= 0)
+        gen_error("empty size mix");
+}
+
+/* draw_size - Draw a request size from the size mix */
+static unsigned draw_size(void)
+{
+    double x = rnd() * total_weight;
+    unsigned lo;
+    int i;
+
+    for (i = 0; i < num_classes - 1 && x >= weight[i]; i++)
+        x -= weight[i];
+    lo = i ? bound[i-1] : 0;
+    return lo + 1 + (unsigned)(rnd() * (bound[i] - lo));
+}
+
+/* draw_life - Draw the lifetime of a new block from the pattern */
+static long long draw_life(double mean)
+{
+    if (pattern == PAT_FIFO)
+        return (long long)mean;
+    if (pattern == PAT_GEN)
+        mean = rnd() < old_frac ? mean * GEN_OLD : mean / 10;
+    return (long long)(-log(1 - rnd()) * mean);
+}
+
+/* new_id - An id that is not live, reusing freed ones first */
+static int new_id(void)
+{
+    if (num_free_ids > 0)
+        return free_ids[--num_free_ids];
+    if (next_id == max_ids) {
+        max_ids = max_ids ? 2 * max_ids : 1024;
+        if ((free_ids = realloc(free_ids, max_ids * sizeof(*free_ids))) == NULL)
+            gen_error("out of memory");
+    }
+    return next_id++;
+}
+
+/*
+ * The heap of live blocks
+ */
+static void live_push(live_t b)
+{
+    long long i = num_live++;
+
+    if (num_live > max_live) {
+        max_live = max_live ? 2 * max_live : 1024;
+        if ((live = realloc(live, max_live * sizeof(*live))) == NULL)
+            gen_error("out of memory");
+    }
+    for (; i > 0 && live[(i-1)/2].death > b.death; i = (i-1)/2)
+        live[i] = live[(i-1)/2];
+    live[i] = b;
+}
+
+static live_t live_pop(void)
+{
+    live_t top = live[0], b = live[--num_live];
+    long long i = 0, c;
+
+    while ((c = 2*i + 1) < num_live) {
+        if (c + 1 < num_live && live[c+1].death < live[c].death)
+            c++;
+        if (b.death <= live[c].death)
+            break;
+        live[i] = live[c];
+        i = c;
+    }
+    live[i] = b;
+    return top;
+}
+
+/*
+ * emit - Write one request
+ */
+static void emit(out_t *out, int type, int id, unsigned size)
+{
+    traceop_t op;
+    int rc;
+
+    if (!out->stream && out->num_ops == INT_MAX)
+        gen_error("more than %d requests", INT_MAX);
+    out->num_ops++;
+    if (out->binary) {
+        memset(&op, 0, sizeof(op));
+        op.type = type;
+        op.index = id;
+        op.size = size;
+        rc = fwrite(&op, sizeof(op), 1, out->fp) == 1;
+    } else if (type == ALLOC) {
+        rc = fprintf(out->fp, "a %d %u\n", id, size) > 0;
+    } else if (type == REALLOC) {
+        rc = fprintf(out->fp, "r %d %u\n", id, size) > 0;
+    } else {
+        rc = fprintf(out->fp, "f %d\n", id) > 0;
+    }
+    if (!rc)
+        gen_error("write failed: %s", strerror(errno));
+}
+
+/* free_block - Free the block that dies first */
+static void free_block(out_t *out, long long *live_bytes)
+{
+    live_t b = live_pop();
+
+    emit(out, FREE, b.id, 0);
+    *live_bytes -= b.size;
+    free_ids[num_free_ids++] = b.id;
+}
+
+/*
+ * write_header - Write the header, at the start of the file.  The text
+ *     header pads the counts so it can be rewritten in place at the end.
+ *     A streamed header is written once, before the counts are known.
+ */
+static void write_header(out_t *out)
+{
+    bintrace_t hdr;
+
+    if (out->stream) {
+        if (out->num_ops > 0)
+            return;
+    } else if (fseek(out->fp, 0, SEEK_SET) < 0)
+        gen_error("cannot seek in the output: %s", strerror(errno));
+    if (out->binary) {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, BIN_MAGIC, sizeof(hdr.magic));
+        hdr.version = BIN_VERSION;
+        hdr.op_size = sizeof(traceop_t);
+        hdr.weight = 1;
+        hdr.num_ids = out->stream ? -1 : next_id;
+        hdr.num_ops = out->stream ? -1 : out->num_ops;
+        hdr.num_blocks = hdr.num_ops;
+        hdr.max_count = 1;
+        fwrite(&hdr, sizeof(hdr), 1, out->fp);
+    } else {
+        fprintf(out->fp, "1\n%10d\n%10lld\n0\n", next_id, out->num_ops);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const char *outfile = "gen.rep";
+    long long num_reqs = 1000000;
+    long long peak = 0, live_bytes = 0, now;
+    double mean_life = 1000, realloc_frac = 0.05;
+    size_t len;
+    out_t out;
+    live_t b;
+    int c;
+
+    parse_mix(DEFAULT_MIX);
+    while ((c = getopt(argc, argv, "n:o:s:z:l:p:g:r:m:h")) != EOF) {
+        switch (c) {
+        case 'n':
+            num_reqs = parse_bytes(optarg);
+            break;
+        case 'o':
+            outfile = optarg;
+            break;
+        case 's':
+            rng_state ^= strtoull(optarg, NULL, 0) * 0x2545f4914f6cdd1dULL;
+            break;
+        case 'z':
+            parse_mix(optarg);
+            break;
+        case 'l':
+            mean_life = atof(optarg);
+            break;
+        case 'p':
+            if (strcmp(optarg, "random") == 0)
+                pattern = PAT_RANDOM;
+            else if (strcmp(optarg, "fifo") == 0)
+                pattern = PAT_FIFO;
+            else if (strcmp(optarg, "gen") == 0)
+                pattern = PAT_GEN;
+            else
+                gen_error("unknown pattern %s", optarg);
+            break;
+        case 'g':
+            old_frac = atof(optarg);
+            break;
+        case 'r':
+            realloc_frac = atof(optarg);
+            break;
+        case 'm':
+            peak = parse_bytes(optarg);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    out.stream = strcmp(outfile, "-") == 0;
+    if (num_reqs < 1 || (!out.stream && num_reqs >= INT_MAX))
+        gen_error("-n takes 1 to %d requests, or more with -o -", INT_MAX - 1);
+    if (mean_life < 1)
+        gen_error("-l must be at least 1");
+    if (old_frac < 0 || old_frac > 1 || realloc_frac < 0 || realloc_frac >= 1)
+        gen_error("-g and -r are fractions");
+
+    len = strlen(outfile);
+    out.binary = out.stream ||
+        (len > 4 && strcmp(outfile + len - 4, ".bin") == 0);
+    out.num_ops = 0;
+    if (out.stream)
+        out.fp = stdout;
+    else if ((out.fp = fopen(outfile, "w+")) == NULL)
+        gen_error("cannot create %s: %s", outfile, strerror(errno));
+    setvbuf(out.fp, NULL, _IOFBF, 1 << 20);
+    write_header(&out);
+
+    while ((now = out.num_ops) < num_reqs) {
+        if (num_live > 0 && live[0].death <= now) {
+            free_block(&out, &live_bytes);
+        } else if (num_live > 0 && rnd() < realloc_frac) {
+            /* Grow a random block mostly, sometimes (or if it would
+               break the cap) shrink it */
+            live_t *r = &live[(long long)(rnd() * num_live)];
+            unsigned size = rnd() < 0.75 ? r->size + draw_size() : r->size / 2;
+
+            if (peak && live_bytes + size - r->size > peak)
+                size = r->size / 2;
+
+            size = size < 1 ? 1 : size > MAX_SIZE ? MAX_SIZE : size;
+            live_bytes += (long long)size - r->size;
+            r->size = size;
+            emit(&out, REALLOC, r->id, size);
+        } else {
+            b.size = draw_size();
+            while (peak && num_live > 0 && live_bytes + b.size > peak &&
+                   out.num_ops < num_reqs - 1)
+                free_block(&out, &live_bytes);
+            b.id = new_id();
+            b.death = out.num_ops + 1 + draw_life(mean_life);
+            live_bytes += b.size;
+            live_push(b);
+            emit(&out, ALLOC, b.id, b.size);
+        }
+    }
+    while (num_live > 0)
+        free_block(&out, &live_bytes);
+
+    write_header(&out);
+    if (fclose(out.fp) != 0)
+        gen_error("cannot write %s: %s", outfile, strerror(errno));
+    return 0;
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mtracegen [-h] [-n <reqs>] [-o <file>] [-s <seed>] [-z <mix>]\n"
+                    "                 [-p random|fifo|gen] [-l <reqs>] [-g <frac>] [-r <frac>] [-m <bytes>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n <reqs>  Requests before the live blocks are freed (default 1M).\n");
+    fprintf(stderr, "\t-o <file>  Output trace; binary if it ends in .bin (default gen.rep),\n"
+                    "\t           or - for a binary trace of any length to stdout.\n");
+    fprintf(stderr, "\t-s <seed>  Seed of the random numbers.\n");
+    fprintf(stderr, "\t-z <mix>   Size mix, as bound:weight,... (default %s).\n", DEFAULT_MIX);
+    fprintf(stderr, "\t-p <pat>   Lifetime pattern: random, fifo or gen (default random).\n");
+    fprintf(stderr, "\t-l <reqs>  Mean lifetime of a block in requests (default 1000).\n");
+    fprintf(stderr, "\t-g <frac>  With -p gen, fraction of blocks that live long (default 0.1).\n");
+    fprintf(stderr, "\t-r <frac>  Fraction of requests that are reallocs (default 0.05).\n");
+    fprintf(stderr, "\t-m <bytes> Most bytes live at once; free early to stay below.\n");
+}
@@ -0,0 +1,36 @@
+/*
+ * trace.h - The requests of a trace as mdriver holds them in memory,
+ *     and the binary trace format that stores them as is
+ */
+/* Characterizes a single trace operation (allocator request).  A batch
+   operation covers the count blocks index, index+1, ... at once.  The
+   ops are packed into 12 bytes and stored as is in binary traces. */
+enum { ALLOC, FREE, REALLOC, ALLOC_BATCH, FREE_BATCH };
+#define MAX_BATCH ((1 << 28) - 1)
+typedef struct {
+    unsigned type : 4;                /* one of the enum above */
+    unsigned count : 28;              /* number of blocks in a batch */
+    int index;                        /* index for free() to use later */
+    unsigned size;                    /* byte size of alloc/realloc request */
+} traceop_t;
+_Static_assert(sizeof(traceop_t) == 12, "traceop_t must stay packed");
+
+/*
+ * A binary trace is this header followed by num_ops traceop_t's in
+ * host byte order.  mdriver -b writes one next to each .rep trace,
+ * mtracegen writes them directly, and mdriver maps them in place of
+ * parsing the text.
+ */
+#define BIN_MAGIC   "mmtrace"  /* with the NUL, fills magic[] */
+#define BIN_VERSION 1
+typedef struct {
+    char magic[8];
+    int version;
+    int op_size;         /* sizeof(traceop_t) of the writer */
+    int weight;
+    int num_ids;
+    int num_ops;
+    int ignore_ranges;
+    int num_blocks;
+    int max_count;
+} bintrace_t;
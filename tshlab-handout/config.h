@@ -41,6 +41,17 @@
   "trace23.txt",\
   "trace24.txt"
 
+/*
+ * Sync messages from jobs to the driver: a tag byte, then the job's
+ * PID. WAIT in a trace waits for a READY or an ACK; the others only
+ * tell runtrace what a job is doing at that moment.
+ */
+#define SYNC_READY 'R'  /* Running, and waiting for the driver's SIGNAL */
+#define SYNC_ACK   'A'  /* Took the driver's SIGNAL */
+#define SYNC_STOP  'S'  /* About to stop itself or its job */
+#define SYNC_INT   'I'  /* About to interrupt itself or its job */
+#define SYNC_CONT  'C'  /* Continued after being stopped */
+
 /* Various constants */
 #define ITERS 3
 #define MAXBUF 1024
@@ -18,9 +18,16 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <signal.h>
+#include <limits.h>
+#include <sys/wait.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define HAVE_SSE 1
+#endif
 
 #include "driverhdrs.h"
 #include "driverlib.h"
+#include "rio.h"
 
 /**************************
  * Private helper functions 
@@ -36,264 +43,386 @@ void sigalrm_handler(int sig) {
     exit(1);
 }
 
+typedef struct sockaddr SA;
+
 /*
- * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
+ * How urlencode treats each byte. Only the printable ASCII characters
+ * are allowed. Note: for a general purpose URL-encoding routine, we
+ * would also allow newline and form feeds, but since result
+ * submissions are constrained to be single text lines, we disallow
+ * them in this context. However, tabs are allowed.
  */
-typedef struct sockaddr SA;
-static void rio_readinitb(rio_t *rp, int fd) 
+#define URL_BAD    0    /* Not allowed in a result string */
+#define URL_SAFE   1    /* Copied as is */
+#define URL_SPACE  2    /* Becomes '+' */
+#define URL_ESCAPE 3    /* Becomes %XX */
+static const unsigned char urlclass[256] = {
+    ['\t'] = URL_ESCAPE,
+    [' '] = URL_SPACE,
+    ['!' ... 127] = URL_ESCAPE,
+    ['*'] = URL_SAFE, ['-'] = URL_SAFE, ['.'] = URL_SAFE, ['_'] = URL_SAFE,
+    ['0' ... '9'] = URL_SAFE,
+    ['A' ... 'Z'] = URL_SAFE,
+    ['a' ... 'z'] = URL_SAFE,
+};
+
+#ifdef HAVE_SSE
+/*
+ * safe_sse2 - Mask of the URL_SAFE bytes in c. Bytes of 128 and up
+ *     are negative to the signed compares, so they are never safe.
+ */
+static inline __m128i safe_sse2(__m128i c)
 {
-    rp->rio_fd = fd;  
-    rp->rio_cnt = 0;  
-    rp->rio_bufptr = rp->rio_buf;
+    __m128i l = _mm_or_si128(c, _mm_set1_epi8(0x20)); /* A-Z to a-z */
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+				  _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1)));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+				  _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i punct = _mm_or_si128(
+	_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('*')),
+		     _mm_cmpeq_epi8(c, _mm_set1_epi8('-'))),
+	_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('.')),
+		     _mm_cmpeq_epi8(c, _mm_set1_epi8('_'))));
+
+    return _mm_or_si128(_mm_or_si128(alpha, digit), punct);
 }
 
-
-/* 
- * rio_read - This is a wrapper for the Unix read() function that
- *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
- *    buffer, where n is the number of bytes requested by the user and
- *    rio_cnt is the number of unread bytes in the internal buffer. On
- *    entry, rio_read() refills the internal buffer via a call to
- *    read() if the internal buffer is empty.
+/*
+ * safe_run_sse2 - Length of the run of URL_SAFE bytes that src[0..len)
+ *     starts with, classified 16 bytes at a time
  */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+static size_t safe_run_sse2(const unsigned char *src, size_t len)
 {
-    int cnt;
-
-    while (rp->rio_cnt <= 0) {  /* refill if buf is empty */
-	rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, 
-			   sizeof(rp->rio_buf));
-	if (rp->rio_cnt < 0) {
-	    if (errno != EINTR) /* interrupted by sig handler return */
-		return -1;
-	}
-	else if (rp->rio_cnt == 0)  /* EOF */
-	    return 0;
-	else 
-	    rp->rio_bufptr = rp->rio_buf; /* reset buffer ptr */
+    size_t i;
+    unsigned mask;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+	mask = _mm_movemask_epi8(safe_sse2(
+	    _mm_loadu_si128((const __m128i *)(src + i))));
+	if (mask != 0xffff)
+	    return i + __builtin_ctz(~mask);
     }
-
-    /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
-    cnt = n;          
-    if (((unsigned int)rp->rio_cnt) < n)   
-	cnt = rp->rio_cnt;
-    memcpy(usrbuf, rp->rio_bufptr, cnt);
-    rp->rio_bufptr += cnt;
-    rp->rio_cnt -= cnt;
-    return cnt;
+    while (i < len && urlclass[src[i]] == URL_SAFE)
+	i++;
+    return i;
 }
 
-/* 
- * rio_readlineb - robustly read a text line (buffered)
+/*
+ * safe_run_avx2 - The same, 32 bytes at a time
  */
-static ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
+__attribute__((target("avx2")))
+static size_t safe_run_avx2(const unsigned char *src, size_t len)
 {
-    int rc;
-		size_t n;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-	if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n')
-		break;
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* error */
+    size_t i;
+    unsigned mask;
+    __m256i c, l, alpha, digit, punct;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+	c = _mm256_loadu_si256((const __m256i *)(src + i));
+	l = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+	alpha = _mm256_andnot_si256(
+	    _mm256_cmpgt_epi8(l, _mm256_set1_epi8('z')),
+	    _mm256_cmpgt_epi8(l, _mm256_set1_epi8('a' - 1)));
+	digit = _mm256_andnot_si256(
+	    _mm256_cmpgt_epi8(c, _mm256_set1_epi8('9')),
+	    _mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)));
+	punct = _mm256_or_si256(
+	    _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('*')),
+			    _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'))),
+	    _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('.')),
+			    _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_'))));
+	mask = _mm256_movemask_epi8(
+	    _mm256_or_si256(_mm256_or_si256(alpha, digit), punct));
+	if (mask != 0xffffffff)
+	    return i + __builtin_ctz(~mask);
     }
-    *bufp = 0;
-    return n;
+    return i + safe_run_sse2(src + i, len - i);
 }
+#endif
 
 /*
- * rio_writen - Robustly write n bytes (unbuffered)
+ * safe_run - Length of the run of URL_SAFE bytes that src[0..len)
+ *     starts with
  */
-static ssize_t rio_writen(int fd, void *usrbuf, size_t n) 
+static size_t safe_run(const unsigned char *src, size_t len)
 {
-    size_t nleft = n;
-    ssize_t nwritten;
-    char *bufp = usrbuf;
-
-    while (nleft > 0) {
-	if ((nwritten = write(fd, bufp, nleft)) <= 0) {
-	    if (errno == EINTR)  /* interrupted by sig handler return */
-		nwritten = 0;    /* and call write() again */
-	    else
-		return -1;       /* errorno set by write() */
-	}
-	nleft -= nwritten;
-	bufp += nwritten;
-    }
-    return n;
+#ifdef HAVE_SSE
+    if (len >= 32 && __builtin_cpu_supports("avx2"))
+	return safe_run_avx2(src, len);
+    return safe_run_sse2(src, len);
+#else
+    size_t i = 0;
+
+    while (i < len && urlclass[src[i]] == URL_SAFE)
+	i++;
+    return i;
+#endif
 }
 
-
 /*
- * urlencode - URL-encodes the src input string into dst
+ * urlencode - URL-encodes the len bytes at src into dst, which needs
+ *     room for 3*len+1 bytes. Runs of safe characters are found a
+ *     vector at a time and copied in one go. Returns the length of
+ *     the encoded string, or -1 if src has a character not allowed.
  */
-static int urlencode(unsigned char *src, unsigned char *dst)
+static ssize_t urlencode(const unsigned char *src, size_t len, 
+			 unsigned char *dst)
 {
-    int len = strlen((char *)src);
-    char buf[8];
-
-    for ( ; len--; src++) {
-	if ((*src == '*') || (*src == '-') || 
-	    (*src== '.') || (*src == '_') || 
-	    (('0' <= *src) && (*src <= '9')) || 
-	    (('A' <= *src) && (*src <= 'Z')) || 
-	    (('a' <= *src) && (*src <= 'z'))) {
-	    *dst++ = *src;
-	}
-	else if (*src == ' ') {
+    static const char hex[] = "0123456789ABCDEF";
+    unsigned char *start = dst;
+    size_t run;
+
+    while (len > 0) {
+	run = safe_run(src, len);
+	memcpy(dst, src, run);
+	dst += run, src += run, len -= run;
+	if (len == 0)
+	    break;
+
+	switch (urlclass[*src]) {
+	case URL_SPACE:
 	    *dst++ = '+';
-	}
-
-	/* 
-	 * Allow only the printable ASCII characters Note: for a
-	 * general purpose URL-encoding routine, we would also allow
-	 * newline and form feeds, but since result submissions are
-	 * constrained to be single text lines, we disallow them in this 
-	 * context. However, tabs are allowd.
-	 */
-	else if (((*src > 31) && (*src < 128)) || 
-		 (*src == '\t')) {
-	    sprintf(buf, "%%%02X", *src);
-	    *dst++ = buf[0];
-	    *dst++ = buf[1];
-	    *dst++ = buf[2];
-	}
-        else {
+	    break;
+	case URL_ESCAPE:
+	    *dst++ = '%';
+	    *dst++ = hex[*src >> 4];
+	    *dst++ = hex[*src & 0xf];
+	    break;
+	default:
 	    return -1;
-        }
+	}
+	src++, len--;
     }
-
-    return 0;
+    *dst = '\0';
+    return dst - start;
 }
 
+/*
+ * The connection to the Autolab server. It is kept open between
+ * submissions (HTTP/1.1 keep-alive), and the server's address is
+ * looked up only once per host and port.
+ */
+static struct {
+    char *hostname;                /* Host the address was looked up for */
+    int port;                      /* ... and its port */
+    struct sockaddr_in addr;       /* The server's socket address */
+    int fd;                        /* Open connection, or -1 if none */
+    int reused;                    /* Has fd already carried a request? */
+    rio_t rio;                     /* Buffered reads from fd */
+} server = { NULL, 0, {0}, -1, 0 };
 
 /*
- * submitr - Submit a client result string to the autolab server.
+ * server_close - Drop the connection to the server, if any
  */
-int submitr(char *hostname,    /* Server domain name */
-	    int port,          /* Server port */
-	    char *course,      /* Course name */
-	    char *userid,      /* Userid */
-	    char *lab,         /* Lab name */
-	    char *result,      /* Result string to submit */
-	    char *status_msg)  /* Status message returned to caller */
+static void server_close(void)
+{
+    if (server.fd >= 0)
+	close(server.fd);
+    server.fd = -1;
+}
+
+/*
+ * server_connect - Make sure there is a connection to hostname:port,
+ *     resolving the name only if it is not the one already cached
+ */
+static int server_connect(char *hostname, int port, char *status_msg)
 {
-    int clientfd;                  /* socket descriptor */
     struct hostent *hp;            /* DNS host entry */
-    struct sockaddr_in serveraddr; /* Server's socket address */
 
-    size_t result_size;      /* Input result size in bytes */
-    size_t req_size;         /* HTTP request size in bytes */
-    rio_t rio;               /* Handle for buffered RIO functions */
+    if (server.hostname == NULL || strcmp(server.hostname, hostname) ||
+	server.port != port) {
+	server_close();
+	free(server.hostname);
+	server.hostname = NULL;
 
-    char buf[SUBMITR_MAXBUF];        /* Buffer for HTTP requests/responses */ 
-    char enc_result[SUBMITR_MAXBUF]; /* Buffer for URL-encoded result string */
+	/* Fill in the server's IP address and port */
+	if ((hp = gethostbyname(hostname)) == NULL) {
+	    strcpy(status_msg, "Error: DNS is unable to resolve "
+		   "Autolab server address");
+	    return -1;
+	}
+	bzero((char *) &server.addr, sizeof(server.addr));
+	server.addr.sin_family = AF_INET;
+	bcopy((char *)hp->h_addr, 
+	      (char *)&server.addr.sin_addr.s_addr, hp->h_length);
+	server.addr.sin_port = htons(port);
+	server.hostname = strdup(hostname);
+	server.port = port;
+    }
+    if (server.fd >= 0)
+	return 0;
 
-    char version[SUBMITR_MAXBUF];    /* Fields from first response line */
-    int errcode=0;  
-    char errmsg[SUBMITR_MAXBUF];
+    /* A server that hangs up on an idle connection must not kill us */
+    signal(SIGPIPE, SIG_IGN);
 
-    /* Create the initial socket descriptor */
-    if ((clientfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    /* Create the socket descriptor */
+    if ((server.fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
 	strcpy(status_msg, "Error: Client unable to create socket");
 	return -1;
     }
-	
-    /* Fill in the server's IP address and port */
-    if ((hp = gethostbyname(hostname)) == NULL) {
-	strcpy(status_msg, "Error: DNS is unable to resolve Autolab server address");
-	close(clientfd);
-	return -1;
-    }
-    bzero((char *) &serveraddr, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET;
-    bcopy((char *)hp->h_addr, 
-	  (char *)&serveraddr.sin_addr.s_addr, hp->h_length);
-    serveraddr.sin_port = htons(port);
 
     /* Establish a connection with the server */
-    if (connect(clientfd, (SA *) &serveraddr, sizeof(serveraddr)) < 0) {
+    if (connect(server.fd, (SA *) &server.addr, sizeof(server.addr)) < 0) {
 	strcpy(status_msg, "Error: Unable to connect to the Autolab server");
-	close(clientfd);
+	server_close();
 	return -1;
     }
+    rio_readinitb(&server.rio, server.fd);
+    server.reused = 0;
+    return 0;
+}
 
-    /* 
-     * Make sure the data will fit in the buffer. Make the
-     * conservative assumption that each character in the result
-     * string will be translated into its corresponding 3 character
-     * '%XX' hex url encoding. Include a conservative pad of 128
-     * bytes for separators in the HTTP URI.  
-     */
-    result_size = strlen(result);
-    req_size = strlen(course) + strlen(userid) + 
-	strlen(lab) + 3*result_size + 128; 
-    if (req_size > SUBMITR_MAXBUF) {
-	strcpy(status_msg, "Error: Result string too large. Increase SUBMITR_MAXBUF");
-	close(clientfd);
-	return -1;
+/*
+ * server_read_chunked - Read a body sent with "Transfer-Encoding:
+ *     chunked", through its last chunk and trailer, so that the next
+ *     response on the connection can be read. Up to size - 1 bytes of
+ *     it are stored in buf, the rest skipped. Returns the bytes stored,
+ *     or -1 on error
+ */
+static ssize_t server_read_chunked(char *buf, size_t size)
+{
+    char line[SUBMITR_MAXBUF];
+    size_t len = 0, want;
+    long chunk;
+    ssize_t n;
+    char *dst;
+
+    while (1) {
+	/* The size line is hex, maybe followed by ";extensions" */
+	if (rio_readlineb(&server.rio, line, SUBMITR_MAXBUF) <= 0)
+	    return -1;
+	if ((chunk = strtol(line, NULL, 16)) <= 0)
+	    break;
+	for (; chunk > 0; chunk -= n) {
+	    if (len < size - 1) {
+		dst = buf + len;
+		want = size - 1 - len;
+	    } else {
+		dst = line;
+		want = SUBMITR_MAXBUF;
+	    }
+	    if ((size_t)chunk < want)
+		want = chunk;
+	    if ((n = rio_readnb(&server.rio, dst, want)) <= 0)
+		return -1;
+	    if (dst != line)
+		len += n;
+	}
+	/* The CRLF after the chunk's data */
+	if (rio_readlineb(&server.rio, line, SUBMITR_MAXBUF) <= 0)
+	    return -1;
     }
-
-    /* URL-encode the result string */
-    bzero((char *)enc_result, SUBMITR_MAXBUF);
-    if (urlencode((unsigned char *)result, (unsigned char *)enc_result) < 0) {
-	strcpy(status_msg, "Error: Result string contains an illegal or unprintable character.");
-	close(clientfd);
+    if (chunk < 0)
 	return -1;
-    }
 
-    /* Construct the HTTP request */
-    sprintf(buf, "GET /%s/submitr.pl/?userid=%s&lab=%s&result=%s&submit=submit HTTP/1.0\r\n\r\n", course, userid, lab, enc_result);
+    /* Trailer headers, up to the empty line */
+    while (strcmp(line, "\r\n"))
+	if (rio_readlineb(&server.rio, line, SUBMITR_MAXBUF) <= 0)
+	    return -1;
+    return len;
+}
+
+/*
+ * server_request - Send one HTTP request on the open connection and
+ *     read the response, leaving the connection open if the server
+ *     allows it. The first line of the response body becomes the status
+ *     message. The body may come with a Content-Length, in chunks, or up
+ *     to the end of the connection. Returns 0 if it is "OK", -1
+ *     otherwise, and -2 if a reused connection turned out to have been
+ *     closed by the server before it took the request, so that the
+ *     request can be retried.
+ */
+static int server_request(char *request, char *status_msg)
+{
+    char buf[SUBMITR_MAXBUF];        /* Buffer for HTTP responses */
+    char version[SUBMITR_MAXBUF];    /* Fields from first response line */
+    int errcode=0;  
+    char errmsg[SUBMITR_MAXBUF];
+    long length = -1;                /* Content-Length, -1 if none */
+    int chunked = 0;                 /* Transfer-Encoding: chunked? */
+    int keepalive = 1;               /* May the connection be reused? */
+    ssize_t len, n;
+    int reused = server.reused;
+
+    server.reused = 1;
 
     /* Send the request to the server */
-    if (rio_writen(clientfd, buf, strlen(buf)) < 0) {
+    if (rio_writen(server.fd, request, strlen(request)) < 0) {
 	strcpy(status_msg, "Error: Client unable to write to the Autolab server");
-	close(clientfd);
-	return -1;
+	server_close();
+	return reused ? -2 : -1;
     }
 
     /* Read first HTTP response header line from the server */
-    rio_readinitb(&rio, clientfd);
-    if (rio_readlineb(&rio, buf, SUBMITR_MAXBUF) <= 0) {
-	strcpy(status_msg, "Error: Client unable to read first header from Autolab server");
-	close(clientfd);
-	return -1;
+    if (rio_readlineb(&server.rio, buf, SUBMITR_MAXBUF) <= 0) {
+	strcpy(status_msg, "Error: Client unable to read first header "
+	       "from Autolab server");
+	server_close();
+	return reused ? -2 : -1;
     }
     sscanf(buf, "%s %d %[a-zA-z ]", version, &errcode, errmsg);
     if (errcode != 200) {
 	sprintf(status_msg, "Error: HTTP request failed with error %d: %s", 
 		errcode, errmsg);
-	close(clientfd);
+	server_close();
 	return -1;
     }
+    if (strncmp(version, "HTTP/1.1", 8))
+	keepalive = 0;
 
     /* Read the remaining HTTP response header lines */
     while (strcmp(buf, "\r\n")) {
-	if (rio_readlineb(&rio, buf, SUBMITR_MAXBUF) <= 0) {
-	    strcpy(status_msg, "Error: Client unable to read headers from Autolab server");
-	    close(clientfd);
+	if (rio_readlineb(&server.rio, buf, SUBMITR_MAXBUF) <= 0) {
+	    strcpy(status_msg, "Error: Client unable to read headers "
+		   "from Autolab server");
+	    server_close();
 	    return -1;
 	}
+	if (!strncasecmp(buf, "Content-Length:", 15))
+	    length = strtol(buf + 15, NULL, 10);
+	else if (!strncasecmp(buf, "Transfer-Encoding:", 18) &&
+		 !strncasecmp(buf + 18 + strspn(buf + 18, " \t"), "chunked", 7))
+	    chunked = 1;
+	else if (!strncasecmp(buf, "Connection:", 11) &&
+		 !strncasecmp(buf + 11 + strspn(buf + 11, " \t"), "close", 5))
+	    keepalive = 0;
     }
 
-    /* Read and echo the response from the server */
-    if (rio_readlineb(&rio, buf, SUBMITR_MAXBUF) <= 0) {
-	strcpy(status_msg, "Error: Client unable to read status message from Autolab server");
-	close(clientfd);
+    /* 
+     * Read the response from the server. A chunked body has no length,
+     * and any Content-Length is to be ignored. Without either, the body
+     * ends when the server closes the connection, so it cannot be
+     * reused.
+     */
+    if (chunked)
+	len = server_read_chunked(buf, SUBMITR_MAXBUF);
+    else if (length < 0) {
+	keepalive = 0;
+	len = rio_readlineb(&server.rio, buf, SUBMITR_MAXBUF);
+    }
+    else {
+	len = rio_readnb(&server.rio, buf, 
+			 length < SUBMITR_MAXBUF ? length : SUBMITR_MAXBUF - 1);
+	/* Skip what does not fit, to get to the next response */
+	for (length -= len; len > 0 && length > 0; length -= n) {
+	    if ((n = rio_readnb(&server.rio, errmsg, length < SUBMITR_MAXBUF ? 
+				length : SUBMITR_MAXBUF)) <= 0)
+		len = -1;
+	}
+    }
+    if (len <= 0) {
+	strcpy(status_msg, "Error: Client unable to read status message "
+	       "from Autolab server");
+	server_close();
 	return -1;
     }
+    buf[len] = '\0';
+    buf[strcspn(buf, "\r\n")] = '\0';
 
-    /* Set the return status message, clean up, and exit */
+    /* Set the return status message, and clean up */
     strcpy(status_msg, buf);
-    close(clientfd);
+    if (!keepalive)
+	server_close();
 
     if (!strcmp(status_msg, "OK"))
 	return 0;
@@ -301,6 +430,74 @@ int submitr(char *hostname,    /* Server domain name */
 	return -1;
 }
 
+/*
+ * submitr - Submit a client result string to the autolab server.
+ */
+int submitr(char *hostname,    /* Server domain name */
+	    int port,          /* Server port */
+	    char *course,      /* Course name */
+	    char *userid,      /* Userid */
+	    char *lab,         /* Lab name */
+	    char *result,      /* Result string to submit */
+	    char *status_msg)  /* Status message returned to caller */
+{
+    size_t result_size;      /* Input result size in bytes */
+    size_t req_size;         /* HTTP request size in bytes */
+    int status = -1, tries;
+
+    char *buf = NULL;                /* Buffer for the HTTP request */ 
+    char *enc_result;                /* Buffer for URL-encoded result string */
+
+    /* 
+     * Size the buffers for the result. Each character in the result
+     * string may be translated into its corresponding 3 character
+     * '%XX' hex url encoding. Include a conservative pad of 128
+     * bytes for separators in the HTTP URI, and room for the host.
+     */
+    result_size = strlen(result);
+    req_size = strlen(course) + strlen(userid) + strlen(hostname) +
+	strlen(lab) + 3*result_size + 128; 
+    if ((enc_result = malloc(3*result_size + 1)) == NULL ||
+	(buf = malloc(req_size)) == NULL) {
+	strcpy(status_msg, "Error: Client out of memory");
+	goto out;
+    }
+
+    /* URL-encode the result string */
+    if (urlencode((unsigned char *)result, result_size, 
+		  (unsigned char *)enc_result) < 0) {
+	strcpy(status_msg, "Error: Result string contains an illegal "
+	       "or unprintable character.");
+	goto out;
+    }
+
+    /* Construct the HTTP request */
+    snprintf(buf, req_size,
+	     "GET /%s/submitr.pl/?userid=%s&lab=%s&result=%s&submit=submit "
+	     "HTTP/1.1\r\n"
+	     "Host: %s\r\n"
+	     "Connection: keep-alive\r\n"
+	     "\r\n",
+	     course, userid, lab, enc_result, hostname);
+
+    /* 
+     * Send it on the open connection if there is one. If the server
+     * has since closed that, connect again and send it once more.
+     */
+    for (tries = 0; tries < 2; tries++) {
+	if (server_connect(hostname, port, status_msg) < 0)
+	    break;
+	if ((status = server_request(buf, status_msg)) != -2)
+	    break;
+	status = -1;
+    }
+
+ out:
+    free(enc_result);
+    free(buf);
+    return status;
+}
+
 
 /******************
  * Public functions
@@ -327,10 +524,6 @@ void init_timeout(int timeout) {
  */
 int init_driver(char *status_msg) 
 {
-    int clientfd;                  /* Socket descriptor */
-    struct hostent *hp;            /* DNS host entry */
-    struct sockaddr_in serveraddr; /* Server's socket address */
-
     char *hostname = SERVER_NAME;
     int port = SERVER_PORT;
 
@@ -340,36 +533,12 @@ int init_driver(char *status_msg)
     signal(SIGPOLL, SIG_IGN);
 
     /*
-     * Make sure that we can talk to the server 
+     * Make sure that we can talk to the server. The connection is
+     * kept for the first submission.
      */
-
-    /* Create the initial socket descriptor */
-    if ((clientfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-	strcpy(status_msg, "Error: Client unable to create socket");
+    if (server_connect(hostname, port, status_msg) < 0)
 	return -1;
-    }
-	
-    /* Fill in the server's IP address and port */
-    if ((hp = gethostbyname(hostname)) == NULL) {
-	strcpy(status_msg, "Error: DNS is unable to resolve server address");
-	close(clientfd);
-	return -1;
-    }
-    bzero((char *) &serveraddr, sizeof(serveraddr));
-    serveraddr.sin_family = AF_INET;
-    bcopy((char *)hp->h_addr, 
-	  (char *)&serveraddr.sin_addr.s_addr, hp->h_length);
-    serveraddr.sin_port = htons(port);
-
-    /* Establish a connection with the server */
-    if (connect(clientfd, (SA *) &serveraddr, sizeof(serveraddr)) < 0) {
-	strcpy(status_msg, "Error: Unable to connect to server");
-	close(clientfd);
-	return -1;
-    }
 
-    /* Close the connection with the server */
-    close(clientfd);
     strcpy(status_msg, "OK");
     return 0;
 }    
@@ -408,3 +577,117 @@ int driver_post(char *userid, char *result, int autograded, char *status_msg)
     strcpy(status_msg, "OK");
     return 0;
 }
+
+/*
+ * The batches driver_post_batch has left to background processes:
+ * each reports on its own pipe, with one struct batch_report.
+ */
+struct batch_report {
+    int status;                                /* 0 if all were OK */
+    char msg[PIPE_BUF - sizeof(int)];          /* First error, or "OK" */
+};
+static struct batch {
+    pid_t pid;                     /* The process submitting it */
+    int fd;                        /* Read end of its pipe */
+} *batches;
+static int nbatches;
+
+/*
+ * driver_post_batch - Transmit n autoresult strings to Autolab without
+ *     waiting for them: they are submitted in order, over one kept-alive
+ *     connection, by a child process. Collect the outcome with
+ *     driver_post_wait. Returns -1 only if the batch could not be
+ *     started.
+ */
+int driver_post_batch(char *userid, char **results, int n, 
+		      int autograded, char *status_msg)
+{
+    struct batch_report report;
+    struct batch *b;
+    int i, fds[2];
+    pid_t pid;
+
+    /* Nothing goes over the network, so there is nothing to wait for */
+    if (autograded || !userid || !strcmp(userid, "")) {
+	for (i = 0; i < n; i++)
+	    driver_post(userid, results[i], autograded, status_msg);
+	strcpy(status_msg, "OK");
+	return 0;
+    }
+
+    if ((b = realloc(batches, (nbatches + 1) * sizeof(*b))) == NULL) {
+	strcpy(status_msg, "Error: Client out of memory");
+	return -1;
+    }
+    batches = b;
+    if (pipe(fds) < 0) {
+	strcpy(status_msg, "Error: Client unable to create pipe");
+	return -1;
+    }
+
+    /* Output buffered so far must not be written twice */
+    fflush(NULL);
+    if ((pid = fork()) < 0) {
+	strcpy(status_msg, "Error: Client unable to fork");
+	close(fds[0]);
+	close(fds[1]);
+	return -1;
+    }
+
+    if (pid == 0) {
+	close(fds[0]);
+	report.status = 0;
+	strcpy(report.msg, "OK");
+	for (i = 0; i < n; i++) {
+	    if (submitr(SERVER_NAME, SERVER_PORT, COURSE_NAME, userid, LAB,
+			results[i], status_msg) < 0 && report.status == 0) {
+		report.status = -1;
+		snprintf(report.msg, sizeof(report.msg), "%s", status_msg);
+	    }
+	}
+	if (write(fds[1], &report, sizeof(report)) < 0)
+	    _exit(1);
+	_exit(0);
+    }
+
+    /* The connection, if any, now belongs to the child */
+    server_close();
+    close(fds[1]);
+    batches[nbatches].pid = pid;
+    batches[nbatches].fd = fds[0];
+    nbatches++;
+    strcpy(status_msg, "OK");
+    return 0;
+}
+
+/*
+ * driver_post_wait - Wait for every batch started by driver_post_batch
+ *     to be submitted. Returns 0 if all were accepted, else -1 with the
+ *     first error in status_msg.
+ */
+int driver_post_wait(char *status_msg)
+{
+    struct batch_report report;
+    int i, status = 0;
+    ssize_t n;
+
+    strcpy(status_msg, "OK");
+    for (i = 0; i < nbatches; i++) {
+	/* One report of at most PIPE_BUF bytes arrives whole */
+	while ((n = read(batches[i].fd, &report, sizeof(report))) < 0 && 
+	       errno == EINTR)
+	    ;
+	if (n != sizeof(report)) {
+	    report.status = -1;
+	    strcpy(report.msg, "Error: Submission process died");
+	}
+	close(batches[i].fd);
+	waitpid(batches[i].pid, NULL, 0);
+	if (report.status < 0 && status == 0) {
+	    status = -1;
+	    strcpy(status_msg, report.msg);
+	}
+    }
+    nbatches = 0;
+    return status;
+}
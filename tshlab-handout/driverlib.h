@@ -16,17 +16,6 @@
  */
 #define SUBMITR_MAXBUF 8192
 
-/* 
- * Persistent state for the robust I/O (Rio) package 
- */
-#define RIO_BUFSIZE 8192
-typedef struct {
-    int rio_fd;                /* descriptor for this internal buf */
-    int rio_cnt;               /* unread bytes in internal buf */
-    char *rio_bufptr;          /* next unread byte in internal buf */
-    char rio_buf[RIO_BUFSIZE]; /* internal buffer */
-} rio_t;
-
 /* 
  * Package interface
  */
@@ -43,6 +32,16 @@ int driver_post(char *userid,      /* Userid */
 		int autograded,    /* True if called by an autograder */
 		char *status_msg); /* Return status msg */
 
+/* driver_post_batch - Transmit autoresult strings in the background */
+int driver_post_batch(char *userid,      /* Userid */
+		      char **results,    /* Result strings to submit */
+		      int n,             /* How many there are */
+		      int autograded,    /* True if called by an autograder */
+		      char *status_msg); /* Return status msg */
+
+/* driver_post_wait - Wait for the batches, and how they went */
+int driver_post_wait(char *status_msg);
+
 #endif /* __DRIVERLIB_H__ */
 
 
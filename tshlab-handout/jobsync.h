@@ -0,0 +1,78 @@
+/*
+ * jobsync.h - Job side of the driver's sync protocol
+ *
+ * Under runtrace, SYNCFD names a datagram socket to the driver. A test
+ * job reports each change of state as soon as it happens, as one tag
+ * byte (SYNC_* in config.h) followed by its PID, and runtrace answers
+ * a SYNC_READY with "signal" when the trace says SIGNAL. Standalone,
+ * everything here is a no-op. sync_send is async-signal-safe.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+static int sync_fd = -1;       /* The driver's socket, -1 if standalone */
+static char sync_msg[32];      /* A tag byte slot, then our PID */
+static size_t sync_len;        /* Length of sync_msg */
+
+/*
+ * sync_init - Find the driver's socket. Return 1 if we are run by the
+ *             driver, 0 if standalone. Call again after a fork
+ */
+static inline int sync_init(void)
+{
+    char *str, digits[16];
+    struct stat stat;
+    pid_t pid = getpid();
+    int n = 0;
+
+    sync_fd = -1;
+    if ((str = getenv("SYNCFD")) == NULL || fstat(atoi(str), &stat) < 0)
+	return 0;
+    sync_fd = atoi(str);
+
+    do
+	digits[n++] = '0' + pid % 10;
+    while ((pid /= 10) > 0);
+    for (sync_len = 1; n > 0; )
+	sync_msg[sync_len++] = digits[--n];
+    return 1;
+}
+
+/*
+ * sync_send - Tell the driver that our state changed to tag
+ */
+static inline void sync_send(int tag)
+{
+    char msg[sizeof(sync_msg)];
+    int olderrno = errno;
+
+    if (sync_fd < 0)
+	return;
+    memcpy(msg, sync_msg, sync_len);
+    msg[0] = tag;
+    if (send(sync_fd, msg, sync_len, 0) < 0) {
+	write(STDERR_FILENO, "sync_send: send error\n", 22);
+	_exit(1);
+    }
+    errno = olderrno;
+}
+
+/*
+ * sync_wait - Block until the driver sends us something
+ */
+static inline void sync_wait(void)
+{
+    char buf[MAXBUF];
+
+    while (recv(sync_fd, buf, sizeof(buf), 0) < 0) {
+	if (errno != EINTR) {
+	    perror("recv");
+	    exit(1);
+	}
+    }
+}
@@ -7,6 +7,7 @@
 #include <signal.h>
 #include <stdlib.h>
 #include "config.h"
+#include "jobsync.h"
 
 void sigalrm_handler() 
 {
@@ -17,12 +18,16 @@ int main()
 {
     signal(SIGALRM, sigalrm_handler);
     alarm(JOB_TIMEOUT);
+    sync_init();
 
+    sync_send(SYNC_INT);
     if (kill(getpid(), SIGINT) < 0) {
 	perror("kill");
 	exit(1);
     }
 
-    while(1);
+    /* Sleep until the signal comes back; the alarm is the safety net */
+    while(1)
+	pause();
     exit(0);
 }
@@ -23,9 +23,7 @@
 #include <string.h>
 
 #include "config.h"
-
-char buf[MAXBUF];
-int syncfd;
+#include "jobsync.h"
 
 void sigalrm_handler(int signum) 
 {
@@ -34,48 +32,34 @@ void sigalrm_handler(int signum)
 
 void sigterm_handler(int signum)
 {
-	int rc;
-	char *cmdp;
-
 	printf("Took SIGTERM!\n");
 	fflush(stdout);
-	cmdp = "";
-	if ((rc = recv(syncfd, buf, MAXBUF, 0)) < 0) {
-		perror("recv");
-		exit(1);
-	}
-	if ((rc = send(syncfd, cmdp, strlen(cmdp), 0)) < 0) {
-		perror("send");
-		exit(1);
-	}
+	sync_wait();
+	sync_send(SYNC_ACK);
 	exit(0);
 }
 
+void sigcont_handler(int signum)
+{
+	sync_send(SYNC_CONT);
+}
+
 
 
 int main(int argc, char **argv) 
 {
-	int rc;
 	int standalone;
-	char *str;
-	char *cmdp;
-	struct stat stat;
 
 	signal(SIGALRM, sigalrm_handler);
 	signal(SIGTERM, sigterm_handler);
+	signal(SIGCONT, sigcont_handler);
 
 	/* 
 	 * Determine if the shell is running standalone or under the
-	 * control of the driver program. If running under the driver, get
-	 * the number of the driver's synchronizing domain socket
-	 * descriptor.  
+	 * control of the driver program, which passes its synchronizing
+	 * domain socket in SYNCFD.
 	 */
-	standalone = 1;
-	if ((str = getenv("SYNCFD")) != NULL) {
-		syncfd = atoi(str);              /* Get descriptor number */
-		if (fstat(syncfd, &stat) != -1)  /* Is is open? */
-			standalone = 0;
-	}
+	standalone = !sync_init();
 
 	/* 
 	 * If the job is being run by the driver, then synchronize with
@@ -85,15 +69,8 @@ int main(int argc, char **argv)
 
 	if (!standalone) {
 		alarm(JOB_TIMEOUT);
-		cmdp = "";
-		if ((rc = send(syncfd, cmdp, strlen(cmdp), 0)) < 0) {
-			perror("send");
-			exit(1);
-		}
-		if ((rc = recv(syncfd, buf, MAXBUF, 0)) < 0) {
-			perror("recv");
-			exit(1);
-		}
+		sync_send(SYNC_READY);
+		sync_wait();
 		exit(0);
 	}
 	/*
@@ -18,38 +18,32 @@
 #include <string.h>
 
 #include "config.h"
-
-char buf[MAXBUF];
+#include "jobsync.h"
 
 void sigalrm_handler(int signum) 
 {
     exit(0);
 }
 
+void sigcont_handler(int signum)
+{
+    sync_send(SYNC_CONT);
+}
+
 int main(int argc, char **argv) 
 {
-    int rc;
     int standalone;
-    int syncfd;
-    char *str;
-    char *cmdp;
-    struct stat stat;
 
     signal(SIGALRM, sigalrm_handler);
 
     if (fork() == 0) { /* child */
 	/* 
 	 * Determine if the shell is running standalone or under the
-	 * control of the driver program. If running under the driver, get
-	 * the number of the driver's synchronizing domain socket
-	 * descriptor.  
+	 * control of the driver program, which passes its synchronizing
+	 * domain socket in SYNCFD.
 	 */
-	standalone = 1;
-	if ((str = getenv("SYNCFD")) != NULL) {
-	    syncfd = atoi(str);              /* Get descriptor number */
-	    if (fstat(syncfd, &stat) != -1)  /* Is is open? */
-		standalone = 0;
-	}
+	standalone = !sync_init();
+	signal(SIGCONT, sigcont_handler);
 	
 	/* 
 	 * If the job is being run by the driver, then synchronize with
@@ -59,16 +53,8 @@ int main(int argc, char **argv)
 	
 	if (!standalone) {
 	    alarm(JOB_TIMEOUT);
-	    cmdp = "";
-	    if ((rc = send(syncfd, cmdp, strlen(cmdp), 0)) < 0) {
-		perror("send");
-		exit(1);
-	    }
-	    
-	    if ((rc = recv(syncfd, buf, MAXBUF, 0)) < 0) {
-		perror("recv");
-		exit(1);
-	    }
+	    sync_send(SYNC_READY);
+	    sync_wait();
 	    exit(0);
 	}
 	
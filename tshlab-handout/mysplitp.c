@@ -18,8 +18,7 @@
 #include <sys/wait.h>
 
 #include "config.h"
-
-char buf[MAXBUF];
+#include "jobsync.h"
 
 int main(int argc, char **argv) 
 {
@@ -27,11 +26,14 @@ int main(int argc, char **argv)
 
     /* Child waits to be stopped by parent */
     if ((child_pid = fork()) == 0) {
-	while(1);
+	while(1)
+	    pause();
 	exit(0);
     }
 
     /* Parent stops child and then self */
+    sync_init();
+    sync_send(SYNC_STOP);
     if (kill(child_pid, SIGTSTP) < 0) {
 	perror("kill1");
 	exit(1);
@@ -42,6 +44,7 @@ int main(int argc, char **argv)
     }
 
     /* Parent terminates after being restarted, killing child */
+    sync_send(SYNC_CONT);
     if (kill(child_pid, SIGTERM) < 0) {
 	perror("kill3");
 	exit(1);
@@ -9,22 +9,33 @@
 #include <signal.h>
 #include <stdlib.h>
 #include "config.h"
+#include "jobsync.h"
 
 void sigalrm_handler() 
 {
     exit(0);
 }
 
+void sigcont_handler() 
+{
+    sync_send(SYNC_CONT);
+}
+
 int main() 
 {
     signal(SIGALRM, sigalrm_handler);
+    signal(SIGCONT, sigcont_handler);
     alarm(JOB_TIMEOUT);
+    sync_init();
 
+    sync_send(SYNC_STOP);
     if (kill(getppid(), SIGTSTP) < 0) {
 	perror("kill");
 	exit(1);
     }
 
-    while(1);
+    /* Sleep until the signal comes back; the alarm is the safety net */
+    while(1)
+	pause();
     exit(0);
 }
@@ -6,12 +6,17 @@
 #include <sys/types.h>
 #include <signal.h>
 #include <stdlib.h>
+#include "config.h"
+#include "jobsync.h"
 
 int main() 
 {
+    sync_init();
+    sync_send(SYNC_STOP);
     if (kill(getpid(), SIGTSTP) < 0) {
 	perror("kill");
 	exit(1);
     }
+    sync_send(SYNC_CONT);
     exit(0);
 }
@@ -0,0 +1,247 @@
+/*
+ * rio.c - Robust I/O (Rio) package
+ *
+ * The buffered input functions may be mixed freely on one rio_t; the
+ * unbuffered output functions restart after signal handlers and short
+ * counts until everything is written.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "rio.h"
+
+/*
+ * rio_readinitb - Associate a descriptor with a read buffer and reset buffer
+ */
+void rio_readinitb(rio_t *rp, int fd)
+{
+    rp->rio_fd = fd;
+    rp->rio_cnt = 0;
+    rp->rio_buf = rp->rio_init;
+    rp->rio_size = RIO_BUFSIZE;
+    rp->rio_bufptr = rp->rio_buf;
+    rp->rio_eof = 0;
+}
+
+/*
+ * rio_freeb - Release a buffer that grew onto the heap
+ */
+void rio_freeb(rio_t *rp)
+{
+    if (rp->rio_buf != rp->rio_init)
+	free(rp->rio_buf);
+    rp->rio_buf = rp->rio_bufptr = rp->rio_init;
+    rp->rio_size = RIO_BUFSIZE;
+    rp->rio_cnt = 0;
+}
+
+/*
+ * rio_fillb - Do one read() into the internal buffer, after the bytes
+ *    not yet consumed, which move to its front. A full buffer doubles.
+ *    One byte is always kept free, so that a last line without a
+ *    newline can still be ended with a NUL. Returns the bytes read, 0
+ *    at EOF, -1 with errno set on error (but not for EINTR)
+ */
+ssize_t rio_fillb(rio_t *rp)
+{
+    ssize_t n;
+    char *buf;
+
+    if (rp->rio_bufptr != rp->rio_buf) {
+	memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	rp->rio_bufptr = rp->rio_buf;
+    }
+    if ((size_t)rp->rio_cnt + 1 >= rp->rio_size) {
+	if (rp->rio_buf == rp->rio_init) {
+	    if ((buf = malloc(2 * rp->rio_size)) != NULL)
+		memcpy(buf, rp->rio_buf, rp->rio_cnt);
+	}
+	else
+	    buf = realloc(rp->rio_buf, 2 * rp->rio_size);
+	if (buf == NULL)
+	    return -1;
+	rp->rio_buf = rp->rio_bufptr = buf;
+	rp->rio_size *= 2;
+    }
+
+    do
+	n = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+		 rp->rio_size - rp->rio_cnt - 1);
+    while (n < 0 && errno == EINTR); /* interrupted by sig handler return */
+    if (n == 0)
+	rp->rio_eof = 1;
+    else if (n > 0)
+	rp->rio_cnt += n;
+    return n;
+}
+
+/*
+ * rio_read - This is a wrapper for the Unix read() function that
+ *    transfers min(n, rio_cnt) bytes from an internal buffer to a user
+ *    buffer, where n is the number of bytes requested by the user and
+ *    rio_cnt is the number of unread bytes in the internal buffer. On
+ *    entry, rio_read() refills the internal buffer via a call to
+ *    read() if the internal buffer is empty.
+ */
+static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+    size_t cnt;
+    ssize_t rc;
+
+    while (rp->rio_cnt <= 0) {  /* refill if buf is empty */
+	if ((rc = rio_fillb(rp)) < 0)
+	    return -1;
+	else if (rc == 0)  /* EOF */
+	    return 0;
+    }
+
+    /* Copy min(n, rp->rio_cnt) bytes from internal buf to user buf */
+    cnt = n;
+    if ((size_t)rp->rio_cnt < n)
+	cnt = rp->rio_cnt;
+    memcpy(usrbuf, rp->rio_bufptr, cnt);
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    return cnt;
+}
+
+/*
+ * rio_readnb - Robustly read n bytes (buffered)
+ */
+ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
+{
+    size_t nleft = n;
+    ssize_t nread;
+    char *bufp = usrbuf;
+
+    while (nleft > 0) {
+	if ((nread = rio_read(rp, bufp, nleft)) < 0)
+	    return -1;          /* errno set by read() */
+	else if (nread == 0)
+	    break;              /* EOF */
+	nleft -= nread;
+	bufp += nread;
+    }
+    return (n - nleft);         /* return >= 0 */
+}
+
+/*
+ * rio_readlineb - robustly read a text line (buffered)
+ */
+ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+    int rc;
+    size_t n;
+    char c, *bufp = usrbuf;
+
+    for (n = 1; n < maxlen; n++) {
+	if ((rc = rio_read(rp, &c, 1)) == 1) {
+	    *bufp++ = c;
+	    if (c == '\n')
+		break;
+	} else if (rc == 0) {
+	    if (n == 1)
+		return 0; /* EOF, no data read */
+	    else
+		break;    /* EOF, some data was read */
+	} else
+	    return -1;	  /* error */
+    }
+    *bufp = 0;
+    return n;
+}
+
+/*
+ * rio_nextlineb_view - Take the next line out of what has already been
+ *    read, without reading more: a whole line, or at EOF a last line
+ *    with no newline. Returns 0 if there is none yet
+ */
+ssize_t rio_nextlineb_view(rio_t *rp, char **linep)
+{
+    char *nl;
+    ssize_t len;
+
+    if (rp->rio_cnt <= 0)
+	return 0;
+    if ((nl = memchr(rp->rio_bufptr, '\n', rp->rio_cnt)) != NULL) {
+	*nl = '\0';
+	len = nl + 1 - rp->rio_bufptr;
+    }
+    else if (rp->rio_eof) {
+	rp->rio_bufptr[rp->rio_cnt] = '\0'; /* the byte rio_fillb kept */
+	len = rp->rio_cnt;
+    }
+    else
+	return 0;
+
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += len;
+    rp->rio_cnt -= len;
+    return len;
+}
+
+/*
+ * rio_readlineb_view - Like rio_nextlineb_view, but read until there is
+ *    a line. Returns 0 at EOF, -1 on error
+ */
+ssize_t rio_readlineb_view(rio_t *rp, char **linep)
+{
+    ssize_t n;
+
+    while ((n = rio_nextlineb_view(rp, linep)) == 0) {
+	if (rp->rio_eof)
+	    return 0;
+	if (rio_fillb(rp) < 0)
+	    return -1;
+    }
+    return n;
+}
+
+/*
+ * rio_writen - Robustly write n bytes (unbuffered)
+ */
+ssize_t rio_writen(int fd, const void *usrbuf, size_t n)
+{
+    size_t nleft = n;
+    ssize_t nwritten;
+    const char *bufp = usrbuf;
+
+    while (nleft > 0) {
+	if ((nwritten = write(fd, bufp, nleft)) <= 0) {
+	    if (errno == EINTR)  /* interrupted by sig handler return */
+		nwritten = 0;    /* and call write() again */
+	    else
+		return -1;       /* errorno set by write() */
+	}
+	nleft -= nwritten;
+	bufp += nwritten;
+    }
+    return n;
+}
+
+/*
+ * rio_writev - Robustly write iov[0..iovcnt-1] (unbuffered), in as
+ *    few writev() calls as the kernel allows. The iovecs are updated
+ *    as they are written, so they are garbage afterwards
+ */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    ssize_t nwritten, total = 0;
+
+    while (iovcnt > 0) {
+	if ((nwritten = writev(fd, iov, iovcnt)) < 0) {
+	    if (errno == EINTR)  /* interrupted by sig handler return */
+		continue;
+	    return -1;           /* errorno set by writev() */
+	}
+	total += nwritten;
+	for (; iovcnt > 0 && (size_t)nwritten >= iov->iov_len; iovcnt--, iov++)
+	    nwritten -= iov->iov_len;
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return total;
+}
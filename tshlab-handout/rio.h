@@ -0,0 +1,46 @@
+/*
+ * rio.h - Robust I/O (Rio) package, shared by tsh, runtrace and
+ *         driverlib
+ */
+#ifndef __RIO_H__
+#define __RIO_H__
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/*
+ * Persistent state for the robust I/O (Rio) package. The buffer starts
+ * out as rio_init and moves to the heap if a line outgrows it.
+ */
+#define RIO_BUFSIZE 8192
+typedef struct {
+    int rio_fd;                 /* descriptor for this internal buf */
+    ssize_t rio_cnt;            /* unread bytes in internal buf */
+    char *rio_bufptr;           /* next unread byte in internal buf */
+    char *rio_buf;              /* internal buffer */
+    size_t rio_size;            /* size of internal buffer */
+    int rio_eof;                /* read() has returned 0 */
+    char rio_init[RIO_BUFSIZE]; /* internal buffer until it grows */
+} rio_t;
+
+/* Buffered input */
+void rio_readinitb(rio_t *rp, int fd);
+void rio_freeb(rio_t *rp);
+ssize_t rio_fillb(rio_t *rp);
+ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n);
+ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen);
+
+/*
+ * Zero-copy line input: *linep points at the line in the internal
+ * buffer, its newline replaced by a NUL, until the next call that
+ * reads. Both return the bytes consumed (newline included), 0 if
+ * there is no line.
+ */
+ssize_t rio_nextlineb_view(rio_t *rp, char **linep);
+ssize_t rio_readlineb_view(rio_t *rp, char **linep);
+
+/* Unbuffered output */
+ssize_t rio_writen(int fd, const void *usrbuf, size_t n);
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt);
+
+#endif /* __RIO_H__ */
@@ -14,11 +14,17 @@
 #include <ctype.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <fcntl.h>
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/prctl.h>
+#include <sys/epoll.h>
+#include <time.h>
+#include <dirent.h>
 #include "config.h"
+#include "rio.h"
 
 #define MAXBUF 1024
 
@@ -26,7 +32,7 @@
  * Global variables 
  */
 char buf[MAXBUF];
-char line[MAXBUF];
+char *line;
 char command[MAXBUF];
 extern char **environ;
 char *state;
@@ -34,6 +40,7 @@ char *state;
 /* Modified by command line args */
 int verbose = 0;
 int sandboxing = 0;
+int forking = 0;
 char *tracefile = NULL;
 char *shellprog = "./tsh";
 char *shellargs = NULL;
@@ -42,13 +49,35 @@ char *shellargs = NULL;
 int datafd[2];
 int syncfd[2];
 
+/* Everything runtrace waits on goes through one epoll instance */
+int epfd;
+
+/* 
+ * Shell output received but not yet printed. Bytes [start, end) are
+ * pending; the buffer is compacted and grown as needed, so a prompt
+ * split across reads is still seen whole.
+ */
+struct {
+    char *buf;
+    size_t start, end, size;
+    char last;      /* Last byte printed, '\n' after a prompt */
+    int eof;        /* The shell closed its end */
+} out = {NULL, 0, 0, 0, '\n', 0};
+
+int syncs;          /* Syncs received from jobs and not yet WAITed for */
+struct timespec started;  /* When we started, for the event log (-V) */
+
 /* Prototypes */
 void usage(char *msg);
 int blankline(char *str);
 void print_child_status(void);
 int next_prompt(void);
-int readable(int fd, int secs);
+int scan_prompt(int echo);
+int pump(const struct timespec *deadline);
+void job_event(const char *msg, ssize_t len);
+void set_deadline(struct timespec *deadline, int secs);
 void clean(void);
+pid_t parentof(pid_t pid);
 
 /*
  * sigalrm_handler - Notify when we timeout waiting for the child
@@ -56,7 +85,6 @@ void clean(void);
 void sigalrm_handler(int sig) 
 {
     printf("%s: Runtrace timed out while %s.\n", tracefile, state);
-    clean();
     exit(1);
 }
 
@@ -67,15 +95,28 @@ int main(int argc, char **argv)
     int child_pid;
     char c;
     char *bufp;
-    FILE *tracefp;
+    int tracefd;
+    rio_t tracerio;
+    struct iovec iov[2];
     int n=0;
     struct stat statbuf;
+    struct epoll_event ev;
+    struct timespec deadline;
     
     /* Install the signal handler */
     signal(SIGALRM, sigalrm_handler);
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    /*
+     * Adopt the jobs the shell leaves behind, so that clean() can find
+     * everything this trace started without touching other traces,
+     * however we exit
+     */
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+    atexit(clean);
 printf("%d\n",n);
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hVxs:f:")) != EOF) {
+    while ((c = getopt(argc, argv, "hVxFs:f:")) != EOF) {
         switch (c) {
         case 'h':             /* Print help message */
             usage("");
@@ -92,6 +133,9 @@ printf("%d\n",n);
 	case 'x':             /* Enable sandboxing */
 	    sandboxing = 1;   /* Hidden argument */
 	    break;
+	case 'F':             /* Run the shell with -F, so jobs go */
+	    forking = 1;      /* through the wrapped fork */
+	    break;
 	default:
             usage("Unrecognized argument");
 	}
@@ -111,10 +155,11 @@ printf("%d\n",n);
     } 
 
     /* Open the trace file for reading */
-    if ((tracefp = fopen(tracefile, "r")) == NULL) {
+    if ((tracefd = open(tracefile, O_RDONLY)) < 0) {
 	fprintf(stderr, "Unable to open trace file %s\n", tracefile);
 	exit(1);
     }
+    rio_readinitb(&tracerio, tracefd);
 
     /* Socket pair for data transfers between runtrace and shell */
     if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, datafd) < 0) {
@@ -156,19 +201,17 @@ printf("%d\n",n);
 	dup2(datafd[1], 1);
 	
 	/* Create the shell command line arguments */
-	shellargv[0] = shellprog;
-	if (verbose) {
-	    shellargv[1] = "-v";
-	    shellargv[2] = '\0';
-	}
-	else {
-	    shellargv[1] = '\0';
-	}
+	n = 0;
+	shellargv[n++] = shellprog;
+	if (verbose)
+	    shellargv[n++] = "-v";
+	if (forking)
+	    shellargv[n++] = "-F";
+	shellargv[n] = '\0';
 
 	/* Modify the environment if sandboxing is enabled */
 	if (sandboxing) {
-	    strcpy(line, "LD_PRELOAD=/usr/lib/libdl.so ./sandbox.so");
-	    putenv(line);
+	    putenv("LD_PRELOAD=/usr/lib/libdl.so ./sandbox.so");
 	}
 
 	/* Now go ahead and run the shell */
@@ -185,26 +228,40 @@ printf("%d\n",n);
     /* Close the descriptor the parent is not using */
     close(datafd[1]); 
 
+    /* Watch the shell's output and the jobs' syncs */
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+	perror("epoll_create1");
+	exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = datafd[0];
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, datafd[0], &ev) < 0) {
+	perror("epoll_ctl datafd");
+	exit(1);
+    }
+    ev.data.fd = syncfd[0];
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, syncfd[0], &ev) < 0) {
+	perror("epoll_ctl syncfd");
+	exit(1);
+    }
+
     /* Read the initial prompt from the shell */
-    if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
+    set_deadline(&deadline, DRIVER_TIMEOUT);
+    while ((n = scan_prompt(0)) == 0 && !out.eof && pump(&deadline))
+	;
+    if (n < 0 || (n == 0 && out.eof)) {
+	fprintf(stderr, "%s: Runtrace expected initial shell prompt but got '%.*s' instead.\n", 
+		tracefile, (int)(out.end - out.start), out.buf + out.start);
+	exit(1);
+    }
+    else if (n == 0) {
 	fprintf(stderr, "%s: Runtrace timed out waiting for initial shell prompt\n", tracefile);
-    }     
-    else {
-	bzero(buf, MAXBUF);
-	n = recv(datafd[0], buf, MAXBUF, 0);
-	if (strcmp(buf, PROMPT)) {
-	    fprintf(stderr, "%s: Runtrace expected initial shell prompt but got '%s' instead.\n", tracefile, buf);
-	    exit(1);
-	}
     }
 
     /* 
      * Parent reads trace file and sends commands to the shell 
      */
-    while (fgets(line, MAXBUF, tracefp)) {
-
-	/* Delete newline character */
-	line[strlen(line)-1] = '\0';
+    while (rio_readlineb_view(&tracerio, &line) > 0) {
 
 	/* Ignore blank lines */
 	if (blankline(line)) { 
@@ -220,27 +277,24 @@ printf("%d\n",n);
 	}
 
 	/* Parse the command line */
-	sscanf(line, "%s", command);
+	sscanf(line, "%1023s", command);
 	if (verbose)
 	    printf("runtrace: command=%s line=%s\n", command, line);
 	
 	/* WAIT command */
 	if (!strcmp(command, "WAIT")) {
-	    if (readable(syncfd[0], DRIVER_TIMEOUT) == 0) {
+	    set_deadline(&deadline, DRIVER_TIMEOUT);
+	    while (syncs == 0 && pump(&deadline))
+		;
+	    if (syncs == 0) {
 		printf("%s: Runtrace timed out waiting for sync from job\n", 
 		       tracefile);
 		exit(1);
 	    }
-	    else {
-		bzero(buf, MAXBUF);
-		if ((recv(syncfd[0], buf, MAXBUF, 0)) < 0) {
-		    perror("recv syncfd");
-		    exit(1);
-		}
-		if (verbose)
-		    printf("runtrace: received sync from job\n");
-		continue;
-	    }
+	    syncs--;
+	    if (verbose)
+		printf("runtrace: received sync from job\n");
+	    continue;
 	}
 
 
@@ -290,8 +344,12 @@ printf("%d\n",n);
 	    if (verbose) {
 		printf("runtrace: Sending '%s' to shell\n", line);
 	    }
-	    strcat(line, "\n");
-	    if ((send(datafd[0], line, strlen(line), 0)) < 0) {
+	    /* One datagram, so the shell reads the line in one go */
+	    iov[0].iov_base = line;
+	    iov[0].iov_len = strlen(line);
+	    iov[1].iov_base = "\n";
+	    iov[1].iov_len = 1;
+	    if (rio_writev(datafd[0], iov, 2) < 0) {
 		perror("send datafd[0]");
 		exit(1);
 	    }
@@ -308,17 +366,55 @@ printf("%d\n",n);
     state = "waiting for shell to terminate";
     waitpid(child_pid, NULL, 0);
 
-    /* Kill any of our stray shells and jobs */
-    clean();
+    /* Our stray shells and jobs are killed by clean() on the way out */
     exit(0);
 }
 
 
 /*
- * clean - clean up any stray jobs or shells 
+ * clean - clean up any stray jobs or shells. Since we are a subreaper,
+ *         every process the trace started is our child or becomes one
+ *         when its parent dies, so keep killing children until none
+ *         are left
  */
 void clean() {
-    system("/bin/kill -9 tsh tshref mytstpp mytstps mycat myenv myintp myints myspin1 myspin2 mysplit > /dev/null 2>&1");
+    DIR *dir;
+    struct dirent *de;
+    pid_t pid, self = getpid();
+    int found;
+
+    do {
+	found = 0;
+	if ((dir = opendir("/proc")) == NULL)
+	    return;
+	while ((de = readdir(dir)) != NULL) {
+	    if ((pid = atoi(de->d_name)) > 0 && parentof(pid) == self) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		found = 1;
+	    }
+	}
+	closedir(dir);
+    } while (found);
+}
+
+/*
+ * parentof - Return the parent of a process, or -1 if it is gone
+ */
+pid_t parentof(pid_t pid)
+{
+    FILE *fp;
+    char path[64], stat[MAXBUF], *p;
+    int ppid = -1;
+
+    sprintf(path, "/proc/%d/stat", (int)pid);
+    if ((fp = fopen(path, "r")) == NULL)
+	return -1;
+    /* The command name is in parentheses and may hold anything */
+    if (fgets(stat, MAXBUF, fp) != NULL && (p = strrchr(stat, ')')) != NULL)
+	sscanf(p + 1, " %*c %d", &ppid);
+    fclose(fp);
+    return ppid;
 }
 
 /*
@@ -327,11 +423,12 @@ void clean() {
 void usage(char *msg)
 {
     printf("%s\n", msg);
-    printf("Usage: runtrace -f <file> -s <shellprog> [-hV]\n");
+    printf("Usage: runtrace -f <file> -s <shellprog> [-hVF]\n");
     printf("Options:\n");
     printf("  -h            Print this message\n");
     printf("  -s <shell>    Shell program to test (default ./tsh)\n");
     printf("  -f <file>     Trace file\n");
+    printf("  -F            Run the shell with -F (launch jobs with fork)\n");
     printf("  -V            Be more verbose\n");
 
     exit(0);
@@ -403,69 +500,197 @@ void print_child_status()
  */
 int next_prompt(void)
 {
+    struct timespec deadline;
     int n;
-    
-    bzero(buf, MAXBUF);
-    if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-	printf("%s: Runtrace timed out waiting for next shell prompt\n", 
-	       tracefile);
-	print_child_status();
-	return 0;
-    }
-    else {
-	if ((n = recv(datafd[0], buf, MAXBUF, 0)) < 0) {
-	    perror("next_prompt:recv1");
-	    exit(1);
-	}
-	else if (n == 0) { /* EOF */
-	    return 0;
-	} 
-    }
 
-    while(strcmp(buf, PROMPT)) {
-	printf("%s", buf);
-
-	bzero(buf, MAXBUF);
-	if (readable(datafd[0], DRIVER_TIMEOUT) == 0) {
-	    printf("%s: Runtrace timed out waiting for next shell prompt\n", 
+    set_deadline(&deadline, DRIVER_TIMEOUT);
+    while ((n = scan_prompt(1)) == 0) {
+	if (out.eof) {
+	    /* Print whatever the shell said last */
+	    fwrite(out.buf + out.start, 1, out.end - out.start, stdout);
+	    out.start = out.end = 0;
+	    return 0;
+	}
+	if ((n = pump(&deadline)) == 0) {
+	    fwrite(out.buf + out.start, 1, out.end - out.start, stdout);
+	    out.start = out.end = 0;
+	    printf("%s: Runtrace timed out waiting for next shell prompt\n",
 		   tracefile);
 	    print_child_status();
 	    return 0;
 	}
-	else {
-	    if ((n = recv(datafd[0], buf, MAXBUF, 0)) < 0) {
-		perror("next_prompt:recv1");
-		exit(1);
-	    }
-	    else if (n == 0) { /* EOF */
-		return 0;
-	    } 
-	}
+	/* The shell is still talking, so give it a fresh timeout */
+	if (n > 1)
+	    set_deadline(&deadline, DRIVER_TIMEOUT);
     }
     return 1;
 }
 
 /*
- * readable - Wait secs seconds for descriptor fd to become readable
- *            Return > 0 if fd is readable, 0 if timeout.
+ * at_line_start - Is pending byte i at the start of a line?
  */
-int readable(int fd, int secs) 
+static int at_line_start(size_t i)
 {
-    int n;
+    return i > out.start ? out.buf[i - 1] == '\n' : out.last == '\n';
+}
 
-    fd_set rset;
-    struct timeval tv;
+/*
+ * scan_prompt - Look for the shell prompt in the pending output. The
+ *               prompt counts only at the start of a line and at the
+ *               very end of what has arrived, since the shell then
+ *               waits for a command; "tsh> " followed by more text is
+ *               output (e.g. a trace's echo). If echo is set, pending
+ *               bytes that cannot be part of a prompt are printed.
+ *               Returns 1 if the prompt was found and consumed, 0 if
+ *               not yet, -1 if echo is clear and other output came
+ */
+int scan_prompt(int echo)
+{
+    size_t plen = strlen(PROMPT), n = out.end - out.start, keep;
+    char *p = out.buf + out.start;
+
+    if (n >= plen && memcmp(p + n - plen, PROMPT, plen) == 0 &&
+	at_line_start(out.end - plen)) {
+	if (n > plen && !echo)
+	    return -1;
+	fwrite(p, 1, n - plen, stdout);
+	out.start = out.end = 0;
+	out.last = '\n';
+	return 1;
+    }
+
+    /* Hold back a tail that may be the start of a prompt */
+    for (keep = n < plen ? n : plen - 1; keep > 0; keep--) {
+	if (memcmp(p + n - keep, PROMPT, keep) == 0 &&
+	    at_line_start(out.end - keep))
+	    break;
+    }
+    if (n > keep) {
+	if (!echo)
+	    return -1;
+	fwrite(p, 1, n - keep, stdout);
+	out.last = p[n - keep - 1];
+	out.start += n - keep;
+    }
+    return 0;
+}
 
-    FD_ZERO(&rset);
-    FD_SET(fd, &rset);
+/*
+ * pump - Wait until the deadline for the shell or a job to send
+ *        something and take it in: shell output is appended to out,
+ *        syncs from jobs are counted in syncs. Returns 0 on timeout,
+ *        2 if shell output arrived, 1 otherwise
+ */
+int pump(const struct timespec *deadline)
+{
+    struct epoll_event ev[2];
+    struct timespec now;
+    long ms;
+    int i, n, got = 1;
+    ssize_t len;
+    char sync[MAXBUF];
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+	(deadline->tv_nsec - now.tv_nsec + 999999) / 1000000;
+    if (ms <= 0)
+	return 0;
 
-    tv.tv_sec = secs;
-    tv.tv_usec = 0;
-    
-    if ((n = select(fd+1, &rset, NULL, NULL, &tv)) < 0) {
-	perror("select");
+    if ((n = epoll_wait(epfd, ev, 2, ms)) < 0) {
+	if (errno == EINTR)
+	    return 1;
+	perror("epoll_wait");
 	exit(1);
     }
+    if (n == 0)
+	return 0;
+
+    for (i = 0; i < n; i++) {
+	if (ev[i].data.fd == syncfd[0]) {
+	    if ((len = recv(syncfd[0], sync, MAXBUF - 1, 0)) < 0) {
+		perror("recv syncfd");
+		exit(1);
+	    }
+	    sync[len] = '\0';
+	    job_event(sync, len);
+	    continue;
+	}
+
+	/* Make room for a whole datagram after the pending bytes */
+	if (out.start > 0) {
+	    memmove(out.buf, out.buf + out.start, out.end - out.start);
+	    out.end -= out.start;
+	    out.start = 0;
+	}
+	if (out.size - out.end < MAXBUF) {
+	    out.size = out.size ? 2 * out.size : 4 * MAXBUF;
+	    if ((out.buf = realloc(out.buf, out.size)) == NULL) {
+		fprintf(stderr, "runtrace: out of memory\n");
+		exit(1);
+	    }
+	}
+	if ((len = recv(datafd[0], out.buf + out.end, MAXBUF, 0)) < 0) {
+	    perror("pump:recv");
+	    exit(1);
+	}
+	if (len == 0) { /* EOF */
+	    out.eof = 1;
+	    epoll_ctl(epfd, EPOLL_CTL_DEL, datafd[0], NULL);
+	}
+	out.end += len;
+	got = 2;
+    }
+    return got;
+}
+
+/*
+ * job_event - Take in a sync message from a job (see config.h). READY
+ *             and ACK, and the empty message of older jobs, count
+ *             toward WAIT; the other events are only logged
+ */
+void job_event(const char *msg, ssize_t len)
+{
+    struct timespec now;
+    long usecs;
+    char *what;
+
+    switch (len > 0 ? msg[0] : SYNC_READY) {
+    case SYNC_READY:
+	what = "is ready";
+	syncs++;
+	break;
+    case SYNC_ACK:
+	what = "took the signal";
+	syncs++;
+	break;
+    case SYNC_STOP:
+	what = "is stopping";
+	break;
+    case SYNC_INT:
+	what = "is interrupting";
+	break;
+    case SYNC_CONT:
+	what = "was continued";
+	break;
+    default:
+	what = "sent an unknown message";
+	break;
+    }
+
+    if (verbose) {
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usecs = (now.tv_sec - started.tv_sec) * 1000000 +
+	    (now.tv_nsec - started.tv_nsec) / 1000;
+	printf("runtrace: %ld.%06lds: job %s %s\n", usecs / 1000000,
+	       usecs % 1000000, len > 1 ? msg + 1 : "?", what);
+    }
+}
 
-    return n;
+/*
+ * set_deadline - Set deadline to secs seconds from now
+ */
+void set_deadline(struct timespec *deadline, int secs)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += secs;
 }
@@ -4,11 +4,14 @@
  * Uses a collection of trace files to test a shell implementation.
  *
  * Introduces non-determinism in the fork() function call to 
- * identify erroneous races in the student code.
+ * identify erroneous races in the student code. The test shell is
+ * run with -F, so that its jobs are launched with the wrapped fork
+ * rather than posix_spawn.
  *  
  * Copyright (c) 2004-2011, R. Bryant and D. O'Hallaron
  */
 #include <stdio.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
@@ -17,26 +20,31 @@
 #include <float.h>
 #include <time.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <poll.h>
 
 #include "driverlib.h"
 #include "config.h"
 
+/* A growable in-memory copy of a shell's output */
+struct outbuf {
+    char *buf;     /* The bytes (not NUL-terminated) */
+    size_t len;    /* Bytes in use */
+    size_t size;   /* Bytes allocated */
+};
+
 /* Prototypes */
 void usage(void);
 int runtrace(char *tracefile);
-void delete_tmpfiles(void);
-void emit_file(char *filename);
-
-/* 
- * Perl program that filters a shell output file:
- *
- * (1) Elides all whitespace. 
- * (2) Converts PIDs of the form "(12345)" to "(PID)". 
- *
- * These transformations allow us to do diffs on the outputs of 
- * different runs of different shells.  
- */
-#define PERLPROG "while(<>){chomp; s/\\s+//g; s/\\(\\d+\\)/\\(PID\\)/g; print \"$_\"}"
+int runiters(char *tracefile);
+void runparallel(char **tracefiles, int n, int *correct);
+int exclusive(char *tracefile);
+int runshell(char *shell, char *tracefile, int sandbox, int forking,
+             struct outbuf *out);
+void output(struct outbuf *out, const char *s, size_t n);
+void filter(const struct outbuf *raw, struct outbuf *out);
+void diff(const struct outbuf *a, const struct outbuf *b, struct outbuf *out);
+void emit(const struct outbuf *out);
 
 /********************
  * Global variables
@@ -46,6 +54,7 @@ char *shellprog = "./tsh";  /* Name of test shell (-s) */
 int sandboxing = 0;         /* Enable sandboxing (-x) */
 int autograded = 0;         /* Set only on the Autolab server (-A) */
 int num_iters=ITERS;        /* How many times to test each trace file */
+int num_jobs = 1;           /* How many traces to run at once (-j) */
 
 /* Null-terminated list of trace files */
 static char *default_tracefiles[] = {TRACEFILES, NULL};
@@ -54,28 +63,21 @@ static char *default_tracefiles[] = {TRACEFILES, NULL};
 char autoresult[MAXBUF]; /* Autolab autoresult string */  
 char status[MAXBUF];
 
-/* Temp filenames for unfiltered shell output */
-char ref_raw_outfile[MAXBUF];
-char test_raw_outfile[MAXBUF];
-char diff_raw_outfile[MAXBUF];
-
-/* Temp filenames for filtered shell output */
-char ref_filtered_outfile[MAXBUF];
-char test_filtered_outfile[MAXBUF];
-char diff_filtered_outfile[MAXBUF];
+/* Raw and filtered output of the test and reference shells */
+struct outbuf test_raw, ref_raw, diff_raw;
+struct outbuf test_filtered, ref_filtered;
 
 /**************
  * Main routine
  **************/
 int main(int argc, char **argv)
 {
-    int i, j;
+    int i;
     char c;
-    int pid;
-    int current_time;
 
     int correct[MAXTRACES];    /* True if trace i is correct */
     int num_correct;           /* Number of correct traces */ 
+    char *results[1];          /* The autoresult strings to post */
 
     char **tracefiles = NULL;  /* Null-terminated array of trace file names */
     int num_tracefiles = 0;    /* The number of traces in that array */
@@ -91,7 +93,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "Ai:t:s:hVx")) != EOF) {
+    while ((c = getopt(argc, argv, "Ai:j:t:s:hVx")) != EOF) {
         switch (c) {
 
 		case 'A': /* hidden Autolab driver argument */
@@ -106,6 +108,14 @@ int main(int argc, char **argv)
 		    }
 		    break;
 
+		case 'j': /* number of traces to run concurrently */
+		    num_jobs = atoi(optarg);
+		    if (num_jobs < 1) {
+				printf("Error: Invalid number of jobs (-j)\n");
+				usage();
+		    }
+		    break;
+
 		case 's':  /* The name of the test shell (default ./tsh) */
 		    shellprog = strdup(optarg);
 		    break;
@@ -152,25 +162,6 @@ int main(int argc, char **argv)
 		printf("Warning: -A flag is ignored when testing single traces\n");
     }
 
-    /* Get the current time stamp and PID */
-    current_time = (int) time(NULL);
-    pid = (int) getpid();
-
-    /* Generate some (truly) unique filenames in /usr/tmp */
-    sprintf(test_raw_outfile, 
-		    "/tmp/test_raw_outfile.%d.%d", current_time, pid);
-    sprintf(ref_raw_outfile, 
-		    "/tmp/ref_raw_outfile.%d.%d", current_time, pid);
-    sprintf(diff_raw_outfile, 
-		    "/tmp/diff_raw_outfile.%d.%d", current_time, pid);
-
-    sprintf(test_filtered_outfile, 
-		    "/tmp/test_filtered_outfile.%d.%d", current_time, pid);
-    sprintf(ref_filtered_outfile, 
-		    "/tmp/ref_filtered_outfile.%d.%d", current_time, pid);
-    sprintf(diff_filtered_outfile, 
-		    "/tmp/diff_filtered_outfile.%d.%d", current_time, pid);
-
     /* Evaluate a single tracefile */
     if (singletrace) {
 		printf("Running %s...\n", tracefiles[tracenum]);
@@ -180,30 +171,24 @@ int main(int argc, char **argv)
 
     /* Evaluate all trace files */
     else {
+		if (num_jobs > 1) {
+		    runparallel(tracefiles, num_tracefiles, correct);
+		}
+		else {
+		    for (i = 0; i < num_tracefiles; i++)
+				correct[i] = runiters(tracefiles[i]);
+		}
+
 		num_correct = 0;
 		for (i = 0; i < num_tracefiles; i++) {
-		    if (num_iters > 1) 
-				printf("Running %d iters of %s\n", num_iters, tracefiles[i]);
-		    for (j = 0; j < num_iters; j++) {
-				if (num_iters > 1) 
-				    printf("%d. Running %s...\n", j+1, tracefiles[i]);
-				else
-				    printf("Running %s...\n", tracefiles[i]);
-
-				/* Run the trace interpreter on trace i */
-				correct[i] = runtrace(tracefiles[i]);
-				if (!correct[i]) {
-				    break;
-				}
-		    }
-		    
 		    if (correct[i])
 				num_correct++;
 		}
 
 		/* 
-		 * Post the result of all the tests to Autolab. Note that
-		 * this function does nothing when run on the client machines.
+		 * Post the result of all the tests to Autolab, in the
+		 * background while the summary is printed. Note that this
+		 * does nothing when run on the client machines.
 		 */
 		sprintf(autoresult, "%d:%d", num_correct, num_tracefiles);
 		for (i = 0; i < num_tracefiles; i++) {
@@ -212,22 +197,185 @@ int main(int argc, char **argv)
 
 		printf("\n");
 		printf("Summary: %d/%d correct traces\n", num_correct, num_tracefiles);
-		driver_post(NULL, autoresult, autograded, status);
+		results[0] = autoresult;
+		if (driver_post_batch(NULL, results, 1, autograded, status) < 0 ||
+		    driver_post_wait(status) < 0)
+		    printf("%s\n", status);
     }
 
-    /* Clean up */
-    delete_tmpfiles();
     exit(0);
 }
 
+/*
+ * runiters - Run a trace num_iters times, stopping at the first failure
+ *            Return 1 if every run was correct, 0 otherwise
+ */
+int runiters(char *tracefile)
+{
+    int j, correct = 0;
+
+    if (num_iters > 1)
+		printf("Running %d iters of %s\n", num_iters, tracefile);
+    for (j = 0; j < num_iters; j++) {
+		if (num_iters > 1)
+		    printf("%d. Running %s...\n", j+1, tracefile);
+		else
+		    printf("Running %s...\n", tracefile);
+
+		/* Run the trace interpreter on the trace */
+		correct = runtrace(tracefile);
+		if (!correct) {
+		    break;
+		}
+    }
+    return correct;
+}
+
+/*
+ * runparallel - Run up to num_jobs traces at once (-j). Each trace gets
+ *               its own worker process, which runs runiters() with its
+ *               stdout going to a pipe, so each runtrace has its own
+ *               sockets and shells. The workers' reports are printed in
+ *               trace order as they become available, so the output is
+ *               the same as a serial run. Traces that look at processes
+ *               by name (exclusive) run with nothing else running
+ */
+void runparallel(char **tracefiles, int n, int *correct)
+{
+    struct worker {
+		pid_t pid;           /* Worker process, 0 if not running */
+		int fd;              /* Read end of its stdout, -1 at EOF */
+		int status;          /* Its wait status */
+		int done;            /* Exited and fully read */
+		struct outbuf out;   /* Its report */
+    } *w;
+    struct pollfd *pfd;
+    int *slot;
+    int i, k, fds[2], next = 0, printed = 0, running = 0, fatal = 0;
+    char buf[MAXBUF];
+    ssize_t len;
+
+    if ((w = calloc(n, sizeof(*w))) == NULL ||
+		(pfd = calloc(num_jobs, sizeof(*pfd))) == NULL ||
+		(slot = calloc(num_jobs, sizeof(*slot))) == NULL) {
+		fprintf(stderr, "sdriver: out of memory\n");
+		exit(1);
+    }
+
+    while (printed < n) {
+		/* Start workers while there is room */
+		while (!fatal && next < n && running < num_jobs &&
+		       !(running > 0 && exclusive(tracefiles[next])) &&
+		       !(running > 0 && exclusive(tracefiles[next - 1]))) {
+		    fflush(stdout);
+		    if (pipe(fds) < 0) {
+				perror("sdriver: pipe");
+				exit(1);
+		    }
+		    if ((w[next].pid = fork()) < 0) {
+				perror("sdriver: fork");
+				exit(1);
+		    }
+		    if (w[next].pid == 0) {
+				close(fds[0]);
+				dup2(fds[1], STDOUT_FILENO);
+				close(fds[1]);
+				exit(runiters(tracefiles[next]) ? 0 : 2);
+		    }
+		    close(fds[1]);
+		    w[next].fd = fds[0];
+		    next++;
+		    running++;
+		}
+
+		/* Print finished reports in trace order */
+		while (printed < next && w[printed].done) {
+		    emit(&w[printed].out);
+		    correct[printed] = WIFEXITED(w[printed].status) &&
+				WEXITSTATUS(w[printed].status) == 0;
+		    if (!WIFEXITED(w[printed].status) ||
+				(WEXITSTATUS(w[printed].status) != 0 &&
+				 WEXITSTATUS(w[printed].status) != 2))
+				exit(1);
+		    printed++;
+		}
+		if (printed == n || running == 0)
+		    continue;
+
+		/* Wait for output from any running worker */
+		for (i = k = 0; i < next; i++) {
+		    if (w[i].pid != 0 && w[i].fd >= 0) {
+				pfd[k].fd = w[i].fd;
+				pfd[k].events = POLLIN;
+				slot[k++] = i;
+		    }
+		}
+		if (poll(pfd, k, -1) < 0) {
+		    if (errno == EINTR)
+				continue;
+		    perror("sdriver: poll");
+		    exit(1);
+		}
+		for (i = 0; i < k; i++) {
+		    struct worker *wp = &w[slot[i]];
+
+		    if (pfd[i].revents == 0)
+				continue;
+		    if ((len = read(wp->fd, buf, sizeof(buf))) > 0) {
+				output(&wp->out, buf, len);
+				continue;
+		    }
+		    if (len < 0 && errno == EINTR)
+				continue;
+
+		    /* EOF: the worker is exiting */
+		    close(wp->fd);
+		    wp->fd = -1;
+		    while (waitpid(wp->pid, &wp->status, 0) < 0 && errno == EINTR)
+				;
+		    if (!WIFEXITED(wp->status) ||
+				(WEXITSTATUS(wp->status) != 0 && WEXITSTATUS(wp->status) != 2))
+				fatal = 1;
+		    wp->pid = 0;
+		    wp->done = 1;
+		    running--;
+		}
+    }
+
+    for (i = 0; i < n; i++)
+		free(w[i].out.buf);
+    free(w);
+    free(pfd);
+    free(slot);
+}
+
+/*
+ * exclusive - Return true if a trace inspects or signals processes by
+ *             name (/bin/ps, /bin/kill), so that the jobs of traces
+ *             running alongside it would show up in its output
+ */
+int exclusive(char *tracefile)
+{
+    FILE *fp;
+    char buf[MAXBUF];
+    int found = 0;
+
+    if ((fp = fopen(tracefile, "r")) == NULL)
+		return 0;
+    while (!found && fgets(buf, MAXBUF, fp)) {
+		if (strstr(buf, "/bin/ps") != NULL || strstr(buf, "/bin/kill") != NULL)
+		    found = 1;
+    }
+    fclose(fp);
+    return found;
+}
+
 /*
  * runtrace - Run trace file on test and reference shells
  *            Return 0 if results are different, 1 if identical
   */
 int runtrace(char *tracefile)
-{ 
-    int status;
-    char buf[MAXBUF];
+{
     struct stat statbuf;
 
     if (stat(tracefile, &statbuf) < 0) {
@@ -236,77 +384,57 @@ int runtrace(char *tracefile)
     }
 
     /* Run the student's test shell */
-    if (sandboxing)
-		sprintf(buf, "./runtrace -x -s %s -f %s > %s\n", 
-				shellprog, tracefile, test_raw_outfile);
-    else
-		sprintf(buf, "./runtrace -s %s -f %s > %s\n", 
-				shellprog, tracefile, test_raw_outfile);
-
-    if (system(buf) != 0) {
-		printf("sdriver unable to run %s\n", buf);
+    if (runshell(shellprog, tracefile, sandboxing, 1, &test_raw) != 0) {
+		printf("sdriver unable to run ./runtrace -s %s -f %s\n",
+		       shellprog, tracefile);
     }
-    
+
     /* Run the reference shell */
-    sprintf(buf, "./runtrace -s ./tshref -f %s > %s\n", 
-		    tracefile, ref_raw_outfile);
-    if (system(buf) != 0) {
-		emit_file(ref_raw_outfile);
-		printf("sdriver unable to run %s\n", buf);
-		delete_tmpfiles();
+    if (runshell("./tshref", tracefile, 0, 0, &ref_raw) != 0) {
+		emit(&ref_raw);
+		printf("sdriver unable to run ./runtrace -s ./tshref -f %s\n",
+		       tracefile);
 		exit(1);
     }
-    
+
     /* Filter the test and reference outputs */
-    sprintf(buf, "perl -e '%s' < %s | sort > %s", 
-		    PERLPROG, test_raw_outfile, test_filtered_outfile);
-    system(buf);
-    
-    sprintf(buf, "perl -e '%s' < %s | sort > %s", 
-		    PERLPROG, ref_raw_outfile, ref_filtered_outfile);
-    system(buf);
-    
-    /* Diff the filtered output files */
-    sprintf(buf, "diff %s %s > %s\n", 
-		    test_filtered_outfile, ref_filtered_outfile, diff_filtered_outfile);
-    status = system(buf);
-    
-    /* Filtered output files were different */
-    if (status != 0) {
-		sprintf(buf, "diff %s %s > %s\n", 
-				test_raw_outfile, ref_raw_outfile, diff_raw_outfile);
-		system(buf);
-
-		printf("Oops: test and reference outputs for %s differed.\n", 
+    filter(&test_raw, &test_filtered);
+    filter(&ref_raw, &ref_filtered);
+
+    /* Filtered outputs were different */
+    if (test_filtered.len != ref_filtered.len ||
+		memcmp(test_filtered.buf, ref_filtered.buf, test_filtered.len) != 0) {
+		diff(&test_raw, &ref_raw, &diff_raw);
+
+		printf("Oops: test and reference outputs for %s differed.\n",
 		       tracefile);
 		printf("\n");
 
 		printf("Test output:\n");
-		emit_file(test_raw_outfile);
+		emit(&test_raw);
 		printf("\n");
 
 		printf("Reference output:\n");
-		emit_file(ref_raw_outfile);
+		emit(&ref_raw);
 		printf("\n");
 
 		printf("Output of 'diff test reference':\n");
-		emit_file(diff_raw_outfile);
+		emit(&diff_raw);
 		printf("\n");
 
 		return 0;
 }
-    
-    /* Filtered output files were identical */
+
+    /* Filtered outputs were identical */
     if (verbose) {
 		printf("Success: The test and reference outputs for %s matched!\n", tracefile);
     }
     if (verbose > 1) {
 		printf("Test output:\n");
-		emit_file(test_raw_outfile);
+		emit(&test_raw);
 		printf("\n");
 		printf("Reference output:\n");
-		fflush(stdout);
-		emit_file(ref_raw_outfile);
+		emit(&ref_raw);
 		printf("\n");
     }
 
@@ -314,33 +442,270 @@ int runtrace(char *tracefile)
 }
 
 /*
- * emit_file - prints an ascii file to stdout
+ * runshell - Run a shell on a trace file through ./runtrace, collecting
+ *            its standard output in out. With forking, the shell is run
+ *            with -F. Return 0 if runtrace exited normally with status
+ *            0, -1 otherwise
  */
-void emit_file(char *filename) 
+int runshell(char *shell, char *tracefile, int sandbox, int forking,
+             struct outbuf *out)
 {
-    FILE *fp;
+    int fds[2], status, argc = 0;
+    pid_t pid;
+    ssize_t n;
     char buf[MAXBUF];
+    char *argv[8];
+
+    argv[argc++] = "./runtrace";
+    if (sandbox)
+		argv[argc++] = "-x";
+    if (forking)
+		argv[argc++] = "-F";
+    argv[argc++] = "-s";
+    argv[argc++] = shell;
+    argv[argc++] = "-f";
+    argv[argc++] = tracefile;
+    argv[argc] = NULL;
+
+    out->len = 0;
+    fflush(stdout);
+    if (pipe(fds) < 0) {
+		perror("sdriver: pipe");
+		return -1;
+    }
+    if ((pid = fork()) < 0) {
+		perror("sdriver: fork");
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+    }
+    if (pid == 0) {
+		close(fds[0]);
+		if (dup2(fds[1], STDOUT_FILENO) < 0)
+		    _exit(127);
+		close(fds[1]);
+		execv(argv[0], argv);
+		_exit(127);
+    }
+    close(fds[1]);
+
+    while ((n = read(fds[0], buf, sizeof(buf))) != 0) {
+		if (n < 0) {
+		    if (errno == EINTR)
+				continue;
+		    perror("sdriver: read");
+		    break;
+		}
+		output(out, buf, n);
+    }
+    close(fds[0]);
+
+    while (waitpid(pid, &status, 0) < 0) {
+		if (errno != EINTR) {
+		    perror("sdriver: waitpid");
+		    return -1;
+		}
+    }
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+/*
+ * output - Append n bytes to an output buffer
+ */
+void output(struct outbuf *out, const char *s, size_t n)
+{
+    if (out->len + n > out->size) {
+		size_t size = out->size ? out->size : MAXBUF;
+		while (size < out->len + n)
+		    size *= 2;
+		if ((out->buf = realloc(out->buf, size)) == NULL) {
+		    fprintf(stderr, "sdriver: out of memory\n");
+		    exit(1);
+		}
+		out->size = size;
+    }
+    memcpy(out->buf + out->len, s, n);
+    out->len += n;
+}
+
+/*
+ * filter - Normalize a shell's output so that runs of different shells
+ *          can be compared:
+ *
+ * (1) Elides all whitespace, including the newlines.
+ * (2) Converts PIDs of the form "(12345)" to "(PID)", line by line.
+ *
+ * This is what the old perl filter did. Since it dropped the newlines
+ * as well, the sort that followed it only ever saw a single line, so
+ * no sorting is needed here.
+ */
+void filter(const struct outbuf *raw, struct outbuf *out)
+{
+    static struct outbuf line;
+    const char *p = raw->buf, *end = raw->buf + raw->len;
+    size_t i, j;
+
+    out->len = 0;
+    while (p < end) {
+		/* Strip the whitespace out of the next line */
+		line.len = 0;
+		for (; p < end && *p != '\n'; p++) {
+		    if (!isspace((unsigned char)*p))
+				output(&line, p, 1);
+		}
+		if (p < end)
+		    p++;
+
+		/* Rewrite every (digits) in it */
+		for (i = 0; i < line.len; i = j) {
+		    j = i + 1;
+		    if (line.buf[i] == '(') {
+				while (j < line.len && isdigit((unsigned char)line.buf[j]))
+				    j++;
+				if (j > i + 1 && j < line.len && line.buf[j] == ')') {
+				    output(out, "(PID)", 5);
+				    j++;
+				    continue;
+				}
+				j = i + 1;
+		    }
+		    output(out, line.buf + i, 1);
+		}
+    }
+}
+
+/*
+ * splitlines - Index the lines of an output buffer. Sets *np to the
+ *              number of lines and returns a malloc'd array of n + 1
+ *              offsets; line i spans [off[i], off[i+1]), newline included
+ */
+static size_t *splitlines(const struct outbuf *b, size_t *np)
+{
+    size_t i, n = 0, *off;
 
-    if ((fp = fopen(filename, "r")) == NULL) {
-		printf("fopen error: Unable to open file %s\n", filename);
+    for (i = 0; i < b->len; i++) {
+		if (b->buf[i] == '\n' || i == b->len - 1)
+		    n++;
+    }
+    if ((off = malloc((n + 1) * sizeof(size_t))) == NULL) {
+		fprintf(stderr, "sdriver: out of memory\n");
 		exit(1);
     }
-    while(fgets(buf, MAXBUF, fp)) {
-		printf("%s", buf);
+    n = 0;
+    off[0] = 0;
+    for (i = 0; i < b->len; i++) {
+		if (b->buf[i] == '\n' || i == b->len - 1)
+		    off[++n] = i + 1;
     }
-    fclose(fp);
+    *np = n;
+    return off;
 }
 
 /*
- * delete_tmpfiles - Clean up the temp files we created during testing
+ * diffrange - Write a diff(1) line range: "3" or "3,5"
  */
-void delete_tmpfiles()
+static void diffrange(struct outbuf *out, size_t lo, size_t hi)
 {
-    char buf[MAXBUF];
-    sprintf(buf, "rm -rf %s %s %s %s %s %s",
-		    test_raw_outfile, ref_raw_outfile, diff_raw_outfile,
-		    test_filtered_outfile, ref_filtered_outfile, diff_filtered_outfile);
-    system(buf);
+    char buf[64];
+
+    if (hi <= lo + 1)
+		sprintf(buf, "%lu", (unsigned long)(hi > lo ? hi : lo));
+    else
+		sprintf(buf, "%lu,%lu", (unsigned long)lo + 1, (unsigned long)hi);
+    output(out, buf, strlen(buf));
+}
+
+#define NONEWLINE "\n\\ No newline at end of file\n"
+
+/*
+ * difflines - Write lines [lo, hi) of a buffer, each prefixed with tag
+ */
+static void difflines(struct outbuf *out, const char *tag,
+		      const struct outbuf *b, const size_t *off,
+		      size_t lo, size_t hi)
+{
+    for (; lo < hi; lo++) {
+		output(out, tag, 2);
+		output(out, b->buf + off[lo], off[lo + 1] - off[lo]);
+		if (b->buf[off[lo + 1] - 1] != '\n')
+		    output(out, NONEWLINE, strlen(NONEWLINE));
+    }
+}
+
+/*
+ * diff - Write the differences between a and b to out in the normal
+ *        format of diff(1), from a longest common subsequence of lines.
+ *        Trace outputs are a few dozen lines, so the quadratic table
+ *        is cheap
+ */
+void diff(const struct outbuf *a, const struct outbuf *b, struct outbuf *out)
+{
+    size_t n, m, i, j, i0, j0, *aoff, *boff;
+    unsigned *lcs;
+
+    aoff = splitlines(a, &n);
+    boff = splitlines(b, &m);
+#define SAME(i, j) (aoff[(i)+1] - aoff[i] == boff[(j)+1] - boff[j] && \
+		    memcmp(a->buf + aoff[i], b->buf + boff[j], \
+			   aoff[(i)+1] - aoff[i]) == 0)
+#define LCS(i, j) lcs[(i) * (m + 1) + (j)]
+
+    /* LCS(i, j) is the LCS length of a[i..] and b[j..] */
+    if ((lcs = calloc((n + 1) * (m + 1), sizeof(unsigned))) == NULL) {
+		fprintf(stderr, "sdriver: out of memory\n");
+		exit(1);
+    }
+    for (i = n; i-- > 0; ) {
+		for (j = m; j-- > 0; ) {
+		    if (SAME(i, j))
+				LCS(i, j) = LCS(i + 1, j + 1) + 1;
+		    else
+				LCS(i, j) = LCS(i + 1, j) > LCS(i, j + 1) ?
+				    LCS(i + 1, j) : LCS(i, j + 1);
+		}
+    }
+
+    out->len = 0;
+    i = j = 0;
+    while (i < n || j < m) {
+		if (i < n && j < m && SAME(i, j)) {
+		    i++;
+		    j++;
+		    continue;
+		}
+
+		/* Extend a hunk until the two sides line up again */
+		i0 = i;
+		j0 = j;
+		while ((i < n || j < m) && !(i < n && j < m && SAME(i, j))) {
+		    if (j == m || (i < n && LCS(i + 1, j) >= LCS(i, j + 1)))
+				i++;
+		    else
+				j++;
+		}
+
+		diffrange(out, i0, i);
+		output(out, i == i0 ? "a" : j == j0 ? "d" : "c", 1);
+		diffrange(out, j0, j);
+		output(out, "\n", 1);
+		difflines(out, "< ", a, aoff, i0, i);
+		if (i > i0 && j > j0)
+		    output(out, "---\n", 4);
+		difflines(out, "> ", b, boff, j0, j);
+    }
+#undef SAME
+#undef LCS
+    free(lcs);
+    free(aoff);
+    free(boff);
+}
+
+/*
+ * emit - Print an output buffer to stdout
+ */
+void emit(const struct outbuf *out)
+{
+    fwrite(out->buf, 1, out->len, stdout);
 }
 
 /* 
@@ -348,11 +713,12 @@ void delete_tmpfiles()
  */
 void usage(void) 
 {
-    printf("Usage: sdriver [-hV] [-s <shell> -t <tracenum> -i <iters>]\n");
+    printf("Usage: sdriver [-hV] [-s <shell> -t <tracenum> -i <iters> -j <n>]\n");
     printf("Options\n");
     printf("\t-h           Print this message.\n");
     printf("\t-i <iters>   Run each trace <iters> times (default %d)\n", 
 		   num_iters);
+    printf("\t-j <n>       Run up to <n> traces at once (default 1)\n");
     printf("\t-s <shell>   Name of test shell (default ./tsh)\n");
     printf("\t-t <n>       Run trace <n> only (default all)\n");
     printf("\t-V           Be more verbose.\n");
@@ -3,23 +3,45 @@
  * 
  * <Put your name and login ID here>
  */
+#define _GNU_SOURCE         /* for pipe2, splice and tee */
 #include <assert.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <errno.h>
+#include <spawn.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include "rio.h"
 
 /* Misc manifest constants */
-#define MAXLINE    1024   /* max line size */
-#define MAXARGS     128   /* max args on a command line */
-#define MAXJOBS      16   /* max jobs at any point in time */
-#define MAXJID    1<<16   /* max job ID */
+#define MAXLINE    1024   /* size of the message and path buffers */
+#define MAXJID    (1<<16) /* max job ID */
+#define MINJOBS      64   /* initial size of the job table indexes */
+#define MAXSTAGES    32   /* max commands in a pipeline */
+#define FILTERBUF (1<<16) /* bytes moved per splice by a built-in filter */
+#define MINHASH      64   /* initial buckets of the command hash table */
+#define DEFPATH "/bin:/usr/bin"   /* search path when PATH is not set */
+#define MINTOK      256   /* initial bytes and arguments of a token buffer */
+#define CMDSLACK   4096   /* dead bytes the command line arena may hold */
+#define LISTJOBS     64   /* jobs listjobs writes with one writev */
+#define SCRIPTBUF (1<<16) /* stdout buffer in script mode */
+#define CGROOT "/sys/fs/cgroup"   /* where relative cgroup paths start */
 
 /* Job states */
 #define UNDEF         0   /* undefined */
@@ -47,34 +69,179 @@
 extern char **environ;      /* defined in libc */
 char prompt[] = "tsh> ";    /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;            /* if true, print additional output */
-int nextjid = 1;            /* next job ID to allocate */
+int use_fork = 0;           /* if true, launch jobs with fork, not posix_spawn */
+sigset_t shell_mask;        /* signal mask the shell started with */
 char sbuf[MAXLINE];         /* for composing sprintf messages */
 
 struct job_t {              /* The job struct */
     pid_t pid;              /* job PID */
     int jid;                /* job ID [1, 2, ...] */
     int state;              /* UNDEF, BG, FG, or ST */
-    char cmdline[MAXLINE];  /* command line */
+    unsigned cmdline;       /* offset of its command line in cmd_arena */
+    struct proc_t *procs;   /* its processes that have not been reaped */
+    int nprocs;
+    struct par_t *par;      /* tasks of a parallel builtin, or NULL */
+    int timed;              /* if true, report its usage when it ends */
+    char *place;            /* where @ modifiers put it, as listed, or NULL */
+    struct timespec start;  /* when it was started */
+    struct timeval utime;   /* CPU time of its processes reaped so far */
+    struct timeval stime;
+    long maxrss;            /* largest max RSS among them, in KB */
+    long nvcsw, nivcsw;     /* their context switches */
+    struct job_t *next;     /* next spare job */
 };
-struct job_t job_list[MAXJOBS]; /* The job list */
+
+struct proc_t {             /* A process of a job; one per pipeline stage */
+    pid_t pid;
+    struct job_t *job;      /* the job it belongs to */
+    struct proc_t *sibling; /* next process of the same job */
+    struct proc_t *next;    /* next process in the same PID bucket, or spare */
+};
+
+/*
+ * The job table.  Jobs are found by JID through by_jid[], a direct
+ * index, and by the PID of any of their processes through a chained hash
+ * table; both grow as jobs are added.  The PID of a job is that of its
+ * first process, which leads the process group of a pipeline.  A new job
+ * gets the lowest free JID: the top of a min-heap of the JIDs given
+ * back, or else nextjid.  Only addjob allocates, with SIGCHLD blocked,
+ * so that deletejob and reapproc are safe to call from a handler:
+ * structs are recycled through the spare lists.
+ */
+struct job_list_t {
+    struct job_t **by_jid;  /* by_jid[jid], NULL if free; jid_cap entries */
+    int jid_cap;
+    struct proc_t **by_pid; /* hash buckets; pid_mask + 1 of them */
+    int pid_mask;
+    int nprocs;             /* processes in by_pid */
+    int *free_jids;         /* min-heap of free JIDs below nextjid */
+    int nfree;
+    int nextjid;            /* JIDs from here on have never been used */
+    int count;              /* jobs in the table */
+    struct job_t *fg;       /* the job in the FG state, if any */
+    struct job_t *spare;    /* cleared job structs to reuse */
+    struct proc_t *spare_procs;
+};
+struct job_list_t job_list[1];  /* The job list */
+
+/*
+ * The command hash table, as in bash: where each command named without
+ * a slash was found in PATH, so that running it again does not search
+ * PATH again.  It is emptied when PATH changes, and an entry is dropped
+ * when its file turns out to be gone.
+ */
+struct hashent_t {
+    char *name;             /* the command */
+    char *path;             /* where it was found */
+    int hits;               /* times it has been run since */
+    struct hashent_t *next; /* next entry in the same bucket */
+};
+struct cmd_hash_t {
+    struct hashent_t **buckets; /* mask + 1 of them */
+    int mask;
+    int count;
+    char *pathvar;          /* the PATH the entries were found in */
+} cmd_hash[1];
+
+/*
+ * Job command lines are interned in one arena, so that a job costs the
+ * length of its line and jobs with the same line share one copy.  Jobs
+ * refer to a line by its offset, which lets the arena move and be
+ * compacted.  A line no job refers to stays in the intern table, and is
+ * reused if it comes again, until the arena is next compacted; the
+ * whole arena is emptied whenever the job list is.
+ */
+struct cmdstr {             /* A command line in the arena */
+    unsigned len;           /* bytes in s, not counting the NUL */
+    unsigned refs;          /* jobs with this line */
+    char s[];
+};
+struct cmd_arena_t {
+    char *buf;
+    size_t used, cap;       /* bytes of buf used and allocated */
+    size_t dead;            /* bytes of lines no job refers to */
+    unsigned *table;        /* intern table: offset + 1 of a line, or 0 */
+    unsigned mask;          /* table has mask + 1 slots */
+    unsigned count;         /* lines in table */
+} cmd_arena[1];
+
+char **script;              /* with -f, the lines of the script */
+int nscript, scriptpos;     /* lines in it, and the next to run */
+
+rio_t inrio;                /* stdin, and the input read but not yet run */
 
 struct cmdline_tokens {
     int argc;               /* Number of arguments */
-    char *argv[MAXARGS];    /* The arguments list */
-    char *infile;           /* The input file */
-    char *outfile;          /* The output file */
+    char **argv;            /* The arguments list; NULL ends each stage */
+    int nstages;            /* Number of commands in the pipeline */
+    int stage[MAXSTAGES];   /* argv[stage[i]] is argv[0] of command i */
+    char *infile;           /* The input file, of the first command */
+    char *outfile;          /* The output file, of the last command */
+    int timed;              /* The line started with "time" */
+    int hascpus;            /* @cpus= was given: run on cpus only */
+    cpu_set_t cpus;
+    char *cgroup;           /* @cgroup= path to run in, or NULL */
     enum builtins_t {       /* Indicates if argv[0] is a builtin command */
         BUILTIN_NONE,
         BUILTIN_QUIT,
         BUILTIN_JOBS,
         BUILTIN_BG,
-        BUILTIN_FG} builtins;
+        BUILTIN_FG,
+        BUILTIN_PARALLEL,
+        BUILTIN_HASH} builtins;
+    char *buf;              /* the words, which the pointers point into */
+    size_t *off;            /* where each argument starts in buf */
+    size_t bufcap;          /* bytes allocated for buf */
+    int argcap;             /* arguments allocated for argv and off */
+};
+
+/*
+ * The tasks of "parallel -j N command [args...] ::: arg...", which runs
+ * command with each arg appended, at most N at a time, as one job.  The
+ * tasks share a process group, led by whichever task started it: a
+ * task joins the group of those still running, or starts a new one,
+ * and the job's PID, when all before it have ended.
+ */
+struct par_t {
+    struct cmdline_tokens tok;  /* the command; its last argument is
+                                   set to each task's arg in turn */
+    char **args;            /* the tasks' args */
+    pid_t *pids;            /* PID of each task started */
+    int *status;            /* wait status of each task that ended */
+    int ntasks;
+    int next;               /* next task to start */
+    int running;            /* tasks started and not yet reaped */
+    int limit;              /* most tasks to run at once */
+    int stop;               /* if true, start no more tasks */
+    struct timespec start;
+    char *words;            /* the strings tok.argv and args point into */
 };
 /* End global variables */
 
 
 /* Function prototypes */
 void eval(char *cmdline);
+void bgfg(struct cmdline_tokens *tok);
+int launch(struct cmdline_tokens *tok, int i, int in, int out, pid_t pgid,
+           const sigset_t *mask, pid_t *pidp);
+int isfilter(char **argv);
+int runfilter(char **argv);
+
+void loadscript(const char *file);
+void readinput(void);
+char *nextline(void);
+void handlesignals(int sfd);
+
+char *hashlookup(const char *name);
+void hashdrop(const char *name);
+void hashclear(void);
+void hashcmd(struct cmdline_tokens *tok);
+
+void parallel(struct cmdline_tokens *tok, int bg, char *cmdline);
+int parstart(struct par_t *par, pid_t pgid, pid_t *pidp);
+void parfill(struct job_t *job);
+void parreap(struct job_t *job, pid_t pid, int status);
+void parfree(struct par_t *par);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
@@ -85,15 +252,27 @@ int parseline(const char *cmdline, struct cmdline_tokens *tok);
 void sigquit_handler(int sig);
 
 void clearjob(struct job_t *job);
-void initjobs(struct job_t *job_list);
-int maxjid(struct job_t *job_list); 
-int addjob(struct job_t *job_list, pid_t pid, int state, char *cmdline);
-int deletejob(struct job_t *job_list, pid_t pid); 
-pid_t fgpid(struct job_t *job_list);
-struct job_t *getjobpid(struct job_t *job_list, pid_t pid);
-struct job_t *getjobjid(struct job_t *job_list, int jid); 
+void initjobs(struct job_list_t *job_list);
+int maxjid(struct job_list_t *job_list); 
+void reservejobs(struct job_list_t *job_list, int n);
+int addjob(struct job_list_t *job_list, pid_t pid, int state, char *cmdline);
+unsigned cmdintern(const char *cmdline);
+void cmdrelease(unsigned off);
+const char *jobcmdline(const struct job_t *job);
+int addproc(struct job_list_t *job_list, struct job_t *job, pid_t pid);
+int deletejob(struct job_list_t *job_list, pid_t pid); 
+int reapproc(struct job_list_t *job_list, pid_t pid);
+void setjobstate(struct job_list_t *job_list, struct job_t *job, int state);
+pid_t fgpid(struct job_list_t *job_list);
+struct job_t *getjobpid(struct job_list_t *job_list, pid_t pid);
+struct job_t *getjobjid(struct job_list_t *job_list, int jid); 
 int pid2jid(pid_t pid); 
-void listjobs(struct job_t *job_list, int output_fd);
+void listjobs(struct job_list_t *job_list, int output_fd, int usage);
+void addusage(struct job_t *job, const struct rusage *ru);
+int fmtusage(char *buf, size_t size, const struct job_t *job);
+int parsecpus(const char *list, cpu_set_t *set);
+char *placement(const struct cmdline_tokens *tok);
+int place(const struct cmdline_tokens *tok);
 
 void usage(void);
 void unix_error(char *msg);
@@ -111,15 +290,22 @@ int
 main(int argc, char **argv) 
     {	
 	char c;
-    char cmdline[MAXLINE];    /* cmdline for fgets */
+    char *cmdline;            /* the next command line */
     int emit_prompt = 1; /* emit prompt (default) */
+    int prompted = 0;    /* the prompt is showing */
+    int stdin_poll = 1;  /* stdin can be watched with epoll */
+    int watching = 0;    /* ... and is being watched */
+    char *scriptfile = NULL;  /* -f: run this script instead of stdin */
+    int sfd, epfd, want, n, i;
+    sigset_t sigs;
+    struct epoll_event ev, events[2];
 
     /* Redirect stderr to stdout (so that driver will get all output
      * on the pipe connected to stdout) */
     dup2(1, 2);
 
     /* Parse the command line */
-    while ((c = getopt(argc, argv, "hvp")) != EOF) {
+    while ((c = getopt(argc, argv, "hvpFf:")) != EOF) {
         switch (c) {
         case 'h':             /* print help message */
             usage();
@@ -130,78 +316,232 @@ main(int argc, char **argv)
         case 'p':             /* don't print a prompt */
             emit_prompt = 0;  /* handy for automatic testing */
             break;
+        case 'F':             /* launch jobs with fork and execve */
+            use_fork = 1;
+            break;
+        case 'f':             /* run a script */
+            scriptfile = optarg;
+            emit_prompt = 0;
+            break;
         default:
             usage();
         }
     }
 
-    /* Install the signal handlers */
-
-    /* These are the ones you will need to implement */
-    Signal(SIGINT,  sigint_handler);   /* ctrl-c */
-    Signal(SIGTSTP, sigtstp_handler);  /* ctrl-z */
-    Signal(SIGCHLD, sigchld_handler);  /* Terminated or stopped child */
+    /* SIGINT, SIGTSTP and SIGCHLD stay blocked and are read from a
+       signalfd, which the event loop waits on along with stdin */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);     /* ctrl-c */
+    sigaddset(&sigs, SIGTSTP);    /* ctrl-z */
+    sigaddset(&sigs, SIGCHLD);    /* Terminated or stopped child */
+    sigprocmask(SIG_BLOCK, &sigs, &shell_mask);
+    if ((sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        unix_error("signalfd error");
     Signal(SIGTTIN, SIG_IGN);
     Signal(SIGTTOU, SIG_IGN);
 
     /* This one provides a clean way to kill the shell */
     Signal(SIGQUIT, sigquit_handler); 
 
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        unix_error("epoll_create1 error");
+    ev.events = EPOLLIN;
+    ev.data.fd = sfd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev) < 0)
+        unix_error("epoll_ctl error");
+    ev.data.fd = STDIN_FILENO;
+    if (scriptfile != NULL)
+        stdin_poll = 0;           /* not read at all */
+    else if (epoll_ctl(epfd, EPOLL_CTL_ADD, STDIN_FILENO, &ev) == 0)
+        watching = 1;
+    else if (errno == EPERM)
+        stdin_poll = 0;           /* a regular file: always readable */
+    else
+        unix_error("epoll_ctl error");
+
     /* Initialize the job list */
     initjobs(job_list);
 
+    /* A script's output is written a command at a time, not a line */
+    rio_readinitb(&inrio, STDIN_FILENO);
+    if (scriptfile != NULL) {
+        loadscript(scriptfile);
+        setvbuf(stdout, NULL, _IOFBF, SCRIPTBUF);
+    }
+
 
-    /* Execute the shell's read/eval loop */
+    /* Execute the shell's event loop */
     while (1) {
 
-        if (emit_prompt) {
-            printf("%s", prompt);
-            fflush(stdout);
-        }
-        if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
-            app_error("fgets error");
-        if (feof(stdin)) { 
-            /* End of file (ctrl-d) */
-            printf ("\n");
-            fflush(stdout);
-            fflush(stderr);
-            exit(0);
+        /* Run the command lines read so far, until one holds the
+           foreground; its job must end or stop before the next */
+        while (job_list->fg == NULL && (cmdline = nextline()) != NULL) {
+            eval(cmdline);
+            if (scriptfile == NULL)
+                fflush(stdout);
+            prompted = 0;
         }
-        
-        /* Remove the trailing newline */
-        cmdline[strlen(cmdline)-1] = '\0';
-        
-        /* Evaluate the command line */
-        eval(cmdline);
-        
-        fflush(stdout);
+
+        if (job_list->fg == NULL) {
+            if (inrio.rio_eof) { 
+                /* End of file (ctrl-d) */
+                if (scriptfile == NULL)
+                    printf ("\n");
+                fflush(stdout);
+                fflush(stderr);
+                exit(0);
+            }
+            if (emit_prompt && !prompted) {
+                printf("%s", prompt);
+                fflush(stdout);
+                prompted = 1;
+            }
+        }
+
+        /* Wait for signals, and for input if it can be run */
+        want = job_list->fg == NULL;
+        if (stdin_poll && want != watching) {
+            ev.events = want ? EPOLLIN : 0;
+            ev.data.fd = STDIN_FILENO;
+            if (epoll_ctl(epfd, EPOLL_CTL_MOD, STDIN_FILENO, &ev) < 0)
+                unix_error("epoll_ctl error");
+            watching = want;
+        }
+        if (want && !stdin_poll)
+            readinput();
         fflush(stdout);
+        n = epoll_wait(epfd, events, 2, want && !stdin_poll ? 0 : -1);
+        if (n < 0 && errno != EINTR)
+            unix_error("epoll_wait error");
+        for (i = 0; i < n; i++) {
+            if (events[i].data.fd == sfd)
+                handlesignals(sfd);
+            else
+                readinput();
+        }
     } 
     
     exit(0); /* control never reaches here */
 }
+
 /*
- * built-in command check
- * 
+ * loadscript - Map the script file and split it into lines up front,
+ *     in place: the mapping is private, so the newlines can become
+ *     NULs.  It is laid over anonymous memory at least a byte longer
+ *     than the file, so the last line can be ended too.  The job table
+ *     is sized for the script's background lines in one go.
+ */
+void 
+loadscript(const char *file) 
+{
+    struct stat st;
+    size_t pg = sysconf(_SC_PAGESIZE), span;
+    char *base, *p, *end, *nl, *last;
+    int fd, cap = 0, nbg = 0;
+
+    if ((fd = open(file, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+        printf("%s: %s\n", file, strerror(errno));
+        exit(1);
+    }
+    span = (st.st_size + 1 + pg - 1) & ~(pg - 1);
+    if ((base = mmap(NULL, span, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED ||
+        (st.st_size > 0 &&
+         mmap(base, st.st_size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED))
+        unix_error("loadscript: mmap error");
+    close(fd);
+
+    end = base + st.st_size;
+    for (p = base; p < end; p = nl + 1) {
+        if ((nl = memchr(p, '\n', end - p)) == NULL)
+            nl = end;
+        *nl = '\0';
+        if (nscript == cap) {
+            cap = cap ? 2 * cap : MINJOBS;
+            if ((script = realloc(script, cap * sizeof(char *))) == NULL)
+                unix_error("loadscript: realloc error");
+        }
+        script[nscript++] = p;
+        for (last = nl; last > p && isspace((unsigned char)last[-1]); last--)
+            ;
+        nbg += last > p && last[-1] == '&';
+    }
+    if (script == NULL)
+        script = &base;         /* an empty script; never read */
+    inrio.rio_eof = 1;
+    reservejobs(job_list, nbg);
+}
 
-//int builtin_command(char **argv)
-//{
-//if (!strcmp(argv[0], "quit"))
-//exit(0);
-//if (!strcmp(argv[0], "&"))
-///
-//return 1;
-//return 0;
-//
-//}
- 
- 
+/*
+ * readinput - Read what stdin has into inrio, noting end of file.  The
+ *     buffer grows to hold a line of any length.
+ */
+void 
+readinput(void) 
+{
+    if (inrio.rio_eof)
+        return;
+    if (rio_fillb(&inrio) < 0 && errno != EAGAIN)
+        app_error("read error");
+}
+
+/*
+ * nextline - Take the next command line out of inrio, or the script.
+ *     The line stays where it is, with its newline replaced by a NUL,
+ *     until the next readinput.  At end of file the last line needs no
+ *     newline.  Returns NULL if there is no whole line yet.
+ */
+char 
+*nextline(void) 
+{
+    char *line;
+
+    if (script != NULL)
+        return scriptpos < nscript ? script[scriptpos++] : NULL;
+    return rio_nextlineb_view(&inrio, &line) > 0 ? line : NULL;
+}
+
+/*
+ * handlesignals - Act on the signals that have arrived on the signalfd
+ *     sfd.  SIGCHLDs merge while blocked, so one call to the SIGCHLD
+ *     handler, which reaps every child that has changed state, is
+ *     enough however many were read.
+ */
+void 
+handlesignals(int sfd) 
+{
+    struct signalfd_siginfo si[16];
+    ssize_t n;
+    int i, chld = 0;
+
+    while ((n = read(sfd, si, sizeof(si))) > 0) {
+        for (i = 0; i < n / (ssize_t)sizeof(si[0]); i++) {
+            switch (si[i].ssi_signo) {
+            case SIGCHLD:
+                chld = 1;
+                break;
+            case SIGINT:
+                sigint_handler(SIGINT);
+                break;
+            case SIGTSTP:
+                sigtstp_handler(SIGTSTP);
+                break;
+            }
+        }
+    }
+    if (n < 0 && errno != EAGAIN && errno != EINTR)
+        unix_error("signalfd read error");
+    if (chld)
+        sigchld_handler(SIGCHLD);
+}
+/*
  * eval - Evaluate the command line that the user has just typed in
  * 
  * If the user has requested a built-in command (quit, jobs, bg or fg)
  * then execute it immediately. Otherwise, fork a child process and
- * run the job in the context of the child. If the job is running in
- * the foreground, wait for it to terminate and then return.  Note:
+ * run the job in the context of the child. A job running in the
+ * foreground is waited for by the event loop in main.  Note:
  * each child process must have a unique process group ID so that our
  * background children don't receive SIGINT (SIGTSTP) from the kernel
  * when we type ctrl-c (ctrl-z) at the keyboard.  
@@ -209,81 +549,406 @@ main(int argc, char **argv)
 void 
 eval(char *cmdline) 
 {	
-	pid_t pid;
+	pid_t pid, pgid;
+	int i, in, out, next_in, fds[2];
 
     int bg;              /* should the job run in bg or fg? */
-    struct cmdline_tokens tok;
+    static struct cmdline_tokens tok;   /* its buffers are reused */
 
     /* Parse command line */
     bg = parseline(cmdline, &tok); 
     //check built-in command or not
 	if((tok.builtins)==BUILTIN_QUIT)
 	exit(0);
-		else if((tok.builtins)==BUILTIN_JOBS)
-	printf("tok builtin jobs\n");
-       else if((tok.builtins)==BUILTIN_BG)
-	printf("tok builtin BG\n");
-	  else if((tok.builtins)==BUILTIN_FG)
-	printf("tok builtin FG\n");
+		else if((tok.builtins)==BUILTIN_JOBS) {
+	int fd = STDOUT_FILENO;
+	int usage = tok.argv[1] && !strcmp(tok.argv[1], "-l");
+	if (tok.outfile && (fd = open(tok.outfile, O_WRONLY | O_CREAT | O_TRUNC,
+	                              0666)) < 0)
+		printf("%s: %s\n", tok.outfile, strerror(errno));
+	else
+		listjobs(job_list, fd, usage);
+	}
+       else if((tok.builtins)==BUILTIN_BG || (tok.builtins)==BUILTIN_FG)
+	bgfg(&tok);
+	  else if((tok.builtins)==BUILTIN_PARALLEL)
+	parallel(&tok, bg, cmdline);
+	  else if((tok.builtins)==BUILTIN_HASH)
+	hashcmd(&tok);
 	else {
-	printf("tok builtin none\n");
 	if (bg == -1) return;               /* parsing error */
     
    
     if (tok.argv[0] == NULL)  return;   /* ignore empty lines */
-	sigset_t mask;
-		sigemptyset(&mask);
-		sigaddset(&mask, SIGCHLD);
-		sigaddset(&mask, SIGINT);
-		sigaddset(&mask, SIGTSTP);
-		sigprocmask(SIG_BLOCK, &mask, NULL);//block SIGCHLD
-		
-	
-	 /* Child runs user job */
-     if ((pid = Fork()) == 0) {
-	
-	 if (execve(*(tok.argv), (tok.argv), NULL) < 0) {
-	  printf("%s: Command not found.\n", *(tok.argv));
-	  exit(0);
-	 }
-	 else{
-		
-	   printf("%s: Command  found.\n", *(tok.argv));
-	 }
-	}// end child
-	addjob(job_list, pid, bg + 1, cmdline);
-
-		sigprocmask(SIG_UNBLOCK, &mask, NULL);
-	int jid = pid2jid(pid);
-    // run in background
-      if (bg == 1){
-			printf( "[%d] (%d) %s\n", jid, pid, cmdline);
-			// fprintf(stdout, "[%d] (%d) %s\n", jid, pid, cmdline);
-			 
+	/* Start the commands left to right, connected by pipes; the
+	   first one started leads the process group of the job */
+	pgid = 0;
+	in = -1;
+	for (i = 0; i < tok.nstages; i++) {
+		out = next_in = -1;
+		if (i < tok.nstages - 1) {
+			if (pipe2(fds, O_CLOEXEC) < 0)
+				unix_error("eval: pipe error");
+			next_in = fds[0];
+			out = fds[1];
 		}
-		//run in foreground
-		else if(bg == 0){
-			printf("eval >>>>run in fg, bg ,%d\n",bg);
-			int status;
-			if (waitpid(pid, &status, 0) < 0)
-			unix_error("waitfg: waitpid error");
-
-			
+		if (launch(&tok, i, in, out, pgid, &shell_mask, &pid) == 0) {
+			if (pgid == 0) {
+				pgid = pid;
+				if (addjob(job_list, pid, bg + 1, cmdline)) {
+					getjobpid(job_list, pid)->timed = tok.timed;
+					getjobpid(job_list, pid)->place = placement(&tok);
+				}
+			} else {
+				addproc(job_list, getjobpid(job_list, pgid), pid);
+			}
 		}
-		
-	
-	
+		if (in >= 0)
+			close(in);
+		if (out >= 0)
+			close(out);
+		in = next_in;
 	}
-     
+	if (pgid == 0)
+		return;
 
-     
-      // printf("eval >>>> tok argv ,%s  %s  %s\n",*(tok.argv),*(tok.argv+1),*(tok.argv+2));
-     
-    
+    // run in background; the event loop waits for a foreground job
+      if (bg == 1){
+			printf( "[%d] (%d) %s\n", pid2jid(pgid), pgid, cmdline);
+		}
+	}
 
     return;
 }
 
+/*
+ * launch - Start command i of tok in process group pgid, or in a group
+ *     of its own if pgid is 0, and store its PID in *pidp.  Its input
+ *     and output come from in and out when they are not -1 (pipe ends
+ *     opened close-on-exec), and otherwise from tok's infile for the
+ *     first command and outfile for the last.  The child gets the
+ *     signal mask mask and default signal dispositions.  Jobs are
+ *     started with posix_spawn, which glibc implements with
+ *     clone(CLONE_VM|CLONE_VFORK): the shell's page tables are not
+ *     copied, so launching does not get slower as the shell grows.
+ *     With -F, for built-in filters, and for jobs placed with @cpus= or
+ *     @cgroup=, which the child applies to itself before execve, they
+ *     are forked instead; that also lets the fork wrapper shuffle the
+ *     order parent and child run in.
+ *     Returns 0, or -1 after printing why the job could not be started.
+ */
+int 
+launch(struct cmdline_tokens *tok, int i, int in, int out, pid_t pgid,
+       const sigset_t *mask, pid_t *pidp) 
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t dfl;
+    char **argv = &tok->argv[tok->stage[i]];
+    char *infile = i == 0 ? tok->infile : NULL;
+    char *outfile = i == tok->nstages - 1 ? tok->outfile : NULL;
+    char *path = argv[0];
+    int filter = isfilter(argv);
+    int placed = tok->hascpus || tok->cgroup != NULL;
+    int fd, err;
+
+    /* Commands named without a slash are found in PATH */
+    if (!filter && strchr(argv[0], '/') == NULL) {
+        /* A forked child cannot tell us that a hashed file is gone */
+        if ((path = hashlookup(argv[0])) != NULL && use_fork &&
+            access(path, X_OK) < 0) {
+            hashdrop(argv[0]);
+            path = hashlookup(argv[0]);
+        }
+        if (path == NULL) {
+            printf("%s: Command not found\n", argv[0]);
+            return -1;
+        }
+    }
+
+    /* Signals the shell catches or ignores get their defaults back */
+    sigemptyset(&dfl);
+    sigaddset(&dfl, SIGINT);
+    sigaddset(&dfl, SIGTSTP);
+    sigaddset(&dfl, SIGCHLD);
+    sigaddset(&dfl, SIGTTIN);
+    sigaddset(&dfl, SIGTTOU);
+    sigaddset(&dfl, SIGQUIT);
+
+    /* Output so far comes before the job's */
+    fflush(stdout);
+
+    if (use_fork || filter || placed) {
+        if ((*pidp = Fork()) == 0) {
+            setpgid(0, pgid);
+            for (fd = 1; fd < NSIG; fd++)
+                if (sigismember(&dfl, fd))
+                    signal(fd, SIG_DFL);
+            sigprocmask(SIG_SETMASK, mask, NULL);
+            if (in >= 0)
+                dup2(in, STDIN_FILENO);
+            if (out >= 0)
+                dup2(out, STDOUT_FILENO);
+            if (infile) {
+                if ((fd = open(infile, O_RDONLY)) < 0) {
+                    printf("%s: %s\n", infile, strerror(errno));
+                    exit(1);
+                }
+                dup2(fd, STDIN_FILENO);
+                close(fd);
+            }
+            if (outfile) {
+                if ((fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC,
+                               0666)) < 0) {
+                    printf("%s: %s\n", outfile, strerror(errno));
+                    exit(1);
+                }
+                dup2(fd, STDOUT_FILENO);
+                close(fd);
+            }
+            if (placed && place(tok) < 0)
+                exit(1);
+            if (filter) {
+                /* No exec to close the other pipe ends for us */
+                close_range(3, ~0U, 0);
+                exit(runfilter(argv));
+            }
+            execve(path, argv, environ);
+            printf("%s: Command not found\n", argv[0]);
+            exit(0);
+        }
+        /* As the child does, so that the group is complete on return */
+        setpgid(*pidp, pgid ? pgid : *pidp);
+        return 0;
+    }
+
+    if ((err = posix_spawn_file_actions_init(&actions)) != 0 ||
+        (err = posix_spawnattr_init(&attr)) != 0) {
+        errno = err;
+        unix_error("launch: posix_spawn init error");
+    }
+    if (in >= 0)
+        posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    if (out >= 0)
+        posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+    if (infile)
+        posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, infile,
+                                         O_RDONLY, 0);
+    if (outfile)
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, outfile,
+                                         O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP |
+                             POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setpgroup(&attr, pgid);
+    posix_spawnattr_setsigmask(&attr, mask);
+    posix_spawnattr_setsigdefault(&attr, &dfl);
+
+    err = posix_spawn(pidp, path, &actions, &attr, argv, environ);
+    if (err != 0 && path != argv[0] && access(path, X_OK) < 0) {
+        /* Gone since it was hashed; look again */
+        hashdrop(argv[0]);
+        if ((path = hashlookup(argv[0])) != NULL)
+            err = posix_spawn(pidp, path, &actions, &attr, argv, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err == 0)
+        return 0;
+
+    /* Say whether the command or a redirection failed */
+    if (path == NULL || access(path, X_OK) < 0)
+        printf("%s: Command not found\n", argv[0]);
+    else if (infile && access(infile, R_OK) < 0)
+        printf("%s: %s\n", infile, strerror(err));
+    else
+        printf("%s: %s\n", outfile ? outfile : argv[0], strerror(err));
+    return -1;
+}
+
+/*
+ * isfilter - Is argv a built-in filter?  These are a bare "cat", which
+ *     copies its input to its output, and "tee file", which also copies
+ *     it to file.  Like builtins, they take precedence over commands
+ *     of the same name in PATH.
+ */
+int 
+isfilter(char **argv) 
+{
+    if (!strcmp(argv[0], "cat"))
+        return argv[1] == NULL;
+    if (!strcmp(argv[0], "tee"))
+        return argv[1] != NULL && argv[2] == NULL;
+    return 0;
+}
+
+/*
+ * runfilter - Run the built-in filter argv in a child and return its
+ *     exit status.  Where its input and output are pipes, the data
+ *     moves with splice, and tee duplicates it for the file, without
+ *     being copied through user space; anywhere else it is copied
+ *     through a buffer.
+ */
+int 
+runfilter(char **argv) 
+{
+    static char buf[FILTERBUF];
+    int fd = -1;
+    ssize_t n, m, k;
+
+    if (argv[1] != NULL &&
+        (fd = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+        printf("%s: %s\n", argv[1], strerror(errno));
+        return 1;
+    }
+
+    while (1) {
+        if (fd < 0)
+            n = splice(STDIN_FILENO, NULL, STDOUT_FILENO, NULL, FILTERBUF,
+                       SPLICE_F_MOVE);
+        else
+            n = tee(STDIN_FILENO, STDOUT_FILENO, FILTERBUF, 0);
+        if (n <= 0)
+            break;
+        /* tee left the data in the input pipe; move it to the file */
+        for (m = 0; fd >= 0 && m < n; m += k)
+            if ((k = splice(STDIN_FILENO, NULL, fd, NULL, n - m,
+                            SPLICE_F_MOVE)) <= 0)
+                return 1;
+    }
+    if (n == 0)
+        return 0;
+    if (errno != EINVAL)
+        return 1;
+
+    /* Not pipes at both ends */
+    while ((n = read(STDIN_FILENO, buf, sizeof(buf))) > 0) {
+        for (m = 0; m < n; m += k)
+            if ((k = write(STDOUT_FILENO, buf + m, n - m)) < 0)
+                return 1;
+        for (m = 0; fd >= 0 && m < n; m += k)
+            if ((k = write(fd, buf + m, n - m)) < 0)
+                return 1;
+    }
+    return n < 0;
+}
+
+/*
+ * parsecpus - Parse a CPU list such as "0-3,8" into set.  Returns 0,
+ *     or -1 if the list is malformed or names a CPU set cannot hold.
+ */
+int 
+parsecpus(const char *list, cpu_set_t *set) 
+{
+    char *end;
+    long lo, hi;
+
+    CPU_ZERO(set);
+    do {
+        lo = hi = strtol(list, &end, 10);
+        if (end == list || lo < 0)
+            return -1;
+        if (*end == '-') {
+            list = end + 1;
+            hi = strtol(list, &end, 10);
+            if (end == list || hi < lo)
+                return -1;
+        }
+        if (hi >= CPU_SETSIZE)
+            return -1;
+        for (; lo <= hi; lo++)
+            CPU_SET(lo, set);
+        list = end + 1;
+    } while (*end == ',');
+    return *end == '\0' ? 0 : -1;
+}
+
+/*
+ * placement - Describe where tok's @ modifiers put its job, as
+ *     listjobs shows it: a malloc'd string, or NULL if it has none.
+ */
+char 
+*placement(const struct cmdline_tokens *tok) 
+{
+    char buf[MAXLINE];
+    int len = 0, cpu, lo;
+
+    if (tok->hascpus) {
+        len += snprintf(buf + len, sizeof(buf) - len, "cpus=");
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &tok->cpus))
+                continue;
+            for (lo = cpu; cpu + 1 < CPU_SETSIZE && CPU_ISSET(cpu + 1, &tok->cpus); cpu++)
+                ;
+            len += snprintf(buf + len, sizeof(buf) - len,
+                            lo == cpu ? "%d," : "%d-%d,", lo, cpu);
+        }
+        buf[len - 1] = ' ';
+    }
+    if (tok->cgroup != NULL && len < (int)sizeof(buf))
+        len += snprintf(buf + len, sizeof(buf) - len, "cgroup=%s ", tok->cgroup);
+    return len > 0 ? strdup(buf) : NULL;
+}
+
+/*
+ * place - In a forked child, before execve: move to the CPUs and the
+ *     cgroup tok asks for.  A relative cgroup path is taken from the
+ *     cgroup v2 root.  Returns 0, or -1 after printing what failed.
+ */
+int 
+place(const struct cmdline_tokens *tok) 
+{
+    char path[MAXLINE];
+    int fd;
+
+    if (tok->hascpus && sched_setaffinity(0, sizeof(tok->cpus), &tok->cpus) < 0) {
+        printf("@cpus: %s\n", strerror(errno));
+        return -1;
+    }
+    if (tok->cgroup != NULL) {
+        snprintf(path, sizeof(path), "%s%s/cgroup.procs",
+                 tok->cgroup[0] == '/' ? "" : CGROOT "/", tok->cgroup);
+        /* Writing 0 moves the writer */
+        if ((fd = open(path, O_WRONLY)) < 0 || write(fd, "0", 1) < 0) {
+            printf("%s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+/*
+ * tokput - Append byte c to the words in tok, where len bytes are used
+ */
+static inline void 
+tokput(struct cmdline_tokens *tok, size_t *len, char c) 
+{
+    if (*len == tok->bufcap) {
+        tok->bufcap = tok->bufcap ? 2 * tok->bufcap : MINTOK;
+        if ((tok->buf = realloc(tok->buf, tok->bufcap)) == NULL)
+            unix_error("parseline: realloc error");
+    }
+    tok->buf[(*len)++] = c;
+}
+
+/*
+ * tokarg - Record an argument of tok starting at offset off of the
+ *     words, or the end of a pipeline stage if off is -1
+ */
+static void 
+tokarg(struct cmdline_tokens *tok, size_t off) 
+{
+    if (tok->argc + 1 >= tok->argcap) {
+        tok->argcap = tok->argcap ? 2 * tok->argcap : MINTOK;
+        tok->off = realloc(tok->off, tok->argcap * sizeof(size_t));
+        tok->argv = realloc(tok->argv, tok->argcap * sizeof(char *));
+        if (tok->off == NULL || tok->argv == NULL)
+            unix_error("parseline: realloc error");
+    }
+    tok->off[tok->argc++] = off;
+}
+
 /* 
  * parseline - Parse the command line and build the argv array.
  * 
@@ -292,6 +957,9 @@ eval(char *cmdline)
  *
  *                command [arguments...] [< infile] [> oufile] [&]
  *
+ *             or a pipeline of such commands separated by |, where only
+ *             the first may have an infile and only the last an outfile.
+ *
  *   tok:      Pointer to a cmdline_tokens structure. The elements of this
  *             structure will be populated with the parsed tokens. Characters 
  *             enclosed in single or double quotes are treated as a single
@@ -302,19 +970,23 @@ eval(char *cmdline)
  *  -1:        if cmdline is incorrectly formatted
  * 
  * Note:       The string elements of tok (e.g., argv[], infile, outfile) 
- *             are statically allocated inside parseline() and will be 
- *             overwritten the next time this function is invoked.
+ *             are stored in buffers owned by tok, which grow to fit a
+ *             line of any length and are reused, and overwritten, the
+ *             next time this function is invoked with the same tok.
+ *             cmdline is scanned once, copying each token as it is
+ *             found; the pointers are made from offsets at the end, as
+ *             the buffers may move while they grow.
  */
 int 
 parseline(const char *cmdline, struct cmdline_tokens *tok) 
 {
-
-    static char array[MAXLINE];          /* holds local copy of command line */
-    const char delims[10] = " \t\r\n";   /* argument delimiters (white-space) */
-    char *buf = array;                   /* ptr that traverses command line */
-    char *next;                          /* ptr to the end of the current arg */
-    char *endbuf;                        /* ptr to the end of the cmdline string */
+    const char *p = cmdline;             /* ptr that traverses command line */
+    size_t len = 0;                      /* bytes of tok->buf used */
+    size_t start;                        /* offset of the current token */
+    size_t infile, outfile;              /* offsets of the file names */
+    char quote;                          /* quote that opened the token */
     int is_bg;                           /* background job? */
+    int i;
 
     int parsing_state;                   /* indicates if the next token is the
                                             input or output file */
@@ -323,88 +995,106 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
         return -1;
     }
 
-    (void) strncpy(buf, cmdline, MAXLINE);
-    endbuf = buf + strlen(buf);
-    
-
+    infile = outfile = (size_t)-1;
+    tok->timed = 0;
+    tok->hascpus = 0;
+    tok->cgroup = NULL;
     tok->infile = NULL;
     tok->outfile = NULL;
+    tok->builtins = BUILTIN_NONE;
 
     /* Build the argv list */
     parsing_state = ST_NORMAL;
     tok->argc = 0;
+    tok->nstages = 1;
+    tok->stage[0] = 0;
 
-
-    while (buf < endbuf) {
+    while (1) {
         /* Skip the white-spaces */
-        buf += strspn (buf, delims);
-        //printf("\nparseline strspn (buf, delims)>>> %d\n",(int)strspn (buf, delims));
-        
-     
-        if (buf >= endbuf) break;
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+        if (*p == '\0') break;
 
         /* Check for I/O redirection specifiers */
-        if (*buf == '<') {
-            if (tok->infile) {
+        if (*p == '<') {
+            if (infile != (size_t)-1 || tok->nstages > 1) {
                 (void) fprintf(stderr, "Error: Ambiguous I/O redirection\n");
                 return -1;
             }
             parsing_state |= ST_INFILE;
-            buf++;
+            p++;
             continue;
         }
-        if (*buf == '>') {
-            if (tok->outfile) {
+        if (*p == '>') {
+            if (outfile != (size_t)-1) {
                 (void) fprintf(stderr, "Error: Ambiguous I/O redirection\n");
                 return -1;
             }
             parsing_state |= ST_OUTFILE;
-            buf ++;
+            p++;
             continue;
         }
 
-        if (*buf == '\'' || *buf == '\"') {
-            /* Detect quoted tokens */
-            buf++;
-            next = strchr (buf, *(buf-1));
-        } else {
-            /* Find next delimiter */
-            next = buf + strcspn (buf, delims);
-        }
-        
-        if (next == NULL) {
-            /* Returned by strchr(); this means that the closing
-               quote was not found. */
-            (void) fprintf (stderr, "Error: unmatched %c.\n", *(buf-1));
-            return -1;
+        /* End the current command of a pipeline */
+        if (*p == '|') {
+            if (parsing_state != ST_NORMAL) {
+                (void) fprintf(stderr, "Error: must provide file name for redirection\n");
+                return -1;
+            }
+            if (outfile != (size_t)-1) {
+                (void) fprintf(stderr, "Error: Ambiguous I/O redirection\n");
+                return -1;
+            }
+            if (tok->argc == tok->stage[tok->nstages-1]) {
+                (void) fprintf(stderr, "Error: missing command in pipeline\n");
+                return -1;
+            }
+            if (tok->nstages >= MAXSTAGES) {
+                (void) fprintf(stderr, "Error: too many commands in pipeline\n");
+                return -1;
+            }
+            tokarg(tok, (size_t)-1);
+            tok->stage[tok->nstages++] = tok->argc;
+            p++;
+            continue;
         }
-           
-
 
-        /* Terminate the token */
-        *next = '\0';
+        /* Copy the token: up to the closing quote if it is quoted, and
+           otherwise up to the next delimiter */
+        start = len;
+        if (*p == '\'' || *p == '\"') {
+            quote = *p++;
+            while (*p != quote) {
+                if (*p == '\0') {
+                    (void) fprintf (stderr, "Error: unmatched %c.\n", quote);
+                    return -1;
+                }
+                tokput(tok, &len, *p++);
+            }
+            p++;
+        } else {
+            while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' &&
+                   *p != '\n')
+                tokput(tok, &len, *p++);
+        }
+        tokput(tok, &len, '\0');
 
         /* Record the token as either the next argument or the input/output file */
         switch (parsing_state) {
         case ST_NORMAL:
-            tok->argv[tok->argc++] = buf;
+            tokarg(tok, start);
             break;
         case ST_INFILE:
-            tok->infile = buf;
+            infile = start;
             break;
         case ST_OUTFILE:
-            tok->outfile = buf;
+            outfile = start;
             break;
         default:
             (void) fprintf(stderr, "Error: Ambiguous I/O redirection\n");
             return -1;
         }
         parsing_state = ST_NORMAL;
-
-        /* Check if argv is full */
-        if (tok->argc >= MAXARGS-1) break;
-
-        buf = next + 1;
     }
 
     if (parsing_state != ST_NORMAL) {
@@ -412,11 +1102,51 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
         return -1;
     }
 
-    /* The argument list must end with a NULL pointer */
-    tok->argv[tok->argc] = NULL;
+    /* Turn the offsets into pointers; the argument list must end with
+       a NULL pointer */
+    tokarg(tok, (size_t)-1);
+    tok->argc--;
+    for (i = 0; i <= tok->argc; i++)
+        tok->argv[i] = tok->off[i] == (size_t)-1 ? NULL : tok->buf + tok->off[i];
+    if (infile != (size_t)-1)
+        tok->infile = tok->buf + infile;
+    if (outfile != (size_t)-1)
+        tok->outfile = tok->buf + outfile;
 
     if (tok->argc == 0)  /* ignore blank line */
         return 1;
+    if (tok->argc == tok->stage[tok->nstages-1]) {
+        (void) fprintf(stderr, "Error: missing command in pipeline\n");
+        return -1;
+    }
+
+    /* Prefixes: "time" reports what the job used, and @cpus=LIST and
+       @cgroup=PATH say where it runs */
+    while (1) {
+        if (!strcmp(tok->argv[0], "time") && tok->argv[1] != NULL) {
+            tok->timed = 1;
+        } else if (!strncmp(tok->argv[0], "@cpus=", 6)) {
+            if (parsecpus(tok->argv[0] + 6, &tok->cpus) < 0) {
+                (void) fprintf(stderr, "Error: bad CPU list %s\n", tok->argv[0] + 6);
+                return -1;
+            }
+            tok->hascpus = 1;
+        } else if (!strncmp(tok->argv[0], "@cgroup=", 8) && tok->argv[0][8]) {
+            tok->cgroup = tok->argv[0] + 8;
+        } else if (tok->argv[0][0] == '@') {
+            (void) fprintf(stderr, "Error: unknown modifier %s\n", tok->argv[0]);
+            return -1;
+        } else {
+            break;
+        }
+        memmove(tok->argv, tok->argv + 1, tok->argc-- * sizeof(char *));
+        for (i = 1; i < tok->nstages; i++)
+            tok->stage[i]--;
+        if (tok->argv[0] == NULL) {
+            (void) fprintf(stderr, "Error: missing command\n");
+            return -1;
+        }
+    }
 
     if (!strcmp(tok->argv[0], "quit")) {                 /* quit command */
         tok->builtins = BUILTIN_QUIT;
@@ -426,6 +1156,10 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
         tok->builtins = BUILTIN_BG;
     } else if (!strcmp(tok->argv[0], "fg")) {            /* fg command */
         tok->builtins = BUILTIN_FG;
+    } else if (!strcmp(tok->argv[0], "parallel")) {      /* parallel command */
+        tok->builtins = BUILTIN_PARALLEL;
+    } else if (!strcmp(tok->argv[0], "hash")) {          /* hash command */
+        tok->builtins = BUILTIN_HASH;
     } else {
         tok->builtins = BUILTIN_NONE;
     }
@@ -433,26 +1167,300 @@ parseline(const char *cmdline, struct cmdline_tokens *tok)
     /* Should the job run in the background? */
     if ((is_bg = (*tok->argv[tok->argc-1] == '&')) != 0)
         tok->argv[--tok->argc] = NULL;
+    if (tok->nstages > 1 && tok->argc == tok->stage[tok->nstages-1]) {
+        (void) fprintf(stderr, "Error: missing command in pipeline\n");
+        return -1;
+    }
 
     return is_bg;
 }
 
 
+/*
+ * bgfg - Run the bg and fg builtins on the job named by PID or %jobid.
+ *     The job is continued as a whole, by sending SIGCONT to its
+ *     process group, so every stage of a pipeline and every task of a
+ *     parallel job starts again.  A job moved to the foreground is
+ *     waited for by the event loop in main, like one just started.
+ */
+void 
+bgfg(struct cmdline_tokens *tok) 
+{
+    char *cmd = tok->argv[0], *arg = tok->argv[1];
+    struct job_t *job;
+    char *end;
+    long id;
+
+    if (arg == NULL) {
+        printf("%s command requires PID or %%jobid argument\n", cmd);
+        return;
+    }
+    id = strtol(arg[0] == '%' ? arg + 1 : arg, &end, 10);
+    if (!isdigit((unsigned char)arg[arg[0] == '%']) || *end != '\0') {
+        printf("%s: argument must be a PID or %%jobid\n", cmd);
+        return;
+    }
+    if (arg[0] == '%') {
+        if (id > INT_MAX || (job = getjobjid(job_list, id)) == NULL) {
+            printf("%s: No such job\n", arg);
+            return;
+        }
+    } else if (id > INT_MAX || (job = getjobpid(job_list, id)) == NULL) {
+        printf("(%ld): No such process\n", id);
+        return;
+    }
+
+    if (kill(-job->pid, SIGCONT) < 0 && errno != ESRCH)
+        unix_error("bgfg: kill error");
+    if (tok->builtins == BUILTIN_BG) {
+        setjobstate(job_list, job, BG);
+        printf("[%d] (%d) %s\n", job->jid, job->pid, jobcmdline(job));
+    } else
+        setjobstate(job_list, job, FG);
+}
+
+/*******************
+ * Parallel builtin
+ *******************/
+
+/*
+ * parallel - Run the parallel builtin: parse "parallel [-j N] command
+ *     [args...] ::: arg...", start the first N tasks as one job and
+ *     leave the rest to be started by parreap as tasks end.  N is the
+ *     number of online CPUs by default.
+ */
+void 
+parallel(struct cmdline_tokens *tok, int bg, char *cmdline) 
+{
+    struct par_t *par;
+    struct job_t *job;
+    char **argv = tok->argv, *w;
+    int limit = sysconf(_SC_NPROCESSORS_ONLN);
+    int first = 1, sep, ncmd, i, len;
+    pid_t pid = 0;
+
+    if (tok->nstages > 1 || tok->infile || tok->outfile) {
+        printf("parallel: cannot be part of a pipeline or redirected\n");
+        return;
+    }
+    if (argv[1] && !strncmp(argv[1], "-j", 2)) {
+        if (argv[1][2] != '\0')
+            limit = atoi(&argv[1][2]);
+        else if (argv[2] != NULL) {
+            limit = atoi(argv[2]);
+            first++;
+        }
+        first++;
+    }
+    for (sep = first; sep < tok->argc && strcmp(argv[sep], ":::"); sep++)
+        ;
+    if (limit < 1 || sep == first || sep == tok->argc) {
+        printf("usage: parallel [-j N] command [args...] ::: arg...\n");
+        return;
+    }
+    ncmd = sep - first;
+
+    /* Copy the words; the next parseline overwrites them */
+    if ((par = calloc(1, sizeof(*par))) == NULL)
+        unix_error("parallel: calloc error");
+    par->ntasks = tok->argc - sep - 1;
+    par->limit = limit;
+    par->args = malloc(par->ntasks * sizeof(char *));
+    par->tok.argv = malloc((ncmd + 2) * sizeof(char *));
+    par->pids = malloc(par->ntasks * sizeof(pid_t));
+    par->status = malloc(par->ntasks * sizeof(int));
+    for (len = 0, i = first; i < tok->argc; i++)
+        len += strlen(argv[i]) + 1;
+    if ((w = par->words = malloc(len)) == NULL || !par->args ||
+        !par->tok.argv || !par->pids || !par->status)
+        unix_error("parallel: malloc error");
+    for (i = first; i < tok->argc; i++) {
+        if (i < sep)
+            par->tok.argv[i - first] = w;
+        else if (i > sep)
+            par->args[i - sep - 1] = w;
+        w = stpcpy(w, argv[i]) + 1;
+    }
+    par->tok.argc = ncmd + 1;
+    par->tok.argv[ncmd + 1] = NULL;
+    par->tok.nstages = 1;
+    par->tok.hascpus = tok->hascpus;
+    par->tok.cpus = tok->cpus;
+    if (tok->cgroup != NULL && (par->tok.cgroup = strdup(tok->cgroup)) == NULL)
+        unix_error("parallel: strdup error");
+    clock_gettime(CLOCK_MONOTONIC, &par->start);
+
+    /* The first task to start makes the job */
+    while (par->next < par->ntasks && parstart(par, 0, &pid) < 0)
+        ;
+    if (par->running == 0 || !addjob(job_list, pid, bg ? BG : FG, cmdline)) {
+        if (par->running > 0)
+            kill(-pid, SIGTERM);
+        parfree(par);
+        return;
+    }
+    job = getjobpid(job_list, pid);
+    job->par = par;
+    job->timed = tok->timed;
+    job->place = placement(tok);
+    parfill(job);
+    if (bg)
+        printf("[%d] (%d) %s\n", job->jid, job->pid, cmdline);
+}
+
+/*
+ * parfill - Start tasks of a parallel job until limit are running,
+ *     unless the job is stopped.
+ */
+void 
+parfill(struct job_t *job) 
+{
+    struct par_t *par = job->par;
+    pid_t pid;
+
+    while (job->state != ST && !par->stop && par->running < par->limit &&
+           par->next < par->ntasks) {
+        if (parstart(par, par->running > 0 ? job->pid : 0, &pid) < 0)
+            continue;
+        if (par->running == 1)
+            job->pid = pid;
+        addproc(job_list, job, pid);
+    }
+}
+
+/*
+ * parstart - Start the next task of par in process group pgid, or in a
+ *     new one if pgid is 0, and store its PID in *pidp.  A task that
+ *     cannot be started counts as having exited with status 127.
+ *     Returns 0, or -1 if the task could not be started.
+ */
+int 
+parstart(struct par_t *par, pid_t pgid, pid_t *pidp) 
+{
+    int i = par->next++;
+
+    par->tok.argv[par->tok.argc - 1] = par->args[i];
+    par->pids[i] = 0;
+    if (launch(&par->tok, 0, -1, -1, pgid, &shell_mask, pidp) < 0) {
+        par->status[i] = 127 << 8;
+        return -1;
+    }
+    par->pids[i] = *pidp;
+    par->running++;
+    return 0;
+}
+
+/*
+ * parreap - Record that task pid of a parallel job has ended with wait
+ *     status status, and start more.  A task killed by a signal, as by
+ *     ctrl-c, cancels those not yet started.  After the last one, print
+ *     the exit status of every task and the wall time of the whole.
+ */
+void 
+parreap(struct job_t *job, pid_t pid, int status) 
+{
+    struct par_t *par = job->par;
+    struct timespec now;
+    int i, failed = 0;
+
+    for (i = 0; i < par->next && par->pids[i] != pid; i++)
+        ;
+    if (i == par->next)
+        return;
+    par->pids[i] = 0;
+    par->status[i] = status;
+    par->running--;
+    if (WIFSIGNALED(status))
+        par->stop = 1;
+    parfill(job);
+    if (par->running > 0 || (!par->stop && par->next < par->ntasks))
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (i = 0; i < par->next; i++) {
+        status = par->status[i];
+        if (WIFEXITED(status))
+            printf("[%d] %s: exit %d\n", i + 1, par->args[i],
+                   WEXITSTATUS(status));
+        else
+            printf("[%d] %s: signal %d\n", i + 1, par->args[i],
+                   WTERMSIG(status));
+        failed += status != 0;
+    }
+    printf("parallel: %d tasks, %d failed, %d not run, %.3f s\n",
+           par->ntasks, failed, par->ntasks - par->next,
+           (now.tv_sec - par->start.tv_sec) +
+           (now.tv_nsec - par->start.tv_nsec) / 1e9);
+}
+
+/* parfree - Free the tasks of a parallel job */
+void 
+parfree(struct par_t *par) 
+{
+    free(par->args);
+    free(par->tok.argv);
+    free(par->tok.cgroup);
+    free(par->pids);
+    free(par->status);
+    free(par->words);
+    free(par);
+}
+
+
 /*****************
  * Signal handlers
  *****************/
 
+/* 
+ * These three signals are blocked and read from a signalfd, so their
+ * handlers run from the event loop in main, not asynchronously.
+ */
+
 /* 
  * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
  *     a child job terminates (becomes a zombie), or stops because it
  *     received a SIGSTOP, SIGTSTP, SIGTTIN or SIGTTOU signal. The 
  *     handler reaps all available zombie children, but doesn't wait 
- *     for any other currently running children to terminate.  
+ *     for any other currently running children to terminate.  A job
+ *     ends with its last process; a pipeline is reported once, by its
+ *     first process.  The resource usage of each process is added to
+ *     its job's, and reported when the job ends if it was timed.
  */
 void 
 sigchld_handler(int sig) 
 {
-    return;
+    struct job_t *job;
+    struct rusage ru;
+    char buf[128];
+    pid_t pid;
+    int status;
+
+    while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED, &ru)) > 0) {
+        if ((job = getjobpid(job_list, pid)) == NULL)
+            continue;
+        if (WIFSTOPPED(status)) {
+            if (job->state != ST) {
+                printf("Job [%d] (%d) stopped by signal %d\n",
+                       job->jid, job->pid, WSTOPSIG(status));
+                setjobstate(job_list, job, ST);
+            }
+            continue;
+        }
+        if (WIFSIGNALED(status) && pid == job->pid)
+            printf("Job [%d] (%d) terminated by signal %d\n",
+                   job->jid, job->pid, WTERMSIG(status));
+        addusage(job, &ru);
+        if (job->par != NULL)
+            parreap(job, pid, status);
+        if (job->timed && job->nprocs == 1) {
+            fmtusage(buf, sizeof(buf), job);
+            printf("Job [%d] (%d) %s\n", job->jid, job->pid, buf);
+        }
+        reapproc(job_list, pid);
+    }
+    if (pid < 0 && errno != ECHILD)
+        unix_error("sigchld_handler: wait4 error");
+    fflush(stdout);
 }
 
 /* 
@@ -463,7 +1471,10 @@ sigchld_handler(int sig)
 void 
 sigint_handler(int sig) 
 {
-    return;
+    pid_t pid = fgpid(job_list);
+
+    if (pid != 0)
+        kill(-pid, sig);
 }
 
 /*
@@ -474,7 +1485,10 @@ sigint_handler(int sig)
 void 
 sigtstp_handler(int sig) 
 {
-    return;
+    pid_t pid = fgpid(job_list);
+
+    if (pid != 0)
+        kill(-pid, sig);
 }
 
 /*********************
@@ -485,176 +1499,609 @@ sigtstp_handler(int sig)
  * Helper routines that manipulate the job list
  **********************************************/
 
+/* cmdsize - Bytes an arena line of len characters takes, kept aligned */
+static inline size_t 
+cmdsize(unsigned len) 
+{
+    return (sizeof(struct cmdstr) + len + 1 + 7) & ~(size_t)7;
+}
+
+/* cmdat - The arena line at offset off */
+static inline struct cmdstr 
+*cmdat(unsigned off) 
+{
+    return (struct cmdstr *)(cmd_arena->buf + off);
+}
+
+/* cmdslot - Enter the line at offset off in an intern table of mask + 1
+   slots, whose hash is h */
+static void 
+cmdslot(unsigned *table, unsigned mask, unsigned h, unsigned off) 
+{
+    while (table[h & mask] != 0)
+        h++;
+    table[h & mask] = off + 1;
+}
+
+/* cmdhash - Hash of the line s of len bytes (FNV-1a) */
+static inline unsigned 
+cmdhash(const char *s, unsigned len) 
+{
+    unsigned h = 2166136261u;
+
+    while (len-- > 0)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+/* cmdrehash - Rebuild the intern table with cap slots */
+static void 
+cmdrehash(unsigned cap) 
+{
+    struct cmdstr *cs;
+    size_t off;
+
+    free(cmd_arena->table);
+    if ((cmd_arena->table = calloc(cap, sizeof(unsigned))) == NULL)
+        unix_error("cmdrehash: calloc error");
+    cmd_arena->mask = cap - 1;
+    for (off = 0; off < cmd_arena->used; off += cmdsize(cs->len)) {
+        cs = cmdat(off);
+        cmdslot(cmd_arena->table, cmd_arena->mask, cmdhash(cs->s, cs->len), off);
+    }
+}
+
+/* cmdcompact - Squeeze out the lines no job refers to, and point the
+   jobs at where theirs have moved */
+static void 
+cmdcompact(void) 
+{
+    struct cmdstr *cs;
+    struct job_t *job;
+    char *buf;
+    size_t off, to = 0;
+    int jid;
+
+    if ((buf = malloc(cmd_arena->cap)) == NULL)
+        unix_error("cmdcompact: malloc error");
+    cmd_arena->count = 0;
+    for (off = 0; off < cmd_arena->used; off += cmdsize(cs->len)) {
+        cs = cmdat(off);
+        if (cs->refs == 0)
+            continue;
+        memcpy(buf + to, cs, cmdsize(cs->len));
+        cs->refs = to + 1;      /* where it went, to patch the jobs */
+        to += cmdsize(cs->len);
+        cmd_arena->count++;
+    }
+    for (jid = 1; jid < job_list->nextjid; jid++)
+        if ((job = job_list->by_jid[jid]) != NULL)
+            job->cmdline = cmdat(job->cmdline)->refs - 1;
+
+    free(cmd_arena->buf);
+    cmd_arena->buf = buf;
+    cmd_arena->used = to;
+    cmd_arena->dead = 0;
+    cmdrehash(cmd_arena->mask + 1);
+}
+
+/* cmdintern - Return the offset of cmdline in the arena, adding it if
+   no job has had the same line since the arena was last compacted */
+unsigned 
+cmdintern(const char *cmdline) 
+{
+    unsigned len = strlen(cmdline);
+    unsigned h = cmdhash(cmdline, len);
+    struct cmdstr *cs;
+    size_t need, cap;
+    unsigned i, slot;
+
+    if (cmd_arena->table == NULL)
+        cmdrehash(MINJOBS);
+    for (i = h; (slot = cmd_arena->table[i & cmd_arena->mask]) != 0; i++) {
+        cs = cmdat(slot - 1);
+        if (cs->len == len && !memcmp(cs->s, cmdline, len)) {
+            if (cs->refs++ == 0)
+                cmd_arena->dead -= cmdsize(len);
+            return slot - 1;
+        }
+    }
+
+    if (cmd_arena->dead > CMDSLACK && cmd_arena->dead > cmd_arena->used / 2)
+        cmdcompact();
+    need = cmdsize(len);
+    if (cmd_arena->used + need > cmd_arena->cap) {
+        for (cap = cmd_arena->cap ? cmd_arena->cap : CMDSLACK;
+             cmd_arena->used + need > cap; cap *= 2)
+            ;
+        if ((cmd_arena->buf = realloc(cmd_arena->buf, cap)) == NULL)
+            unix_error("cmdintern: realloc error");
+        cmd_arena->cap = cap;
+    }
+    /* Keep the table at most half full */
+    if (2 * (cmd_arena->count + 1) > cmd_arena->mask + 1)
+        cmdrehash(2 * (cmd_arena->mask + 1));
+
+    cs = cmdat(cmd_arena->used);
+    cs->len = len;
+    cs->refs = 1;
+    memcpy(cs->s, cmdline, len + 1);
+    cmdslot(cmd_arena->table, cmd_arena->mask, h, cmd_arena->used);
+    cmd_arena->count++;
+    cmd_arena->used += need;
+    return cmd_arena->used - need;
+}
+
+/* cmdrelease - Drop a job's reference to the arena line at offset off */
+void 
+cmdrelease(unsigned off) 
+{
+    struct cmdstr *cs = cmdat(off);
+
+    if (--cs->refs == 0)
+        cmd_arena->dead += cmdsize(cs->len);
+}
+
+/* cmdclear - Empty the arena, once no job refers to any of it */
+static void 
+cmdclear(void) 
+{
+    cmd_arena->used = 0;
+    cmd_arena->dead = 0;
+    cmd_arena->count = 0;
+    if (cmd_arena->table != NULL)
+        memset(cmd_arena->table, 0, (cmd_arena->mask + 1) * sizeof(unsigned));
+}
+
+/* jobcmdline - The command line of a job */
+const char 
+*jobcmdline(const struct job_t *job) 
+{
+    return cmdat(job->cmdline)->s;
+}
+
 /* clearjob - Clear the entries in a job struct */
 void 
 clearjob(struct job_t *job) {
     job->pid = 0;
     job->jid = 0;
     job->state = UNDEF;
-    job->cmdline[0] = '\0';
+    job->cmdline = 0;
+    job->procs = NULL;
+    job->nprocs = 0;
+    job->par = NULL;
+    job->timed = 0;
+    job->place = NULL;
+    memset(&job->utime, 0, sizeof(job->utime));
+    memset(&job->stime, 0, sizeof(job->stime));
+    job->maxrss = job->nvcsw = job->nivcsw = 0;
+    job->next = NULL;
+}
+
+/* pidhash - Bucket of pid in a PID index of mask + 1 buckets */
+static inline int 
+pidhash(pid_t pid, int mask) 
+{
+    return (int)(((unsigned)pid * 2654435761u) >> 8) & mask;
 }
 
 /* initjobs - Initialize the job list */
 void 
-initjobs(struct job_t *job_list) {
-    int i;
-
-    for (i = 0; i < MAXJOBS; i++)
-        clearjob(&job_list[i]);
+initjobs(struct job_list_t *job_list) {
+    job_list->jid_cap = MINJOBS;
+    job_list->pid_mask = MINJOBS - 1;
+    job_list->by_jid = calloc(job_list->jid_cap, sizeof(struct job_t *));
+    job_list->by_pid = calloc(job_list->pid_mask + 1, sizeof(struct proc_t *));
+    job_list->free_jids = malloc(job_list->jid_cap * sizeof(int));
+    if (!job_list->by_jid || !job_list->by_pid || !job_list->free_jids)
+        unix_error("initjobs error");
+    job_list->nprocs = 0;
+    job_list->nfree = 0;
+    job_list->nextjid = 1;
+    job_list->count = 0;
+    job_list->fg = NULL;
+    job_list->spare = NULL;
+    job_list->spare_procs = NULL;
 }
 
 /* maxjid - Returns largest allocated job ID */
 int 
-maxjid(struct job_t *job_list) 
+maxjid(struct job_list_t *job_list) 
 {
-    int i, max=0;
+    int jid;
 
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].jid > max)
-            max = job_list[i].jid;
-    return max;
+    for (jid = job_list->nextjid - 1; jid > 0; jid--)
+        if (job_list->by_jid[jid] != NULL)
+            return jid;
+    return 0;
 }
 
-/* addjob - Add a job to the job list */
-int 
-addjob(struct job_t *job_list, pid_t pid, int state, char *cmdline) 
+/* growjobs - Make room in the index for JIDs up to jid; the heap holds
+   fewer than nextjid, so it is sized the same */
+static int 
+growjobs(struct job_list_t *job_list, int jid) 
 {
-    int i;
-
-    if (pid < 1)
-        return 0;
+    struct job_t **by_jid;
+    int *free_jids;
+    int cap;
+
+    if (jid >= job_list->jid_cap) {
+        if (jid >= MAXJID)
+            return 0;
+        for (cap = job_list->jid_cap; cap <= jid; cap *= 2)
+            ;
+        if ((by_jid = realloc(job_list->by_jid, cap * sizeof(*by_jid))) == NULL)
+            return 0;
+        memset(by_jid + job_list->jid_cap, 0,
+               (cap - job_list->jid_cap) * sizeof(*by_jid));
+        job_list->by_jid = by_jid;
+        if ((free_jids = realloc(job_list->free_jids, cap * sizeof(int))) == NULL)
+            return 0;
+        job_list->free_jids = free_jids;
+        job_list->jid_cap = cap;
+    }
+    return 1;
+}
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (job_list[i].pid == 0) {
-            job_list[i].pid = pid;
-            job_list[i].state = state;
-            job_list[i].jid = nextjid++;
-            if (nextjid > MAXJOBS)
-                nextjid = 1;
-            strcpy(job_list[i].cmdline, cmdline);
-            if(verbose){
-                printf("Added job [%d] %d %s\n", job_list[i].jid, job_list[i].pid, job_list[i].cmdline);
+/* growpids - Make room in the PID index for n processes, keeping its
+   load factor at most 1 */
+static int 
+growpids(struct job_list_t *job_list, int n) 
+{
+    struct proc_t **by_pid, *proc, *next;
+    int cap, i;
+
+    if (n > job_list->pid_mask + 1) {
+        for (cap = job_list->pid_mask + 1; cap < n; cap *= 2)
+            ;
+        if ((by_pid = calloc(cap, sizeof(*by_pid))) == NULL)
+            return 0;
+        for (i = 0; i <= job_list->pid_mask; i++) {
+            for (proc = job_list->by_pid[i]; proc != NULL; proc = next) {
+                next = proc->next;
+                proc->next = by_pid[pidhash(proc->pid, cap - 1)];
+                by_pid[pidhash(proc->pid, cap - 1)] = proc;
             }
-            return 1;
         }
+        free(job_list->by_pid);
+        job_list->by_pid = by_pid;
+        job_list->pid_mask = cap - 1;
     }
-    printf("Tried to create too many jobs\n");
-    return 0;
+    return 1;
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
+/* reservejobs - Size the indexes for n jobs of a process each at once,
+   rather than as they are added */
+void 
+reservejobs(struct job_list_t *job_list, int n) 
+{
+    growjobs(job_list, n < MAXJID ? n : MAXJID - 1);
+    growpids(job_list, n);
+}
+
+/* jidpop - Take the lowest free JID */
+static int 
+jidpop(struct job_list_t *job_list) 
+{
+    int *h = job_list->free_jids;
+    int n, i, c, top, last;
+
+    if (job_list->nfree == 0)
+        return job_list->nextjid++;
+
+    top = h[0];
+    n = --job_list->nfree;
+    last = h[n];
+    for (i = 0; (c = 2*i + 1) < n; i = c) {
+        if (c + 1 < n && h[c+1] < h[c])
+            c++;
+        if (last <= h[c])
+            break;
+        h[i] = h[c];
+    }
+    h[i] = last;
+    return top;
+}
+
+/* jidpush - Give a JID back */
+static void 
+jidpush(struct job_list_t *job_list, int jid) 
+{
+    int *h = job_list->free_jids;
+    int i, p;
+
+    for (i = job_list->nfree++; i > 0 && h[p = (i - 1) / 2] > jid; i = p)
+        h[i] = h[p];
+    h[i] = jid;
+}
+
+/* findproc - Find the link that points to the process whose PID=pid */
+static struct proc_t 
+**findproc(struct job_list_t *job_list, pid_t pid) 
+{
+    struct proc_t **link;
+
+    for (link = &job_list->by_pid[pidhash(pid, job_list->pid_mask)];
+         *link != NULL; link = &(*link)->next)
+        if ((*link)->pid == pid)
+            return link;
+    return NULL;
+}
+
+/* unlinkproc - Take a process out of the PID index and of its job */
+static void 
+unlinkproc(struct job_list_t *job_list, struct proc_t *proc) 
+{
+    struct proc_t **link = findproc(job_list, proc->pid);
+    struct proc_t **sib;
+
+    *link = proc->next;
+    for (sib = &proc->job->procs; *sib != proc; sib = &(*sib)->sibling)
+        ;
+    *sib = proc->sibling;
+    proc->job->nprocs--;
+    job_list->nprocs--;
+    proc->next = job_list->spare_procs;
+    job_list->spare_procs = proc;
+}
+
+/* freejob - Take a job and whatever processes it has left off the list */
+static void 
+freejob(struct job_list_t *job_list, struct job_t *job) 
+{
+    while (job->procs != NULL)
+        unlinkproc(job_list, job->procs);
+    job_list->by_jid[job->jid] = NULL;
+    cmdrelease(job->cmdline);
+    if (--job_list->count == 0) {
+        /* Start numbering over, and storing lines */
+        job_list->nfree = 0;
+        job_list->nextjid = 1;
+        cmdclear();
+    } else {
+        jidpush(job_list, job->jid);
+    }
+    if (job_list->fg == job)
+        job_list->fg = NULL;
+    if (job->par != NULL)
+        parfree(job->par);
+    free(job->place);
+    clearjob(job);
+    job->next = job_list->spare;
+    job_list->spare = job;
+}
+
+/* addjob - Add a job to the job list; pid is its first process */
 int 
-deletejob(struct job_t *job_list, pid_t pid) 
+addjob(struct job_list_t *job_list, pid_t pid, int state, char *cmdline) 
 {
-    int i;
+    struct job_t *job;
 
     if (pid < 1)
         return 0;
 
-    for (i = 0; i < MAXJOBS; i++) {
-        if (job_list[i].pid == pid) {
-            clearjob(&job_list[i]);
-            nextjid = maxjid(job_list)+1;
-            return 1;
-        }
+    if (!growjobs(job_list, job_list->nfree ? 0 : job_list->nextjid)) {
+        printf("Tried to create too many jobs\n");
+        return 0;
     }
-    return 0;
+    if ((job = job_list->spare) != NULL)
+        job_list->spare = job->next;
+    else if ((job = malloc(sizeof(*job))) == NULL) {
+        printf("Tried to create too many jobs\n");
+        return 0;
+    }
+
+    clearjob(job);
+    job->pid = pid;
+    job->state = state;
+    job->jid = jidpop(job_list);
+    job->cmdline = cmdintern(cmdline);
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    job_list->by_jid[job->jid] = job;
+    job_list->count++;
+    if (!addproc(job_list, job, pid)) {
+        freejob(job_list, job);
+        printf("Tried to create too many jobs\n");
+        return 0;
+    }
+    if (state == FG)
+        job_list->fg = job;
+    if(verbose){
+        printf("Added job [%d] %d %s\n", job->jid, job->pid, jobcmdline(job));
+    }
+    return 1;
+}
+
+/* addproc - Add a process, such as a later pipeline stage, to a job */
+int 
+addproc(struct job_list_t *job_list, struct job_t *job, pid_t pid) 
+{
+    struct proc_t *proc;
+    int b;
+
+    if (pid < 1 || job == NULL || !growpids(job_list, job_list->nprocs + 1))
+        return 0;
+    if ((proc = job_list->spare_procs) != NULL)
+        job_list->spare_procs = proc->next;
+    else if ((proc = malloc(sizeof(*proc))) == NULL)
+        return 0;
+
+    proc->pid = pid;
+    proc->job = job;
+    proc->sibling = job->procs;
+    job->procs = proc;
+    job->nprocs++;
+    b = pidhash(pid, job_list->pid_mask);
+    proc->next = job_list->by_pid[b];
+    job_list->by_pid[b] = proc;
+    job_list->nprocs++;
+    return 1;
+}
+
+/* deletejob - Delete the job that process pid belongs to */
+int 
+deletejob(struct job_list_t *job_list, pid_t pid) 
+{
+    struct proc_t **link;
+
+    if (pid < 1 || (link = findproc(job_list, pid)) == NULL)
+        return 0;
+    freejob(job_list, (*link)->job);
+    return 1;
+}
+
+/* reapproc - Forget a process that has been reaped, deleting its job
+   along with its last process.  Returns 1 if the job was deleted, 0 if
+   it has processes left, and -1 if pid is not in any job */
+int 
+reapproc(struct job_list_t *job_list, pid_t pid) 
+{
+    struct proc_t **link;
+    struct job_t *job;
+
+    if (pid < 1 || (link = findproc(job_list, pid)) == NULL)
+        return -1;
+    job = (*link)->job;
+    unlinkproc(job_list, *link);
+    if (job->nprocs > 0)
+        return 0;
+    freejob(job_list, job);
+    return 1;
+}
+
+/* setjobstate - Change the state of a job, keeping track of the FG job */
+void 
+setjobstate(struct job_list_t *job_list, struct job_t *job, int state) 
+{
+    if (job_list->fg == job)
+        job_list->fg = NULL;
+    job->state = state;
+    if (state == FG)
+        job_list->fg = job;
+}
+
+/* addusage - Add the resource usage of a reaped process to its job's */
+void 
+addusage(struct job_t *job, const struct rusage *ru) 
+{
+    timeradd(&job->utime, &ru->ru_utime, &job->utime);
+    timeradd(&job->stime, &ru->ru_stime, &job->stime);
+    if (ru->ru_maxrss > job->maxrss)
+        job->maxrss = ru->ru_maxrss;
+    job->nvcsw += ru->ru_nvcsw;
+    job->nivcsw += ru->ru_nivcsw;
+}
+
+/* fmtusage - Format the wall time of a job so far and the usage of its
+   processes reaped so far into buf, as snprintf does */
+int 
+fmtusage(char *buf, size_t size, const struct job_t *job) 
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return snprintf(buf, size,
+                    "real %.3fs user %.3fs sys %.3fs maxrss %ldK cs %ld/%ld",
+                    (now.tv_sec - job->start.tv_sec) +
+                    (now.tv_nsec - job->start.tv_nsec) / 1e9,
+                    job->utime.tv_sec + job->utime.tv_usec / 1e6,
+                    job->stime.tv_sec + job->stime.tv_usec / 1e6,
+                    job->maxrss, job->nvcsw, job->nivcsw);
 }
 
 /* fgpid - Return PID of current foreground job, 0 if no such job */
 pid_t 
-fgpid(struct job_t *job_list) {
-    int i;
-
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].state == FG)
-            return job_list[i].pid;
-    return 0;
+fgpid(struct job_list_t *job_list) {
+    return job_list->fg != NULL ? job_list->fg->pid : 0;
 }
 
-/* getjobpid  - Find a job (by PID) on the job list */
+/* getjobpid  - Find a job (by the PID of any of its processes) */
 struct job_t 
-*getjobpid(struct job_t *job_list, pid_t pid) {
-    int i;
+*getjobpid(struct job_list_t *job_list, pid_t pid) {
+    struct proc_t **link;
 
-    if (pid < 1)
+    if (pid < 1 || (link = findproc(job_list, pid)) == NULL)
         return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].pid == pid)
-            return &job_list[i];
-    return NULL;
+    return (*link)->job;
 }
 
 /* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *job_list, int jid) 
+struct job_t *getjobjid(struct job_list_t *job_list, int jid) 
 {
-    int i;
-
-    if (jid < 1)
+    if (jid < 1 || jid >= job_list->nextjid)
         return NULL;
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].jid == jid)
-            return &job_list[i];
-    return NULL;
+    return job_list->by_jid[jid];
 }
 
 /* pid2jid - Map process ID to job ID */
 int 
 pid2jid(pid_t pid) 
 {
-    int i;
+    struct job_t *job = getjobpid(job_list, pid);
 
-    if (pid < 1)
-        return 0;
-    for (i = 0; i < MAXJOBS; i++)
-        if (job_list[i].pid == pid) {
-            return job_list[i].jid;
-        }
-    return 0;
+    return job != NULL ? job->jid : 0;
 }
 
-/* listjobs - Print the job list */
+/* listjobs - Print the job list, in JID order, with each job's usage
+   if usage is true, and its placement if it was placed.  Up to
+   LISTJOBS jobs go out in one writev, their command lines straight
+   from the arena */
 void 
-listjobs(struct job_t *job_list, int output_fd) 
+listjobs(struct job_list_t *job_list, int output_fd, int usage) 
 {
-    int i;
-    char buf[MAXLINE];
-
-    for (i = 0; i < MAXJOBS; i++) {
-        memset(buf, '\0', MAXLINE);
-        if (job_list[i].pid != 0) {
-            sprintf(buf, "[%d] (%d) ", job_list[i].jid, job_list[i].pid);
-            if(write(output_fd, buf, strlen(buf)) < 0) {
-                fprintf(stderr, "Error writing to output file\n");
-                exit(1);
-            }
-            memset(buf, '\0', MAXLINE);
-            switch (job_list[i].state) {
-            case BG:
-                sprintf(buf, "Running    ");
-                break;
-            case FG:
-                sprintf(buf, "Foreground ");
-                break;
-            case ST:
-                sprintf(buf, "Stopped    ");
-                break;
-            default:
-                sprintf(buf, "listjobs: Internal error: job[%d].state=%d ",
-                        i, job_list[i].state);
-            }
-            if(write(output_fd, buf, strlen(buf)) < 0) {
-                fprintf(stderr, "Error writing to output file\n");
-                exit(1);
-            }
-            memset(buf, '\0', MAXLINE);
-            sprintf(buf, "%s\n", job_list[i].cmdline);
-            if(write(output_fd, buf, strlen(buf)) < 0) {
+    int jid, n = 0, len;
+    struct job_t *job;
+    const char *state;
+    const char *cmdline;
+    struct iovec iov[4 * LISTJOBS];
+    char head[LISTJOBS][160];
+
+    /* Anything printed before comes first */
+    fflush(stdout);
+
+    for (jid = 1; jid < job_list->nextjid; jid++) {
+        if ((job = job_list->by_jid[jid]) == NULL)
+            continue;
+        switch (job->state) {
+        case BG:
+            state = "Running    ";
+            break;
+        case FG:
+            state = "Foreground ";
+            break;
+        case ST:
+            state = "Stopped    ";
+            break;
+        default:
+            state = "listjobs: Internal error: bad job state ";
+        }
+        cmdline = jobcmdline(job);
+        len = snprintf(head[n], sizeof(head[n]), "[%d] (%d) %s",
+                       job->jid, job->pid, state);
+        if (usage) {
+            len += fmtusage(head[n] + len, sizeof(head[n]) - len, job);
+            len += snprintf(head[n] + len, sizeof(head[n]) - len, "  ");
+        }
+        iov[4*n].iov_base = head[n];
+        iov[4*n].iov_len = len;
+        iov[4*n+1].iov_base = job->place;
+        iov[4*n+1].iov_len = job->place ? strlen(job->place) : 0;
+        iov[4*n+2].iov_base = (char *)cmdline;
+        iov[4*n+2].iov_len = strlen(cmdline);
+        iov[4*n+3].iov_base = "\n";
+        iov[4*n+3].iov_len = 1;
+        if (++n == LISTJOBS) {
+            if (rio_writev(output_fd, iov, 4 * n) < 0) {
                 fprintf(stderr, "Error writing to output file\n");
                 exit(1);
             }
+            n = 0;
         }
     }
+    if (n > 0 && rio_writev(output_fd, iov, 4 * n) < 0) {
+        fprintf(stderr, "Error writing to output file\n");
+        exit(1);
+    }
     if(output_fd != STDOUT_FILENO)
         close(output_fd);
 }
@@ -663,6 +2110,211 @@ listjobs(struct job_t *job_list, int output_fd)
  ******************************/
 
 
+/*************************************
+ * Command hash table helper routines
+ *************************************/
+
+/* namehash - Bucket of name in a table of mask + 1 buckets (FNV-1a) */
+static inline int 
+namehash(const char *name, int mask) 
+{
+    unsigned h = 2166136261u;
+
+    while (*name)
+        h = (h ^ (unsigned char)*name++) * 16777619u;
+    return (int)h & mask;
+}
+
+/* searchpath - Find name in the directories of pathvar; returns the
+   malloc'd path of the first regular, executable file, or NULL */
+static char 
+*searchpath(const char *name, const char *pathvar) 
+{
+    const char *dir, *end;
+    char buf[MAXLINE];
+    struct stat st;
+    int len;
+
+    for (dir = pathvar; ; dir = end + 1) {
+        end = strchrnul(dir, ':');
+        len = end - dir;
+        /* An empty element is the current directory */
+        if (snprintf(buf, sizeof(buf), "%.*s%s%s", len, dir,
+                     len > 0 ? "/" : "", name) < (int)sizeof(buf) &&
+            stat(buf, &st) == 0 && S_ISREG(st.st_mode) &&
+            access(buf, X_OK) == 0)
+            return strdup(buf);
+        if (*end == '\0')
+            return NULL;
+    }
+}
+
+/* hashfind - Find the link that points to the entry for name */
+static struct hashent_t 
+**hashfind(const char *name) 
+{
+    struct hashent_t **link;
+
+    for (link = &cmd_hash->buckets[namehash(name, cmd_hash->mask)];
+         *link != NULL; link = &(*link)->next)
+        if (!strcmp((*link)->name, name))
+            return link;
+    return NULL;
+}
+
+/* hashadd - Enter name, found at path, growing the table to keep the
+   load factor at most 1 */
+static struct hashent_t 
+*hashadd(const char *name, char *path) 
+{
+    struct hashent_t **buckets, *e, *next;
+    int cap, i, b;
+
+    if (cmd_hash->count > cmd_hash->mask) {
+        cap = 2 * (cmd_hash->mask + 1);
+        if ((buckets = calloc(cap, sizeof(*buckets))) == NULL)
+            unix_error("hashadd: calloc error");
+        for (i = 0; i <= cmd_hash->mask; i++) {
+            for (e = cmd_hash->buckets[i]; e != NULL; e = next) {
+                next = e->next;
+                b = namehash(e->name, cap - 1);
+                e->next = buckets[b];
+                buckets[b] = e;
+            }
+        }
+        free(cmd_hash->buckets);
+        cmd_hash->buckets = buckets;
+        cmd_hash->mask = cap - 1;
+    }
+    if ((e = malloc(sizeof(*e))) == NULL || (e->name = strdup(name)) == NULL)
+        unix_error("hashadd: malloc error");
+    e->path = path;
+    e->hits = 0;
+    b = namehash(name, cmd_hash->mask);
+    e->next = cmd_hash->buckets[b];
+    cmd_hash->buckets[b] = e;
+    cmd_hash->count++;
+    return e;
+}
+
+/* hashpath - Return the search path, emptying the table if PATH has
+   changed since its entries were found */
+static const char 
+*hashpath(void) 
+{
+    const char *pathvar = getenv("PATH");
+
+    if (pathvar == NULL)
+        pathvar = DEFPATH;
+    if (cmd_hash->buckets == NULL) {
+        cmd_hash->mask = MINHASH - 1;
+        if ((cmd_hash->buckets = calloc(MINHASH, sizeof(struct hashent_t *))) == NULL)
+            unix_error("hashpath: calloc error");
+    }
+    if (cmd_hash->pathvar == NULL || strcmp(cmd_hash->pathvar, pathvar)) {
+        hashclear();
+        free(cmd_hash->pathvar);
+        if ((cmd_hash->pathvar = strdup(pathvar)) == NULL)
+            unix_error("hashpath: strdup error");
+    }
+    return cmd_hash->pathvar;
+}
+
+/* hashlookup - Return the path of the command name, searching PATH only
+   if it is not in the table; NULL if it is not found */
+char 
+*hashlookup(const char *name) 
+{
+    const char *pathvar = hashpath();
+    struct hashent_t **link, *e;
+    char *path;
+
+    if ((link = hashfind(name)) == NULL) {
+        if ((path = searchpath(name, pathvar)) == NULL)
+            return NULL;
+        e = hashadd(name, path);
+    } else {
+        e = *link;
+    }
+    e->hits++;
+    return e->path;
+}
+
+/* hashdrop - Forget where name was found */
+void 
+hashdrop(const char *name) 
+{
+    struct hashent_t **link, *e;
+
+    if (cmd_hash->buckets == NULL || (link = hashfind(name)) == NULL)
+        return;
+    e = *link;
+    *link = e->next;
+    free(e->name);
+    free(e->path);
+    free(e);
+    cmd_hash->count--;
+}
+
+/* hashclear - Empty the table */
+void 
+hashclear(void) 
+{
+    struct hashent_t *e, *next;
+    int i;
+
+    for (i = 0; i <= cmd_hash->mask; i++) {
+        for (e = cmd_hash->buckets[i]; e != NULL; e = next) {
+            next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+        cmd_hash->buckets[i] = NULL;
+    }
+    cmd_hash->count = 0;
+}
+
+/*
+ * hashcmd - The hash builtin.  With no arguments, list the table; with
+ *     -r, empty it; otherwise look up each argument and enter it.
+ */
+void 
+hashcmd(struct cmdline_tokens *tok) 
+{
+    struct hashent_t *e;
+    char *path;
+    int i;
+
+    hashpath();
+    if (tok->argc == 1) {
+        if (cmd_hash->count == 0) {
+            printf("hash: hash table empty\n");
+            return;
+        }
+        printf("hits\tcommand\n");
+        for (i = 0; i <= cmd_hash->mask; i++)
+            for (e = cmd_hash->buckets[i]; e != NULL; e = e->next)
+                printf("%4d\t%s\n", e->hits, e->path);
+        return;
+    }
+    for (i = 1; i < tok->argc; i++) {
+        if (!strcmp(tok->argv[i], "-r")) {
+            hashclear();
+        } else if (strchr(tok->argv[i], '/') == NULL) {
+            hashdrop(tok->argv[i]);
+            if ((path = searchpath(tok->argv[i], cmd_hash->pathvar)) == NULL)
+                printf("hash: %s: not found\n", tok->argv[i]);
+            else
+                hashadd(tok->argv[i], path);
+        }
+    }
+}
+/*****************************************
+ * end command hash table helper routines
+ *****************************************/
+
+
 /***********************
  * Other helper routines
  ***********************/
@@ -673,10 +2325,12 @@ listjobs(struct job_t *job_list, int output_fd)
 void 
 usage(void) 
 {
-    printf("Usage: shell [-hvp]\n");
+    printf("Usage: shell [-hvpF] [-f script]\n");
     printf("   -h   print this message\n");
     printf("   -v   print additional diagnostic information\n");
     printf("   -p   do not emit a command prompt\n");
+    printf("   -F   launch jobs with fork instead of posix_spawn\n");
+    printf("   -f   run the commands in script, then exit\n");
     exit(1);
 }
 
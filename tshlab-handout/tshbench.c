@@ -0,0 +1,538 @@
+/*
+ * tshbench.c - Shell lab performance benchmark
+ *
+ * Drives one or more shells the way runtrace does, over a datagram
+ * socket standing in for the terminal, and measures:
+ *
+ *   launch   command sent at the prompt -> the job is running
+ *   sigint   SIGINT sent to the shell -> the foreground job has it
+ *   sigtstp  SIGTSTP sent to the shell -> the foreground job has it
+ *   reap     N background jobs exit at once -> jobs lists none of them
+ *   jobs     jobs builtin with N background jobs -> the next prompt
+ *
+ * and prints percentiles for each shell side by side. The jobs are
+ * tshbench itself run with -J, which reports its state over SYNCFD
+ * (see jobsync.h) the moment it changes.
+ *
+ * Usage: tshbench [-h] [-s <shell>]... [-r <reps>] [-n <jobs>]
+ */
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <dirent.h>
+#include "config.h"
+#include "jobsync.h"
+
+#define MAXSHELLS 8
+#define NBENCH 5
+#define REAPREPS 10     /* Reps per reap sample, since each starts njobs */
+
+/* A shell under test */
+struct shell {
+    char *prog;         /* Program to run */
+    pid_t pid;          /* Its process */
+    int datafd;         /* Our end of its stdin/stdout */
+    int syncfd;         /* Our end of the jobs' sync socket */
+    int pidfd;          /* Readable once the shell exits */
+    int epfd;           /* Watches all three */
+    char out[64 * MAXBUF];  /* Output since the last command */
+    size_t len;
+};
+
+/* Samples for one benchmark on one shell, in microseconds */
+struct result {
+    long *us;
+    int n;
+    int failed;         /* The shell could not run this benchmark */
+};
+
+char *benchname[NBENCH] = {"launch", "sigint", "sigtstp", "reap", "jobs"};
+char *shells[MAXSHELLS];
+int nshells = 0;
+int reps = 200;         /* Samples per benchmark (-r) */
+int njobs = 16;         /* Jobs for the reap and jobs benchmarks (-n) */
+
+/* Prototypes */
+void usage(char *msg);
+int start_shell(struct shell *sh, char *prog);
+void stop_shell(struct shell *sh);
+int wait_prompt(struct shell *sh);
+int wait_sync(struct shell *sh, int tag);
+int command(struct shell *sh, char *cmd);
+int release(struct shell *sh, int n);
+int drain(struct shell *sh);
+int bench(struct shell *sh, int which, struct result *r);
+long elapsed(const struct timespec *since);
+void report(struct result r[][NBENCH]);
+int job(char *mode);
+
+int main(int argc, char **argv)
+{
+    struct result r[MAXSHELLS][NBENCH];
+    struct shell sh;
+    int c, i, b;
+
+    while ((c = getopt(argc, argv, "hs:r:n:J:")) != EOF) {
+	switch (c) {
+	case 'h':             /* Print help message */
+	    usage("");
+	    break;
+	case 's':             /* A shell to measure; may be repeated */
+	    if (nshells == MAXSHELLS)
+		usage("Too many shells (-s)");
+	    shells[nshells++] = optarg;
+	    break;
+	case 'r':             /* Samples per benchmark */
+	    if ((reps = atoi(optarg)) < 1)
+		usage("Invalid number of reps (-r)");
+	    break;
+	case 'n':             /* Jobs for reap and jobs */
+	    if ((njobs = atoi(optarg)) < 1)
+		usage("Invalid number of jobs (-n)");
+	    break;
+	case 'J':             /* Run as a benchmark job (hidden) */
+	    return job(optarg);
+	default:
+	    usage("Unrecognized argument");
+	}
+    }
+    if (nshells == 0) {
+	shells[nshells++] = "./tsh";
+	shells[nshells++] = "./tshref";
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Adopt the jobs each shell leaves behind, so stop_shell can kill them */
+    prctl(PR_SET_CHILD_SUBREAPER, 1);
+    printf("tshbench: %d reps, %d jobs\n", reps, njobs);
+    for (i = 0; i < nshells; i++) {
+	for (b = 0; b < NBENCH; b++) {
+	    r[i][b].us = calloc(reps, sizeof(long));
+	    r[i][b].n = 0;
+	    r[i][b].failed = 0;
+
+	    /* A fresh shell per benchmark, so one cannot skew the next */
+	    if (start_shell(&sh, shells[i]) < 0 || bench(&sh, b, &r[i][b]) < 0) {
+		fprintf(stderr, "%s: %s benchmark failed\n", shells[i],
+			benchname[b]);
+		r[i][b].failed = 1;
+	    }
+	    stop_shell(&sh);
+	}
+    }
+    report(r);
+    exit(0);
+}
+
+/*
+ * bench - Run one benchmark on a shell that has just printed a prompt,
+ *         adding a sample to r for each rep. Every step ends at the
+ *         next prompt. Return -1 if the shell misbehaves
+ */
+int bench(struct shell *sh, int which, struct result *r)
+{
+    struct timespec t0;
+    int i, rep;
+
+    /* The jobs benchmark lists the same njobs jobs every time */
+    if (which == 4) {
+	for (i = 0; i < njobs; i++) {
+	    if (command(sh, "./tshbench -J wait &") < 0 ||
+		wait_sync(sh, SYNC_READY) < 0 || wait_prompt(sh) < 0)
+		return -1;
+	}
+    }
+
+    /* The reap benchmark starts njobs jobs per sample */
+    for (rep = 0; rep < reps; rep += which == 3 ? REAPREPS : 1) {
+	switch (which) {
+	case 0: /* launch */
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    if (command(sh, "./tshbench -J wait") < 0 ||
+		wait_sync(sh, SYNC_READY) < 0)
+		return -1;
+	    r->us[r->n++] = elapsed(&t0);
+	    if (release(sh, 1) < 0 || wait_prompt(sh) < 0)
+		return -1;
+	    break;
+
+	case 1: /* sigint */
+	case 2: /* sigtstp */
+	    if (command(sh, which == 1 ? "./tshbench -J int" :
+			"./tshbench -J tstp") < 0 ||
+		wait_sync(sh, SYNC_READY) < 0)
+		return -1;
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    kill(sh->pid, which == 1 ? SIGINT : SIGTSTP);
+	    if (wait_sync(sh, which == 1 ? SYNC_INT : SYNC_STOP) < 0)
+		return -1;
+	    r->us[r->n++] = elapsed(&t0);
+	    if (wait_prompt(sh) < 0)
+		return -1;
+	    break;
+
+	case 3: /* reap */
+	    for (i = 0; i < njobs; i++) {
+		if (command(sh, "./tshbench -J wait &") < 0 ||
+		    wait_sync(sh, SYNC_READY) < 0 || wait_prompt(sh) < 0)
+		    return -1;
+	    }
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    if (release(sh, njobs) < 0 || drain(sh) < 0)
+		return -1;
+	    r->us[r->n++] = elapsed(&t0);
+	    break;
+
+	case 4: /* jobs */
+	    clock_gettime(CLOCK_MONOTONIC, &t0);
+	    if (command(sh, "jobs") < 0 || wait_prompt(sh) < 0)
+		return -1;
+	    r->us[r->n++] = elapsed(&t0);
+	    break;
+	}
+    }
+    return 0;
+}
+
+/*
+ * start_shell - Start a shell on a socket, as runtrace does, and wait
+ *               for its first prompt. Return -1 if it does not come
+ */
+int start_shell(struct shell *sh, char *prog)
+{
+    int datafd[2], syncfd[2];
+    struct epoll_event ev;
+    static char env[64];
+    char *argv[] = {prog, NULL};
+
+    sh->prog = prog;
+    sh->pid = -1;
+    sh->len = 0;
+    sh->epfd = sh->pidfd = -1;
+    sh->datafd = sh->syncfd = -1;
+    if (socketpair(AF_LOCAL, SOCK_DGRAM, 0, datafd) < 0 ||
+	socketpair(AF_LOCAL, SOCK_DGRAM, 0, syncfd) < 0) {
+	perror("socketpair");
+	exit(1);
+    }
+
+    /* Tell the jobs which descriptor to synchronize on */
+    sprintf(env, "SYNCFD=%d", syncfd[1]);
+    putenv(env);
+
+    fflush(stdout);
+    if ((sh->pid = fork()) == 0) {
+	close(datafd[0]);
+	close(syncfd[0]);
+	dup2(datafd[1], 0);
+	dup2(datafd[1], 1);
+	execv(prog, argv);
+	perror(prog);
+	_exit(1);
+    }
+    close(datafd[1]);
+    close(syncfd[1]);
+    sh->datafd = datafd[0];
+    sh->syncfd = syncfd[0];
+    if (sh->pid < 0) {
+	perror("fork");
+	exit(1);
+    }
+
+    if ((sh->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+	perror("epoll_create1");
+	exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = sh->datafd;
+    epoll_ctl(sh->epfd, EPOLL_CTL_ADD, sh->datafd, &ev);
+    ev.data.fd = sh->syncfd;
+    epoll_ctl(sh->epfd, EPOLL_CTL_ADD, sh->syncfd, &ev);
+    if ((sh->pidfd = syscall(SYS_pidfd_open, sh->pid, 0)) >= 0) {
+	ev.data.fd = sh->pidfd;
+	epoll_ctl(sh->epfd, EPOLL_CTL_ADD, sh->pidfd, &ev);
+    }
+
+    return wait_prompt(sh);
+}
+
+/*
+ * stop_shell - Kill a shell and whatever jobs it left behind. We are a
+ *              subreaper, so those are all our children by now, or
+ *              become so as their parents die
+ */
+void stop_shell(struct shell *sh)
+{
+    DIR *dir;
+    struct dirent *de;
+    char path[64], stat[MAXBUF], *p;
+    FILE *fp;
+    int pid, ppid, found;
+
+    do {
+	found = 0;
+	if ((dir = opendir("/proc")) == NULL)
+	    break;
+	while ((de = readdir(dir)) != NULL) {
+	    if ((pid = atoi(de->d_name)) <= 0)
+		continue;
+	    sprintf(path, "/proc/%d/stat", pid);
+	    if ((fp = fopen(path, "r")) == NULL)
+		continue;
+	    ppid = -1;
+	    if (fgets(stat, MAXBUF, fp) != NULL &&
+		(p = strrchr(stat, ')')) != NULL)
+		sscanf(p + 1, " %*c %d", &ppid);
+	    fclose(fp);
+	    if (ppid == getpid()) {
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		found = 1;
+	    }
+	}
+	closedir(dir);
+    } while (found);
+
+    if (sh->datafd >= 0)
+	close(sh->datafd);
+    if (sh->syncfd >= 0)
+	close(sh->syncfd);
+    if (sh->pidfd >= 0)
+	close(sh->pidfd);
+    if (sh->epfd >= 0)
+	close(sh->epfd);
+}
+
+/*
+ * next_event - Wait up to DRIVER_TIMEOUT for the shell to print or a
+ *              job to sync. Shell output is added to sh->out; a sync
+ *              message is returned in msg. Return the descriptor that
+ *              was read, or -1 on timeout or if the shell exited
+ */
+static int next_event(struct shell *sh, char *msg, ssize_t *msglen)
+{
+    struct epoll_event ev;
+    ssize_t n;
+    int rc;
+
+    while ((rc = epoll_wait(sh->epfd, &ev, 1, DRIVER_TIMEOUT * 1000)) < 0) {
+	if (errno != EINTR) {
+	    perror("epoll_wait");
+	    exit(1);
+	}
+    }
+    if (rc == 0 || ev.data.fd == sh->pidfd)
+	return -1;
+
+    if (ev.data.fd == sh->syncfd) {
+	if ((*msglen = recv(sh->syncfd, msg, MAXBUF, 0)) < 0)
+	    return -1;
+	return sh->syncfd;
+    }
+    if (sh->len == sizeof(sh->out))
+	sh->len = 0;
+    n = recv(sh->datafd, sh->out + sh->len, sizeof(sh->out) - sh->len, 0);
+    if (n <= 0)
+	return -1;
+    sh->len += n;
+    return sh->datafd;
+}
+
+/*
+ * wait_prompt - Wait for the shell to print its prompt. The output
+ *               before it stays in sh->out. Return -1 on timeout
+ */
+int wait_prompt(struct shell *sh)
+{
+    char msg[MAXBUF];
+    ssize_t msglen;
+    size_t plen = strlen(PROMPT);
+
+    while (1) {
+	if (sh->len >= plen &&
+	    memcmp(sh->out + sh->len - plen, PROMPT, plen) == 0) {
+	    sh->len -= plen;
+	    return 0;
+	}
+	if (next_event(sh, msg, &msglen) < 0)
+	    return -1;
+    }
+}
+
+/*
+ * wait_sync - Wait for a job to send the sync message tag. Return -1
+ *             on timeout
+ */
+int wait_sync(struct shell *sh, int tag)
+{
+    char msg[MAXBUF];
+    ssize_t msglen;
+    int fd;
+
+    while (1) {
+	if ((fd = next_event(sh, msg, &msglen)) < 0)
+	    return -1;
+	if (fd == sh->syncfd && msglen > 0 && msg[0] == tag)
+	    return 0;
+    }
+}
+
+/*
+ * command - Send a command line to the shell
+ */
+int command(struct shell *sh, char *cmd)
+{
+    char line[MAXBUF];
+
+    sh->len = 0;
+    snprintf(line, sizeof(line), "%s\n", cmd);
+    return send(sh->datafd, line, strlen(line), 0) < 0 ? -1 : 0;
+}
+
+/*
+ * release - Let n waiting jobs exit
+ */
+int release(struct shell *sh, int n)
+{
+    while (n-- > 0) {
+	if (send(sh->syncfd, "signal", 6, 0) < 0)
+	    return -1;
+    }
+    return 0;
+}
+
+/*
+ * drain - Ask the shell for jobs until it lists none. Return -1 if it
+ *         still has some after DRIVER_TIMEOUT
+ */
+int drain(struct shell *sh)
+{
+    struct timespec t0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (1) {
+	if (command(sh, "jobs") < 0 || wait_prompt(sh) < 0)
+	    return -1;
+	if (memchr(sh->out, '[', sh->len) == NULL)
+	    return 0;
+	if (elapsed(&t0) > DRIVER_TIMEOUT * 1000000L)
+	    return -1;
+    }
+}
+
+/*
+ * elapsed - Microseconds since a CLOCK_MONOTONIC time
+ */
+long elapsed(const struct timespec *since)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000 +
+	(now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+static int cmplong(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * report - Print percentiles for each benchmark, one row per shell
+ */
+void report(struct result r[][NBENCH])
+{
+    struct result *p;
+    int i, b;
+
+    printf("\n%-8s %-12s %8s %9s %9s %9s %9s\n", "bench", "shell",
+	   "samples", "p50(us)", "p90(us)", "p99(us)", "max(us)");
+    for (b = 0; b < NBENCH; b++) {
+	for (i = 0; i < nshells; i++) {
+	    p = &r[i][b];
+	    printf("%-8s %-12s ", benchname[b], shells[i]);
+	    if (p->failed || p->n == 0) {
+		printf("%8s\n", "failed");
+		continue;
+	    }
+	    qsort(p->us, p->n, sizeof(long), cmplong);
+	    printf("%8d %9ld %9ld %9ld %9ld", p->n, p->us[p->n / 2],
+		   p->us[p->n * 9 / 10], p->us[p->n * 99 / 100],
+		   p->us[p->n - 1]);
+	    if (b == 3)
+		printf("  (%.0f exits/s)",
+		       njobs * 1e6 / (p->us[p->n / 2] ? p->us[p->n / 2] : 1));
+	    printf("\n");
+	}
+    }
+}
+
+/*
+ * sigint_job, sigtstp_job - Report the signal the moment it arrives
+ */
+void sigint_job(int sig)
+{
+    sync_send(SYNC_INT);
+    _exit(0);
+}
+
+void sigtstp_job(int sig)
+{
+    sync_send(SYNC_STOP);
+    _exit(0);
+}
+
+/*
+ * job - Be a benchmark job (-J mode): report READY, then wait for the
+ *       driver ("wait") or for a SIGINT ("int") or SIGTSTP ("tstp").
+ *       The alarm is the safety net if the driver goes away
+ */
+int job(char *mode)
+{
+    char buf[MAXBUF];
+
+    alarm(JOB_TIMEOUT);
+    if (!sync_init())
+	return 1;
+    if (!strcmp(mode, "int"))
+	signal(SIGINT, sigint_job);
+    else if (!strcmp(mode, "tstp"))
+	signal(SIGTSTP, sigtstp_job);
+    sync_send(SYNC_READY);
+
+    if (!strcmp(mode, "wait")) {
+	/* Returns with an error too when the driver closes its end */
+	recv(sync_fd, buf, sizeof(buf), 0);
+	return 0;
+    }
+    while (1)
+	pause();
+}
+
+/*
+ * usage - Print help message and terminate
+ */
+void usage(char *msg)
+{
+    printf("%s\n", msg);
+    printf("Usage: tshbench [-h] [-s <shell>]... [-r <reps>] [-n <jobs>]\n");
+    printf("Options:\n");
+    printf("  -h            Print this message\n");
+    printf("  -s <shell>    Shell to measure; repeat to compare (default ./tsh ./tshref)\n");
+    printf("  -r <reps>     Samples per benchmark (default 200)\n");
+    printf("  -n <jobs>     Jobs for the reap and jobs benchmarks (default 16)\n");
+    exit(0);
+}